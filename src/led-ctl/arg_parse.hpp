@@ -2,10 +2,12 @@
 
 #include "version.h"
 #include "util/compiler.hpp"
+#include "util/usb_filter.hpp"
 #include <filesystem>
 #include <getopt.h>
 #include <cstdio>  // std::fprintf
-#include <cstdlib> // std::exit
+#include <cstdlib> // std::exit, std::strtod
+#include <stdexcept>
 #include <string>
 
 
@@ -13,7 +15,16 @@ struct cli_args
 {
     int vendor_id = -1;
     int product_id = -1;
+    usb_filter filter; ///< further selectors, e.g. to pick one of several indicators
     bool debug = false;
+    std::string serve_name; ///< shared-memory command ring to serve
+    std::string client_name; ///< shared-memory command ring to enqueue commands on
+    std::string script_file; ///< "-" for stdin
+    std::string record_file;
+    std::string replay_file;
+    double replay_speed = 1.0; ///< 0 means as fast as possible
+    std::string trace_file; ///< dump trace events here on exit
+    std::string decode_trace_file;
 };
 
 cli_args
@@ -21,15 +32,46 @@ arg_parse(int argc, char** argv)
 {
     auto usage = [](std::FILE* outerr, std::filesystem::path const& app) {
         std::fprintf(outerr,
-                "usage: %s [-Dhv] <vendor_id>:<product_id>\n"
+                "usage: %s [-Dhv] [-r <file>] [-s <name> | -S <file>] [<filter options>]\n"
+                "       [<vendor_id>:<product_id>]\n"
+                "       %s [-Dhv] -p <file> [-x <speed>] [<filter options>]\n"
+                "       [<vendor_id>:<product_id>]\n"
+                "       %s -c <name> [-S <file>]\n"
+                "       %s -T <file>\n"
                 "arguments:\n"
                 "   vendor_id               Vendor id of device to connect to (e.g. 0x0123).\n"
                 "   product_id              Product id of device to connect to (e.g. 0x3210).\n"
+                "                           Either these or a filter option, or both, select\n"
+                "                           the device; the first that matches is opened.\n"
                 "options:\n"
+                "  -c, --client=<name>      Enqueue the commands of --script (default: stdin) on\n"
+                "                           the shared-memory ring <name>, for the led-ctl\n"
+                "                           serving it to execute; no device is opened.\n"
                 "  -D, --debug              Enable libusb debugging (to stderr).\n"
                 "  -h, --help               This output.\n"
-                "  -v, --version            Print application version information.\n",
-                app.c_str());
+                "  -p, --replay=<file>      Replay a log written by --record against the device,\n"
+                "                           or against a simulated device if none is given.\n"
+                "  -r, --record=<file>      Record every report sent to the device to <file>.\n"
+                "  -s, --serve=<name>       Own the device and execute commands enqueued by other\n"
+                "                           processes on the shared-memory ring <name> (e.g.\n"
+                "                           /delcom) until interrupted.\n"
+                "  -S, --script=<file>      Execute commands (on/off/pwm/blink/sleep/read) read\n"
+                "                           from <file>, or stdin if <file> is \"-\".\n"
+                "  -t, --trace=<file>       Write the binary trace of all device transfers to\n"
+                "                           <file> on exit.\n"
+                "  -T, --decode-trace=<file>\n"
+                "                           Print a trace written by --trace and exit.\n"
+                "  -v, --version            Print application version information.\n"
+                "  -x, --replay-speed=<n>   Replay speed factor: 1 is original timing (default),\n"
+                "                           2 is twice as fast, 0 is as fast as possible.\n"
+                "filter options (comma-separated lists; all given must match):\n"
+                "      --bus=<n>,...        Bus number.\n"
+                "      --class=<class>[:<sub>],...\n"
+                "                           Device class, or any interface's class, in hex.\n"
+                "      --port=<path>,...    Port path prefix (e.g. 1.4 matches 1.4 and 1.4.2).\n"
+                "      --serial=<serial>    Serial number; may be repeated.\n"
+                "      --speed=<speed>,...  low, full, high, super or super_plus, or Mbit/s.\n",
+                app.c_str(), app.c_str(), app.c_str(), app.c_str());
         std::exit(outerr == stdout ? EXIT_SUCCESS : EXIT_FAILURE);
     };
 
@@ -39,15 +81,28 @@ arg_parse(int argc, char** argv)
     while (true) {
         // clang-format off
         static option long_options[] = {
-                { "debug",      no_argument,    nullptr,    'D' },
-                { "help",       no_argument,    nullptr,    'h' },
-                { "version",    no_argument,    nullptr,    'v' },
-                { nullptr,      0,              nullptr,    0 },
+                { "bus",        required_argument,  nullptr,    'B' },
+                { "class",      required_argument,  nullptr,    'C' },
+                { "client",     required_argument,  nullptr,    'c' },
+                { "debug",      no_argument,        nullptr,    'D' },
+                { "decode-trace", required_argument, nullptr,   'T' },
+                { "help",       no_argument,        nullptr,    'h' },
+                { "port",       required_argument,  nullptr,    'P' },
+                { "record",     required_argument,  nullptr,    'r' },
+                { "replay",     required_argument,  nullptr,    'p' },
+                { "replay-speed", required_argument, nullptr,   'x' },
+                { "script",     required_argument,  nullptr,    'S' },
+                { "serial",     required_argument,  nullptr,    'N' },
+                { "serve",      required_argument,  nullptr,    's' },
+                { "speed",      required_argument,  nullptr,    'M' },
+                { "trace",      required_argument,  nullptr,    't' },
+                { "version",    no_argument,        nullptr,    'v' },
+                { nullptr,      0,                  nullptr,    0 },
         };
         // clang-format on
 
-        int const c = ::getopt_long(
-                argc, argv, "Dhv", static_cast<option const*>(long_options), nullptr);
+        int const c = ::getopt_long(argc, argv, "c:Dhp:r:s:S:t:T:vx:",
+                static_cast<option const*>(long_options), nullptr);
         if (c == -1)
             break;
 
@@ -56,6 +111,65 @@ arg_parse(int argc, char** argv)
                 usage(stdout, app);
                 break;
 
+            case 'c':
+                args.client_name = optarg;
+                break;
+
+            case 'B':
+            case 'C':
+            case 'P':
+            case 'N':
+            case 'M':
+                try {
+                    // clang-format off
+                    switch (c) {
+                        case 'B': args.filter.add_buses(optarg); break;
+                        case 'C': args.filter.add_classes(optarg); break;
+                        case 'P': args.filter.add_port_prefixes(optarg); break;
+                        case 'N': args.filter.add_serial(optarg); break;
+                        case 'M': args.filter.add_speeds(optarg); break;
+                    }
+                    // clang-format on
+                } catch (std::invalid_argument const& e) {
+                    std::fprintf(stderr, "%s\n", e.what());
+                    usage(stderr, app);
+                }
+                break;
+
+            case 's':
+                args.serve_name = optarg;
+                break;
+
+            case 'p':
+                args.replay_file = optarg;
+                break;
+
+            case 'r':
+                args.record_file = optarg;
+                break;
+
+            case 'x': {
+                char* end = nullptr;
+                args.replay_speed = std::strtod(optarg, &end);
+                if (end == optarg || *end != '\0' || args.replay_speed < 0.0) {
+                    std::fprintf(stderr, "invalid replay speed \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                break;
+            }
+
+            case 'S':
+                args.script_file = optarg;
+                break;
+
+            case 't':
+                args.trace_file = optarg;
+                break;
+
+            case 'T':
+                args.decode_trace_file = optarg;
+                break;
+
             case 'v':
                 std::fprintf(stdout, "app_version=%s\n%s\n", ::VERSION,
                         get_version_info_multiline().c_str());
@@ -73,7 +187,22 @@ arg_parse(int argc, char** argv)
         }
     } // while
 
-    if (optind == argc) {
+    if (!args.client_name.empty()) {
+        if (optind != argc || !args.filter.empty() || !args.serve_name.empty()
+                || !args.replay_file.empty()) {
+            std::fprintf(stderr, "--client takes no device, and no other mode\n\n");
+            usage(stderr, app);
+        }
+        return args;
+    }
+
+    if (!args.serve_name.empty() + !args.script_file.empty() + !args.replay_file.empty() > 1) {
+        std::fprintf(stderr, "--serve, --script and --replay are mutually exclusive\n\n");
+        usage(stderr, app);
+    }
+
+    if (optind == argc && args.filter.empty() && args.replay_file.empty()
+            && args.decode_trace_file.empty()) {
         std::fprintf(stderr, "missing required argument(s)\n\n");
         usage(stderr, app);
     }
@@ -0,0 +1,371 @@
+#include "command_ring.hpp"
+#include "util/log.hpp"
+#include <fmt/format.h>
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h> // SYS_futex
+#include <fcntl.h>
+#include <signal.h> // ::kill
+#include <unistd.h>
+#include <cerrno>
+#include <cstring> // std::strerror
+#include <ctime>
+#include <new>
+#include <stdexcept>
+
+
+namespace delcom {
+
+    namespace { // unnamed
+
+        using detail::ring_layout;
+
+        long
+        futex_wait(std::atomic<std::uint32_t>* addr, std::uint32_t expected, int timeout_msecs)
+        {
+            timespec ts{};
+            ts.tv_sec = timeout_msecs / 1000;
+            ts.tv_nsec = static_cast<long>(timeout_msecs % 1000) * 1'000'000;
+            return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(addr), FUTEX_WAIT,
+                    expected, &ts, nullptr, 0);
+        }
+
+        long
+        futex_wake(std::atomic<std::uint32_t>* addr)
+        {
+            return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(addr), FUTEX_WAKE, 1,
+                    nullptr, nullptr, 0);
+        }
+
+        /// Unlinks the ring \c name if the server that created it is
+        /// gone (it crashed, or was killed, before unlinking it itself).
+        /// \returns true if it did
+        bool
+        unlink_stale_ring(std::string const& name)
+        {
+            int const fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd == -1)
+                return errno == ENOENT; // unlinked meanwhile
+            struct stat st;
+            void* addr = MAP_FAILED;
+            if (::fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(ring_layout)))
+                addr = ::mmap(nullptr, sizeof(ring_layout), PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED)
+                return false; // not a ring of ours; leave it alone
+
+            // a server sets its pid first thing after creating the ring
+            pid_t const owner = static_cast<ring_layout const*>(addr)->owner_pid;
+            ::munmap(addr, sizeof(ring_layout));
+            if (owner == 0 || ::kill(owner, 0) == 0 || errno == EPERM)
+                return false;
+
+            LOG_WARN("{}: removing command ring {} left behind by process {}",
+                    __builtin_FUNCTION(), name, owner);
+            return ::shm_unlink(name.c_str()) == 0 || errno == ENOENT;
+        }
+
+        ring_layout*
+        map_ring(std::string const& name, bool create)
+        {
+            // only the user running the server (and its clients) may
+            // drive the device
+            int const flags = create ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR;
+            int fd = ::shm_open(name.c_str(), flags, 0600);
+            if (fd == -1 && create && errno == EEXIST && unlink_stale_ring(name))
+                fd = ::shm_open(name.c_str(), flags, 0600);
+            if (fd == -1) {
+                throw std::runtime_error(fmt::format("{}: shm_open({}) failure ({})",
+                        __builtin_FUNCTION(), name, std::strerror(errno)));
+            }
+
+            if (create && ::ftruncate(fd, sizeof(ring_layout)) == -1) {
+                int const e = errno;
+                ::close(fd);
+                ::shm_unlink(name.c_str());
+                throw std::runtime_error(fmt::format(
+                        "{}: ftruncate failure ({})", __builtin_FUNCTION(), std::strerror(e)));
+            }
+
+            if (!create) {
+                struct stat st;
+                if (::fstat(fd, &st) == -1
+                        || st.st_size < static_cast<off_t>(sizeof(ring_layout))) {
+                    ::close(fd);
+                    throw std::runtime_error(fmt::format(
+                            "{}: {} is not a command ring", __builtin_FUNCTION(), name));
+                }
+            }
+
+            void* addr = ::mmap(
+                    nullptr, sizeof(ring_layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            int const e = errno;
+            ::close(fd);
+            if (addr == MAP_FAILED) {
+                if (create)
+                    ::shm_unlink(name.c_str());
+                throw std::runtime_error(fmt::format(
+                        "{}: mmap failure ({})", __builtin_FUNCTION(), std::strerror(e)));
+            }
+
+            return static_cast<ring_layout*>(addr);
+        }
+
+    } // namespace
+
+
+    command_ring_server::command_ring_server(std::string name, vi_hid& hid)
+            : name_(std::move(name))
+            , hid_(hid)
+    {
+        ring_ = map_ring(name_, /*create=*/true);
+
+        // the destructor won't run if this throws, and a segment left
+        // behind would make every later server fail with EEXIST
+        try {
+            // the object is freshly zero-filled by ftruncate; construct
+            // the layout in place so that the atomics have a well-defined
+            // state
+            ring_ = new (ring_) ring_layout;
+            ring_->owner_pid = ::getpid(); // first, see unlink_stale_ring()
+            ring_->version = detail::ring_version;
+            ring_->capacity = detail::ring_capacity;
+            ring_->enqueue_pos.store(0, std::memory_order_relaxed);
+            ring_->dropped.store(0, std::memory_order_relaxed);
+            ring_->dequeue_pos.store(0, std::memory_order_relaxed);
+            ring_->futex_word.store(0, std::memory_order_relaxed);
+            ring_->consumer_waiting.store(0, std::memory_order_relaxed);
+            ring_->state_seq.store(0, std::memory_order_relaxed);
+            ring_->state_serial_number.store(
+                    hid_.read_firmware_info().serial_number, std::memory_order_relaxed);
+            for (std::size_t i = 0; i < detail::ring_capacity; ++i)
+                ring_->slots[i].seq.store(i, std::memory_order_relaxed);
+
+            publish_state();
+        } catch (...) {
+            ::munmap(ring_, sizeof(detail::ring_layout));
+            ::shm_unlink(name_.c_str());
+            throw;
+        }
+        ring_->magic.store(detail::ring_magic, std::memory_order_release);
+    }
+
+    command_ring_server::~command_ring_server() noexcept
+    {
+        ring_->magic.store(0, std::memory_order_release);
+        ::munmap(ring_, sizeof(detail::ring_layout));
+        ::shm_unlink(name_.c_str());
+    }
+
+    void
+    command_ring_server::run(std::atomic<bool> const& stop, int poll_msecs)
+    {
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (drain() != 0)
+                continue;
+
+            // Nothing queued; announce that we are about to sleep, then
+            // re-check so that a producer that enqueued before seeing
+            // the flag is not missed.
+            std::uint32_t const word = ring_->futex_word.load(std::memory_order_acquire);
+            ring_->consumer_waiting.store(1, std::memory_order_seq_cst);
+            std::uint64_t const pos = ring_->dequeue_pos.load(std::memory_order_relaxed);
+            auto const& slot = ring_->slots[pos & (detail::ring_capacity - 1)];
+            if (slot.seq.load(std::memory_order_seq_cst) != pos + 1)
+                futex_wait(&ring_->futex_word, word, poll_msecs);
+            ring_->consumer_waiting.store(0, std::memory_order_relaxed);
+        }
+
+        drain();
+    }
+
+    std::size_t
+    command_ring_server::drain()
+    {
+        std::size_t count = 0;
+        std::uint64_t failed = 0;
+
+        std::uint64_t pos = ring_->dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = ring_->slots[pos & (detail::ring_capacity - 1)];
+            if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+                break;
+
+            ring_command const cmd = slot.cmd;
+            slot.seq.store(pos + detail::ring_capacity, std::memory_order_release);
+            ++pos;
+            ring_->dequeue_pos.store(pos, std::memory_order_relaxed);
+
+            try {
+                if (!execute(cmd))
+                    ++failed;
+            } catch (std::exception const& e) {
+                LOG_ERROR("{}: {}", __builtin_FUNCTION(), e.what());
+                ++failed;
+            }
+            ++count;
+        }
+
+        if (count != 0) {
+            ring_->state_processed.fetch_add(count, std::memory_order_relaxed);
+            ring_->state_failed.fetch_add(failed, std::memory_order_relaxed);
+            try {
+                publish_state();
+            } catch (std::exception const& e) {
+                // the previous state stays published; the next drain
+                // tries again
+                LOG_ERROR("{}: {}", __builtin_FUNCTION(), e.what());
+            }
+        }
+
+        return count;
+    }
+
+    bool
+    command_ring_server::execute(ring_command const& cmd)
+    {
+        switch (cmd.type) {
+            case ring_command::Type::LedOn:
+                return hid_.turn_led_on(cmd.color, cmd.duration_msecs);
+            case ring_command::Type::LedOff:
+                return hid_.turn_led_off(cmd.color);
+            case ring_command::Type::SetIntensity:
+                return hid_.set_led_intensity(cmd.color, cmd.pct);
+            default:
+                break;
+        }
+
+        LOG_ERROR("{}: unknown command type ({})", __builtin_FUNCTION(),
+                static_cast<int>(cmd.type));
+        return false;
+    }
+
+    void
+    command_ring_server::publish_state()
+    {
+        port_data const pd = hid_.read_port_data();
+        std::uint32_t const ports = pd.port0 | (pd.port1 << 8) | (pd.port2 << 16)
+                | (static_cast<std::uint32_t>(pd.clock_status) << 24);
+
+        std::uint64_t const seq = ring_->state_seq.load(std::memory_order_relaxed);
+        ring_->state_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        ring_->state_ports.store(ports, std::memory_order_relaxed);
+        ring_->state_seq.store(seq + 2, std::memory_order_release);
+    }
+
+
+    /**********************************************************************/
+
+    command_ring_client::command_ring_client(std::string name)
+            : name_(std::move(name))
+    {
+        ring_ = map_ring(name_, /*create=*/false);
+
+        if (ring_->magic.load(std::memory_order_acquire) != detail::ring_magic
+                || ring_->version != detail::ring_version
+                || ring_->capacity != detail::ring_capacity) {
+            ::munmap(ring_, sizeof(detail::ring_layout));
+            throw std::runtime_error(fmt::format(
+                    "{}: {} has no owner or an incompatible layout", __builtin_FUNCTION(), name_));
+        }
+    }
+
+    command_ring_client::~command_ring_client() noexcept
+    {
+        ::munmap(ring_, sizeof(detail::ring_layout));
+    }
+
+    bool
+    command_ring_client::push(ring_command const& cmd) noexcept
+    {
+        std::uint64_t pos = ring_->enqueue_pos.load(std::memory_order_relaxed);
+        detail::ring_slot* slot = nullptr;
+        while (true) {
+            slot = &ring_->slots[pos & (detail::ring_capacity - 1)];
+            std::uint64_t const seq = slot->seq.load(std::memory_order_acquire);
+            auto const diff = static_cast<std::int64_t>(seq - pos);
+            if (diff == 0) {
+                if (ring_->enqueue_pos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                ring_->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = ring_->enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->cmd = cmd;
+        slot->seq.store(pos + 1, std::memory_order_seq_cst);
+
+        // pairs with the consumer's store to consumer_waiting followed
+        // by its re-check of the slot
+        if (ring_->consumer_waiting.load(std::memory_order_seq_cst) != 0) {
+            ring_->futex_word.fetch_add(1, std::memory_order_release);
+            futex_wake(&ring_->futex_word);
+        }
+
+        return true;
+    }
+
+    bool
+    command_ring_client::turn_led_on(Color color, std::uint32_t duration_msecs) noexcept
+    {
+        ring_command cmd;
+        cmd.type = ring_command::Type::LedOn;
+        cmd.color = color;
+        cmd.duration_msecs = duration_msecs;
+        return push(cmd);
+    }
+
+    bool
+    command_ring_client::turn_led_off(Color color) noexcept
+    {
+        ring_command cmd;
+        cmd.type = ring_command::Type::LedOff;
+        cmd.color = color;
+        return push(cmd);
+    }
+
+    bool
+    command_ring_client::set_led_intensity(Color color, std::uint8_t pct) noexcept
+    {
+        if (pct > 100)
+            return false;
+
+        ring_command cmd;
+        cmd.type = ring_command::Type::SetIntensity;
+        cmd.color = color;
+        cmd.pct = pct;
+        return push(cmd);
+    }
+
+    ring_state
+    command_ring_client::state() const noexcept
+    {
+        ring_state st;
+        std::uint64_t seq0 = 0;
+        std::uint64_t seq1 = 0;
+        std::uint32_t ports = 0;
+        do {
+            seq0 = ring_->state_seq.load(std::memory_order_acquire);
+            ports = ring_->state_ports.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq1 = ring_->state_seq.load(std::memory_order_relaxed);
+        } while ((seq0 & 1) != 0 || seq0 != seq1);
+
+        st.ports.port0 = ports & 0xff;
+        st.ports.port1 = (ports >> 8) & 0xff;
+        st.ports.port2 = (ports >> 16) & 0xff;
+        st.ports.clock_status = (ports >> 24) & 0xff;
+        st.serial_number = ring_->state_serial_number.load(std::memory_order_relaxed);
+        st.commands_processed = ring_->state_processed.load(std::memory_order_relaxed);
+        st.commands_failed = ring_->state_failed.load(std::memory_order_relaxed);
+        st.commands_dropped = ring_->dropped.load(std::memory_order_relaxed);
+        return st;
+    }
+
+} // namespace delcom
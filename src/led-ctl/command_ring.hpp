@@ -0,0 +1,153 @@
+#pragma once
+
+#include "delcom.hpp"
+#include <atomic>
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <string>
+
+
+namespace delcom {
+
+    /// A fixed-size command record placed in the shared-memory ring.
+    struct ring_command
+    {
+        enum class Type : std::uint8_t
+        {
+            LedOn = 1,
+            LedOff = 2,
+            SetIntensity = 3,
+        };
+
+        Type type = Type::LedOff;
+        Color color = Color::Green;
+        std::uint8_t pct = 0; ///< only used by SetIntensity
+        std::uint8_t reserved = 0;
+        std::uint32_t duration_msecs = 0; ///< only used by LedOn
+    };
+    static_assert(sizeof(ring_command) == 8);
+
+    /// Snapshot of the state published by the ring's owner.
+    struct ring_state
+    {
+        port_data ports;
+        std::uint32_t serial_number = 0;
+        std::uint64_t commands_processed = 0;
+        std::uint64_t commands_failed = 0;
+        std::uint64_t commands_dropped = 0; ///< rejected by producers because ring was full
+    };
+
+    namespace detail {
+
+        inline constexpr std::uint32_t ring_magic = 0x444c'4352; // "DLCR"
+        inline constexpr std::uint32_t ring_version = 1;
+        inline constexpr std::size_t ring_capacity = 256; ///< must be a power of two
+        inline constexpr std::size_t cache_line_size = 64;
+
+        static_assert((ring_capacity & (ring_capacity - 1)) == 0);
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+        static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+        /// A slot's sequence number tells producers and the consumer
+        /// who owns it: seq == pos means free for the producer claiming
+        /// pos, seq == pos + 1 means filled and ready for the consumer.
+        struct ring_slot
+        {
+            std::atomic<std::uint64_t> seq;
+            ring_command cmd;
+        };
+
+        /// Layout of the shared-memory segment. Everything in here is
+        /// either written once before \c magic is published, or is an
+        /// atomic.
+        struct ring_layout
+        {
+            std::atomic<std::uint32_t> magic;
+            std::uint32_t version;
+            std::uint32_t capacity;
+            std::int32_t owner_pid;
+
+            alignas(cache_line_size) std::atomic<std::uint64_t> enqueue_pos;
+            std::atomic<std::uint64_t> dropped;
+            alignas(cache_line_size) std::atomic<std::uint64_t> dequeue_pos;
+
+            /// Futex word bumped by producers when the consumer is
+            /// parked; \c consumer_waiting tells producers whether the
+            /// wake syscall is needed at all.
+            alignas(cache_line_size) std::atomic<std::uint32_t> futex_word;
+            std::atomic<std::uint32_t> consumer_waiting;
+
+            /// Published device state, guarded by a seqlock (odd
+            /// sequence means an update is in progress).
+            alignas(cache_line_size) std::atomic<std::uint64_t> state_seq;
+            std::atomic<std::uint32_t> state_ports; ///< port0|port1<<8|port2<<16|clock<<24
+            std::atomic<std::uint32_t> state_serial_number;
+            std::atomic<std::uint64_t> state_processed;
+            std::atomic<std::uint64_t> state_failed;
+
+            alignas(cache_line_size) ring_slot slots[ring_capacity];
+        };
+
+    } // namespace detail
+
+
+    /// Owner side of the command ring. Creates a POSIX shared-memory
+    /// object, executes the commands that producers enqueue against
+    /// the given \c vi_hid, and publishes the resulting device state.
+    /// There must be exactly one server per ring name.
+    class command_ring_server
+    {
+    private:
+        std::string name_;
+        vi_hid& hid_;
+        detail::ring_layout* ring_ = nullptr;
+
+    public:
+        command_ring_server(std::string name, vi_hid&);
+        ~command_ring_server() noexcept;
+        command_ring_server(command_ring_server const&) = delete;
+        command_ring_server& operator=(command_ring_server const&) = delete;
+
+        /// Processes commands until \c stop becomes true. Blocks on a
+        /// futex while the ring is empty; \c stop is re-checked at
+        /// least every \c poll_msecs.
+        void run(std::atomic<bool> const& stop, int poll_msecs = 250);
+
+        /// Drains all currently-queued commands.
+        /// \returns number of commands executed
+        std::size_t drain();
+
+    private:
+        bool execute(ring_command const&);
+        void publish_state();
+    };
+
+    /// Producer side of the command ring. Any number of processes (and
+    /// threads) may enqueue concurrently. Enqueuing is a handful of
+    /// atomic operations; a syscall is only made when the owner is
+    /// parked waiting for work.
+    class command_ring_client
+    {
+    private:
+        std::string name_;
+        detail::ring_layout* ring_ = nullptr;
+
+    public:
+        explicit command_ring_client(std::string name);
+        ~command_ring_client() noexcept;
+        command_ring_client(command_ring_client const&) = delete;
+        command_ring_client& operator=(command_ring_client const&) = delete;
+
+        /// \returns false if the ring is full (the command is dropped)
+        bool push(ring_command const&) noexcept;
+
+        bool turn_led_on(Color, std::uint32_t duration_msecs = 0) noexcept;
+        bool turn_led_off(Color) noexcept;
+        bool set_led_intensity(Color, std::uint8_t pct) noexcept;
+
+        /// Reads the most recently published device state without
+        /// talking to the device.
+        ring_state state() const noexcept;
+    };
+
+} // namespace delcom
@@ -1,58 +1,13 @@
 #include "delcom.hpp"
 #include "util/assert.hpp"
+#include "util/log.hpp"
+#include "util/trace.hpp"
+#include "util/usb_open.hpp"
 #include <fmt/format.h>
 
 
 namespace delcom {
 
-    namespace { // unnamed
-
-        libusb_device_handle*
-        open_device(libusb_context* const ctx, std::uint16_t vid, std::uint16_t pid)
-        {
-            libusb_device** devices = nullptr;
-            ssize_t num_devs = ::libusb_get_device_list(ctx, &devices);
-            if (num_devs < 0) {
-                fmt::print(stderr, "libusb_get_device_list failure ({})\n",
-                        ::libusb_strerror(static_cast<libusb_error>(num_devs)));
-                ::libusb_free_device_list(devices, 1);
-                return nullptr;
-            }
-
-            libusb_device* dev = nullptr;
-            for (ssize_t i = 0; i < num_devs; ++i) {
-                libusb_device_descriptor dd;
-                if (int rv = ::libusb_get_device_descriptor(devices[i], &dd); rv != 0) {
-                    fmt::print(stderr, "libusb_get_device_descriptor failure ({})\n",
-                            ::libusb_strerror(static_cast<libusb_error>(num_devs)));
-                    ::libusb_free_device_list(devices, 1);
-                    return nullptr;
-                }
-
-                if (dd.idVendor == vid && dd.idProduct == pid) {
-                    dev = devices[i];
-                    break;
-                }
-            }
-
-            libusb_device_handle* dev_handle = nullptr;
-            if (dev != nullptr) {
-                if (int rv = ::libusb_open(dev, &dev_handle); rv != 0) {
-                    fmt::print(stderr, "libusb_open failure ({})\n",
-                            ::libusb_strerror(static_cast<libusb_error>(rv)));
-                    dev = nullptr;
-                    dev_handle = nullptr;
-                }
-            }
-
-            // decrements all device counts by 1
-            ::libusb_free_device_list(devices, 1);
-            return dev_handle;
-        }
-
-    } // namespace
-
-
     std::string
     to_str(send_cmd const& msg)
     {
@@ -75,9 +30,23 @@ namespace delcom {
                 "    major_cmd  = {0:#010b} {0:#03d} {0:#04x} {1:s}", msg.cmd, to_str(msg.cmd));
     }
 
+    namespace { // unnamed
+
+        usb_filter
+        id_filter(std::uint16_t vid, std::uint16_t pid)
+        {
+            usb_filter filter;
+            filter.add_id(vid, pid);
+            return filter;
+        }
+
+    } // namespace
+
     vi_hid::vi_hid(std::uint16_t vid, std::uint16_t pid, bool debug)
-            : vendor_id_(vid)
-            , product_id_(pid)
+            : vi_hid(id_filter(vid, pid), debug)
+    {}
+
+    vi_hid::vi_hid(usb_filter const& filter, bool debug)
     {
         if (int e = ::libusb_init(&ctx_); e != LIBUSB_SUCCESS) {
             throw std::runtime_error(fmt::format("{}: libusb_init failure ({})",
@@ -93,12 +62,23 @@ namespace delcom {
             }
         }
 
-        if (dev_ = open_device(ctx_, vendor_id_, product_id_); dev_ == nullptr) {
+        if (dev_ = open_usb_device(ctx_, filter); dev_ == nullptr) {
             ::libusb_exit(ctx_);
-            throw std::runtime_error(fmt::format("{}: failed to open device {:#06x}:{:#06x}",
-                    __builtin_FUNCTION(), vendor_id_, product_id_));
+            throw std::runtime_error(fmt::format("{}: failed to open device matching {}",
+                    __builtin_FUNCTION(), to_str(filter)));
         }
 
+        libusb_device_descriptor dd;
+        if (int e = ::libusb_get_device_descriptor(::libusb_get_device(dev_), &dd);
+                e != LIBUSB_SUCCESS) {
+            ::libusb_close(dev_);
+            ::libusb_exit(ctx_);
+            throw std::runtime_error(fmt::format("{}: libusb_get_device_descriptor failure ({})",
+                    __builtin_FUNCTION(), ::libusb_strerror(static_cast<libusb_error>(e))));
+        }
+        vendor_id_ = dd.idVendor;
+        product_id_ = dd.idProduct;
+
         // if (::libusb_kernel_driver_active(dev_, interface_) == 1) {
         //     if (int e = ::libusb_detach_kernel_driver(dev_, interface_); e != LIBUSB_SUCCESS) {
         //         ::libusb_close(dev_);
@@ -135,11 +115,15 @@ namespace delcom {
 
     vi_hid::~vi_hid() noexcept
     {
+        std::vector<std::thread> threads;
         {
             std::lock_guard l(threads_lock_);
-            for (auto& t : threads_)
-                t.join();
+            stopping_ = true;
+            threads.swap(threads_);
         }
+        stopping_cv_.notify_all();
+        for (auto& t : threads)
+            t.join();
 
         if (int e = ::libusb_release_interface(dev_, interface_); e != LIBUSB_SUCCESS) {
             std::fprintf(stderr, "libusb: release_interface failure (%s)\n",
@@ -198,7 +182,11 @@ namespace delcom {
             std::erase_if(threads_, [](auto& t) { return !t.joinable(); });
 
             threads_.emplace_back([this, color, duration_msecs]() {
-                std::this_thread::sleep_for(std::chrono::milliseconds(duration_msecs));
+                {
+                    std::unique_lock l(threads_lock_);
+                    stopping_cv_.wait_for(l, std::chrono::milliseconds(duration_msecs),
+                            [this] { return stopping_; });
+                }
                 led(false, color);
             });
         }
@@ -217,7 +205,7 @@ namespace delcom {
     {
         // 'pct' must be 0 <= pct <= 100
         if (pct > 100) {
-            fmt::print(stderr, "{}: invalid pct ({}) provided; constraints are 0 <= pct <= 100\n",
+            LOG_ERROR("{}: invalid pct ({}) provided; constraints are 0 <= pct <= 100",
                     __builtin_FUNCTION(), pct);
             return false;
         }
@@ -225,6 +213,45 @@ namespace delcom {
         return set_pwm(color, pct);
     }
 
+    bool
+    vi_hid::flash_led(Color color, std::uint8_t on_duty, std::uint8_t off_duty) const
+    {
+        bool const enable = (on_duty != 0 || off_duty != 0);
+
+        packet msg;
+        msg.send.cmd = Command::Write8Bytes;
+
+        try {
+            if (enable) {
+                // one duty-cycle command per pin
+                constexpr std::tuple<Color, WriteCommand> pins[] = {
+                        {Color::Green, WriteCommand::SetDutyCyclePort1Pin0},
+                        {Color::Red, WriteCommand::SetDutyCyclePort1Pin1},
+                        {Color::Blue, WriteCommand::SetDutyCyclePort1Pin2},
+                };
+                for (auto const& [pin_color, write_cmd] : pins) {
+                    if ((color & pin_color) != pin_color)
+                        continue;
+
+                    msg.send.write_cmd = write_cmd;
+                    msg.send.lsb = on_duty;
+                    msg.send.msb = off_duty;
+                    if (!send_set_report(msg))
+                        return false;
+                }
+            }
+
+            // lsb disables, msb enables the clock generator per pin
+            msg.send.write_cmd = WriteCommand::ToggleClockGenPort1;
+            msg.send.lsb = enable ? 0 : static_cast<std::uint8_t>(color);
+            msg.send.msb = enable ? static_cast<std::uint8_t>(color) : 0;
+            return send_set_report(msg);
+        } catch (std::exception const& e) {
+            throw std::runtime_error(fmt::format(
+                    "{}: send_set_report failure ({})", __builtin_FUNCTION(), e.what()));
+        }
+    }
+
     bool
     vi_hid::turn_off_leds_on_button_press(bool enable) const
     {
@@ -295,6 +322,29 @@ namespace delcom {
         return {info->counter_value, (info->overflow_status == 0xff) ? true : false};
     }
 
+    void
+    vi_hid::record_to(packet_log_writer* log) noexcept
+    {
+        log_ = log;
+    }
+
+    bool
+    vi_hid::replay_packet(usb::hid::ClassRequest request, packet const& recorded) const
+    {
+        packet msg = recorded;
+        switch (request) {
+            case usb::hid::ClassRequest::GetReport:
+                return send_get_report(msg) == sizeof(msg);
+            case usb::hid::ClassRequest::SetReport:
+                return send_set_report(msg);
+            default:
+                break;
+        }
+
+        throw std::runtime_error(fmt::format("{}: unsupported request ({})", __builtin_FUNCTION(),
+                static_cast<int>(request)));
+    }
+
 
     // private
     /**********************************************************************/
@@ -308,17 +358,17 @@ namespace delcom {
         //  3) enabling auto clear
 
         if (!turn_led_off(Color::Red | Color::Green | Color::Blue)) {
-            fmt::print(stderr, "{}: turn_led_off failure\n", __builtin_FUNCTION());
+            LOG_ERROR("{}: turn_led_off failure", __builtin_FUNCTION());
             return false;
         }
 
         if (!set_pwm(Color::Red | Color::Green | Color::Blue, initial_pwm_)) {
-            fmt::print(stderr, "{}: set_pwm failure\n", __builtin_FUNCTION());
+            LOG_ERROR("{}: set_pwm failure", __builtin_FUNCTION());
             return false;
         }
 
         if (!turn_off_leds_on_button_press(/*enable=*/true)) {
-            fmt::print(stderr, "{}: set_pwm failure\n", __builtin_FUNCTION());
+            LOG_ERROR("{}: set_pwm failure", __builtin_FUNCTION());
             return false;
         }
 
@@ -372,7 +422,8 @@ namespace delcom {
                 msg.send.lsb = 0;
                 p0 = send_set_report(msg);
                 if (!p0) {
-                    fmt::print(stderr, "{}: send_set_report failure: failed to set PWM for pin 0\n",
+                    LOG_ERROR_RATE_LIMITED(1000,
+                            "{}: send_set_report failure: failed to set PWM for pin 0",
                             __builtin_FUNCTION());
                 }
             }
@@ -380,7 +431,8 @@ namespace delcom {
                 msg.send.lsb = 1;
                 p1 = send_set_report(msg);
                 if (!p1) {
-                    fmt::print(stderr, "{}: send_set_report failure: failed to set PWM for pin 1\n",
+                    LOG_ERROR_RATE_LIMITED(1000,
+                            "{}: send_set_report failure: failed to set PWM for pin 1",
                             __builtin_FUNCTION());
                 }
             }
@@ -388,7 +440,8 @@ namespace delcom {
                 msg.send.lsb = 2;
                 p2 = send_set_report(msg);
                 if (!p2) {
-                    fmt::print(stderr, "{}: send_set_report failure: failed to set PWM for pin 2\n",
+                    LOG_ERROR_RATE_LIMITED(1000,
+                            "{}: send_set_report failure: failed to set PWM for pin 2",
                             __builtin_FUNCTION());
                 }
             }
@@ -416,19 +469,15 @@ namespace delcom {
                 = (static_cast<std::uint8_t>(usb::hid::ReportType::Feature) << 8) | msg.data[0];
         std::uint8_t const index = interface_;
 
-        // fmt::print("send_get_report [\n"
-        //            "  request_type = {0:#010b} {0:#03d} {0:#04x}\n"
-        //            "  request      = {1:#010b} {1:#03d} {1:#04x}\n"
-        //            "  value        = {2:#018b} {2:#05d} {2:#06x}\n"
-        //            "  index        = {3:#010b} {3:#03d} {3:#04x}\n"
-        //            "  report data [\n"
-        //            "{4:s}\n"
-        //            "  ]\n"
-        //            "]\n",
-        //         request_type, request, value, index, to_str(msg.recv));
+        TRACE_BEGIN(trace_begin);
 
+        packet const req = msg;
         int nbytes = ::libusb_control_transfer(dev_, request_type, request, value, index, msg.data,
                 sizeof(msg), /*timeout_millis=*/0);
+        TRACE_CONTROL_TRANSFER(trace_begin, request_type, request, value, index, req.data,
+                sizeof(req), nbytes);
+        if (log_ != nullptr)
+            log_->append(usb::hid::ClassRequest::GetReport, req, nbytes);
         if (nbytes != sizeof(msg)) {
             throw std::runtime_error(fmt::format("{}: libusb_control_transfer failure ({})",
                     __builtin_FUNCTION(), ::libusb_strerror(static_cast<libusb_error>(nbytes))));
@@ -452,19 +501,14 @@ namespace delcom {
         std::uint16_t const value = static_cast<std::uint8_t>(usb::hid::ReportType::Feature) << 8;
         std::uint8_t const index = interface_;
 
-        // fmt::print("send_set_report [\n"
-        //            "  request_type = {0:#010b} {0:#03d} {0:#04x}\n"
-        //            "  request      = {1:#010b} {1:#03d} {1:#04x}\n"
-        //            "  value        = {2:#018b} {2:#05d} {2:#06x}\n"
-        //            "  index        = {3:#010b} {3:#03d} {3:#04x}\n"
-        //            "  report data [\n"
-        //            "{4:s}\n"
-        //            "  ]\n"
-        //            "]\n",
-        //         request_type, request, value, index, to_str(msg.send));
+        TRACE_BEGIN(trace_begin);
 
         int nbytes = ::libusb_control_transfer(dev_, request_type, request, value, index,
                 const_cast<std::uint8_t*>(msg.data), sizeof(msg), /*timeout_millis=*/0);
+        TRACE_CONTROL_TRANSFER(trace_begin, request_type, request, value, index, msg.data,
+                sizeof(msg), nbytes);
+        if (log_ != nullptr)
+            log_->append(usb::hid::ClassRequest::SetReport, msg, nbytes);
         if (nbytes != sizeof(msg)) {
             throw std::runtime_error(fmt::format("{}: libusb_control_transfer failure ({})",
                     __builtin_FUNCTION(), ::libusb_strerror(static_cast<libusb_error>(nbytes))));
@@ -1,12 +1,16 @@
 #pragma once
 
+#include "packet_log.hpp"
 #include "protocol.hpp"
 #include "usb_hid.hpp"
+#include "util/usb_filter.hpp"
 #include <fmt/format.h>
 #include <libusb.h>
+#include <condition_variable>
 #include <cstddef> // std::size_t
 #include <cstdint>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <tuple>
 #include <vector>
@@ -85,6 +89,11 @@ namespace delcom {
     }
 
 
+    /// Multi-line, human-readable rendering of a report's fields.
+    std::string to_str(send_cmd const&);
+    std::string to_str(recv_cmd const&);
+
+
     /// Simple API for sending/receiving data to/from Delcom's visual
     /// indicator USB HID. Relies on libusb for communication.
     /// \ref vendor id = 0x0fc5
@@ -101,10 +110,16 @@ namespace delcom {
         std::uint16_t interface_ = 0;
         std::size_t initial_pwm_ = 50; ///< half (50%)
         std::mutex threads_lock_;
+        std::condition_variable stopping_cv_; ///< cuts turn_led_on() timers short
+        bool stopping_ = false; ///< guarded by threads_lock_
         std::vector<std::thread> threads_;
+        packet_log_writer* log_ = nullptr;
 
     public:
         vi_hid(std::uint16_t vendor_id, std::uint16_t product_id, bool debug = false);
+        /// Opens the first device \c filter accepts, e.g. to pick one of
+        /// several indicators by serial number or port.
+        explicit vi_hid(usb_filter const& filter, bool debug = false);
         ~vi_hid() noexcept;
 
         std::uint16_t vendor_id() const noexcept;
@@ -112,7 +127,8 @@ namespace delcom {
         firmware_info read_firmware_info() const;
 
         /// A duration of 0 turns the light on until \c turn_led_off is
-        /// called. Returns immediately, regardless of duration.
+        /// called. Returns immediately, regardless of duration; the
+        /// light goes off early if this is destroyed first.
         bool turn_led_on(Color color, std::uint64_t duration_msecs = 0);
         bool turn_led_off(Color) const;
         bool turn_off_leds_on_button_press(bool enable) const;
@@ -121,11 +137,25 @@ namespace delcom {
         /// 0 means off.
         bool set_led_intensity(Color, std::uint8_t pct) const;
 
+        /// Enable hardware flashing (clock generator mode), where
+        /// on_duty and off_duty are in units of the clock generator
+        /// period. Both being 0 disables flashing. The led must also
+        /// be turned on for the flashing to be visible.
+        bool flash_led(Color, std::uint8_t on_duty, std::uint8_t off_duty) const;
+
         port_data read_port_data() const;
 
         /// \returns event-counter value and overflow status
         std::tuple<std::uint32_t, bool> read_and_reset_event_counter() const;
 
+        /// Record every report sent to the device (with its outcome) to
+        /// \c log, which must outlive this object. nullptr disables
+        /// recording.
+        void record_to(packet_log_writer* log) noexcept;
+
+        /// Send a previously-recorded report as-is.
+        bool replay_packet(usb::hid::ClassRequest, packet const&) const;
+
     private:
         bool initialize_device() const;
         bool led(bool enable, Color) const;
@@ -1,49 +1,222 @@
 #include "arg_parse.hpp"
+#include "command_ring.hpp"
 #include "delcom.hpp"
+#include "packet_log.hpp"
+#include "replay.hpp"
+#include "script.hpp"
 #include "util/assert.hpp"
+#include "util/trace.hpp"
 #include <fmt/core.h>
 #include <fmt/ostream.h> // for formatting std::thread_id
 #include <libusb.h>
+#include <algorithm> // std::copy
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <limits>
+#include <optional>
+#include <string>
 #include <thread> // std::this_thread
+#include <vector>
+
+
+namespace { // unnamed
+
+    std::atomic<bool> stop_requested = false;
+
+    void
+    request_stop(int /*signum*/)
+    {
+        stop_requested.store(true, std::memory_order_relaxed);
+    }
+
+    int
+    run_replay(std::string const& file, delcom::vi_hid* hid, double speed)
+    {
+        delcom::packet_log_reader const log(file);
+        delcom::replay_stats const st = delcom::replay(log, hid, speed);
+        fmt::print("replayed {} packets in {:.3f} secs ({}): {} failures, {} mismatches, "
+                   "max lag {} usecs\n",
+                st.packets, st.elapsed_nsecs / 1e9, hid == nullptr ? "simulated" : "device",
+                st.failures, st.mismatches, st.max_lag_nsecs / 1000);
+        return (st.failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    void
+    print_trace(std::string const& file)
+    {
+        std::vector<trace::event> const events = trace::load(file);
+        std::uint64_t const t0 = events.empty() ? 0 : events.front().begin_nsecs;
+
+        for (trace::event const& ev : events) {
+            auto const request = static_cast<usb::hid::ClassRequest>(ev.request);
+
+            fmt::print("[+{:.9f}] tid={} {} {} usecs request_type={:#04x} request={:#04x} "
+                       "value={:#06x} index={} result={}\n",
+                    (ev.begin_nsecs - t0) / 1e9, ev.thread_id, usb::hid::to_str(request),
+                    (ev.end_nsecs - ev.begin_nsecs) / 1000, ev.request_type, ev.request, ev.value,
+                    ev.index, ev.result);
+
+            delcom::packet msg;
+            std::copy(ev.payload, ev.payload + ev.length, msg.data);
+            fmt::print("{}\n",
+                    (request == usb::hid::ClassRequest::SetReport) ? delcom::to_str(msg.send)
+                                                                   : delcom::to_str(msg.recv));
+        }
+    }
+
+    /// Enqueues the script's commands on a ring served by another
+    /// led-ctl, printing a result line for each as it does with a device.
+    int
+    run_client(cli_args const& args)
+    {
+        try {
+            delcom::command_ring_client client(args.client_name);
+
+            bool const from_stdin = args.script_file.empty() || args.script_file == "-";
+            std::FILE* in = from_stdin ? stdin : std::fopen(args.script_file.c_str(), "r");
+            if (in == nullptr) {
+                fmt::print(stderr, "error: failed to open {}\n", args.script_file);
+                return EXIT_FAILURE;
+            }
+
+            delcom::script_stats const stats = delcom::run_script(client, in, stdout);
+            if (in != stdin)
+                std::fclose(in);
+
+            fmt::print(stderr, "{} commands, {} failures\n", stats.commands, stats.failures);
+            return (stats.failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } catch (std::exception const& e) {
+            fmt::print(stderr, "exception: {}\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    /// Runs the selected mode against the device; the device is closed
+    /// (and its timer threads joined) by the time this returns.
+    int
+    run_device(cli_args const& args)
+    {
+        int exit_code = EXIT_SUCCESS;
+        try {
+            using delcom::Color;
+
+            // declared before the device, whose led-off timer threads may
+            // still be sending when it is destroyed
+            std::optional<delcom::packet_log_writer> recorder;
+            if (!args.record_file.empty())
+                recorder.emplace(args.record_file);
+
+            usb_filter filter = args.filter;
+            if (args.vendor_id != -1) {
+                filter.add_id(static_cast<std::uint16_t>(args.vendor_id),
+                        static_cast<std::uint16_t>(args.product_id));
+            }
+            delcom::vi_hid hid(filter, args.debug);
+            if (recorder)
+                hid.record_to(&*recorder);
+
+            fmt::print("connected to device {:#06x}:{:#06x} ({})\n", hid.vendor_id(),
+                    hid.product_id(), hid.read_firmware_info().str());
+            fmt::print("device state: [{}]\n", hid.read_port_data().str());
+
+            if (!args.replay_file.empty())
+                return run_replay(args.replay_file, &hid, args.replay_speed);
+
+            if (!args.script_file.empty()) {
+                std::FILE* in = (args.script_file == "-")
+                        ? stdin
+                        : std::fopen(args.script_file.c_str(), "r");
+                if (in == nullptr) {
+                    fmt::print(stderr, "error: failed to open {}\n", args.script_file);
+                    return EXIT_FAILURE;
+                }
+
+                delcom::script_stats const stats = delcom::run_script(hid, in, stdout);
+                if (in != stdin)
+                    std::fclose(in);
+
+                fmt::print(stderr, "{} commands, {} failures\n", stats.commands, stats.failures);
+                return (stats.failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+
+            if (!args.serve_name.empty()) {
+                std::signal(SIGINT, request_stop);
+                std::signal(SIGTERM, request_stop);
+
+                delcom::command_ring_server server(args.serve_name, hid);
+                fmt::print("serving command ring {}\n", args.serve_name);
+                server.run(stop_requested);
+                fmt::print("device state: [{}]\n", hid.read_port_data().str());
+                return exit_code;
+            }
+
+            hid.turn_led_on(Color::Green, 3000);
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            hid.turn_led_on(Color::Red, 2000);
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            hid.turn_led_on(Color::Blue, 1000);
+
+            fmt::print("device state: [{}]\n", hid.read_port_data().str());
+
+        } catch (std::exception const& e) {
+            fmt::print(stderr, "exception: {}\n", e.what());
+            exit_code = EXIT_FAILURE;
+        }
+
+        return exit_code;
+    }
+
+} // namespace
 
 
 int
 main(int argc, char** argv)
 {
     cli_args const args = arg_parse(argc, argv);
-    if (args.vendor_id < 0 || args.vendor_id > std::numeric_limits<std::uint16_t>::max()) {
-        fmt::print(stderr, "error: invalid vendor id\n");
-        return EXIT_FAILURE;
-    }
-    if (args.product_id < 0 || args.product_id > std::numeric_limits<std::uint16_t>::max()) {
-        fmt::print(stderr, "error: invalid product id\n");
-        return EXIT_FAILURE;
+
+    if (!args.decode_trace_file.empty()) {
+        try {
+            print_trace(args.decode_trace_file);
+            return EXIT_SUCCESS;
+        } catch (std::exception const& e) {
+            fmt::print(stderr, "exception: {}\n", e.what());
+            return EXIT_FAILURE;
+        }
     }
 
-    int exit_code = EXIT_SUCCESS;
-    try {
-        using delcom::Color;
+    if (!args.client_name.empty())
+        return run_client(args);
 
-        delcom::vi_hid hid(args.vendor_id, args.product_id, args.debug);
-        fmt::print("connected to device {:#06x}:{:#06x} ({})\n", hid.vendor_id(), hid.product_id(),
-                hid.read_firmware_info().str());
-        fmt::print("device state: [{}]\n", hid.read_port_data().str());
+    if (!args.replay_file.empty() && args.vendor_id == -1 && args.filter.empty()) {
+        try {
+            return run_replay(args.replay_file, nullptr, args.replay_speed);
+        } catch (std::exception const& e) {
+            fmt::print(stderr, "exception: {}\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
 
-        hid.turn_led_on(Color::Green, 3000);
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        hid.turn_led_on(Color::Red, 2000);
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        hid.turn_led_on(Color::Blue, 1000);
+    // the filter options alone may select the device
+    if (args.vendor_id != -1 || args.filter.empty()) {
+        if (args.vendor_id < 0 || args.vendor_id > std::numeric_limits<std::uint16_t>::max()) {
+            fmt::print(stderr, "error: invalid vendor id\n");
+            return EXIT_FAILURE;
+        }
+        if (args.product_id < 0 || args.product_id > std::numeric_limits<std::uint16_t>::max()) {
+            fmt::print(stderr, "error: invalid product id\n");
+            return EXIT_FAILURE;
+        }
+    }
 
-        fmt::print("device state: [{}]\n", hid.read_port_data().str());
+    int const exit_code = run_device(args);
 
-    } catch (std::exception const& e) {
-        fmt::print(stderr, "exception: {}\n", e.what());
-        exit_code = EXIT_FAILURE;
+    if (!args.trace_file.empty() && !trace::dump(args.trace_file)) {
+        fmt::print(stderr, "error: failed to write trace to {}\n", args.trace_file);
+        return EXIT_FAILURE;
     }
 
     return exit_code;
@@ -0,0 +1,183 @@
+#include "packet_log.hpp"
+#include <fmt/format.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring> // std::memcmp, std::memcpy, std::strerror
+#include <ctime>   // ::clock_gettime
+#include <stdexcept>
+
+
+namespace delcom {
+
+    namespace { // unnamed
+
+        constexpr std::size_t grow_records = 64 * 1024; ///< 1.5MiB per chunk
+
+        constexpr std::size_t
+        file_size(std::size_t num_records) noexcept
+        {
+            return sizeof(packet_log_header) + num_records * sizeof(packet_log_record);
+        }
+
+        std::uint64_t
+        now_nsecs(clockid_t clock) noexcept
+        {
+            timespec ts{};
+            ::clock_gettime(clock, &ts);
+            return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+        }
+
+    } // namespace
+
+
+    packet_log_writer::packet_log_writer(std::string path)
+            : path_(std::move(path))
+    {
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ == -1) {
+            throw std::runtime_error(fmt::format("{}: open({}) failure ({})", __builtin_FUNCTION(),
+                    path_, std::strerror(errno)));
+        }
+
+        if (!grow()) {
+            ::close(fd_);
+            throw std::runtime_error(fmt::format("{}: failed to size {} ({})",
+                    __builtin_FUNCTION(), path_, std::strerror(errno)));
+        }
+
+        packet_log_header hdr;
+        hdr.start_realtime_nsecs = now_nsecs(CLOCK_REALTIME);
+        hdr.start_monotonic_nsecs = now_nsecs(CLOCK_MONOTONIC);
+        std::memcpy(base_, &hdr, sizeof(hdr));
+    }
+
+    packet_log_writer::~packet_log_writer() noexcept
+    {
+        ::munmap(base_, file_size(capacity_));
+        if (::ftruncate(fd_, static_cast<off_t>(file_size(size_))) == -1) {
+            std::fprintf(stderr, "%s: ftruncate(%s) failure (%s)\n", __builtin_FUNCTION(),
+                    path_.c_str(), std::strerror(errno));
+        }
+        ::close(fd_);
+    }
+
+    void
+    packet_log_writer::append(
+            usb::hid::ClassRequest request, packet const& msg, int result) noexcept
+    {
+        packet_log_record rec;
+        rec.result = result;
+        rec.request = request;
+        std::memcpy(rec.data, msg.data, sizeof(rec.data));
+
+        std::lock_guard l(lock_);
+        // taken under the lock, so that the records are in time order
+        rec.timestamp_nsecs = now_nsecs(CLOCK_MONOTONIC);
+        if (size_ == capacity_ && !grow())
+            return; // out of disk space; drop rather than disturb the device path
+
+        std::memcpy(base_ + file_size(size_), &rec, sizeof(rec));
+        ++size_;
+
+        // kept current so that a log survives the process crashing
+        header()->num_records = size_;
+    }
+
+    std::size_t
+    packet_log_writer::size() const noexcept
+    {
+        std::lock_guard l(lock_);
+        return size_;
+    }
+
+    bool
+    packet_log_writer::grow() noexcept
+    {
+        std::size_t const new_capacity = capacity_ + grow_records;
+        if (::ftruncate(fd_, static_cast<off_t>(file_size(new_capacity))) == -1)
+            return false;
+
+        void* addr = (base_ == nullptr)
+                ? ::mmap(nullptr, file_size(new_capacity), PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd_, 0)
+                : ::mremap(base_, file_size(capacity_), file_size(new_capacity), MREMAP_MAYMOVE);
+        if (addr == MAP_FAILED)
+            return false;
+
+        base_ = static_cast<std::byte*>(addr);
+        capacity_ = new_capacity;
+        return true;
+    }
+
+    packet_log_header*
+    packet_log_writer::header() noexcept
+    {
+        return reinterpret_cast<packet_log_header*>(base_);
+    }
+
+
+    /**********************************************************************/
+
+    packet_log_reader::packet_log_reader(std::string const& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw std::runtime_error(fmt::format("{}: open({}) failure ({})", __builtin_FUNCTION(),
+                    path, std::strerror(errno)));
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < file_size(0)) {
+            ::close(fd);
+            throw std::runtime_error(
+                    fmt::format("{}: {} is not a packet log", __builtin_FUNCTION(), path));
+        }
+
+        length_ = static_cast<std::size_t>(st.st_size);
+        base_ = ::mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+        int const e = errno;
+        ::close(fd);
+        if (base_ == MAP_FAILED) {
+            throw std::runtime_error(
+                    fmt::format("{}: mmap failure ({})", __builtin_FUNCTION(), std::strerror(e)));
+        }
+
+        header_ = static_cast<packet_log_header const*>(base_);
+        packet_log_header const expected;
+        if (std::memcmp(header_->magic, expected.magic, sizeof(expected.magic)) != 0
+                || header_->version != expected.version
+                || header_->record_size != expected.record_size
+                || header_->num_records
+                        > (length_ - sizeof(packet_log_header)) / sizeof(packet_log_record)) {
+            ::munmap(base_, length_);
+            throw std::runtime_error(fmt::format(
+                    "{}: {} is not a (complete) packet log", __builtin_FUNCTION(), path));
+        }
+
+        ::madvise(base_, length_, MADV_SEQUENTIAL);
+        records_ = {reinterpret_cast<packet_log_record const*>(header_ + 1),
+                static_cast<std::size_t>(header_->num_records)};
+    }
+
+    packet_log_reader::~packet_log_reader() noexcept
+    {
+        ::munmap(base_, length_);
+    }
+
+    packet_log_header const&
+    packet_log_reader::header() const noexcept
+    {
+        return *header_;
+    }
+
+    std::span<packet_log_record const>
+    packet_log_reader::records() const noexcept
+    {
+        return records_;
+    }
+
+} // namespace delcom
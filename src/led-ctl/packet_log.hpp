@@ -0,0 +1,85 @@
+#pragma once
+
+#include "protocol.hpp"
+#include "usb_hid.hpp"
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+
+
+namespace delcom {
+
+    /// One recorded report transfer. Fixed size so that a log is a
+    /// plain array of records following the header.
+    struct packet_log_record
+    {
+        std::uint64_t timestamp_nsecs = 0; ///< CLOCK_MONOTONIC
+        std::int32_t result = 0; ///< bytes transferred, or libusb_error if negative
+        usb::hid::ClassRequest request = usb::hid::ClassRequest::SetReport;
+        std::uint8_t reserved[3] = {0};
+        std::uint8_t data[sizeof(packet)] = {0};
+    };
+    static_assert(sizeof(packet_log_record) == 24);
+
+    /// On-disk header of a packet log.
+    struct packet_log_header
+    {
+        char magic[8] = {'D', 'L', 'C', 'M', 'P', 'L', 'O', 'G'};
+        std::uint32_t version = 1;
+        std::uint32_t record_size = sizeof(packet_log_record);
+        std::uint64_t num_records = 0; ///< updated on every append
+        std::uint64_t start_realtime_nsecs = 0; ///< wall-clock time the log was opened
+        std::uint64_t start_monotonic_nsecs = 0; ///< monotonic time the log was opened
+        std::uint64_t reserved[3] = {0};
+    };
+    static_assert(sizeof(packet_log_header) == 64);
+
+    /// Appends records to a memory-mapped log file. The mapping grows
+    /// in large chunks, so an append is normally a copy into the page
+    /// cache with no syscall. Safe to call from multiple threads.
+    class packet_log_writer
+    {
+    private:
+        std::string path_;
+        int fd_ = -1;
+        std::byte* base_ = nullptr;
+        std::size_t capacity_ = 0; ///< in records
+        std::size_t size_ = 0; ///< in records
+        mutable std::mutex lock_;
+
+    public:
+        explicit packet_log_writer(std::string path);
+        ~packet_log_writer() noexcept;
+        packet_log_writer(packet_log_writer const&) = delete;
+        packet_log_writer& operator=(packet_log_writer const&) = delete;
+
+        void append(usb::hid::ClassRequest, packet const&, int result) noexcept;
+        std::size_t size() const noexcept;
+
+    private:
+        bool grow() noexcept;
+        packet_log_header* header() noexcept;
+    };
+
+    /// Read-only, memory-mapped view of a packet log.
+    class packet_log_reader
+    {
+    private:
+        void* base_ = nullptr;
+        std::size_t length_ = 0;
+        packet_log_header const* header_ = nullptr;
+        std::span<packet_log_record const> records_;
+
+    public:
+        explicit packet_log_reader(std::string const& path);
+        ~packet_log_reader() noexcept;
+        packet_log_reader(packet_log_reader const&) = delete;
+        packet_log_reader& operator=(packet_log_reader const&) = delete;
+
+        packet_log_header const& header() const noexcept;
+        std::span<packet_log_record const> records() const noexcept;
+    };
+
+} // namespace delcom
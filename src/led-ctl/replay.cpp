@@ -0,0 +1,69 @@
+#include "replay.hpp"
+#include "util/log.hpp"
+#include <fmt/format.h>
+#include <algorithm> // std::copy, std::max, std::min
+#include <chrono>
+#include <iterator>
+#include <thread>
+
+
+namespace delcom {
+
+    replay_stats
+    replay(packet_log_reader const& log, vi_hid* hid, double speed)
+    {
+        using namespace std::chrono;
+
+        replay_stats stats;
+        auto const records = log.records();
+        if (records.empty())
+            return stats;
+
+        std::uint64_t const first_ts = records.front().timestamp_nsecs;
+        auto const start = steady_clock::now();
+
+        for (packet_log_record const& rec : records) {
+            if (speed > 0.0) {
+                // timestamps may go backwards (logs written before appends
+                // took them under the lock); clamp those to the first
+                std::uint64_t const since_first =
+                        (rec.timestamp_nsecs > first_ts) ? rec.timestamp_nsecs - first_ts : 0;
+                double const scaled = std::min(static_cast<double>(since_first) / speed, 9e18);
+                auto const offset = nanoseconds(static_cast<std::int64_t>(scaled));
+                auto const target = start + offset;
+                auto const now = steady_clock::now();
+                if (now < target) {
+                    std::this_thread::sleep_until(target);
+                } else {
+                    auto const lag = static_cast<std::uint64_t>((now - target).count());
+                    stats.max_lag_nsecs = std::max(stats.max_lag_nsecs, lag);
+                }
+            }
+
+            bool const recorded_ok = (rec.result == sizeof(packet));
+            bool ok = recorded_ok;
+            if (hid != nullptr) {
+                packet msg;
+                std::copy(std::begin(rec.data), std::end(rec.data), msg.data);
+                try {
+                    ok = hid->replay_packet(rec.request, msg);
+                } catch (std::exception const& e) {
+                    LOG_ERROR("{}: packet {}: {}", __builtin_FUNCTION(), stats.packets,
+                            e.what());
+                    ok = false;
+                }
+            }
+
+            ++stats.packets;
+            if (!ok)
+                ++stats.failures;
+            if (ok != recorded_ok)
+                ++stats.mismatches;
+        }
+
+        auto const elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+        stats.elapsed_nsecs = static_cast<std::uint64_t>(elapsed.count());
+        return stats;
+    }
+
+} // namespace delcom
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "delcom.hpp"
+#include "packet_log.hpp"
+#include <cstddef> // std::size_t
+#include <cstdint>
+
+
+namespace delcom {
+
+    struct replay_stats
+    {
+        std::size_t packets = 0;
+        std::size_t failures = 0; ///< transfers that failed during replay
+        std::size_t mismatches = 0; ///< outcome differs from the recorded one
+        std::uint64_t elapsed_nsecs = 0;
+        std::uint64_t max_lag_nsecs = 0; ///< worst delay behind the schedule
+    };
+
+    /// Plays a packet log back. With a \c speed of 1.0 the original
+    /// inter-packet timing is reproduced, larger values compress it
+    /// (2.0 is twice as fast), and 0 sends as fast as possible. If
+    /// \c hid is nullptr the device is simulated: every packet takes
+    /// its recorded outcome without any I/O.
+    replay_stats replay(packet_log_reader const&, vi_hid* hid, double speed);
+
+} // namespace delcom
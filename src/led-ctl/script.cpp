@@ -0,0 +1,273 @@
+#include "script.hpp"
+#include "command_ring.hpp"
+#include <fmt/format.h>
+#include <charconv> // std::from_chars
+#include <chrono>
+#include <cstdint>
+#include <cstring> // std::strchr
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+
+namespace delcom {
+
+    namespace { // unnamed
+
+        constexpr bool
+        is_space(char c) noexcept
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        template <typename T>
+        std::optional<T>
+        parse_uint(std::string_view s, T max) noexcept
+        {
+            std::uint64_t v = 0;
+            auto const [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+            if (s.empty() || ec != std::errc() || ptr != s.data() + s.size() || v > max)
+                return std::nullopt;
+            return static_cast<T>(v);
+        }
+
+        std::optional<Color>
+        parse_color(std::string_view s) noexcept
+        {
+            if (s.empty())
+                return std::nullopt;
+
+            auto color = static_cast<Color>(0);
+            while (!s.empty()) {
+                std::string_view::size_type const comma = s.find(',');
+                std::string_view const name = s.substr(0, comma);
+
+                if (name == "red")
+                    color |= Color::Red;
+                else if (name == "green")
+                    color |= Color::Green;
+                else if (name == "blue")
+                    color |= Color::Blue;
+                else if (name == "all")
+                    color |= Color::Red | Color::Green | Color::Blue;
+                else
+                    return std::nullopt;
+
+                s = (comma == std::string_view::npos) ? std::string_view() : s.substr(comma + 1);
+            }
+
+            return color;
+        }
+
+        /// Outcome of a single command.
+        struct result
+        {
+            bool ok = false;
+            char const* error = nullptr;
+            std::optional<port_data> ports; ///< only set by "read"
+        };
+
+        result
+        error(char const* what) noexcept
+        {
+            return {false, what, std::nullopt};
+        }
+
+        result
+        extra_arguments() noexcept
+        {
+            return error("extra arguments");
+        }
+
+        template <typename Device>
+        constexpr bool is_ring = std::is_same_v<Device, command_ring_client>;
+
+        /// The outcome of a command handed to \c Device: executed, or
+        /// (on a command ring) enqueued.
+        template <typename Device>
+        result
+        done(bool ok) noexcept
+        {
+            if constexpr (is_ring<Device>)
+                return {ok, ok ? nullptr : "command ring full", std::nullopt};
+            else
+                return {ok, nullptr, std::nullopt};
+        }
+
+        template <typename Device>
+        result
+        execute(Device& dev, std::string_view cmd, tokenizer& tok)
+        {
+            if (cmd == "on") {
+                auto const color = parse_color(tok.next());
+                if (!color)
+                    return error("invalid color");
+
+                std::uint32_t msecs = 0;
+                if (std::string_view const arg = tok.next(); !arg.empty()) {
+                    auto const v = parse_uint<std::uint32_t>(arg, UINT32_MAX);
+                    if (!v)
+                        return error("invalid duration (0 <= msecs <= 4294967295)");
+                    msecs = *v;
+                }
+                if (!tok.next().empty())
+                    return extra_arguments();
+                return done<Device>(dev.turn_led_on(*color, msecs));
+            }
+
+            if (cmd == "off") {
+                auto const color = parse_color(tok.next());
+                if (!color)
+                    return error("invalid color");
+                if (!tok.next().empty())
+                    return extra_arguments();
+                return done<Device>(dev.turn_led_off(*color));
+            }
+
+            if (cmd == "pwm") {
+                auto const color = parse_color(tok.next());
+                if (!color)
+                    return error("invalid color");
+                auto const pct = parse_uint<std::uint8_t>(tok.next(), 100);
+                if (!pct)
+                    return error("invalid pct (0 <= pct <= 100)");
+                if (!tok.next().empty())
+                    return extra_arguments();
+                return done<Device>(dev.set_led_intensity(*color, *pct));
+            }
+
+            if (cmd == "blink") {
+                auto const color = parse_color(tok.next());
+                if (!color)
+                    return error("invalid color");
+                auto const on = parse_uint<std::uint8_t>(tok.next(), UINT8_MAX);
+                auto const off = parse_uint<std::uint8_t>(tok.next(), UINT8_MAX);
+                if (!on || !off)
+                    return error("invalid duty cycle (0 <= duty <= 255)");
+                if (!tok.next().empty())
+                    return extra_arguments();
+                if constexpr (is_ring<Device>)
+                    return error("blink is not supported by the command ring");
+                else
+                    return done<Device>(dev.flash_led(*color, *on, *off));
+            }
+
+            if (cmd == "sleep") {
+                auto const msecs = parse_uint<std::uint32_t>(tok.next(), UINT32_MAX);
+                if (!msecs)
+                    return error("invalid duration (0 <= msecs <= 4294967295)");
+                if (!tok.next().empty())
+                    return extra_arguments();
+                std::this_thread::sleep_for(std::chrono::milliseconds(*msecs));
+                return {true, nullptr, std::nullopt};
+            }
+
+            if (cmd == "read") {
+                if (!tok.next().empty())
+                    return extra_arguments();
+                if constexpr (is_ring<Device>)
+                    return {true, nullptr, dev.state().ports};
+                else
+                    return {true, nullptr, dev.read_port_data()};
+            }
+
+            return error("unknown command");
+        }
+
+        template <typename Device>
+        script_stats
+        run_lines(Device& dev, std::FILE* in, std::FILE* out)
+        {
+            using namespace std::chrono;
+
+            script_stats stats;
+            char line[512];
+            std::size_t line_num = 0;
+            bool truncated = false;
+
+            while (std::fgets(line, sizeof(line), in) != nullptr) {
+                bool const was_truncated = truncated;
+                truncated = (std::strchr(line, '\n') == nullptr && !std::feof(in));
+                if (was_truncated)
+                    continue; // tail of an over-long line, already reported
+                ++line_num;
+
+                tokenizer tok(line);
+                std::string_view const cmd = tok.next();
+                if (cmd.empty() || cmd.front() == '#')
+                    continue;
+
+                auto const wall = system_clock::now();
+                auto const start = steady_clock::now();
+
+                result res;
+                std::string what; // only used if the command threw
+                if (truncated) {
+                    res = error("line too long");
+                } else {
+                    try {
+                        res = execute(dev, cmd, tok);
+                    } catch (std::exception const& e) {
+                        what = e.what();
+                        res = error(what.c_str());
+                    }
+                }
+
+                auto const latency = duration_cast<microseconds>(steady_clock::now() - start);
+                auto const usecs = duration_cast<microseconds>(wall.time_since_epoch()).count();
+
+                ++stats.commands;
+                if (!res.ok)
+                    ++stats.failures;
+
+                fmt::print(out, "{}.{:06} {} {} {} {}", usecs / 1'000'000, usecs % 1'000'000,
+                        latency.count(), line_num, cmd, res.ok ? "ok" : "error");
+                if (res.error != nullptr)
+                    fmt::print(out, " {}", res.error);
+                else if (res.ports)
+                    fmt::print(out, " [{}]", res.ports->str());
+                std::fputc('\n', out);
+            }
+
+            std::fflush(out);
+            return stats;
+        }
+
+    } // namespace
+
+
+    tokenizer::tokenizer(std::string_view line) noexcept
+            : rest_(line)
+    {}
+
+    std::string_view
+    tokenizer::next() noexcept
+    {
+        std::string_view::size_type i = 0;
+        while (i < rest_.size() && is_space(rest_[i]))
+            ++i;
+
+        std::string_view::size_type j = i;
+        while (j < rest_.size() && !is_space(rest_[j]))
+            ++j;
+
+        std::string_view const token = rest_.substr(i, j - i);
+        rest_.remove_prefix(j);
+        return token;
+    }
+
+
+    script_stats
+    run_script(vi_hid& hid, std::FILE* in, std::FILE* out)
+    {
+        return run_lines(hid, in, out);
+    }
+
+    script_stats
+    run_script(command_ring_client& ring, std::FILE* in, std::FILE* out)
+    {
+        return run_lines(ring, in, out);
+    }
+
+} // namespace delcom
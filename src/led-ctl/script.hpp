@@ -0,0 +1,60 @@
+#pragma once
+
+#include "delcom.hpp"
+#include <cstddef> // std::size_t
+#include <cstdio>
+#include <string_view>
+
+
+namespace delcom {
+
+    class command_ring_client;
+
+    /// Splits a line into whitespace-separated tokens in place. No
+    /// allocation; the returned views point into the original line.
+    class tokenizer
+    {
+    private:
+        std::string_view rest_;
+
+    public:
+        explicit tokenizer(std::string_view line) noexcept;
+
+        /// \returns next token, or an empty view when exhausted
+        std::string_view next() noexcept;
+    };
+
+    /// Result of running a script.
+    struct script_stats
+    {
+        std::size_t commands = 0;
+        std::size_t failures = 0;
+    };
+
+    /// Executes commands read line-by-line from \c in against an
+    /// already-open device, writing one result line per command to
+    /// \c out. Blank lines and lines starting with '#' are ignored.
+    ///
+    /// Supported commands, where COLOR is one or more of
+    /// red|green|blue|all separated by commas:
+    ///     on COLOR [MSECS]        turn led(s) on, optionally for MSECS
+    ///     off COLOR               turn led(s) off
+    ///     pwm COLOR PCT           set intensity, 0 <= PCT <= 100
+    ///     blink COLOR ON OFF      hardware flash; "0 0" disables it
+    ///     sleep MSECS             pause the script
+    ///     read                    print current port state
+    ///
+    /// MSECS is at most 4294967295. A command with more arguments than
+    /// it takes is an error, and isn't executed. Leds turned on for
+    /// MSECS are turned off at exit, even if MSECS hasn't passed yet.
+    ///
+    /// Each result line has the form
+    ///     <unix_time.usecs> <latency_usecs> <line> <command> ok|error [detail]
+    script_stats run_script(vi_hid&, std::FILE* in, std::FILE* out);
+
+    /// Like the above, but enqueues the commands on a command ring for
+    /// its server to execute; "ok" means enqueued. "read" prints the
+    /// state the server last published, and "blink" isn't supported.
+    script_stats run_script(command_ring_client&, std::FILE* in, std::FILE* out);
+
+} // namespace delcom
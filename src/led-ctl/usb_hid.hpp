@@ -32,5 +32,22 @@ namespace usb::hid {
             // clang-format on
         };
 
+        constexpr char const*
+        to_str(ClassRequest e)
+        {
+            // clang-format off
+            switch (e) {
+                case ClassRequest::GetReport:   return "GetReport";
+                case ClassRequest::GetIdle:     return "GetIdle";
+                case ClassRequest::GetProtocol: return "GetProtocol";
+                case ClassRequest::SetReport:   return "SetReport";
+                case ClassRequest::SetIdle:     return "SetIdle";
+                case ClassRequest::SetProtocol: return "SetProtocol";
+                default: break;
+            }
+            // clang-format on
+            return "<unknown>";
+        }
+
     } // namespace v1_11
 } // namespace usb::hid
@@ -0,0 +1,5 @@
+MODULE_CPPFLAGS = -isystem/usr/include/libusb-1.0
+MODULE_LDLIBS = -pthread
+MODULE_LIBRARIES = util
+$(use-fmt)
+$(call add-executable-module,$(get-path))
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "version.h"
+#include "util/compiler.hpp"
+#include <filesystem>
+#include <getopt.h>
+#include <algorithm> // std::max
+#include <cstdio>  // std::fprintf
+#include <cstdlib> // std::exit, std::strtoul
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct cli_args
+{
+    std::string store = "usb-inventory.lsq";
+    bool ingest = false; ///< build the store from \c snapshots instead of querying it
+    std::vector<std::string> snapshots; ///< files, or directories of them
+    std::vector<std::string> where; ///< conditions, all of which must hold
+    std::string group_by; ///< comma-separated columns
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool timing = false;
+};
+
+cli_args
+arg_parse(int argc, char** argv)
+{
+    auto usage = [](std::FILE* outerr, std::filesystem::path const& app) {
+        std::fprintf(outerr,
+                "usage: %s [-hv] [-s <store>] -i <snapshot>|<dir>...\n"
+                "       %s [-ht] [-s <store>] [-w <condition>]... [-g <column>,...] [-j <n>]\n"
+                "Builds an inventory store from lsusb2 --save snapshots, one per host (named after\n"
+                "the file, without extension), and counts the devices in it that match conditions,\n"
+                "optionally per group.\n"
+                "options:\n"
+                "  -g, --group-by=<column>,...  Count per distinct combination of up to 4 columns.\n"
+                "  -h, --help                   This output.\n"
+                "  -i, --ingest                 Replace the store with the devices of the snapshots\n"
+                "                               given, and of every file in the directories given.\n"
+                "  -j, --jobs=<n>               Threads to scan with (default: one per core; fewer\n"
+                "                               for small stores).\n"
+                "  -s, --store=<file>           The store (default: usb-inventory.lsq).\n"
+                "  -t, --timing                 Print the time the query took to stderr.\n"
+                "  -v, --version                Print application version information.\n"
+                "  -w, --where=<condition>      <column><op><value>, with op one of = != < <= > >=;\n"
+                "                               may be repeated, and all must hold. IDs, classes and\n"
+                "                               versions are hex (versions also as 2.00), speeds by\n"
+                "                               name (low ... super_plus) or in Mbit/s. Strings compare\n"
+                "                               only with = and !=.\n"
+                "columns:\n"
+                "  host bus ports depth addr speed usb_version class subclass protocol vid pid\n"
+                "  device_version num_configs manufacturer product serial\n"
+                "example:\n"
+                "  %s -w vid=046d -w pid=085e -w device_version=0.16 -w speed=high -g host\n",
+                app.c_str(), app.c_str(), app.c_str());
+        std::exit(outerr == stdout ? EXIT_SUCCESS : EXIT_FAILURE);
+    };
+
+    auto const app = std::filesystem::path(argv[0]).filename();
+
+    cli_args args;
+    while (true) {
+        // clang-format off
+        static option const long_options[] = {
+                { "group-by",   required_argument,  nullptr,    'g' },
+                { "help",       no_argument,        nullptr,    'h' },
+                { "ingest",     no_argument,        nullptr,    'i' },
+                { "jobs",       required_argument,  nullptr,    'j' },
+                { "store",      required_argument,  nullptr,    's' },
+                { "timing",     no_argument,        nullptr,    't' },
+                { "version",    no_argument,        nullptr,    'v' },
+                { "where",      required_argument,  nullptr,    'w' },
+                { nullptr,      0,                  nullptr,    0 },
+        };
+        // clang-format on
+
+        int const c = ::getopt_long(
+                argc, argv, "g:hij:s:tvw:", static_cast<option const*>(long_options), nullptr);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'g':
+                args.group_by = optarg;
+                break;
+
+            case 'h':
+                usage(stdout, app);
+                break;
+
+            case 'i':
+                args.ingest = true;
+                break;
+
+            case 'j': {
+                char* end = nullptr;
+                unsigned long const n = std::strtoul(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || n == 0 || n > 1024) {
+                    std::fprintf(stderr, "invalid number of jobs \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                args.jobs = static_cast<unsigned>(n);
+                break;
+            }
+
+            case 's':
+                args.store = optarg;
+                break;
+
+            case 't':
+                args.timing = true;
+                break;
+
+            case 'v':
+                std::fprintf(stdout, "app_version=%s\n%s\n", ::VERSION,
+                        get_version_info_multiline().c_str());
+                std::exit(EXIT_SUCCESS);
+                break;
+
+            case 'w':
+                args.where.emplace_back(optarg);
+                break;
+
+            case '?':
+            default:
+                usage(stderr, app);
+                break;
+        }
+    } // while
+
+    for (; optind != argc; ++optind) {
+        if (!args.ingest) {
+            std::fprintf(stderr, "extra argument(s): %s\n\n", argv[optind]);
+            usage(stderr, app);
+        }
+        args.snapshots.emplace_back(argv[optind]);
+    }
+
+    if (args.ingest && (args.snapshots.empty() || !args.where.empty() || !args.group_by.empty())) {
+        std::fprintf(stderr, "--ingest takes snapshots, and no query\n");
+        usage(stderr, app);
+    }
+
+    return args;
+}
@@ -0,0 +1,318 @@
+#include "inventory.hpp"
+#include "util/log.hpp"
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm> // std::sort
+#include <cerrno>
+#include <cstdio>
+#include <cstring> // std::memcmp, std::memcpy, std::strerror
+#include <iterator>
+#include <memory>
+#include <numeric> // std::iota
+#include <stdexcept>
+
+
+namespace { // unnamed
+
+    namespace inv = inventory_file;
+
+    using file_ptr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+    // clang-format off
+    constexpr column_info columns[num_columns] = {
+        { "host",           4, true,  false },
+        { "bus",            1, false, false },
+        { "ports",          4, true,  false },
+        { "depth",          1, false, false },
+        { "addr",           1, false, false },
+        { "speed",          1, false, false },
+        { "usb_version",    2, false, true  },
+        { "class",          1, false, true  },
+        { "subclass",       1, false, true  },
+        { "protocol",       1, false, true  },
+        { "vid",            2, false, true  },
+        { "pid",            2, false, true  },
+        { "device_version", 2, false, true  },
+        { "num_configs",    1, false, false },
+        { "manufacturer",   4, true,  false },
+        { "product",        4, true,  false },
+        { "serial",         4, true,  false },
+    };
+    // clang-format on
+
+    std::uint32_t
+    read_code(std::uint8_t const* p) noexcept
+    {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+} // namespace
+
+
+column_info const&
+info(column c) noexcept
+{
+    return columns[static_cast<std::size_t>(c)];
+}
+
+bool
+parse_column(std::string_view name, column& c) noexcept
+{
+    for (std::size_t i = 0; i < num_columns; ++i) {
+        if (name == columns[i].name) {
+            c = static_cast<column>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+inventory_builder::inventory_builder()
+        : columns_(num_columns)
+{
+    intern(""); // code 0, also after sorting
+}
+
+std::uint32_t
+inventory_builder::intern(std::string_view s)
+{
+    auto const [it, inserted] =
+            codes_.try_emplace(std::string(s), static_cast<std::uint32_t>(strings_.size()));
+    if (inserted)
+        strings_.emplace_back(s);
+    return it->second;
+}
+
+void
+inventory_builder::put(column c, std::uint32_t v)
+{
+    std::vector<std::uint8_t>& col = columns_[static_cast<std::size_t>(c)];
+    std::size_t const width = info(c).width;
+    std::size_t const at = col.size();
+    col.resize(at + width);
+    if (width == 1) {
+        col[at] = static_cast<std::uint8_t>(v);
+    } else if (width == 2) {
+        auto const v16 = static_cast<std::uint16_t>(v);
+        std::memcpy(col.data() + at, &v16, sizeof(v16));
+    } else {
+        std::memcpy(col.data() + at, &v, sizeof(v));
+    }
+}
+
+void
+inventory_builder::add(std::string_view host, usb_snapshot const& snap)
+{
+    std::uint32_t const host_code = intern(host);
+    for (usb_snapshot::device const& d : snap.devices()) {
+        fmt::memory_buffer ports;
+        fmt::format_to(
+                std::back_inserter(ports), "{}", fmt::join(d.ports, d.ports + d.num_ports, "."));
+
+        put(column::host, host_code);
+        put(column::bus, d.bus);
+        put(column::ports, intern(std::string_view(ports.data(), ports.size())));
+        put(column::depth, d.num_ports == 0 ? 0 : d.num_ports - 1);
+        put(column::addr, d.address);
+        put(column::speed, d.speed);
+        put(column::usb_version, d.desc.bcdUSB);
+        put(column::cls, d.desc.bDeviceClass);
+        put(column::subclass, d.desc.bDeviceSubClass);
+        put(column::protocol, d.desc.bDeviceProtocol);
+        put(column::vid, d.desc.idVendor);
+        put(column::pid, d.desc.idProduct);
+        put(column::device_version, d.desc.bcdDevice);
+        put(column::num_configs, d.desc.bNumConfigurations);
+        put(column::manufacturer, intern(snap.string(d.manufacturer)));
+        put(column::product, intern(snap.string(d.product)));
+        put(column::serial, intern(snap.string(d.serial)));
+        ++rows_;
+    }
+    ++hosts_;
+}
+
+bool
+inventory_builder::write(std::string const& path)
+{
+    // sort the dictionary and recode the string columns to match
+    std::vector<std::uint32_t> order(strings_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+            [this](std::uint32_t a, std::uint32_t b) { return strings_[a] < strings_[b]; });
+    std::vector<std::uint32_t> recode(strings_.size());
+    for (std::uint32_t i = 0; i < order.size(); ++i)
+        recode[order[i]] = i;
+    for (std::size_t c = 0; c < num_columns; ++c) {
+        if (!columns[c].string)
+            continue;
+        std::uint8_t* p = columns_[c].data();
+        for (std::uint32_t r = 0; r < rows_; ++r, p += sizeof(std::uint32_t)) {
+            std::uint32_t const v = recode[read_code(p)];
+            std::memcpy(p, &v, sizeof(v));
+        }
+    }
+
+    inv::header h;
+    h.num_rows = rows_;
+    h.num_columns = num_columns;
+    h.num_hosts = hosts_;
+    h.num_strings = static_cast<std::uint32_t>(strings_.size());
+
+    std::vector<inv::column_entry> dir(num_columns);
+    std::size_t end = inv::aligned(sizeof(h) + sizeof(inv::column_entry) * num_columns);
+    for (std::size_t c = 0; c < num_columns; ++c) {
+        dir[c] = {static_cast<std::uint32_t>(c), columns[c].width, end};
+        end = inv::aligned(end + columns_[c].size());
+    }
+
+    std::vector<std::uint32_t> offsets;
+    offsets.reserve(strings_.size() + 1);
+    std::string pool;
+    for (std::uint32_t i : order) {
+        offsets.push_back(static_cast<std::uint32_t>(pool.size()));
+        pool += strings_[i];
+    }
+    offsets.push_back(static_cast<std::uint32_t>(pool.size()));
+    h.strings_offset = end;
+    h.strings_size = pool.size();
+    end += offsets.size() * sizeof(std::uint32_t) + pool.size();
+
+    std::vector<std::uint8_t> out(end, 0);
+    std::memcpy(out.data(), &h, sizeof(h));
+    std::memcpy(out.data() + sizeof(h), dir.data(), dir.size() * sizeof(dir[0]));
+    for (std::size_t c = 0; c < num_columns; ++c) {
+        if (!columns_[c].empty())
+            std::memcpy(out.data() + dir[c].offset, columns_[c].data(), columns_[c].size());
+    }
+    std::memcpy(out.data() + h.strings_offset, offsets.data(), offsets.size() * sizeof(offsets[0]));
+    if (!pool.empty())
+        std::memcpy(out.data() + h.strings_offset + offsets.size() * sizeof(offsets[0]),
+                pool.data(), pool.size());
+
+    // write beside the target and rename, so that a running query
+    // never maps a half-written inventory
+    std::string const tmp = path + ".tmp";
+    {
+        file_ptr f(std::fopen(tmp.c_str(), "wb"), &std::fclose);
+        if (!f) {
+            LOG_ERROR("{}: fopen({}) failure ({})", __builtin_FUNCTION(), tmp,
+                    std::strerror(errno));
+            return false;
+        }
+        if (std::fwrite(out.data(), out.size(), 1, f.get()) != 1 || std::fflush(f.get()) != 0) {
+            LOG_ERROR("{}: writing {} failure ({})", __builtin_FUNCTION(), tmp,
+                    std::strerror(errno));
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("{}: writing {} failure ({})", __builtin_FUNCTION(), path, std::strerror(errno));
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+inventory::inventory(std::string const& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(fmt::format(
+                "{}: open({}) failure ({})", __builtin_FUNCTION(), path, std::strerror(errno)));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(inv::header)) {
+        ::close(fd);
+        throw std::runtime_error(
+                fmt::format("{}: {} is not an inventory", __builtin_FUNCTION(), path));
+    }
+
+    length_ = static_cast<std::size_t>(st.st_size);
+    base_ = ::mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+    int const e = errno;
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+        throw std::runtime_error(
+                fmt::format("{}: mmap failure ({})", __builtin_FUNCTION(), std::strerror(e)));
+    }
+
+    // queries scan whole columns
+    ::madvise(base_, length_, MADV_SEQUENTIAL);
+
+    auto const* p = static_cast<std::uint8_t const*>(base_);
+    header_ = static_cast<inv::header const*>(base_);
+    inv::header const expected;
+    bool ok = std::memcmp(header_->magic, expected.magic, sizeof(expected.magic)) == 0
+            && header_->version == expected.version && header_->byte_order == expected.byte_order
+            && header_->num_columns == num_columns
+            && sizeof(inv::header) + num_columns * sizeof(inv::column_entry) <= length_;
+
+    for (std::size_t c = 0; ok && c < num_columns; ++c) {
+        inv::column_entry e;
+        std::memcpy(&e, p + sizeof(inv::header) + c * sizeof(e), sizeof(e));
+        ok = e.id == c && e.width == columns[c].width && e.offset % inv::alignment == 0
+                && e.offset <= length_
+                && std::uint64_t(header_->num_rows) * e.width <= length_ - e.offset;
+        columns_[c] = p + e.offset;
+    }
+
+    std::size_t const offsets_size =
+            (std::size_t(header_->num_strings) + 1) * sizeof(std::uint32_t);
+    ok = ok && header_->strings_offset % sizeof(std::uint32_t) == 0
+            && header_->strings_offset <= length_
+            && offsets_size <= length_ - header_->strings_offset
+            && header_->strings_size == length_ - header_->strings_offset - offsets_size;
+    if (ok) {
+        string_offsets_ = {reinterpret_cast<std::uint32_t const*>(p + header_->strings_offset),
+                header_->num_strings + std::size_t(1)};
+        strings_ = {reinterpret_cast<char const*>(p + header_->strings_offset + offsets_size),
+                header_->strings_size};
+        for (std::size_t i = 0; ok && i < header_->num_strings; ++i)
+            ok = string_offsets_[i] <= string_offsets_[i + 1];
+        ok = ok && string_offsets_.back() == strings_.size();
+    }
+
+    if (!ok) {
+        ::munmap(base_, length_);
+        throw std::runtime_error(fmt::format(
+                "{}: {} is not a (compatible) inventory", __builtin_FUNCTION(), path));
+    }
+}
+
+inventory::~inventory() noexcept
+{
+    ::munmap(base_, length_);
+}
+
+std::string_view
+inventory::string(std::uint32_t code) const noexcept
+{
+    if (code >= header_->num_strings)
+        return {};
+    return strings_.substr(
+            string_offsets_[code], string_offsets_[code + 1] - string_offsets_[code]);
+}
+
+std::uint32_t
+inventory::code(std::string_view s) const noexcept
+{
+    std::uint32_t lo = 0;
+    std::uint32_t hi = header_->num_strings;
+    while (lo < hi) {
+        std::uint32_t const mid = lo + (hi - lo) / 2;
+        if (string(mid) < s)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < header_->num_strings && string(lo) == s) ? lo : UINT32_MAX;
+}
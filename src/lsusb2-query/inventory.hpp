@@ -0,0 +1,157 @@
+#pragma once
+
+#include "util/usb_snapshot.hpp"
+#include <cstddef> // std::byte, std::size_t
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Inventory of many hosts' devices, one row per device, stored column
+// by column and made to be memory-mapped: a header, a directory of
+// columns, the columns, then a dictionary of every string. String
+// columns hold dictionary codes; the dictionary is sorted, so a code
+// compares like its string. Every column starts on a cache line. Byte
+// order is native.
+
+/// Everything a row has, one column each.
+enum class column : std::uint8_t
+{
+    host, ///< snapshot file name, without extension
+    bus,
+    ports, ///< port path, e.g. "1.4"
+    depth, ///< hubs between the root hub and the device
+    addr,
+    speed, ///< libusb_speed
+    usb_version, ///< bcdUSB
+    cls,
+    subclass,
+    protocol,
+    vid,
+    pid,
+    device_version, ///< bcdDevice
+    num_configs,
+    manufacturer,
+    product,
+    serial,
+};
+
+constexpr std::size_t num_columns = static_cast<std::size_t>(column::serial) + 1;
+
+struct column_info
+{
+    char const* name;
+    std::uint8_t width; ///< bytes per row
+    bool string; ///< dictionary codes
+    bool hex; ///< parsed and printed in hex
+};
+
+column_info const& info(column) noexcept;
+
+/// \returns false if \c name is no column's
+bool parse_column(std::string_view name, column& c) noexcept;
+
+
+namespace inventory_file {
+
+    struct header
+    {
+        char magic[8] = {'L', 'S', 'U', 'S', 'B', 'I', 'N', 'V'};
+        std::uint32_t version = 1;
+        std::uint32_t byte_order = 0x01020304;
+        std::uint32_t num_rows = 0;
+        std::uint32_t num_columns = 0;
+        std::uint32_t num_hosts = 0;
+        std::uint32_t num_strings = 0; ///< dictionary entries; code 0 is ""
+        std::uint64_t strings_offset = 0; ///< of num_strings + 1 offsets, then the pool
+        std::uint64_t strings_size = 0; ///< bytes in the string pool
+        std::uint32_t reserved[4] = {0};
+    };
+    static_assert(sizeof(header) == 64);
+
+    struct column_entry
+    {
+        std::uint32_t id = 0; ///< column
+        std::uint32_t width = 0;
+        std::uint64_t offset = 0; ///< from the start of the file
+    };
+    static_assert(sizeof(column_entry) == 16);
+
+    constexpr std::size_t alignment = 64;
+
+    constexpr std::size_t
+    aligned(std::size_t n) noexcept
+    {
+        return (n + alignment - 1) & ~(alignment - 1);
+    }
+
+} // namespace inventory_file
+
+
+/// Collects the devices of many snapshots, then writes them out as an
+/// inventory.
+class inventory_builder
+{
+private:
+    std::vector<std::vector<std::uint8_t>> columns_; ///< raw, \c width bytes per row
+    std::vector<std::string> strings_; ///< by provisional code
+    std::unordered_map<std::string, std::uint32_t> codes_;
+    std::uint32_t rows_ = 0;
+    std::uint32_t hosts_ = 0;
+
+public:
+    inventory_builder();
+
+    /// Adds every device in \c snap as seen on \c host.
+    void add(std::string_view host, usb_snapshot const& snap);
+
+    std::uint32_t rows() const noexcept { return rows_; }
+    std::uint32_t hosts() const noexcept { return hosts_; }
+
+    /// Writes the inventory to \c path, replacing it atomically.
+    /// \returns false (after logging why) on failure
+    bool write(std::string const& path);
+
+private:
+    std::uint32_t intern(std::string_view s);
+    void put(column c, std::uint32_t v);
+};
+
+
+/// Read-only, memory-mapped view of an inventory.
+class inventory
+{
+private:
+    void* base_ = nullptr;
+    std::size_t length_ = 0;
+    inventory_file::header const* header_ = nullptr;
+    void const* columns_[num_columns] = {nullptr};
+    std::span<std::uint32_t const> string_offsets_; ///< num_strings + 1
+    std::string_view strings_;
+
+public:
+    /// \throws std::runtime_error if \c path can't be mapped or is not
+    /// a (compatible) inventory
+    explicit inventory(std::string const& path);
+    ~inventory() noexcept;
+    inventory(inventory const&) = delete;
+    inventory& operator=(inventory const&) = delete;
+
+    std::size_t rows() const noexcept { return header_->num_rows; }
+    std::size_t hosts() const noexcept { return header_->num_hosts; }
+
+    /// \returns the rows of \c c; T must have the column's width
+    template <typename T>
+    std::span<T const>
+    values(column c) const noexcept
+    {
+        return {static_cast<T const*>(columns_[static_cast<std::size_t>(c)]), rows()};
+    }
+
+    /// \returns the code of \c s, or UINT32_MAX if no row has it
+    std::uint32_t code(std::string_view s) const noexcept;
+    std::string_view string(std::uint32_t code) const noexcept;
+};
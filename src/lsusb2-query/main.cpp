@@ -0,0 +1,132 @@
+#include "arg_parse.hpp"
+#include "inventory.hpp"
+#include "query.hpp"
+#include "util/log.hpp"
+#include "util/usb_snapshot.hpp"
+#include <fmt/format.h>
+#include <unistd.h>
+#include <algorithm> // std::sort
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+
+namespace { // unnamed
+
+    namespace fs = std::filesystem;
+
+    /// The snapshot files named, with directories expanded (sorted, so
+    /// that the store doesn't depend on directory order).
+    std::vector<fs::path>
+    snapshot_files(std::vector<std::string> const& args)
+    {
+        std::vector<fs::path> files;
+        for (std::string const& arg : args) {
+            std::error_code ec;
+            if (!fs::is_directory(arg, ec)) {
+                files.emplace_back(arg);
+                continue;
+            }
+            std::size_t const first = files.size();
+            // by hand: a range-for would advance with operator++, which throws
+            fs::directory_iterator it(arg, ec);
+            for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+                std::error_code type_ec;
+                if (it->is_regular_file(type_ec))
+                    files.push_back(it->path());
+            }
+            if (ec)
+                LOG_WARN("{}: {}", arg, ec.message());
+            std::sort(files.begin() + static_cast<std::ptrdiff_t>(first), files.end());
+        }
+        return files;
+    }
+
+    int
+    ingest(cli_args const& args)
+    {
+        inventory_builder builder;
+        bool all_read = true;
+        for (fs::path const& file : snapshot_files(args.snapshots)) {
+            try {
+                usb_snapshot const snap(file.string());
+                builder.add(file.stem().string(), snap);
+            } catch (std::runtime_error const& e) {
+                LOG_WARN("skipping {}", e.what());
+                all_read = false;
+            }
+        }
+
+        if (!builder.write(args.store))
+            return EXIT_FAILURE;
+        fmt::print("{}: {} hosts, {} devices\n", args.store, builder.hosts(), builder.rows());
+        return all_read ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /// \throws std::invalid_argument if a condition or column is
+    /// malformed
+    query
+    make_query(cli_args const& args, inventory const& inv)
+    {
+        query q;
+        q.jobs = args.jobs;
+        for (std::string const& w : args.where)
+            q.where.push_back(parse_condition(w, inv));
+
+        std::string_view list = args.group_by;
+        while (!list.empty()) {
+            std::size_t const comma = list.find(',');
+            std::string_view const name = list.substr(0, comma);
+            column c;
+            if (!name.empty() && !parse_column(name, c))
+                throw std::invalid_argument(fmt::format("unknown column \"{}\"", name));
+            if (!name.empty())
+                q.group_by.push_back(c);
+            if (comma == std::string_view::npos)
+                break;
+            list.remove_prefix(comma + 1);
+        }
+        if (q.group_by.size() > query::max_group_by)
+            throw std::invalid_argument(
+                    fmt::format("at most {} columns to group by", query::max_group_by));
+        return q;
+    }
+
+} // namespace
+
+
+int
+main(int argc, char** argv)
+{
+    cli_args const args = arg_parse(argc, argv);
+    if (args.ingest)
+        return ingest(args);
+
+    try {
+        inventory const inv(args.store);
+        query const q = make_query(args, inv);
+
+        auto const start = std::chrono::steady_clock::now();
+        query_result const r = run_query(inv, q);
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+
+        fmt::memory_buffer out;
+        format_query_result(out, inv, q, r);
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        if (args.timing) {
+            fmt::print(stderr, "{} rows in {:.3f} ms on {} thread(s)\n", inv.rows(),
+                    std::chrono::duration<double, std::milli>(elapsed).count(), r.jobs);
+        }
+        return (std::fflush(stdout) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (std::exception const& e) {
+        fmt::print(stderr, "error: {}\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
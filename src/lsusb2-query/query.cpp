@@ -0,0 +1,314 @@
+#include "query.hpp"
+#include <libusb.h>
+#include <algorithm> // std::clamp, std::min, std::sort
+#include <charconv>
+#include <functional> // std::equal_to, std::greater, std::less, ...
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+    using op = condition::op;
+    using group_key = std::array<std::uint32_t, query::max_group_by>;
+
+    /// Rows per mask; small enough to stay in L1 with a few columns.
+    constexpr std::size_t block_rows = 4096;
+
+    /// Below this, another thread costs more than it saves.
+    constexpr std::size_t min_rows_per_job = 64 * 1024;
+
+    struct key_hash
+    {
+        std::size_t
+        operator()(group_key const& k) const noexcept
+        {
+            std::uint64_t h = 0xcbf29ce484222325;
+            for (std::uint32_t v : k)
+                h = (h ^ v) * 0x100000001b3;
+            return static_cast<std::size_t>(h);
+        }
+    };
+
+    using group_map = std::unordered_map<group_key, std::uint64_t, key_hash>;
+
+    unsigned
+    parse_number(std::string_view s, int base, unsigned max)
+    {
+        if (base == 16 && (s.starts_with("0x") || s.starts_with("0X")))
+            s.remove_prefix(2);
+        unsigned v = 0;
+        auto const [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v, base);
+        if (s.empty() || ec != std::errc() || ptr != s.data() + s.size() || v > max)
+            throw std::invalid_argument(fmt::format("invalid value \"{}\"", s));
+        return v;
+    }
+
+    unsigned
+    parse_speed(std::string_view s)
+    {
+        // clang-format off
+        if (s == "low"          || s == "1.5")      return LIBUSB_SPEED_LOW;
+        if (s == "full"         || s == "12")       return LIBUSB_SPEED_FULL;
+        if (s == "high"         || s == "480")      return LIBUSB_SPEED_HIGH;
+        if (s == "super"        || s == "5000")     return LIBUSB_SPEED_SUPER;
+        if (s == "super_plus"   || s == "10000")    return LIBUSB_SPEED_SUPER_PLUS;
+        // clang-format on
+        throw std::invalid_argument(fmt::format("invalid speed \"{}\"", s));
+    }
+
+    constexpr char const*
+    speed_name(std::uint32_t s) noexcept
+    {
+        // clang-format off
+        switch (s) {
+            case LIBUSB_SPEED_LOW:          return "low";
+            case LIBUSB_SPEED_FULL:         return "full";
+            case LIBUSB_SPEED_HIGH:         return "high";
+            case LIBUSB_SPEED_SUPER:        return "super";
+            case LIBUSB_SPEED_SUPER_PLUS:   return "super_plus";
+            default: break;
+        }
+        // clang-format on
+        return "unknown";
+    }
+
+    bool
+    is_bcd_version(column c) noexcept
+    {
+        return c == column::usb_version || c == column::device_version;
+    }
+
+    /// "2.00" is 0x0200, as in bcdUSB; anything else is plain hex
+    unsigned
+    parse_version(std::string_view s)
+    {
+        std::size_t const dot = s.find('.');
+        if (dot == std::string_view::npos)
+            return parse_number(s, 16, 0xffff);
+        return parse_number(s.substr(0, dot), 16, 0xff) << 8
+                | parse_number(s.substr(dot + 1), 16, 0xff);
+    }
+
+    std::uint32_t
+    value_at(inventory const& inv, column c, std::size_t row) noexcept
+    {
+        switch (info(c).width) {
+            case 1: return inv.values<std::uint8_t>(c)[row];
+            case 2: return inv.values<std::uint16_t>(c)[row];
+            default: return inv.values<std::uint32_t>(c)[row];
+        }
+    }
+
+    /// mask[i] &= cmp(values[i], v); one pass, no branches
+    template <typename T, typename Cmp>
+    void
+    narrow(std::uint8_t* mask, T const* values, std::size_t n, T v, Cmp cmp) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            mask[i] &= static_cast<std::uint8_t>(cmp(values[i], v));
+    }
+
+    template <typename T>
+    void
+    narrow(std::uint8_t* mask, T const* values, std::size_t n, op how, std::uint32_t v) noexcept
+    {
+        auto const tv = static_cast<T>(v);
+        switch (how) {
+            case op::eq: narrow(mask, values, n, tv, std::equal_to<T>()); break;
+            case op::ne: narrow(mask, values, n, tv, std::not_equal_to<T>()); break;
+            case op::lt: narrow(mask, values, n, tv, std::less<T>()); break;
+            case op::le: narrow(mask, values, n, tv, std::less_equal<T>()); break;
+            case op::gt: narrow(mask, values, n, tv, std::greater<T>()); break;
+            case op::ge: narrow(mask, values, n, tv, std::greater_equal<T>()); break;
+        }
+    }
+
+    void
+    narrow(std::uint8_t* mask, inventory const& inv, condition const& cond, std::size_t first,
+            std::size_t n) noexcept
+    {
+        switch (info(cond.col).width) {
+            case 1:
+                narrow(mask, inv.values<std::uint8_t>(cond.col).data() + first, n, cond.how,
+                        cond.value);
+                break;
+            case 2:
+                narrow(mask, inv.values<std::uint16_t>(cond.col).data() + first, n, cond.how,
+                        cond.value);
+                break;
+            default:
+                narrow(mask, inv.values<std::uint32_t>(cond.col).data() + first, n, cond.how,
+                        cond.value);
+                break;
+        }
+    }
+
+    /// Scans rows [first, last), which start on a block boundary.
+    void
+    scan(inventory const& inv, query const& q, std::size_t first, std::size_t last,
+            std::uint64_t& matched, group_map& groups)
+    {
+        alignas(64) std::uint8_t mask[block_rows];
+        for (std::size_t b = first; b < last; b += block_rows) {
+            std::size_t const n = std::min(block_rows, last - b);
+            std::fill(mask, mask + n, std::uint8_t(1));
+            for (condition const& cond : q.where)
+                narrow(mask, inv, cond, b, n);
+
+            if (q.group_by.empty()) {
+                std::uint32_t count = 0;
+                for (std::size_t i = 0; i < n; ++i)
+                    count += mask[i];
+                matched += count;
+                continue;
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!mask[i])
+                    continue;
+                group_key key{};
+                for (std::size_t g = 0; g < q.group_by.size(); ++g)
+                    key[g] = value_at(inv, q.group_by[g], b + i);
+                ++groups[key];
+                ++matched;
+            }
+        }
+    }
+
+    void
+    format_value(buffer& buf, inventory const& inv, column c, std::uint32_t v)
+    {
+        auto out = std::back_inserter(buf);
+        column_info const& ci = info(c);
+        if (ci.string) {
+            std::string_view const s = inv.string(v);
+            buf.append(s.empty() ? std::string_view("-") : s);
+        } else if (c == column::speed) {
+            buf.append(std::string_view(speed_name(v)));
+        } else if (is_bcd_version(c)) {
+            fmt::format_to(out, "{:x}.{:02x}", v >> 8, v & 0xff);
+        } else if (ci.hex) {
+            fmt::format_to(out, "{:0{}x}", v, ci.width * 2);
+        } else {
+            fmt::format_to(out, "{}", v);
+        }
+    }
+
+} // namespace
+
+
+condition
+parse_condition(std::string_view s, inventory const& inv)
+{
+    // longest operators first
+    static constexpr std::pair<std::string_view, op> ops[] = {
+            {"!=", op::ne}, {"<=", op::le}, {">=", op::ge}, {"=", op::eq}, {"<", op::lt},
+            {">", op::gt}};
+
+    std::size_t at = std::string_view::npos;
+    std::string_view sym;
+    condition cond;
+    for (auto const& [text, how] : ops) {
+        std::size_t const i = s.find(text);
+        if (i != std::string_view::npos && (i < at || (i == at && text.size() > sym.size()))) {
+            at = i;
+            sym = text;
+            cond.how = how;
+        }
+    }
+    if (at == std::string_view::npos)
+        throw std::invalid_argument(fmt::format("invalid condition \"{}\"", s));
+
+    std::string_view const name = s.substr(0, at);
+    std::string_view const value = s.substr(at + sym.size());
+    if (!parse_column(name, cond.col))
+        throw std::invalid_argument(fmt::format("unknown column \"{}\"", name));
+
+    column_info const& ci = info(cond.col);
+    if (ci.string) {
+        if (cond.how != op::eq && cond.how != op::ne)
+            throw std::invalid_argument(
+                    fmt::format("\"{}\": strings compare only with = and !=", s));
+        cond.value = inv.code(value); // UINT32_MAX matches no row
+    } else if (cond.col == column::speed) {
+        cond.value = parse_speed(value);
+    } else if (is_bcd_version(cond.col)) {
+        cond.value = parse_version(value);
+    } else {
+        cond.value = parse_number(value, ci.hex ? 16 : 10, (1u << (8 * ci.width)) - 1);
+    }
+    return cond;
+}
+
+
+query_result
+run_query(inventory const& inv, query const& q)
+{
+    std::size_t const rows = inv.rows();
+    std::size_t const max_jobs = std::max<std::size_t>(1, rows / min_rows_per_job);
+    unsigned const jobs = static_cast<unsigned>(std::clamp<std::size_t>(q.jobs, 1, max_jobs));
+
+    // contiguous runs of whole blocks
+    std::size_t const blocks = (rows + block_rows - 1) / block_rows;
+    std::vector<std::uint64_t> matched(jobs, 0);
+    std::vector<group_map> groups(jobs);
+    auto worker = [&](unsigned j) {
+        std::size_t const first = std::min(rows, blocks * j / jobs * block_rows);
+        std::size_t const last = std::min(rows, blocks * (j + 1) / jobs * block_rows);
+        scan(inv, q, first, last, matched[j], groups[j]);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(jobs - 1);
+    for (unsigned j = 1; j < jobs; ++j)
+        threads.emplace_back(worker, j);
+    worker(0);
+    for (std::thread& t : threads)
+        t.join();
+
+    query_result r;
+    r.jobs = jobs;
+    for (unsigned j = 1; j < jobs; ++j) {
+        for (auto const& [key, count] : groups[j])
+            groups[0][key] += count;
+    }
+    for (std::uint64_t m : matched)
+        r.matched += m;
+
+    r.groups.reserve(groups[0].size());
+    for (auto const& [key, count] : groups[0])
+        r.groups.push_back({key, count});
+    std::sort(r.groups.begin(), r.groups.end(),
+            [](query_result::group const& a, query_result::group const& b) {
+                return a.count != b.count ? a.count > b.count : a.key < b.key;
+            });
+    return r;
+}
+
+
+void
+format_query_result(buffer& buf, inventory const& inv, query const& q, query_result const& r)
+{
+    auto out = std::back_inserter(buf);
+    if (q.group_by.empty()) {
+        fmt::format_to(out, "{} of {} devices\n", r.matched, inv.rows());
+        return;
+    }
+
+    fmt::format_to(out, "{:>8}", "count");
+    for (column c : q.group_by)
+        fmt::format_to(out, "  {}", info(c).name);
+    buf.push_back('\n');
+    for (query_result::group const& g : r.groups) {
+        fmt::format_to(out, "{:>8}", g.count);
+        for (std::size_t i = 0; i < q.group_by.size(); ++i) {
+            buf.append(std::string_view("  "));
+            format_value(buf, inv, q.group_by[i], g.key[i]);
+        }
+        buf.push_back('\n');
+    }
+    fmt::format_to(out, "{} of {} devices, {} groups\n", r.matched, inv.rows(), r.groups.size());
+}
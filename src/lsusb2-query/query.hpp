@@ -0,0 +1,68 @@
+#pragma once
+
+#include "inventory.hpp"
+#include <fmt/format.h>
+#include <array>
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+
+// Filter, group-by and count over an inventory. Every condition narrows
+// a byte mask over a block of rows in one pass over its column, a loop
+// the compiler vectorizes; the surviving rows are then counted or
+// grouped. Blocks are split between threads in contiguous runs.
+
+struct condition
+{
+    enum class op
+    {
+        eq,
+        ne,
+        lt,
+        le,
+        gt,
+        ge,
+    };
+
+    column col = column::host;
+    op how = op::eq;
+    std::uint32_t value = 0; ///< a dictionary code for string columns
+};
+
+/// Parses "<column><op><value>" (e.g. "vid=046d", "speed<high",
+/// "product!=Hub"), looking strings up in \c inv. Values are in hex for
+/// hex columns, BCD versions may be given as "2.00", speeds by name or
+/// in Mbit/s. Strings compare only with = and !=.
+/// \throws std::invalid_argument if malformed
+condition parse_condition(std::string_view, inventory const& inv);
+
+
+struct query
+{
+    static constexpr std::size_t max_group_by = 4;
+
+    std::vector<condition> where; ///< all must hold
+    std::vector<column> group_by; ///< at most max_group_by
+    unsigned jobs = 1;
+};
+
+struct query_result
+{
+    struct group
+    {
+        std::array<std::uint32_t, query::max_group_by> key{}; ///< values of query::group_by
+        std::uint64_t count = 0;
+    };
+
+    std::uint64_t matched = 0;
+    std::vector<group> groups; ///< most rows first; empty without group_by
+    unsigned jobs = 1; ///< threads used
+};
+
+query_result run_query(inventory const&, query const&);
+
+/// Appends the number of matching rows, or one line per group.
+void format_query_result(
+        fmt::memory_buffer&, inventory const&, query const&, query_result const&);
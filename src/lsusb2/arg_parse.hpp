@@ -1,19 +1,41 @@
 #pragma once
 
+#include "format.hpp"
+#include "output_template.hpp"
+#include "string_cache.hpp"
 #include "version.h"
 #include "util/compiler.hpp"
+#include "util/usb_filter.hpp"
+#include "util/usb_ids.hpp"
 #include <filesystem>
 #include <getopt.h>
 #include <cstdio>  // std::fprintf
-#include <cstdlib> // std::exit
+#include <cstdlib> // std::exit, std::strtoul
+#include <stdexcept>
 #include <string>
 
 
 struct cli_args
 {
-    int vendor_id = -1;
-    int product_id = -1;
+    usb_filter filter;
     bool debug = false;
+    std::string sysfs_root; ///< enumerate from sysfs instead of libusb if set
+    output_format format = output_format::text;
+    std::string output_template; ///< one line per device if set; overrides format
+    bool names = false; ///< resolve manufacturer/product/serial strings
+    unsigned jobs = 8; ///< workers listing (see list_pipelined()) or probing
+    unsigned string_timeout_ms = 250;
+    std::string string_cache; ///< empty disables
+    std::string usb_ids = usb_ids::default_path; ///< compiled by usbids-compile
+    bool watch = false; ///< report arrivals and departures until killed
+    bool bandwidth = false; ///< report periodic bandwidth instead of listing devices
+    bool speed_check = false; ///< report devices running below their speed instead
+    unsigned probe = 0; ///< requests per device for a latency probe; 0 lists devices
+    bool tree = false; ///< print the hub tree instead of listing devices
+    unsigned top_ms = 0; ///< sample traffic per device at this interval; 0 lists devices
+    std::string save; ///< write a snapshot here instead of listing devices
+    std::string diff_before; ///< compare this snapshot instead of listing devices
+    std::string diff_after; ///< to this one; empty: the bus as enumerated now
 };
 
 cli_args
@@ -21,14 +43,75 @@ arg_parse(int argc, char** argv)
 {
     auto usage = [](std::FILE* outerr, std::filesystem::path const& app) {
         std::fprintf(outerr,
-                "usage: %s [-Dhv] [--device=<vendor_id>:<product_id>]\n"
+                "usage: %s [-Dhnstvw] [--device=<vendor_id>:<product_id>,...] [--format=<fmt>]\n"
+                "       [--sysfs-root=<dir>] [--template=<tmpl>] [<filter options>]\n"
+                "       %s --save=<file> | --diff=<before> [<after>] [<filter options>]\n"
                 "options:\n"
-                "  -d, --device=<vendor_id>:<product_id>    Show only devices with the specified vendor and \n"
-                "                                           product ID. Both IDs are given in hex (e.g. 0x1234:0xabcd).\n"
+                "      --bandwidth                          Report the periodic (interrupt and isochronous)\n"
+                "                                           bandwidth reserved per bus, transaction translator\n"
+                "                                           and device, against the 80%%/90%% periodic limit.\n"
+                "                                           Counts each interface's most demanding alternate\n"
+                "                                           setting (text only).\n"
+                "  -d, --device=<vendor_id>:<product_id>,...\n"
+                "                                           Show only devices with one of the specified vendor and\n"
+                "                                           product IDs, in hex (e.g. 0x1234:0xabcd,0x1234:*).\n"
                 "  -D, --debug                              Enable libusb debugging to stderr.\n"
+                "      --diff=<before> [<after>]            Compare two snapshots (see --save), or a snapshot with\n"
+                "                                           the devices present now: removed, added and changed\n"
+                "                                           devices, paired by serial number or port path. Exits\n"
+                "                                           with 1 if they differ (text only).\n"
+                "  -f, --format=text|json|cbor              Output format (default: text).\n"
                 "  -h, --help                               This output.\n"
-                "  -v, --version                            Print application version information.\n",
-                app.c_str());
+                "  -n, --names                              Resolve manufacturer, product and serial number\n"
+                "                                           strings (needs access to the device nodes unless\n"
+                "                                           --sysfs is used).\n"
+                "      --jobs=<n>                           Devices to read and format, or probe, in parallel\n"
+                "                                           (default: 8).\n"
+                "      --string-timeout=<ms>                Give up on a device's strings and BOS once reading\n"
+                "                                           them has taken this long (default: 250).\n"
+                "      --string-cache[=<file>]              Remember strings, serial numbers included, by port\n"
+                "                                           and device descriptor in <file> (default:\n"
+                "                                           ~/.cache/lsusb2/strings). Off unless given.\n"
+                "      --speed-check                        Report devices whose link runs slower than their BOS\n"
+                "                                           or USB version says they can, with the hub or link\n"
+                "                                           that holds them back (text only; reads strings and\n"
+                "                                           BOS descriptors).\n"
+                "      --probe[=<n>]                        Time <n> (default: 100) GET_DESCRIPTOR/GET_STATUS\n"
+                "                                           requests per device, devices in parallel (--jobs),\n"
+                "                                           and report round-trip latency and failures (libusb\n"
+                "                                           only; needs access to the device nodes).\n"
+                "      --save=<file>                        Write the devices and all their descriptors to <file>\n"
+                "                                           instead of listing them, for --diff.\n"
+                "  -s, --sysfs                              Enumerate from /sys instead of through libusb;\n"
+                "                                           doesn't need access to the device nodes.\n"
+                "      --sysfs-root=<dir>                   Like --sysfs, but read <dir>/bus/usb/devices\n"
+                "                                           (e.g. a captured copy of /sys).\n"
+                "filter options (comma-separated lists; all given must match):\n"
+                "      --bus=<n>,...                        Bus number.\n"
+                "      --class=<class>[:<subclass>],...     Device class, or any interface's class for devices\n"
+                "                                           that declare it per interface, in hex (e.g. 03,0e:01).\n"
+                "      --port=<path>,...                    Port path prefix (e.g. 1.4 matches 1.4 and 1.4.2).\n"
+                "      --serial=<serial>                    Serial number; may be repeated.\n"
+                "      --speed=<speed>,...                  low, full, high, super or super_plus, or Mbit/s.\n"
+                "  -t, --tree                               Print the devices as a tree below the hubs they are\n"
+                "                                           plugged into (text only).\n"
+                "  -T, --template=<tmpl>                    Print one line per device from <tmpl>, e.g.\n"
+                "                                           '{bus}:{addr} {vid:04x}:{pid:04x} {class}'. Fields take\n"
+                "                                           a fmt spec after ':'; only the descriptors they need\n"
+                "                                           are read. Fields: %s\n"
+                "      --top[=<ms>]                         Every <ms> (default: 1000), list the devices with\n"
+                "                                           traffic, busiest first: URBs and bytes per second,\n"
+                "                                           per device and endpoint, from usbmon (/dev/usbmon0);\n"
+                "                                           without it, URBs per second from sysfs urbnum. Runs\n"
+                "                                           until interrupted (text only).\n"
+                "      --usb-ids=<file>                     Vendor and product names from the index built by\n"
+                "                                           usbids-compile (default: %s).\n"
+                "  -v, --version                            Print application version information.\n"
+                "  -w, --watch                              List the devices present, then each device as it\n"
+                "                                           arrives or departs, until interrupted (text or json,\n"
+                "                                           libusb only).\n",
+                app.c_str(), app.c_str(), output_template::field_names().c_str(),
+                usb_ids::default_path);
         std::exit(outerr == stdout ? EXIT_SUCCESS : EXIT_FAILURE);
     };
 
@@ -38,16 +121,38 @@ arg_parse(int argc, char** argv)
     while (true) {
         // clang-format off
         static option const long_options[] = {
+                { "bandwidth",  no_argument,        nullptr,    'A' },
+                { "bus",        required_argument,  nullptr,    'B' },
+                { "class",      required_argument,  nullptr,    'C' },
                 { "debug",      no_argument,        nullptr,    'D' },
                 { "device",     required_argument,  nullptr,    'd' },
+                { "diff",       required_argument,  nullptr,    'Y' },
+                { "format",     required_argument,  nullptr,    'f' },
                 { "help",       no_argument,        nullptr,    'h' },
+                { "jobs",       required_argument,  nullptr,    'J' },
+                { "names",      no_argument,        nullptr,    'n' },
+                { "port",       required_argument,  nullptr,    'P' },
+                { "probe",      optional_argument,  nullptr,    'O' },
+                { "save",       required_argument,  nullptr,    'X' },
+                { "serial",     required_argument,  nullptr,    'N' },
+                { "speed",      required_argument,  nullptr,    'S' },
+                { "speed-check", no_argument,       nullptr,    'G' },
+                { "string-cache", optional_argument, nullptr,   'K' },
+                { "string-timeout", required_argument, nullptr, 'W' },
+                { "sysfs",      no_argument,        nullptr,    's' },
+                { "sysfs-root", required_argument,  nullptr,    'R' },
+                { "template",   required_argument,  nullptr,    'T' },
+                { "top",        optional_argument,  nullptr,    'U' },
+                { "tree",       no_argument,        nullptr,    't' },
+                { "usb-ids",    required_argument,  nullptr,    'I' },
                 { "version",    no_argument,        nullptr,    'v' },
+                { "watch",      no_argument,        nullptr,    'w' },
                 { nullptr,      0,                  nullptr,    0 },
         };
         // clang-format on
 
         int const c = ::getopt_long(
-                argc, argv, "d:Dhv", static_cast<option const*>(long_options), nullptr);
+                argc, argv, "d:Df:hnstT:vw", static_cast<option const*>(long_options), nullptr);
         if (c == -1)
             break;
 
@@ -56,29 +161,143 @@ arg_parse(int argc, char** argv)
                 usage(stdout, app);
                 break;
 
-            case 'd': {
-                std::string vidpid = optarg;
-                std::string::size_type const colon = vidpid.find(':');
-                if (colon == std::string::npos) {
-                    std::fprintf(stderr, "invalid vendor_id:product_id \"%s\"\n", vidpid.c_str());
+            case 'd':
+            case 'B':
+            case 'C':
+            case 'P':
+            case 'N':
+            case 'S':
+                try {
+                    // clang-format off
+                    switch (c) {
+                        case 'd': args.filter.add_ids(optarg); break;
+                        case 'B': args.filter.add_buses(optarg); break;
+                        case 'C': args.filter.add_classes(optarg); break;
+                        case 'P': args.filter.add_port_prefixes(optarg); break;
+                        case 'N': args.filter.add_serial(optarg); break;
+                        case 'S': args.filter.add_speeds(optarg); break;
+                    }
+                    // clang-format on
+                } catch (std::invalid_argument const& e) {
+                    std::fprintf(stderr, "%s\n", e.what());
                     usage(stderr, app);
                 }
-
-                args.vendor_id = std::stoi(vidpid.substr(0, colon), nullptr, 16);
-                args.product_id = std::stoi(vidpid.substr(colon + 1), nullptr, 16);
                 break;
-            }
 
             case 'D':
                 args.debug = true;
                 break;
 
+            case 'f': {
+                auto const format = parse_output_format(optarg);
+                if (!format) {
+                    std::fprintf(stderr, "invalid format \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                args.format = *format;
+                break;
+            }
+
+            case 'n':
+                args.names = true;
+                break;
+
+            case 'J':
+            case 'W': {
+                char* end = nullptr;
+                unsigned long const n = std::strtoul(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || n == 0 || n > 60'000) {
+                    std::fprintf(stderr, "invalid %s \"%s\"\n",
+                            (c == 'J') ? "number of jobs" : "timeout", optarg);
+                    usage(stderr, app);
+                }
+                (c == 'J' ? args.jobs : args.string_timeout_ms) = static_cast<unsigned>(n);
+                break;
+            }
+
+            case 'K':
+                args.string_cache = optarg ? optarg : string_cache::default_path();
+                if (!optarg && args.string_cache.empty()) {
+                    std::fprintf(stderr, "--string-cache needs a <file>: no $XDG_CACHE_HOME or "
+                                         "$HOME\n\n");
+                    usage(stderr, app);
+                }
+                break;
+
+            case 's':
+                args.sysfs_root = "/sys";
+                break;
+
+            case 'R':
+                args.sysfs_root = optarg;
+                break;
+
+            case 'T':
+                args.output_template = optarg;
+                break;
+
+            case 'I':
+                args.usb_ids = optarg;
+                break;
+
             case 'v':
                 std::fprintf(stdout, "app_version=%s\n%s\n", ::VERSION,
                         get_version_info_multiline().c_str());
                 std::exit(EXIT_SUCCESS);
                 break;
 
+            case 'w':
+                args.watch = true;
+                break;
+
+            case 't':
+                args.tree = true;
+                break;
+
+            case 'X':
+                args.save = optarg;
+                break;
+
+            case 'Y':
+                args.diff_before = optarg;
+                break;
+
+            case 'A':
+                args.bandwidth = true;
+                break;
+
+            case 'G':
+                args.speed_check = true;
+                break;
+
+            case 'O': {
+                args.probe = 100;
+                if (!optarg)
+                    break;
+                char* end = nullptr;
+                unsigned long const n = std::strtoul(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || n == 0 || n > 1'000'000) {
+                    std::fprintf(stderr, "invalid number of requests \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                args.probe = static_cast<unsigned>(n);
+                break;
+            }
+
+            case 'U': {
+                args.top_ms = 1000;
+                if (!optarg)
+                    break;
+                char* end = nullptr;
+                unsigned long const n = std::strtoul(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || n < 10 || n > 3'600'000) {
+                    std::fprintf(stderr, "invalid interval \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                args.top_ms = static_cast<unsigned>(n);
+                break;
+            }
+
             case '?':
             default:
                 usage(stderr, app);
@@ -86,10 +305,49 @@ arg_parse(int argc, char** argv)
         }
     } // while
 
+    if (!args.diff_before.empty() && optind + 1 == argc)
+        args.diff_after = argv[optind++];
     for (; optind != argc; ++optind) {
         std::fprintf(stderr, "extra argument(s): %s\n\n", argv[optind]);
         usage(stderr, app);
     }
 
+    if (args.watch
+            && (!args.sysfs_root.empty() || !args.output_template.empty()
+                    || args.format == output_format::cbor)) {
+        std::fprintf(stderr, "--watch works only through libusb, with text or json output\n");
+        usage(stderr, app);
+    }
+
+    int const reports = int(args.bandwidth) + int(args.speed_check) + int(args.probe != 0)
+            + int(args.tree) + int(args.top_ms != 0) + int(!args.save.empty())
+            + int(!args.diff_before.empty());
+    if (reports > 1) {
+        std::fprintf(stderr, "--bandwidth, --speed-check, --probe, --tree, --top, --save and "
+                             "--diff are exclusive\n");
+        usage(stderr, app);
+    }
+    if (args.probe != 0 && !args.sysfs_root.empty()) {
+        std::fprintf(stderr, "--probe works only through libusb\n");
+        usage(stderr, app);
+    }
+    if (!args.save.empty() && (args.watch || !args.output_template.empty())) {
+        std::fprintf(stderr, "--save doesn't combine with --watch or --template\n");
+        usage(stderr, app);
+    }
+    if ((args.bandwidth || args.speed_check || args.probe != 0 || args.tree || args.top_ms != 0
+                || !args.diff_before.empty())
+            && (args.watch || !args.output_template.empty()
+                    || args.format != output_format::text)) {
+        std::fprintf(stderr, "--%s works only with text output\n",
+                args.bandwidth     ? "bandwidth"
+                : args.speed_check ? "speed-check"
+                : args.tree        ? "tree"
+                : args.probe != 0  ? "probe"
+                : args.top_ms != 0 ? "top"
+                                   : "diff");
+        usage(stderr, app);
+    }
+
     return args;
 }
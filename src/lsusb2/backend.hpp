@@ -0,0 +1,72 @@
+#pragma once
+
+#include "device.hpp"
+#include "util/usb_filter.hpp"
+#include <cstddef> // std::size_t
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Both backends list only the devices \c filter accepts, fetching
+// \c what (fetch_flags) for them. Each device is read one stage at a
+// time and dropped as soon as the filter rejects it; stages the filter
+// needs are fetched even if \c what doesn't ask for them.
+//
+// A device that can't be read is skipped (after logging why) rather
+// than ending the enumeration.
+
+
+class string_cache;
+
+/// How enumerate_libusb() reads string descriptors (and the BOS), which
+/// takes opening the device and a control transfer per string.
+struct string_fetch_options
+{
+    unsigned jobs = 8; ///< devices read in parallel
+    unsigned timeout_ms = 250; ///< per device, for all its transfers together
+    string_cache* cache = nullptr; ///< consulted first, and filled in
+};
+
+/// Enumerates devices through libusb. Needs read access to the device
+/// nodes to fetch strings and BOS descriptors.
+/// \returns false (after logging why) on failure
+bool enumerate_libusb(std::vector<usb_device>& devices, unsigned what, usb_filter const& filter,
+        string_fetch_options const& opts, bool debug);
+
+/// The devices on the bus, listed up front and read one at a time, so
+/// that reading overlaps with whatever is done with the devices read
+/// so far. read() may be called from several threads at once, for
+/// different devices.
+class device_source
+{
+public:
+    virtual ~device_source() = default;
+
+    /// \returns the number of devices listed, accepted or not
+    virtual std::size_t size() const noexcept = 0;
+
+    /// Reads the \c i th device into \c d.
+    /// \returns false if the filter rejects it or it can't be read
+    virtual bool read(std::size_t i, usb_device& d) = 0;
+};
+
+/// Lists the devices through libusb, to be read the way
+/// enumerate_libusb() reads them; the string cache is shared between
+/// threads.
+/// \returns nullptr (after logging why) on failure
+std::unique_ptr<device_source> open_libusb(unsigned what, usb_filter const& filter,
+        string_fetch_options const& opts, bool debug);
+
+/// Reads a single device the way enumerate_libusb() does, except that
+/// strings and the BOS are read right away and without the cache.
+/// \returns false if \c filter rejects the device or it can't be read
+bool read_libusb_device(libusb_device* dev, unsigned what, usb_filter const& filter,
+        unsigned string_timeout_ms, usb_device& d);
+
+/// Enumerates devices by reading <root>/bus/usb/devices/*, without
+/// libusb or access to the device nodes. \c root is "/sys" on a live
+/// system, or a copy of it.
+/// \returns false (after logging why) on failure
+bool enumerate_sysfs(std::vector<usb_device>& devices, unsigned what, usb_filter const& filter,
+        std::string const& root);
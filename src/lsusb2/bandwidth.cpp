@@ -0,0 +1,324 @@
+#include "bandwidth.hpp"
+#include "util/usb_enums.hpp"
+#include <algorithm>
+#include <bit> // std::bit_floor
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <utility> // std::swap
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+
+    /// Byte times per (micro)frame and the share of them that may be
+    /// periodic: 90% of a full-speed frame and 80% of a high-speed
+    /// microframe (USB 2.0 5.6.4, 5.7.4), 90% of a SuperSpeed bus
+    /// interval (USB 3.2 8.12.4.1).
+    void
+    set_budget(periodic_schedule& s)
+    {
+        // clang-format off
+        switch (s.speed) {
+            case LIBUSB_SPEED_SUPER_PLUS:
+                s.frame_us = 125; s.frame_bytes = 151'515; s.limit = 0.9; break; // 128b/132b
+            case LIBUSB_SPEED_SUPER:
+                s.frame_us = 125; s.frame_bytes = 62'500; s.limit = 0.9; break; // 8b/10b
+            case LIBUSB_SPEED_HIGH:
+                s.frame_us = 125; s.frame_bytes = 7'500; s.limit = 0.8; break;
+            default:
+                s.frame_us = 1000; s.frame_bytes = 1'500; s.limit = 0.9; break;
+        }
+        // clang-format on
+    }
+
+    char const*
+    frame_name(libusb_speed s) noexcept
+    {
+        if (s >= LIBUSB_SPEED_SUPER)
+            return "bus interval";
+        return (s == LIBUSB_SPEED_HIGH) ? "microframe" : "frame";
+    }
+
+    /// The root hub's speed, or (if it isn't listed) the fastest
+    /// device's, but at least full speed.
+    libusb_speed
+    bus_speed(bus_model const& model, std::uint8_t bus) noexcept
+    {
+        device_node const* root = model.find(bus, {});
+        if (root && root->speed != LIBUSB_SPEED_UNKNOWN)
+            return root->speed;
+        libusb_speed fastest = LIBUSB_SPEED_FULL;
+        for (device_node const& d : model.devices()) {
+            if (d.bus == bus)
+                fastest = std::max(fastest, d.speed);
+        }
+        return fastest;
+    }
+
+    /// Finds the transaction translator of a full- or low-speed device
+    /// on a high-speed bus: that of the nearest high-speed hub above
+    /// it, and per port if the hub is multi-TT (bDeviceProtocol 2).
+    /// Root ports, and devices whose hubs aren't listed, count as
+    /// having a translator per root port, as an xHCI does.
+    void
+    set_translator(bus_model const& model, device_node const& dev, periodic_schedule& s)
+    {
+        s.translator = true;
+        for (std::uint8_t depth = dev.num_ports - 1; depth > 0; --depth) {
+            device_node const* hub = model.find(dev.bus, {dev.ports, depth});
+            if (hub && hub->speed == LIBUSB_SPEED_HIGH) {
+                s.num_ports = (hub->desc.bDeviceProtocol == 2) ? depth + 1 : depth;
+                std::copy(dev.ports, dev.ports + s.num_ports, s.ports);
+                return;
+            }
+        }
+        s.num_ports = 1;
+        s.ports[0] = dev.ports[0];
+    }
+
+    /// Interrupt endpoints below high speed have bInterval in frames,
+    /// which host controllers round down to a power of two; everything
+    /// else has 2^(bInterval-1) frames, microframes or bus intervals.
+    std::uint32_t
+    interval_us(desc::endpoint_desc const& epd, bool iso, libusb_speed speed) noexcept
+    {
+        if (speed <= LIBUSB_SPEED_FULL && !iso)
+            return 1000 * std::bit_floor(std::max<unsigned>(epd.interval(), 1));
+        unsigned const exponent = std::clamp<unsigned>(epd.interval(), 1, 16) - 1;
+        return ((speed <= LIBUSB_SPEED_FULL) ? 1000u : 125u) << exponent;
+    }
+
+    /// From the companion descriptors, falling back to what bMaxBurst
+    /// and Mult allow if wBytesPerInterval is 0.
+    std::uint32_t
+    ss_bytes_per_interval(bus_model const& model, endpoint_node const& ep, std::uint32_t packet,
+            bool iso) noexcept
+    {
+        std::optional<desc::ss_ep_companion_desc> ss;
+        std::optional<desc::ssp_iso_ep_companion_desc> ssp;
+        for (extra_node const& e : model.extras(ep)) {
+            if (auto c = desc::as<desc::ss_ep_companion_desc>(e.desc))
+                ss = c;
+            else if (auto c = desc::as<desc::ssp_iso_ep_companion_desc>(e.desc))
+                ssp = c;
+        }
+
+        if (ssp)
+            return ssp->bytes_per_interval();
+        if (ss && ss->bytes_per_interval() != 0)
+            return ss->bytes_per_interval();
+        std::uint32_t const burst = ss ? ss->max_burst() + 1u : 1u;
+        std::uint32_t const mult = (ss && iso) ? ss->mult() + 1u : 1u;
+        return packet * burst * mult;
+    }
+
+    /// Counts each transaction's protocol overhead at full and high
+    /// speed (USB 2.0 tables 5-4 and 5-7); SuperSpeed counts payload
+    /// only.
+    void
+    measure(bus_model const& model, endpoint_node const& ep, libusb_speed speed,
+            periodic_schedule const& sched, periodic_endpoint& out)
+    {
+        desc::endpoint_desc const& epd = ep.desc;
+        bool const iso =
+                ep_attr_to_transfer_type(epd.attributes()) == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+        std::uint32_t const packet = epd.max_packet_size() & 0x7ff;
+        out.interval_us = interval_us(epd, iso, speed);
+
+        double cost = 0;
+        if (speed >= LIBUSB_SPEED_SUPER) {
+            out.bytes_per_interval = ss_bytes_per_interval(model, ep, packet, iso);
+            cost = out.bytes_per_interval;
+        } else if (speed == LIBUSB_SPEED_HIGH) {
+            // bits 12..11: additional transactions per microframe
+            std::uint32_t const extra = (epd.max_packet_size() >> 11) & 0x3;
+            std::uint32_t const mult = std::min<std::uint32_t>(extra, 2) + 1; // 3 is reserved
+            out.bytes_per_interval = packet * mult;
+            cost = mult * (packet + (iso ? 38.0 : 55.0));
+        } else {
+            out.bytes_per_interval = packet;
+            cost = packet + (iso ? 9.0 : 13.0);
+            if (speed == LIBUSB_SPEED_LOW)
+                cost *= 8; // a low-speed bit takes eight full-speed bit times
+        }
+
+        double const frames = std::max(1.0, double(out.interval_us) / sched.frame_us);
+        out.load = cost / (frames * sched.frame_bytes);
+    }
+
+    /// Each interface's alternate setting with the most periodic load.
+    periodic_device
+    worst_case(bus_model const& model, device_node const& dev, config_node const& config,
+            libusb_speed speed, periodic_schedule const& sched)
+    {
+        periodic_device pd;
+        pd.dev = &dev;
+
+        std::vector<periodic_endpoint> best;
+        std::vector<periodic_endpoint> eps;
+        for (interface_node const& intf : model.interfaces(config)) {
+            double best_load = 0;
+            best.clear();
+            for (altsetting_node const& alt : model.altsettings(intf)) {
+                double load = 0;
+                eps.clear();
+                for (endpoint_node const& ep : model.endpoints(alt)) {
+                    auto const type = ep_attr_to_transfer_type(ep.desc.attributes());
+                    if (type != LIBUSB_TRANSFER_TYPE_INTERRUPT
+                            && type != LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+                        continue;
+                    periodic_endpoint& pe = eps.emplace_back();
+                    pe.ep = &ep;
+                    pe.interface = alt.desc.number();
+                    pe.alt_setting = alt.desc.alt_setting();
+                    measure(model, ep, speed, sched, pe);
+                    load += pe.load;
+                }
+                if (load > best_load) {
+                    best_load = load;
+                    std::swap(best, eps);
+                }
+            }
+            pd.endpoints.insert(pd.endpoints.end(), best.begin(), best.end());
+            pd.load += best_load;
+        }
+        return pd;
+    }
+
+    periodic_schedule&
+    find_or_add(std::vector<periodic_schedule>& schedules, periodic_schedule const& key)
+    {
+        for (periodic_schedule& s : schedules) {
+            if (s.bus == key.bus && s.translator == key.translator && s.num_ports == key.num_ports
+                    && std::equal(s.ports, s.ports + s.num_ports, key.ports))
+                return s;
+        }
+        return schedules.emplace_back(key);
+    }
+
+
+    /// Devices and endpoints get more digits: most take a fraction of
+    /// a percent.
+    void
+    format_percent(buffer& buf, double share, int precision = 1)
+    {
+        fmt::format_to(std::back_inserter(buf), "{:.{}f}%", share * 100, precision);
+    }
+
+    void
+    format_interval(buffer& buf, std::uint32_t us)
+    {
+        if (us % 1000 == 0)
+            fmt::format_to(std::back_inserter(buf), "{} ms", us / 1000);
+        else
+            fmt::format_to(std::back_inserter(buf), "{} us", us);
+    }
+
+    void
+    format_schedule(buffer& buf, periodic_schedule const& s)
+    {
+        auto out = std::back_inserter(buf);
+        if (s.translator) {
+            fmt::format_to(out, "  transaction translator {}-{}, {}: ", s.bus,
+                    fmt::join(s.ports, s.ports + s.num_ports, "."), to_str(s.speed));
+        } else {
+            fmt::format_to(out, "bus {}, {}: ", s.bus, to_str(s.speed));
+        }
+        format_percent(buf, s.load);
+        fmt::format_to(out, " of each {} periodic (limit {:.0f}%, ", frame_name(s.speed),
+                s.limit * 100);
+        if (s.load > s.limit) {
+            format_percent(buf, s.load - s.limit);
+            fmt::format_to(out, " over)\n");
+        } else {
+            format_percent(buf, s.limit - s.load);
+            fmt::format_to(out, " left{})\n", (s.load > 0.9 * s.limit) ? ", near limit" : "");
+        }
+
+        char const* const indent = s.translator ? "    " : "  ";
+        for (periodic_device const& pd : s.devices) {
+            device_node const& d = *pd.dev;
+            if (d.num_ports == 0)
+                fmt::format_to(out, "{}usb{}", indent, d.bus);
+            else
+                fmt::format_to(out, "{}{}-{}", indent, d.bus,
+                        fmt::join(d.ports, d.ports + d.num_ports, "."));
+            fmt::format_to(out, " {:04x}:{:04x}", d.desc.idVendor, d.desc.idProduct);
+            std::string_view const name = d.product_name.empty() ? d.product : d.product_name;
+            if (!name.empty())
+                fmt::format_to(out, " {}", name);
+            buf.append(std::string_view(": "));
+            format_percent(buf, pd.load, 2);
+            buf.push_back('\n');
+
+            for (periodic_endpoint const& pe : pd.endpoints) {
+                std::uint8_t const attrs = pe.ep->desc.attributes();
+                fmt::format_to(out, "{}  interface {} alt {} endpoint {:#04x} {}: {} bytes every ",
+                        indent, pe.interface, pe.alt_setting, pe.ep->desc.address(),
+                        to_str(ep_attr_to_transfer_type(attrs)), pe.bytes_per_interval);
+                format_interval(buf, pe.interval_us);
+                buf.append(std::string_view(", "));
+                format_percent(buf, pe.load, 2);
+                buf.push_back('\n');
+            }
+        }
+    }
+
+} // namespace
+
+
+std::vector<periodic_schedule>
+analyze_periodic(bus_model const& model)
+{
+    std::vector<periodic_schedule> schedules;
+    for (device_node const& dev : model.devices()) {
+        libusb_speed const root = bus_speed(model, dev.bus);
+        periodic_schedule root_key;
+        root_key.bus = dev.bus;
+        root_key.speed = root;
+        set_budget(root_key);
+        find_or_add(schedules, root_key); // listed even if idle
+
+        auto const configs = model.configs(dev);
+        if (configs.empty())
+            continue;
+
+        libusb_speed const speed = (dev.speed == LIBUSB_SPEED_UNKNOWN) ? root : dev.speed;
+        bool const translated =
+                root == LIBUSB_SPEED_HIGH && speed <= LIBUSB_SPEED_FULL && dev.num_ports != 0;
+        periodic_schedule key = root_key;
+        if (translated) {
+            key.speed = LIBUSB_SPEED_FULL;
+            set_budget(key);
+            set_translator(model, dev, key);
+        }
+
+        periodic_device pd = worst_case(model, dev, configs.front(), speed, key);
+        if (pd.endpoints.empty())
+            continue;
+        periodic_schedule& sched = find_or_add(schedules, key);
+        sched.load += pd.load;
+        sched.devices.push_back(std::move(pd));
+    }
+
+    std::stable_sort(schedules.begin(), schedules.end(),
+            [](periodic_schedule const& a, periodic_schedule const& b) {
+                if (a.bus != b.bus)
+                    return a.bus < b.bus;
+                if (a.translator != b.translator)
+                    return b.translator;
+                return std::lexicographical_compare(
+                        a.ports, a.ports + a.num_ports, b.ports, b.ports + b.num_ports);
+            });
+    return schedules;
+}
+
+
+void
+format_periodic_report(buffer& buf, std::span<periodic_schedule const> schedules)
+{
+    for (periodic_schedule const& s : schedules)
+        format_schedule(buf, s);
+}
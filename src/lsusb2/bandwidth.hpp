@@ -0,0 +1,60 @@
+#pragma once
+
+#include "model.hpp"
+#include <fmt/format.h>
+#include <libusb.h>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+
+// Periodic (interrupt and isochronous) bandwidth the host controller
+// reserves for the listed devices. The active configuration and
+// alternate settings aren't known without opening the devices, so this
+// is the worst case of the first configuration: for every interface,
+// the alternate setting that reserves the most. That is what a camera
+// or audio device asks for when it streams at its highest rate.
+//
+// Each schedule has its own budget per (micro)frame. A root hub has
+// one. Full- and low-speed devices behind a high-speed hub are
+// scheduled by the hub's transaction translator (one per port on a
+// multi-TT hub), so they get a full-speed budget of their own.
+
+/// One interrupt or isochronous endpoint.
+struct periodic_endpoint
+{
+    endpoint_node const* ep = nullptr;
+    std::uint8_t interface = 0;
+    std::uint8_t alt_setting = 0;
+    std::uint32_t bytes_per_interval = 0; ///< payload, including high-bandwidth/burst packets
+    std::uint32_t interval_us = 0; ///< service interval as the host schedules it
+    double load = 0; ///< share of each (micro)frame of its schedule, averaged over the interval
+};
+
+struct periodic_device
+{
+    device_node const* dev = nullptr;
+    std::vector<periodic_endpoint> endpoints;
+    double load = 0;
+};
+
+struct periodic_schedule
+{
+    std::uint8_t bus = 0;
+    bool translator = false; ///< a hub's transaction translator rather than the root hub
+    std::uint8_t num_ports = 0; ///< translator: the hub's port path, plus its port if multi-TT
+    std::uint8_t ports[7] = {0};
+    libusb_speed speed = LIBUSB_SPEED_UNKNOWN; ///< full, high, super or super plus
+    std::uint32_t frame_us = 0; ///< 1000 at full speed, 125 above
+    std::uint32_t frame_bytes = 0; ///< byte times in one (micro)frame
+    double limit = 0; ///< share of a (micro)frame that may be periodic
+    double load = 0;
+    std::vector<periodic_device> devices; ///< those with periodic endpoints
+};
+
+/// \returns one schedule per bus, then per transaction translator in
+/// use, ordered by bus and port path
+std::vector<periodic_schedule> analyze_periodic(bus_model const&);
+
+/// Appends a text report of \c schedules.
+void format_periodic_report(fmt::memory_buffer&, std::span<periodic_schedule const> schedules);
@@ -0,0 +1,324 @@
+#pragma once
+
+#include "descriptors.hpp"
+#include "util/usb_enums.hpp"
+#include <libusb.h>
+#include <algorithm> // std::min
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <string_view>
+#include <variant>
+
+
+// Names the fields of every decoded descriptor once, for all output
+// formats. describe() calls back into a visitor \c v with:
+//
+//   v.name(char const*)                          what the descriptor is
+//   v.field(char const* key, <value>)            for each field, where
+//       <value> is an unsigned integer, double, std::string_view, hex
+//       or bcd
+//   v.list(char const* key, std::size_t n, get)  for arrays; get(i)
+//                                                returns one of the above
+//
+// Keys are lower_snake_case and are part of the JSON/CBOR schema.
+
+
+/// Integer that text output shows in hex.
+struct hex
+{
+    std::uint64_t value;
+    int digits;
+};
+
+/// Binary-coded decimal version number (bcdUSB and friends).
+struct bcd
+{
+    std::uint16_t value;
+};
+
+
+template <typename V>
+void
+describe(desc::descriptor const& d, V& v)
+{
+    v.name("descriptor");
+    v.field("type", hex{d.type(), 2});
+    v.list("data", d.raw.size() - 2, [&d](std::size_t i) { return hex{d.raw[i + 2], 2}; });
+}
+
+template <typename V>
+void
+describe(desc::interface_assoc_desc const& d, V& v)
+{
+    v.name("interface association");
+    v.field("first_interface", d.first_interface());
+    v.field("interface_count", d.interface_count());
+    v.field("class", d.function_class());
+    v.field("class_name",
+            std::string_view(to_str(static_cast<libusb_class_code>(d.function_class()))));
+    v.field("subclass", d.function_subclass());
+    v.field("protocol", d.function_protocol());
+    v.field("string_index", d.function_index());
+}
+
+template <typename V>
+void
+describe(desc::hid_desc const& d, V& v)
+{
+    v.name("HID");
+    v.field("version", bcd{d.bcd_hid()});
+    v.field("country_code", d.country_code());
+    v.field("num_descriptors", d.num_descriptors());
+    v.field("report_length", d.report_length());
+}
+
+template <typename V>
+void
+describe(desc::ss_ep_companion_desc const& d, V& v)
+{
+    v.name("SuperSpeed endpoint companion");
+    v.field("max_burst", d.max_burst() + 1u);
+    v.field("attributes", hex{d.attributes(), 2});
+    v.field("bytes_per_interval", d.bytes_per_interval());
+}
+
+template <typename V>
+void
+describe(desc::ssp_iso_ep_companion_desc const& d, V& v)
+{
+    v.name("SuperSpeedPlus isochronous endpoint companion");
+    v.field("bytes_per_interval", d.bytes_per_interval());
+}
+
+template <typename V>
+void
+describe(desc::cdc_header_desc const& d, V& v)
+{
+    v.name("CDC header");
+    v.field("version", bcd{d.bcd_cdc()});
+}
+
+template <typename V>
+void
+describe(desc::cdc_call_mgmt_desc const& d, V& v)
+{
+    v.name("CDC call management");
+    v.field("capabilities", hex{d.capabilities(), 2});
+    v.field("data_interface", d.data_interface());
+}
+
+template <typename V>
+void
+describe(desc::cdc_acm_desc const& d, V& v)
+{
+    v.name("CDC ACM");
+    v.field("capabilities", hex{d.capabilities(), 2});
+}
+
+template <typename V>
+void
+describe(desc::cdc_union_desc const& d, V& v)
+{
+    desc::bytes const subs = d.subordinate_interfaces();
+    v.name("CDC union");
+    v.field("control_interface", d.control_interface());
+    v.list("subordinate_interfaces", subs.size(), [subs](std::size_t i) { return subs[i]; });
+}
+
+template <typename V>
+void
+describe(desc::cdc_ethernet_desc const& d, V& v)
+{
+    v.name("CDC ethernet");
+    v.field("mac_address_index", d.mac_address_index());
+    v.field("statistics", hex{d.statistics(), 8});
+    v.field("max_segment_size", d.max_segment_size());
+    v.field("num_mc_filters", d.num_mc_filters());
+    v.field("num_power_filters", d.num_power_filters());
+}
+
+template <typename V>
+void
+describe(desc::ac_header_desc const& d, V& v)
+{
+    v.name("audio control header");
+    v.field("version", bcd{d.bcd_adc()});
+    v.field("total_length", d.total_length());
+}
+
+template <typename V>
+void
+describe(desc::ac2_header_desc const& d, V& v)
+{
+    v.name("audio control header");
+    v.field("version", bcd{d.bcd_adc()});
+    v.field("category", hex{d.category(), 2});
+    v.field("total_length", d.total_length());
+    v.field("controls", hex{d.controls(), 2});
+}
+
+template <typename V>
+void
+describe(desc::ac_input_terminal_desc const& d, V& v)
+{
+    v.name("audio input terminal");
+    v.field("terminal_id", d.terminal_id());
+    v.field("terminal_type", hex{d.terminal_type(), 4});
+    v.field("assoc_terminal", d.assoc_terminal());
+    v.field("num_channels", d.num_channels());
+}
+
+template <typename V>
+void
+describe(desc::ac_output_terminal_desc const& d, V& v)
+{
+    v.name("audio output terminal");
+    v.field("terminal_id", d.terminal_id());
+    v.field("terminal_type", hex{d.terminal_type(), 4});
+    v.field("assoc_terminal", d.assoc_terminal());
+    v.field("source_id", d.source_id());
+}
+
+template <typename V>
+void
+describe(desc::ac_feature_unit_desc const& d, V& v)
+{
+    v.name("audio feature unit");
+    v.field("unit_id", d.unit_id());
+    v.field("source_id", d.source_id());
+    v.field("control_size", d.control_size());
+}
+
+template <typename V>
+void
+describe(desc::as_general_desc const& d, V& v)
+{
+    v.name("audio streaming");
+    v.field("terminal_link", d.terminal_link());
+    v.field("delay", d.delay());
+    v.field("format_tag", hex{d.format_tag(), 4});
+}
+
+template <typename V>
+void
+describe(desc::as_format_type_desc const& d, V& v)
+{
+    v.name("audio format type");
+    v.field("format_type", d.format_type());
+    v.field("num_channels", d.num_channels());
+    v.field("subframe_size", d.subframe_size());
+    v.field("bit_resolution", d.bit_resolution());
+
+    std::size_t const present = d.sample_freqs_present();
+    if (d.num_sample_freqs() == 0 && present >= 2) {
+        v.field("min_sample_freq", d.sample_freq(0));
+        v.field("max_sample_freq", d.sample_freq(1));
+    } else {
+        std::size_t const n = std::min<std::size_t>(present, d.num_sample_freqs());
+        v.list("sample_freqs", n, [&d](std::size_t i) { return d.sample_freq(i); });
+    }
+}
+
+template <typename V>
+void
+describe(desc::audio_endpoint_desc const& d, V& v)
+{
+    v.name("audio endpoint");
+    v.field("attributes", hex{d.attributes(), 2});
+    v.field("lock_delay_units", d.lock_delay_units());
+    v.field("lock_delay", d.lock_delay());
+}
+
+template <typename V>
+void
+describe(desc::vc_header_desc const& d, V& v)
+{
+    v.name("video control header");
+    v.field("version", bcd{d.bcd_uvc()});
+    v.field("total_length", d.total_length());
+    v.field("clock_frequency", d.clock_frequency());
+    v.field("num_streaming_interfaces", d.num_streaming_interfaces());
+}
+
+template <typename V>
+void
+describe(desc::vc_input_terminal_desc const& d, V& v)
+{
+    v.name("video input terminal");
+    v.field("terminal_id", d.terminal_id());
+    v.field("terminal_type", hex{d.terminal_type(), 4});
+    v.field("assoc_terminal", d.assoc_terminal());
+}
+
+template <typename V>
+void
+describe(desc::vc_output_terminal_desc const& d, V& v)
+{
+    v.name("video output terminal");
+    v.field("terminal_id", d.terminal_id());
+    v.field("terminal_type", hex{d.terminal_type(), 4});
+    v.field("assoc_terminal", d.assoc_terminal());
+    v.field("source_id", d.source_id());
+}
+
+template <typename V>
+void
+describe(desc::vc_processing_unit_desc const& d, V& v)
+{
+    v.name("video processing unit");
+    v.field("unit_id", d.unit_id());
+    v.field("source_id", d.source_id());
+    v.field("max_multiplier", d.max_multiplier());
+}
+
+template <typename V>
+void
+describe(desc::vs_input_header_desc const& d, V& v)
+{
+    v.name("video streaming input header");
+    v.field("num_formats", d.num_formats());
+    v.field("endpoint_address", hex{d.endpoint_address(), 2});
+}
+
+template <typename V>
+void
+describe(desc::vs_format_uncompressed_desc const& d, V& v)
+{
+    // the first four bytes of the format GUID are its FourCC
+    desc::bytes const guid = d.guid();
+    v.name("video format uncompressed");
+    v.field("format_index", d.format_index());
+    v.field("fourcc", std::string_view(reinterpret_cast<char const*>(guid.data()), 4));
+    v.field("num_frames", d.num_frames());
+    v.field("bits_per_pixel", d.bits_per_pixel());
+}
+
+template <typename V>
+void
+describe(desc::vs_format_mjpeg_desc const& d, V& v)
+{
+    v.name("video format MJPEG");
+    v.field("format_index", d.format_index());
+    v.field("num_frames", d.num_frames());
+}
+
+template <typename V>
+void
+describe(desc::vs_frame_desc const& d, V& v)
+{
+    v.name(d.mjpeg() ? "video frame MJPEG" : "video frame uncompressed");
+    v.field("frame_index", d.frame_index());
+    v.field("width", d.width());
+    v.field("height", d.height());
+    v.field("fps", (d.default_interval() == 0) ? 0.0 : 1e7 / d.default_interval());
+    v.field("max_bit_rate", d.max_bit_rate());
+}
+
+
+/// describe() for whatever decode() returned.
+template <typename V>
+void
+describe(desc::decoded const& d, V& v)
+{
+    std::visit([&v](auto const& typed) { describe(typed, v); }, d);
+}
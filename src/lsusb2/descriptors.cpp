@@ -0,0 +1,100 @@
+#include "descriptors.hpp"
+
+
+namespace desc {
+
+    namespace { // unnamed
+
+        /// \returns the first of \c T, \c Rest that \c d can be viewed as,
+        /// or \c d itself
+        template <typename T, typename... Rest>
+        decoded
+        first_of(descriptor d) noexcept
+        {
+            if (auto const v = as<T>(d))
+                return *v;
+            if constexpr (sizeof...(Rest) != 0)
+                return first_of<Rest...>(d);
+            else
+                return d;
+        }
+
+        decoded
+        decode_cdc(descriptor d) noexcept
+        {
+            return first_of<cdc_header_desc, cdc_call_mgmt_desc, cdc_acm_desc, cdc_union_desc,
+                    cdc_ethernet_desc>(d);
+        }
+
+        decoded
+        decode_audio(descriptor d, context const& ctx) noexcept
+        {
+            if (d.type() == dt_cs_endpoint)
+                return first_of<audio_endpoint_desc>(d);
+
+            if (ctx.interface_subclass == subclass_control) {
+                if (ctx.protocol == protocol_uac2) // terminals and units have other layouts
+                    return first_of<ac2_header_desc>(d);
+                if (ctx.protocol != 0) // UAC3 and later
+                    return d;
+                return first_of<ac_header_desc, ac_input_terminal_desc, ac_output_terminal_desc,
+                        ac_feature_unit_desc>(d);
+            }
+            if (ctx.interface_subclass == subclass_streaming) {
+                if (ctx.protocol != 0)
+                    return d;
+                return first_of<as_general_desc, as_format_type_desc>(d);
+            }
+            return d;
+        }
+
+        decoded
+        decode_video(descriptor d, context const& ctx) noexcept
+        {
+            if (ctx.interface_subclass == subclass_control) {
+                return first_of<vc_header_desc, vc_input_terminal_desc, vc_output_terminal_desc,
+                        vc_processing_unit_desc>(d);
+            }
+            if (ctx.interface_subclass == subclass_streaming) {
+                if (d.subtype() == 0x05 || d.subtype() == 0x07)
+                    return first_of<vs_frame_desc>(d);
+                return first_of<vs_input_header_desc, vs_format_uncompressed_desc,
+                        vs_format_mjpeg_desc>(d);
+            }
+            return d;
+        }
+
+    } // namespace
+
+
+    decoded
+    decode(descriptor d, context const& ctx) noexcept
+    {
+        switch (d.type()) {
+            case dt_interface_assoc:
+                return first_of<interface_assoc_desc>(d);
+            case dt_hid:
+                return first_of<hid_desc>(d);
+            case dt_ss_ep_companion:
+                return first_of<ss_ep_companion_desc>(d);
+            case dt_ssp_iso_ep_companion:
+                return first_of<ssp_iso_ep_companion_desc>(d);
+
+            case dt_cs_interface:
+            case dt_cs_endpoint:
+                if (ctx.interface_class == class_cdc && d.type() == dt_cs_interface)
+                    return decode_cdc(d);
+                if (ctx.interface_class == class_audio)
+                    return decode_audio(d, ctx);
+                if (ctx.interface_class == class_video && d.type() == dt_cs_interface)
+                    return decode_video(d, ctx);
+                break;
+
+            default:
+                break;
+        }
+
+        return d;
+    }
+
+} // namespace desc
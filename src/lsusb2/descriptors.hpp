@@ -0,0 +1,605 @@
+#pragma once
+
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <variant>
+
+
+/// In-place views of raw (wire format) descriptors. Nothing here
+/// copies or allocates: every view refers into the blob it was parsed
+/// from, which must outlive it.
+namespace desc {
+
+    using bytes = std::span<std::uint8_t const>;
+
+    // descriptor types
+    inline constexpr std::uint8_t dt_device = 0x01;
+    inline constexpr std::uint8_t dt_config = 0x02;
+    inline constexpr std::uint8_t dt_interface = 0x04;
+    inline constexpr std::uint8_t dt_endpoint = 0x05;
+    inline constexpr std::uint8_t dt_interface_assoc = 0x0b;
+    inline constexpr std::uint8_t dt_bos = 0x0f;
+    inline constexpr std::uint8_t dt_device_capability = 0x10;
+    inline constexpr std::uint8_t dt_hid = 0x21;
+    inline constexpr std::uint8_t dt_hid_report = 0x22;
+    inline constexpr std::uint8_t dt_cs_interface = 0x24;
+    inline constexpr std::uint8_t dt_cs_endpoint = 0x25;
+    inline constexpr std::uint8_t dt_ss_ep_companion = 0x30;
+    inline constexpr std::uint8_t dt_ssp_iso_ep_companion = 0x31;
+
+    // interface classes and subclasses with class-specific descriptors
+    inline constexpr std::uint8_t class_audio = 0x01;
+    inline constexpr std::uint8_t class_cdc = 0x02;
+    inline constexpr std::uint8_t class_video = 0x0e;
+    inline constexpr std::uint8_t subclass_control = 0x01; ///< audio and video
+    inline constexpr std::uint8_t subclass_streaming = 0x02; ///< audio and video
+    inline constexpr std::uint8_t protocol_uac2 = 0x20; ///< audio interface protocol
+
+
+    /// One descriptor: exactly bLength bytes.
+    struct descriptor
+    {
+        bytes raw;
+
+        constexpr std::uint8_t length() const noexcept { return raw[0]; }
+        constexpr std::uint8_t type() const noexcept { return raw[1]; }
+
+        /// bDescriptorSubtype of class-specific descriptors
+        constexpr std::uint8_t subtype() const noexcept { return u8(2); }
+
+        /// Fields past the end of a short descriptor read as 0.
+        constexpr std::uint8_t
+        u8(std::size_t off) const noexcept
+        {
+            return off < raw.size() ? raw[off] : 0;
+        }
+
+        constexpr std::uint16_t
+        u16(std::size_t off) const noexcept
+        {
+            return static_cast<std::uint16_t>(u8(off) | (u8(off + 1) << 8));
+        }
+
+        constexpr std::uint32_t
+        u24(std::size_t off) const noexcept
+        {
+            return u16(off) | (static_cast<std::uint32_t>(u8(off + 2)) << 16);
+        }
+
+        constexpr std::uint32_t
+        u32(std::size_t off) const noexcept
+        {
+            return u16(off) | (static_cast<std::uint32_t>(u16(off + 2)) << 16);
+        }
+    };
+
+
+    /// Iterates the descriptors of a blob, stopping at the first one
+    /// that is truncated or has bLength < 2.
+    class descriptor_iterator
+    {
+    private:
+        bytes rest_;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = descriptor;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = descriptor;
+
+        constexpr descriptor_iterator() noexcept = default;
+        constexpr explicit descriptor_iterator(bytes blob) noexcept
+                : rest_(valid(blob) ? blob : bytes())
+        {}
+
+        constexpr descriptor operator*() const noexcept { return {rest_.first(rest_[0])}; }
+
+        constexpr descriptor_iterator&
+        operator++() noexcept
+        {
+            bytes const next = rest_.subspan(rest_[0]);
+            rest_ = valid(next) ? next : bytes();
+            return *this;
+        }
+
+        constexpr descriptor_iterator
+        operator++(int) noexcept
+        {
+            descriptor_iterator const prev = *this;
+            ++*this;
+            return prev;
+        }
+
+        constexpr bool
+        operator==(descriptor_iterator const& rhs) const noexcept
+        {
+            return rest_.data() == rhs.rest_.data() && rest_.size() == rhs.rest_.size();
+        }
+
+    private:
+        static constexpr bool
+        valid(bytes b) noexcept
+        {
+            return b.size() >= 2 && b[0] >= 2 && b[0] <= b.size();
+        }
+    };
+
+    class descriptor_range
+    {
+    private:
+        bytes blob_;
+
+    public:
+        constexpr explicit descriptor_range(bytes blob) noexcept
+                : blob_(blob)
+        {}
+
+        constexpr descriptor_iterator begin() const noexcept { return descriptor_iterator(blob_); }
+        constexpr descriptor_iterator end() const noexcept { return {}; }
+
+        /// \returns number of trailing bytes that do not form a descriptor
+        std::size_t
+        trailing_garbage() const noexcept
+        {
+            std::size_t used = 0;
+            for (descriptor const d : *this)
+                used += d.length();
+            return blob_.size() - used;
+        }
+    };
+
+
+    /**********************************************************************/
+    // typed views
+    //
+    // Each view names the fields of one descriptor layout. as<T>()
+    // checks type, subtype and minimum length before handing one out.
+
+    struct config_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_config;
+        static constexpr std::size_t min_length = 9;
+
+        std::uint16_t total_length() const noexcept { return u16(2); }
+        std::uint8_t num_interfaces() const noexcept { return u8(4); }
+        std::uint8_t config_value() const noexcept { return u8(5); }
+        std::uint8_t config_index() const noexcept { return u8(6); }
+        std::uint8_t attributes() const noexcept { return u8(7); }
+        std::uint8_t max_power() const noexcept { return u8(8); }
+    };
+
+    struct interface_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_interface;
+        static constexpr std::size_t min_length = 9;
+
+        std::uint8_t number() const noexcept { return u8(2); }
+        std::uint8_t alt_setting() const noexcept { return u8(3); }
+        std::uint8_t num_endpoints() const noexcept { return u8(4); }
+        std::uint8_t interface_class() const noexcept { return u8(5); }
+        std::uint8_t interface_subclass() const noexcept { return u8(6); }
+        std::uint8_t protocol() const noexcept { return u8(7); }
+        std::uint8_t interface_index() const noexcept { return u8(8); }
+    };
+
+    struct endpoint_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_endpoint;
+        static constexpr std::size_t min_length = 7;
+
+        std::uint8_t address() const noexcept { return u8(2); }
+        std::uint8_t attributes() const noexcept { return u8(3); }
+        std::uint16_t max_packet_size() const noexcept { return u16(4); }
+        std::uint8_t interval() const noexcept { return u8(6); }
+        std::uint8_t refresh() const noexcept { return u8(7); } ///< audio endpoints only
+        std::uint8_t sync_address() const noexcept { return u8(8); } ///< audio endpoints only
+    };
+
+    struct interface_assoc_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_interface_assoc;
+        static constexpr std::size_t min_length = 8;
+
+        std::uint8_t first_interface() const noexcept { return u8(2); }
+        std::uint8_t interface_count() const noexcept { return u8(3); }
+        std::uint8_t function_class() const noexcept { return u8(4); }
+        std::uint8_t function_subclass() const noexcept { return u8(5); }
+        std::uint8_t function_protocol() const noexcept { return u8(6); }
+        std::uint8_t function_index() const noexcept { return u8(7); }
+    };
+
+    struct hid_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_hid;
+        static constexpr std::size_t min_length = 9;
+
+        std::uint16_t bcd_hid() const noexcept { return u16(2); }
+        std::uint8_t country_code() const noexcept { return u8(4); }
+        std::uint8_t num_descriptors() const noexcept { return u8(5); }
+
+        /// \returns wDescriptorLength of the report descriptor, or 0
+        std::uint16_t
+        report_length() const noexcept
+        {
+            for (std::size_t i = 0; i < num_descriptors(); ++i) {
+                if (u8(6 + 3 * i) == dt_hid_report)
+                    return u16(7 + 3 * i);
+            }
+            return 0;
+        }
+    };
+
+    struct ss_ep_companion_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_ss_ep_companion;
+        static constexpr std::size_t min_length = 6;
+
+        std::uint8_t max_burst() const noexcept { return u8(2); }
+        std::uint8_t attributes() const noexcept { return u8(3); }
+        std::uint16_t bytes_per_interval() const noexcept { return u16(4); }
+        std::uint8_t max_streams() const noexcept { return attributes() & 0x1f; } ///< bulk
+        std::uint8_t mult() const noexcept { return attributes() & 0x03; } ///< isochronous
+    };
+
+    struct ssp_iso_ep_companion_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_ssp_iso_ep_companion;
+        static constexpr std::size_t min_length = 8;
+
+        std::uint32_t bytes_per_interval() const noexcept { return u32(4); }
+    };
+
+    // binary device object store (USB 3.2 9.6.2)
+
+    struct bos_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_bos;
+        static constexpr std::size_t min_length = 5;
+
+        std::uint16_t total_length() const noexcept { return u16(2); }
+        std::uint8_t num_capabilities() const noexcept { return u8(4); }
+    };
+
+    /// Device capabilities are told apart by bDevCapabilityType, which
+    /// sits where class-specific descriptors have their subtype.
+    struct usb2_extension_cap_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_device_capability;
+        static constexpr std::uint8_t subtype_id = 0x02;
+        static constexpr std::size_t min_length = 7;
+
+        std::uint32_t attributes() const noexcept { return u32(3); }
+        bool lpm() const noexcept { return attributes() & 0x02; }
+    };
+
+    struct ss_usb_cap_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_device_capability;
+        static constexpr std::uint8_t subtype_id = 0x03;
+        static constexpr std::size_t min_length = 10;
+
+        std::uint8_t attributes() const noexcept { return u8(3); }
+
+        /// bit 0 low, 1 full, 2 high, 3 5 Gbit/s
+        std::uint16_t speeds_supported() const noexcept { return u16(4); }
+        std::uint8_t functionality_support() const noexcept { return u8(6); }
+    };
+
+    struct container_id_cap_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_device_capability;
+        static constexpr std::uint8_t subtype_id = 0x04;
+        static constexpr std::size_t min_length = 20;
+
+        bytes container_id() const noexcept { return raw.subspan(4, 16); }
+    };
+
+    struct ssp_usb_cap_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_device_capability;
+        static constexpr std::uint8_t subtype_id = 0x0a;
+        static constexpr std::size_t min_length = 12;
+
+        std::uint32_t attributes() const noexcept { return u32(4); }
+        std::uint8_t num_sublink_speed_attrs() const noexcept { return (attributes() & 0x1f) + 1; }
+    };
+
+    // communications device class (CDC 1.2)
+
+    struct cdc_header_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x00;
+        static constexpr std::size_t min_length = 5;
+
+        std::uint16_t bcd_cdc() const noexcept { return u16(3); }
+    };
+
+    struct cdc_call_mgmt_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x01;
+        static constexpr std::size_t min_length = 5;
+
+        std::uint8_t capabilities() const noexcept { return u8(3); }
+        std::uint8_t data_interface() const noexcept { return u8(4); }
+    };
+
+    struct cdc_acm_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x02;
+        static constexpr std::size_t min_length = 4;
+
+        std::uint8_t capabilities() const noexcept { return u8(3); }
+    };
+
+    struct cdc_union_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x06;
+        static constexpr std::size_t min_length = 5;
+
+        std::uint8_t control_interface() const noexcept { return u8(3); }
+        bytes subordinate_interfaces() const noexcept { return raw.subspan(4); }
+    };
+
+    struct cdc_ethernet_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x0f;
+        static constexpr std::size_t min_length = 13;
+
+        std::uint8_t mac_address_index() const noexcept { return u8(3); }
+        std::uint32_t statistics() const noexcept { return u32(4); }
+        std::uint16_t max_segment_size() const noexcept { return u16(8); }
+        std::uint16_t num_mc_filters() const noexcept { return u16(10); }
+        std::uint8_t num_power_filters() const noexcept { return u8(12); }
+    };
+
+    // audio (UAC1, and the UAC2 control header)
+
+    struct ac_header_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x01;
+        static constexpr std::size_t min_length = 8;
+
+        std::uint16_t bcd_adc() const noexcept { return u16(3); }
+        std::uint16_t total_length() const noexcept { return u16(5); }
+    };
+
+    /// UAC2 (interface protocol 0x20): bCategory precedes wTotalLength
+    struct ac2_header_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x01;
+        static constexpr std::size_t min_length = 9;
+
+        std::uint16_t bcd_adc() const noexcept { return u16(3); }
+        std::uint8_t category() const noexcept { return u8(5); }
+        std::uint16_t total_length() const noexcept { return u16(6); }
+        std::uint8_t controls() const noexcept { return u8(8); }
+    };
+
+    struct ac_input_terminal_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x02;
+        static constexpr std::size_t min_length = 12;
+
+        std::uint8_t terminal_id() const noexcept { return u8(3); }
+        std::uint16_t terminal_type() const noexcept { return u16(4); }
+        std::uint8_t assoc_terminal() const noexcept { return u8(6); }
+        std::uint8_t num_channels() const noexcept { return u8(7); }
+    };
+
+    struct ac_output_terminal_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x03;
+        static constexpr std::size_t min_length = 9;
+
+        std::uint8_t terminal_id() const noexcept { return u8(3); }
+        std::uint16_t terminal_type() const noexcept { return u16(4); }
+        std::uint8_t assoc_terminal() const noexcept { return u8(6); }
+        std::uint8_t source_id() const noexcept { return u8(7); }
+    };
+
+    struct ac_feature_unit_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x06;
+        static constexpr std::size_t min_length = 7;
+
+        std::uint8_t unit_id() const noexcept { return u8(3); }
+        std::uint8_t source_id() const noexcept { return u8(4); }
+        std::uint8_t control_size() const noexcept { return u8(5); }
+    };
+
+    struct as_general_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x01;
+        static constexpr std::size_t min_length = 7;
+
+        std::uint8_t terminal_link() const noexcept { return u8(3); }
+        std::uint8_t delay() const noexcept { return u8(4); }
+        std::uint16_t format_tag() const noexcept { return u16(5); }
+    };
+
+    struct as_format_type_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x02;
+        static constexpr std::size_t min_length = 8;
+
+        std::uint8_t format_type() const noexcept { return u8(3); }
+        std::uint8_t num_channels() const noexcept { return u8(4); }
+        std::uint8_t subframe_size() const noexcept { return u8(5); }
+        std::uint8_t bit_resolution() const noexcept { return u8(6); }
+
+        /// 0 means continuous (lower and upper bound follow)
+        std::uint8_t num_sample_freqs() const noexcept { return u8(7); }
+
+        /// \returns number of (possibly truncated) frequencies present
+        std::size_t
+        sample_freqs_present() const noexcept
+        {
+            return (raw.size() - 8) / 3;
+        }
+
+        std::uint32_t sample_freq(std::size_t i) const noexcept { return u24(8 + 3 * i); }
+    };
+
+    struct audio_endpoint_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_endpoint;
+        static constexpr std::uint8_t subtype_id = 0x01;
+        static constexpr std::size_t min_length = 7;
+
+        std::uint8_t attributes() const noexcept { return u8(3); }
+        std::uint8_t lock_delay_units() const noexcept { return u8(4); }
+        std::uint16_t lock_delay() const noexcept { return u16(5); }
+    };
+
+    // video (UVC 1.1/1.5)
+
+    struct vc_header_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x01;
+        static constexpr std::size_t min_length = 12;
+
+        std::uint16_t bcd_uvc() const noexcept { return u16(3); }
+        std::uint16_t total_length() const noexcept { return u16(5); }
+        std::uint32_t clock_frequency() const noexcept { return u32(7); }
+        std::uint8_t num_streaming_interfaces() const noexcept { return u8(11); }
+    };
+
+    struct vc_input_terminal_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x02;
+        static constexpr std::size_t min_length = 8;
+
+        std::uint8_t terminal_id() const noexcept { return u8(3); }
+        std::uint16_t terminal_type() const noexcept { return u16(4); }
+        std::uint8_t assoc_terminal() const noexcept { return u8(6); }
+    };
+
+    struct vc_output_terminal_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x03;
+        static constexpr std::size_t min_length = 9;
+
+        std::uint8_t terminal_id() const noexcept { return u8(3); }
+        std::uint16_t terminal_type() const noexcept { return u16(4); }
+        std::uint8_t assoc_terminal() const noexcept { return u8(6); }
+        std::uint8_t source_id() const noexcept { return u8(7); }
+    };
+
+    struct vc_processing_unit_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x05;
+        static constexpr std::size_t min_length = 10;
+
+        std::uint8_t unit_id() const noexcept { return u8(3); }
+        std::uint8_t source_id() const noexcept { return u8(4); }
+        std::uint16_t max_multiplier() const noexcept { return u16(5); }
+    };
+
+    struct vs_input_header_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x01;
+        static constexpr std::size_t min_length = 13;
+
+        std::uint8_t num_formats() const noexcept { return u8(3); }
+        std::uint16_t total_length() const noexcept { return u16(4); }
+        std::uint8_t endpoint_address() const noexcept { return u8(6); }
+    };
+
+    struct vs_format_uncompressed_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x04;
+        static constexpr std::size_t min_length = 27;
+
+        std::uint8_t format_index() const noexcept { return u8(3); }
+        std::uint8_t num_frames() const noexcept { return u8(4); }
+        bytes guid() const noexcept { return raw.subspan(5, 16); }
+        std::uint8_t bits_per_pixel() const noexcept { return u8(21); }
+    };
+
+    struct vs_format_mjpeg_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::uint8_t subtype_id = 0x06;
+        static constexpr std::size_t min_length = 11;
+
+        std::uint8_t format_index() const noexcept { return u8(3); }
+        std::uint8_t num_frames() const noexcept { return u8(4); }
+    };
+
+    /// Shared layout of the uncompressed (0x05) and MJPEG (0x07)
+    /// frame descriptors.
+    struct vs_frame_desc : descriptor
+    {
+        static constexpr std::uint8_t type_id = dt_cs_interface;
+        static constexpr std::size_t min_length = 26;
+
+        bool mjpeg() const noexcept { return subtype() == 0x07; }
+        std::uint8_t frame_index() const noexcept { return u8(3); }
+        std::uint16_t width() const noexcept { return u16(5); }
+        std::uint16_t height() const noexcept { return u16(7); }
+        std::uint32_t max_bit_rate() const noexcept { return u32(13); }
+        std::uint32_t default_interval() const noexcept { return u32(21); } ///< 100ns units
+    };
+
+
+    /// \returns \c d as a \c T if its type (and subtype, if \c T has
+    /// one) match and it is long enough
+    template <typename T>
+    constexpr std::optional<T>
+    as(descriptor d) noexcept
+    {
+        if (d.type() != T::type_id || d.raw.size() < T::min_length)
+            return std::nullopt;
+        if constexpr (requires { T::subtype_id; }) {
+            if (d.subtype() != T::subtype_id)
+                return std::nullopt;
+        }
+        return T{d};
+    }
+
+
+    /// Interface whose descriptors are being walked; class-specific
+    /// descriptors are only meaningful relative to it.
+    struct context
+    {
+        std::uint8_t interface_class = 0;
+        std::uint8_t interface_subclass = 0;
+        std::uint8_t protocol = 0;
+    };
+
+    /// Anything decode() does not recognize stays a plain descriptor.
+    using decoded = std::variant<descriptor, interface_assoc_desc, hid_desc, ss_ep_companion_desc,
+            ssp_iso_ep_companion_desc, cdc_header_desc, cdc_call_mgmt_desc, cdc_acm_desc,
+            cdc_union_desc, cdc_ethernet_desc, ac_header_desc, ac2_header_desc,
+            ac_input_terminal_desc, ac_output_terminal_desc, ac_feature_unit_desc, as_general_desc,
+            as_format_type_desc, audio_endpoint_desc, vc_header_desc, vc_input_terminal_desc,
+            vc_output_terminal_desc, vc_processing_unit_desc, vs_input_header_desc,
+            vs_format_uncompressed_desc, vs_format_mjpeg_desc, vs_frame_desc>;
+
+    /// Picks the typed view for a descriptor that is not a config,
+    /// interface or endpoint descriptor.
+    decoded decode(descriptor, context const&) noexcept;
+
+} // namespace desc
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <libusb.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/// What a backend fetches beyond a device's location (bus, address,
+/// ports and speed), which is always known. Fetch only what is needed:
+/// configurations and strings can cost a file read or a control
+/// transfer per device.
+enum fetch_flags : unsigned
+{
+    fetch_device_desc = 1u << 0,
+    fetch_configs = 1u << 1 | fetch_device_desc,
+    fetch_strings = 1u << 2 | fetch_device_desc,
+    fetch_bos = 1u << 3 | fetch_device_desc, ///< devices declaring USB 2.01 or later
+};
+
+constexpr bool
+wants(unsigned what, fetch_flags f) noexcept
+{
+    return (what & f) == f;
+}
+
+
+/// What lsusb2 knows about one device, independent of the backend that
+/// enumerated it.
+struct usb_device
+{
+    std::uint8_t bus = 0;
+    std::uint8_t address = 0;
+    std::uint8_t num_ports = 0;
+    std::uint8_t ports[7] = {0}; ///< port numbers from the root hub down
+    libusb_speed speed = LIBUSB_SPEED_UNKNOWN;
+    libusb_device_descriptor desc{}; ///< host byte order
+    std::vector<std::vector<std::uint8_t>> configs; ///< raw, wTotalLength bytes each
+    std::string manufacturer; ///< empty if not fetched or not readable
+    std::string product;
+    std::string serial;
+    std::vector<std::uint8_t> bos; ///< raw, wTotalLength bytes; empty if not fetched or none
+};
@@ -0,0 +1,50 @@
+#include "format.hpp"
+#include <unistd.h>
+#include <cerrno>
+
+
+std::optional<output_format>
+parse_output_format(std::string_view s) noexcept
+{
+    // clang-format off
+    if (s == "text")    return output_format::text;
+    if (s == "json")    return output_format::json;
+    if (s == "cbor")    return output_format::cbor;
+    // clang-format on
+    return std::nullopt;
+}
+
+std::unique_ptr<formatter>
+make_formatter(output_format format, bool show_ids)
+{
+    switch (format) {
+        case output_format::json:
+            return make_json_formatter();
+        case output_format::cbor:
+            return make_cbor_formatter();
+        case output_format::text:
+        default:
+            return make_text_formatter(show_ids);
+    }
+}
+
+bool
+output_writer::flush()
+{
+    char const* p = buf_.data();
+    std::size_t left = buf_.size();
+    while (left != 0 && !failed_) {
+        ssize_t const n = ::write(fd_, p, left);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            failed_ = true; // e.g. EPIPE; keep going so the exit status reflects it
+            break;
+        }
+        p += n;
+        left -= static_cast<std::size_t>(n);
+    }
+
+    buf_.clear();
+    return !failed_;
+}
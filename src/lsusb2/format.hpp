@@ -0,0 +1,86 @@
+#pragma once
+
+#include "model.hpp"
+#include <fmt/format.h>
+#include <cstddef> // std::size_t
+#include <memory>
+#include <optional>
+#include <string_view>
+
+
+enum class output_format
+{
+    text,
+    json,
+    cbor,
+};
+
+std::optional<output_format> parse_output_format(std::string_view) noexcept;
+
+
+/// Renders devices into a caller-owned buffer. begin() and end() wrap
+/// the whole listing; device() is called once per listed device, so
+/// the buffer can be flushed in between.
+class formatter
+{
+public:
+    virtual ~formatter() = default;
+
+    virtual void begin(fmt::memory_buffer&) {}
+    virtual void end(fmt::memory_buffer&) {}
+
+    /// \returns false if the device's descriptors are malformed (what
+    /// could be decoded has been rendered)
+    virtual bool device(fmt::memory_buffer&, bus_model const&, device_node const&,
+            std::size_t index) = 0;
+
+    /// Like device(), but without state carried over from the devices
+    /// before it, and safe to call from several threads at once: each
+    /// device is rendered into a buffer of its own. The parts are
+    /// joined in index order with separator() in between.
+    virtual bool device_part(fmt::memory_buffer&, bus_model const&, device_node const&,
+            std::size_t index) const = 0;
+    virtual void separator(fmt::memory_buffer&) const {}
+};
+
+/// \c show_ids adds vendor:product to the text mode device headers
+std::unique_ptr<formatter> make_formatter(output_format, bool show_ids);
+std::unique_ptr<formatter> make_text_formatter(bool show_ids);
+std::unique_ptr<formatter> make_json_formatter();
+std::unique_ptr<formatter> make_cbor_formatter();
+
+/// Appends one device as a JSON object, as found in the JSON
+/// formatter's "devices" array.
+void format_json_device(
+        fmt::memory_buffer&, bus_model const&, device_node const&, std::size_t index);
+
+
+/// Accumulates output in a single buffer and hands it to the kernel
+/// with as few write(2) calls as possible: once at the end for normal
+/// buses, or whenever a large listing passes flush_threshold.
+class output_writer
+{
+private:
+    fmt::memory_buffer buf_;
+    int fd_;
+    bool failed_ = false;
+
+public:
+    static constexpr std::size_t flush_threshold = 256 * 1024;
+
+    explicit output_writer(int fd) noexcept
+            : fd_(fd)
+    {}
+
+    fmt::memory_buffer& buffer() noexcept { return buf_; }
+
+    void
+    flush_if_full()
+    {
+        if (buf_.size() >= flush_threshold)
+            flush();
+    }
+
+    /// \returns false if any write so far has failed
+    bool flush();
+};
@@ -0,0 +1,613 @@
+#include "describe.hpp"
+#include "format.hpp"
+#include "util/usb_enums.hpp"
+#include <bit> // std::bit_cast
+#include <concepts>
+#include <iterator>
+#include <type_traits>
+
+
+// JSON and CBOR share one schema; emit_device() walks the model once
+// and drives either encoder. Bump format_version on incompatible
+// changes.
+//
+// {"format_version": 1, "devices": [{
+//     "index", "bus", "address", "ports": [...], "speed", "speed_mbps",
+//     "usb_version", "class", "class_name", "subclass", "protocol",
+//     "max_packet_size0", "vendor_id", "product_id",
+//     "vendor_name", "product_name" (if in usb.ids), "device_version",
+//     "manufacturer_index", "product_index", "serial_number_index",
+//     "manufacturer", "product", "serial_number" (if resolved),
+//     "num_configurations",
+//     "configurations": [{
+//         "total_length", "value", "string_index", "attributes",
+//         "max_power", "num_interfaces", "malformed_bytes", "extra": [...],
+//         "interfaces": [{
+//             "number",
+//             "altsettings": [{
+//                 "alternate_setting", "class", "class_name", "subclass",
+//                 "protocol", "string_index", "num_endpoints", "extra": [...],
+//                 "endpoints": [{
+//                     "address", "number", "direction", "attributes",
+//                     "transfer_type", "iso_sync_type", "iso_usage_type",
+//                     "max_packet_size", "interval", "refresh",
+//                     "sync_address", "extra": [...]}]}]}]}]}]}
+//
+// Each "extra" element is {"kind": <name>, <describe() fields>...}.
+// Strings read from the device need not be UTF-8: JSON replaces invalid
+// sequences with U+FFFD, CBOR writes such strings as byte strings.
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+
+    /// \returns the length of the well-formed UTF-8 sequence (RFC 3629:
+    /// no overlong forms, surrogates or code points past U+10FFFF) that
+    /// starts \c s, or 0 if there is none
+    std::size_t
+    utf8_sequence(std::string_view s) noexcept
+    {
+        auto const at = [s](std::size_t i) { return static_cast<unsigned char>(s[i]); };
+        unsigned char const c = at(0);
+        std::size_t n = 0;
+        unsigned char lo = 0x80;
+        unsigned char hi = 0xbf;
+        if (c < 0x80)
+            return 1;
+        if (c >= 0xc2 && c <= 0xdf) {
+            n = 2;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            n = 3;
+            lo = (c == 0xe0) ? 0xa0 : 0x80;
+            hi = (c == 0xed) ? 0x9f : 0xbf;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            n = 4;
+            lo = (c == 0xf0) ? 0x90 : 0x80;
+            hi = (c == 0xf4) ? 0x8f : 0xbf;
+        } else {
+            return 0;
+        }
+        if (s.size() < n || at(1) < lo || at(1) > hi)
+            return 0;
+        for (std::size_t i = 2; i < n; ++i) {
+            if (at(i) < 0x80 || at(i) > 0xbf)
+                return 0;
+        }
+        return n;
+    }
+
+    bool
+    is_utf8(std::string_view s) noexcept
+    {
+        while (!s.empty()) {
+            std::size_t const n = utf8_sequence(s);
+            if (n == 0)
+                return false;
+            s.remove_prefix(n);
+        }
+        return true;
+    }
+
+    class json_encoder
+    {
+    private:
+        buffer& buf_;
+        bool need_comma_ = false;
+
+    public:
+        explicit json_encoder(buffer& buf) noexcept
+                : buf_(buf)
+        {}
+
+        void begin_map() { open('{'); }
+        void end_map() { close('}'); }
+        void begin_array() { open('['); }
+        void end_array() { close(']'); }
+
+        void
+        key(std::string_view k)
+        {
+            separate();
+            string(k);
+            buf_.push_back(':');
+            need_comma_ = false;
+        }
+
+        template <std::unsigned_integral T>
+        void
+        value(T v)
+        {
+            separate();
+            fmt::format_to(std::back_inserter(buf_), "{}", v);
+            need_comma_ = true;
+        }
+
+        void
+        value(double v)
+        {
+            separate();
+            fmt::format_to(std::back_inserter(buf_), "{}", v);
+            need_comma_ = true;
+        }
+
+        void
+        value(std::string_view v)
+        {
+            separate();
+            string(v);
+            need_comma_ = true;
+        }
+
+    private:
+        void
+        separate()
+        {
+            if (need_comma_)
+                buf_.push_back(',');
+        }
+
+        void
+        open(char c)
+        {
+            separate();
+            buf_.push_back(c);
+            need_comma_ = false;
+        }
+
+        void
+        close(char c)
+        {
+            buf_.push_back(c);
+            need_comma_ = true;
+        }
+
+        /// Descriptor strings are bytes, not necessarily UTF-8: valid
+        /// sequences pass through, each byte of an invalid one becomes
+        /// U+FFFD, and control characters are escaped, so the output is
+        /// always valid.
+        void
+        string(std::string_view s)
+        {
+            buf_.push_back('"');
+            while (!s.empty()) {
+                char const c = s.front();
+                auto const u = static_cast<unsigned char>(c);
+                std::size_t const n = utf8_sequence(s);
+                if (c == '"' || c == '\\') {
+                    buf_.push_back('\\');
+                    buf_.push_back(c);
+                } else if (u < 0x20 || u == 0x7f) {
+                    fmt::format_to(std::back_inserter(buf_), "\\u{:04x}", u);
+                } else if (n == 0) {
+                    buf_.append(std::string_view("\\ufffd"));
+                } else {
+                    buf_.append(s.substr(0, n));
+                }
+                s.remove_prefix(n == 0 ? 1 : n);
+            }
+            buf_.push_back('"');
+        }
+    };
+
+    /// RFC 8949. Maps and arrays use indefinite lengths so that
+    /// nothing has to be counted before it is written.
+    class cbor_encoder
+    {
+    private:
+        buffer& buf_;
+
+        enum major : std::uint8_t
+        {
+            unsigned_int = 0,
+            byte_string = 2,
+            text_string = 3,
+        };
+
+    public:
+        explicit cbor_encoder(buffer& buf) noexcept
+                : buf_(buf)
+        {}
+
+        void begin_map() { buf_.push_back(static_cast<char>(0xbf)); }
+        void end_map() { buf_.push_back(static_cast<char>(0xff)); }
+        void begin_array() { buf_.push_back(static_cast<char>(0x9f)); }
+        void end_array() { buf_.push_back(static_cast<char>(0xff)); }
+
+        void key(std::string_view k) { value(k); }
+
+        template <std::unsigned_integral T>
+        void
+        value(T v)
+        {
+            head(unsigned_int, v);
+        }
+
+        void
+        value(double v)
+        {
+            buf_.push_back(static_cast<char>(0xfb));
+            be(std::bit_cast<std::uint64_t>(v), 8);
+        }
+
+        /// Text strings must be UTF-8; descriptor strings that are not
+        /// are written as byte strings instead.
+        void
+        value(std::string_view v)
+        {
+            head(is_utf8(v) ? text_string : byte_string, v.size());
+            buf_.append(v);
+        }
+
+    private:
+        void
+        head(major m, std::uint64_t v)
+        {
+            auto const mt = static_cast<std::uint8_t>(m << 5);
+            if (v < 24) {
+                buf_.push_back(static_cast<char>(mt | v));
+            } else if (v <= 0xff) {
+                buf_.push_back(static_cast<char>(mt | 24));
+                be(v, 1);
+            } else if (v <= 0xffff) {
+                buf_.push_back(static_cast<char>(mt | 25));
+                be(v, 2);
+            } else if (v <= 0xffff'ffff) {
+                buf_.push_back(static_cast<char>(mt | 26));
+                be(v, 4);
+            } else {
+                buf_.push_back(static_cast<char>(mt | 27));
+                be(v, 8);
+            }
+        }
+
+        void
+        be(std::uint64_t v, int bytes)
+        {
+            for (int i = bytes - 1; i >= 0; --i)
+                buf_.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+        }
+    };
+
+
+    /// Feeds describe() output to an encoder as map entries.
+    template <typename Enc>
+    class describe_visitor
+    {
+    private:
+        Enc& enc_;
+
+    public:
+        explicit describe_visitor(Enc& enc) noexcept
+                : enc_(enc)
+        {}
+
+        void
+        name(char const* name)
+        {
+            enc_.key("kind");
+            enc_.value(std::string_view(name));
+        }
+
+        template <typename T>
+        void
+        field(char const* key, T const& v)
+        {
+            enc_.key(key);
+            write_value(v);
+        }
+
+        template <typename Get>
+        void
+        list(char const* key, std::size_t n, Get&& get)
+        {
+            enc_.key(key);
+            enc_.begin_array();
+            for (std::size_t i = 0; i < n; ++i)
+                write_value(get(i));
+            enc_.end_array();
+        }
+
+    private:
+        template <std::unsigned_integral T>
+        void
+        write_value(T v)
+        {
+            enc_.value(v);
+        }
+
+        void write_value(double v) { enc_.value(v); }
+        void write_value(std::string_view v) { enc_.value(v); }
+        void write_value(hex v) { enc_.value(v.value); }
+        void write_value(bcd v) { enc_.value(std::string_view(to_version(v.value))); }
+    };
+
+
+    constexpr char const*
+    speed_name(libusb_speed e) noexcept
+    {
+        // clang-format off
+        switch (e) {
+            case LIBUSB_SPEED_LOW:          return "low";
+            case LIBUSB_SPEED_FULL:         return "full";
+            case LIBUSB_SPEED_HIGH:         return "high";
+            case LIBUSB_SPEED_SUPER:        return "super";
+            case LIBUSB_SPEED_SUPER_PLUS:   return "super_plus";
+            default: break;
+        }
+        // clang-format on
+        return "unknown";
+    }
+
+    constexpr std::uint32_t
+    speed_mbps(libusb_speed e) noexcept
+    {
+        // clang-format off
+        switch (e) {
+            case LIBUSB_SPEED_LOW:          return 1; // 1.5, rounded down
+            case LIBUSB_SPEED_FULL:         return 12;
+            case LIBUSB_SPEED_HIGH:         return 480;
+            case LIBUSB_SPEED_SUPER:        return 5000;
+            case LIBUSB_SPEED_SUPER_PLUS:   return 10000;
+            default: break;
+        }
+        // clang-format on
+        return 0;
+    }
+
+    /// "interface-specific", "(in) host-to-device" and friends are for
+    /// people; the structured formats use short stable tokens.
+    constexpr char const*
+    short_name(char const* s) noexcept
+    {
+        return (s[0] == '(') ? (s[1] == 'i' ? "in" : "out") : s;
+    }
+
+
+    template <typename Enc>
+    void
+    field(Enc& enc, std::string_view key, std::uint64_t v)
+    {
+        enc.key(key);
+        enc.value(v);
+    }
+
+    template <typename Enc>
+    void
+    field(Enc& enc, std::string_view key, std::string_view v)
+    {
+        enc.key(key);
+        enc.value(v);
+    }
+
+    template <typename Enc>
+    void
+    emit_extras(Enc& enc, std::span<extra_node const> extras)
+    {
+        enc.key("extra");
+        enc.begin_array();
+        for (extra_node const& e : extras) {
+            enc.begin_map();
+            describe_visitor<Enc> v(enc);
+            describe(desc::decode(e.desc, e.ctx), v);
+            enc.end_map();
+        }
+        enc.end_array();
+    }
+
+    template <typename Enc>
+    void
+    emit_endpoint(Enc& enc, bus_model const& model, endpoint_node const& ep)
+    {
+        desc::endpoint_desc const& d = ep.desc;
+        std::uint8_t const attrs = d.attributes();
+
+        enc.begin_map();
+        field(enc, "address", d.address());
+        field(enc, "number", ep_addr_to_ep_num(d.address()));
+        field(enc, "direction", short_name(to_str(ep_addr_to_endpoint_direction(d.address()))));
+        field(enc, "attributes", attrs);
+        field(enc, "transfer_type", to_str(ep_attr_to_transfer_type(attrs)));
+        field(enc, "iso_sync_type", to_str(ep_attr_to_iso_sync_type(attrs)));
+        field(enc, "iso_usage_type", to_str(ep_attr_to_iso_usage_type(attrs)));
+        field(enc, "max_packet_size", d.max_packet_size());
+        field(enc, "interval", d.interval());
+        field(enc, "refresh", d.refresh());
+        field(enc, "sync_address", d.sync_address());
+        emit_extras(enc, model.extras(ep));
+        enc.end_map();
+    }
+
+    template <typename Enc>
+    void
+    emit_altsetting(Enc& enc, bus_model const& model, altsetting_node const& alt)
+    {
+        desc::interface_desc const& d = alt.desc;
+
+        enc.begin_map();
+        field(enc, "alternate_setting", d.alt_setting());
+        field(enc, "class", d.interface_class());
+        field(enc, "class_name", to_str(static_cast<libusb_class_code>(d.interface_class())));
+        field(enc, "subclass", d.interface_subclass());
+        field(enc, "protocol", d.protocol());
+        field(enc, "string_index", d.interface_index());
+        field(enc, "num_endpoints", d.num_endpoints());
+        emit_extras(enc, model.extras(alt));
+
+        enc.key("endpoints");
+        enc.begin_array();
+        for (endpoint_node const& ep : model.endpoints(alt))
+            emit_endpoint(enc, model, ep);
+        enc.end_array();
+        enc.end_map();
+    }
+
+    template <typename Enc>
+    void
+    emit_config(Enc& enc, bus_model const& model, config_node const& config)
+    {
+        desc::config_desc const& d = config.desc;
+
+        enc.begin_map();
+        field(enc, "total_length", d.total_length());
+        field(enc, "value", d.config_value());
+        field(enc, "string_index", d.config_index());
+        field(enc, "attributes", d.attributes());
+        field(enc, "max_power", d.max_power());
+        field(enc, "num_interfaces", d.num_interfaces());
+        field(enc, "malformed_bytes", config.malformed_bytes);
+        emit_extras(enc, model.extras(config));
+
+        enc.key("interfaces");
+        enc.begin_array();
+        for (interface_node const& iface : model.interfaces(config)) {
+            enc.begin_map();
+            field(enc, "number", iface.number);
+            enc.key("altsettings");
+            enc.begin_array();
+            for (altsetting_node const& alt : model.altsettings(iface))
+                emit_altsetting(enc, model, alt);
+            enc.end_array();
+            enc.end_map();
+        }
+        enc.end_array();
+        enc.end_map();
+    }
+
+    template <typename Enc>
+    void
+    emit_device(Enc& enc, bus_model const& model, device_node const& dev, std::size_t index)
+    {
+        libusb_device_descriptor const& dd = dev.desc;
+
+        enc.begin_map();
+        field(enc, "index", index);
+        field(enc, "bus", dev.bus);
+        field(enc, "address", dev.address);
+        enc.key("ports");
+        enc.begin_array();
+        for (std::size_t i = 0; i < dev.num_ports; ++i)
+            enc.value(dev.ports[i]);
+        enc.end_array();
+        field(enc, "speed", speed_name(dev.speed));
+        field(enc, "speed_mbps", speed_mbps(dev.speed));
+        field(enc, "usb_version", to_version(dd.bcdUSB));
+        field(enc, "class", dd.bDeviceClass);
+        field(enc, "class_name", to_str(static_cast<libusb_class_code>(dd.bDeviceClass)));
+        field(enc, "subclass", dd.bDeviceSubClass);
+        field(enc, "protocol", dd.bDeviceProtocol);
+        field(enc, "max_packet_size0", dd.bMaxPacketSize0);
+        field(enc, "vendor_id", dd.idVendor);
+        field(enc, "product_id", dd.idProduct);
+        if (!dev.vendor_name.empty())
+            field(enc, "vendor_name", dev.vendor_name);
+        if (!dev.product_name.empty())
+            field(enc, "product_name", dev.product_name);
+        field(enc, "device_version", to_version(dd.bcdDevice));
+        field(enc, "manufacturer_index", dd.iManufacturer);
+        field(enc, "product_index", dd.iProduct);
+        field(enc, "serial_number_index", dd.iSerialNumber);
+        if (!dev.manufacturer.empty())
+            field(enc, "manufacturer", dev.manufacturer);
+        if (!dev.product.empty())
+            field(enc, "product", dev.product);
+        if (!dev.serial.empty())
+            field(enc, "serial_number", dev.serial);
+        field(enc, "num_configurations", dd.bNumConfigurations);
+
+        enc.key("configurations");
+        enc.begin_array();
+        for (config_node const& config : model.configs(dev))
+            emit_config(enc, model, config);
+        enc.end_array();
+        enc.end_map();
+    }
+
+
+    bool
+    well_formed(bus_model const& model, device_node const& dev) noexcept
+    {
+        for (config_node const& config : model.configs(dev)) {
+            if (config.malformed_bytes != 0)
+                return false;
+        }
+        return true;
+    }
+
+
+    /// Streams {"format_version": 1, "devices": [...]} one device at a
+    /// time; the encoder's state carries over between device() calls.
+    template <typename Enc>
+    class structured_formatter : public formatter
+    {
+    private:
+        std::unique_ptr<Enc> enc_;
+
+    public:
+        void
+        begin(buffer& buf) override
+        {
+            enc_ = std::make_unique<Enc>(buf);
+            enc_->begin_map();
+            field(*enc_, "format_version", 1u);
+            enc_->key("devices");
+            enc_->begin_array();
+        }
+
+        bool
+        device(buffer&, bus_model const& model, device_node const& dev,
+                std::size_t index) override
+        {
+            emit_device(*enc_, model, dev, index);
+            return well_formed(model, dev);
+        }
+
+        /// A part is an array element on its own; JSON needs the comma
+        /// between parts that the encoder would otherwise have written.
+        bool
+        device_part(buffer& buf, bus_model const& model, device_node const& dev,
+                std::size_t index) const override
+        {
+            Enc enc(buf);
+            emit_device(enc, model, dev, index);
+            return well_formed(model, dev);
+        }
+
+        void
+        separator(buffer& buf) const override
+        {
+            if constexpr (std::is_same_v<Enc, json_encoder>)
+                buf.push_back(',');
+        }
+
+        void
+        end(buffer& buf) override
+        {
+            enc_->end_array();
+            enc_->end_map();
+            if constexpr (std::is_same_v<Enc, json_encoder>)
+                buf.push_back('\n');
+        }
+    };
+
+} // namespace
+
+
+std::unique_ptr<formatter>
+make_json_formatter()
+{
+    return std::make_unique<structured_formatter<json_encoder>>();
+}
+
+std::unique_ptr<formatter>
+make_cbor_formatter()
+{
+    return std::make_unique<structured_formatter<cbor_encoder>>();
+}
+
+void
+format_json_device(buffer& buf, bus_model const& model, device_node const& dev, std::size_t index)
+{
+    json_encoder enc(buf);
+    emit_device(enc, model, dev, index);
+}
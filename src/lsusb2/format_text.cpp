@@ -0,0 +1,279 @@
+#include "describe.hpp"
+#include "format.hpp"
+#include "util/assert.hpp"
+#include "util/log.hpp"
+#include "util/usb_enums.hpp"
+#include <concepts>
+#include <iterator>
+#include <string>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+
+    /// " (name)", or nothing if the name is unknown.
+    std::string
+    name_suffix(std::string_view name)
+    {
+        return name.empty() ? std::string() : fmt::format(" ({})", name);
+    }
+
+    /// A string descriptor index, with the string if it was resolved.
+    std::string
+    string_ref(std::uint8_t index, std::string_view s)
+    {
+        return s.empty() ? fmt::to_string(index) : fmt::format("{} \"{}\"", index, s);
+    }
+
+    /// Renders describe() output as one line: "name: key value, ...".
+    class line_visitor
+    {
+    private:
+        buffer& buf_;
+        bool first_ = true;
+
+    public:
+        explicit line_visitor(buffer& buf) noexcept
+                : buf_(buf)
+        {}
+
+        void
+        name(char const* name)
+        {
+            fmt::format_to(std::back_inserter(buf_), "{}:", name);
+        }
+
+        template <typename T>
+        void
+        field(char const* key, T const& v)
+        {
+            write_key(key);
+            write_value(v);
+        }
+
+        template <typename Get>
+        void
+        list(char const* key, std::size_t n, Get&& get)
+        {
+            write_key(key);
+            if (n == 0)
+                buf_.append(std::string_view("<none>"));
+            for (std::size_t i = 0; i < n; ++i) {
+                if (i != 0)
+                    buf_.push_back(',');
+                write_value(get(i));
+            }
+        }
+
+    private:
+        void
+        write_key(char const* key)
+        {
+            buf_.append(std::string_view(first_ ? " " : ", "));
+            first_ = false;
+            for (; *key != '\0'; ++key)
+                buf_.push_back(*key == '_' ? ' ' : *key);
+            buf_.push_back(' ');
+        }
+
+        template <std::unsigned_integral T>
+        void
+        write_value(T v)
+        {
+            fmt::format_to(std::back_inserter(buf_), "{}", v);
+        }
+
+        void write_value(double v) { fmt::format_to(std::back_inserter(buf_), "{:.2f}", v); }
+        void write_value(std::string_view v) { buf_.append(v); }
+        void write_value(bcd v) { buf_.append(to_version(v.value)); }
+
+        void
+        write_value(hex v)
+        {
+            fmt::format_to(std::back_inserter(buf_), "{:#0{}x}", v.value, v.digits + 2);
+        }
+    };
+
+
+    void
+    format_extras(buffer& buf, std::span<extra_node const> extras, int indent)
+    {
+        for (extra_node const& e : extras) {
+            fmt::format_to(std::back_inserter(buf), "{:{}}", "", indent);
+            line_visitor v(buf);
+            describe(desc::decode(e.desc, e.ctx), v);
+            buf.push_back('\n');
+        }
+    }
+
+    void
+    format_interface_desc(buffer& buf, desc::interface_desc const& ifd)
+    {
+        fmt::format_to(std::back_inserter(buf),
+                "          number:             {}\n"
+                "          alternate setting:  {}\n"
+                "          class:              {}\n"
+                "          sub-class:          {}\n"
+                "          protocol:           {}\n"
+                "          interface index:    {}\n"
+                "          num endpoints:      {}\n",
+                ifd.number(), ifd.alt_setting(),
+                to_str(static_cast<libusb_class_code>(ifd.interface_class())),
+                to_str(static_cast<libusb_class_code>(ifd.interface_subclass())), ifd.protocol(),
+                ifd.interface_index(), ifd.num_endpoints());
+    }
+
+    void
+    format_endpoint_desc(buffer& buf, desc::endpoint_desc const& epd)
+    {
+        std::uint8_t const addr = epd.address();
+        std::uint8_t const attrs = epd.attributes();
+
+        fmt::format_to(std::back_inserter(buf),
+                "              address:           {}\n"
+                "                number:            {}\n"
+                "                direction:         {}\n"
+                "              attrs:             {}\n"
+                "                transfer type:     {}\n"
+                "                iso sync type:     {}\n"
+                "                iso usage type:    {}\n"
+                "              max packet size:   {} bytes\n"
+                "              interval:          {} msec\n"
+                "              refresh:           {}\n"
+                "              sync address:      {}\n",
+                addr, ep_addr_to_ep_num(addr), to_str(ep_addr_to_endpoint_direction(addr)),
+                attrs, to_str(ep_attr_to_transfer_type(attrs)),
+                to_str(ep_attr_to_iso_sync_type(attrs)), to_str(ep_attr_to_iso_usage_type(attrs)),
+                epd.max_packet_size(), epd.interval(), epd.refresh(), epd.sync_address());
+    }
+
+    bool
+    format_config_desc(buffer& buf, bus_model const& model, config_node const& config)
+    {
+        desc::config_desc const& cd = config.desc;
+
+        fmt::format_to(std::back_inserter(buf),
+                "      total length:    {}\n"
+                "      config value:    {}\n"
+                "      config:          {}\n"
+                "      attributes:      {}\n"
+                "      max power:       {}\n"
+                "      num interfaces:  {}\n",
+                cd.total_length(), cd.config_value(), cd.config_index(), cd.attributes(),
+                cd.max_power(), cd.num_interfaces());
+        format_extras(buf, model.extras(config), 8);
+
+        int iface_num = 0;
+        for (interface_node const& iface : model.interfaces(config)) {
+            for (altsetting_node const& alt : model.altsettings(iface)) {
+                fmt::format_to(std::back_inserter(buf), "        interface {}:\n", iface_num++);
+                format_interface_desc(buf, alt.desc);
+                format_extras(buf, model.extras(alt), 12);
+
+                int ep_num = 0;
+                for (endpoint_node const& ep : model.endpoints(alt)) {
+                    fmt::format_to(std::back_inserter(buf), "            endpoint {}:\n", ep_num++);
+                    format_endpoint_desc(buf, ep.desc);
+                    format_extras(buf, model.extras(ep), 16);
+                }
+            }
+        }
+
+        if (config.malformed_bytes != 0) {
+            LOG_ERROR("{}: {} bytes of malformed descriptors", __builtin_FUNCTION(),
+                    config.malformed_bytes);
+            return false;
+        }
+
+        return true;
+    }
+
+
+    class text_formatter : public formatter
+    {
+    private:
+        bool show_ids_;
+
+    public:
+        explicit text_formatter(bool show_ids) noexcept
+                : show_ids_(show_ids)
+        {}
+
+        bool
+        device(buffer& buf, bus_model const& model, device_node const& dev,
+                std::size_t index) override
+        {
+            return device_part(buf, model, dev, index);
+        }
+
+        bool
+        device_part(buffer& buf, bus_model const& model, device_node const& dev,
+                std::size_t index) const override
+        {
+            libusb_device_descriptor const& dd = dev.desc;
+            auto out = std::back_inserter(buf);
+
+            if (show_ids_)
+                fmt::format_to(out, "device {}: {:04x}:{:04x}\n", index, dd.idVendor, dd.idProduct);
+            else
+                fmt::format_to(out, "device {}:\n", index);
+
+            if (dev.num_ports == 0) {
+                fmt::format_to(out, "  bus:                {}\n"
+                                    "  address:            {}\n"
+                                    "  port(s):            <none>\n",
+                        dev.bus, dev.address);
+            } else {
+                fmt::format_to(out, "  bus:                {}\n"
+                                    "  address:            {}\n"
+                                    "  port(s):            {}\n",
+                        dev.bus, dev.address,
+                        fmt::join(dev.ports, dev.ports + dev.num_ports, ","));
+            }
+
+            DEBUG_ASSERT(dd.bLength == 18);
+            DEBUG_ASSERT(dd.bDescriptorType == LIBUSB_DT_DEVICE);
+
+            fmt::format_to(out,
+                    "  speed:              {}\n"
+                    "  usb spec release:   {}\n"
+                    "  class:              {}\n"
+                    "  subclass:           {}\n"
+                    "  protocol:           {}\n"
+                    "  max packet size:    {}\n"
+                    "  vendor id:          {:#06x}{}\n"
+                    "  product id:         {:#06x}{}\n"
+                    "  device release:     {}\n"
+                    "  manufacturer:       {}\n"
+                    "  product:            {}\n"
+                    "  serial number:      {}\n"
+                    "  num configurations: {}\n",
+                    to_str(dev.speed), to_version(dd.bcdUSB),
+                    to_str(static_cast<libusb_class_code>(dd.bDeviceClass)),
+                    to_str(static_cast<libusb_class_code>(dd.bDeviceSubClass)),
+                    dd.bDeviceProtocol, dd.bMaxPacketSize0, dd.idVendor,
+                    name_suffix(dev.vendor_name), dd.idProduct, name_suffix(dev.product_name),
+                    to_version(dd.bcdDevice), string_ref(dd.iManufacturer, dev.manufacturer),
+                    string_ref(dd.iProduct, dev.product), string_ref(dd.iSerialNumber, dev.serial),
+                    dd.bNumConfigurations);
+
+            int config_num = 0;
+            for (config_node const& config : model.configs(dev)) {
+                fmt::format_to(out, "    configuration {}:\n", config_num++);
+                if (!format_config_desc(buf, model, config))
+                    return false;
+            }
+
+            return true;
+        }
+    };
+
+} // namespace
+
+
+std::unique_ptr<formatter>
+make_text_formatter(bool show_ids)
+{
+    return std::make_unique<text_formatter>(show_ids);
+}
@@ -0,0 +1,581 @@
+#include "backend.hpp"
+#include "string_cache.hpp"
+#include "util/log.hpp"
+#include <libusb.h>
+#include <algorithm> // std::clamp, std::lexicographical_compare, std::max, std::min, std::sort
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility> // std::pair
+#include <vector>
+
+
+namespace { // unnamed
+
+    void
+    append(std::vector<std::uint8_t>& out, void const* p, std::size_t n)
+    {
+        auto const* b = static_cast<std::uint8_t const*>(p);
+        out.insert(out.end(), b, b + n);
+    }
+
+    void
+    append_le16(std::vector<std::uint8_t>& out, std::uint16_t v)
+    {
+        out.push_back(static_cast<std::uint8_t>(v & 0xff));
+        out.push_back(static_cast<std::uint8_t>(v >> 8));
+    }
+
+    /// Turns libusb's parsed configuration back into the wire format,
+    /// so that both backends hand the same thing to the printer.
+    std::vector<std::uint8_t>
+    serialize(libusb_config_descriptor const* cd)
+    {
+        std::vector<std::uint8_t> out;
+        out.reserve(cd->wTotalLength);
+
+        out.push_back(cd->bLength);
+        out.push_back(cd->bDescriptorType);
+        append_le16(out, cd->wTotalLength);
+        out.push_back(cd->bNumInterfaces);
+        out.push_back(cd->bConfigurationValue);
+        out.push_back(cd->iConfiguration);
+        out.push_back(cd->bmAttributes);
+        out.push_back(cd->MaxPower);
+        append(out, cd->extra, static_cast<std::size_t>(cd->extra_length));
+
+        for (int i = 0; i < cd->bNumInterfaces; ++i) {
+            libusb_interface const& iface = cd->interface[i];
+            for (int alt = 0; alt < iface.num_altsetting; ++alt) {
+                libusb_interface_descriptor const& ifd = iface.altsetting[alt];
+                out.push_back(ifd.bLength);
+                out.push_back(ifd.bDescriptorType);
+                out.push_back(ifd.bInterfaceNumber);
+                out.push_back(ifd.bAlternateSetting);
+                out.push_back(ifd.bNumEndpoints);
+                out.push_back(ifd.bInterfaceClass);
+                out.push_back(ifd.bInterfaceSubClass);
+                out.push_back(ifd.bInterfaceProtocol);
+                out.push_back(ifd.iInterface);
+                append(out, ifd.extra, static_cast<std::size_t>(ifd.extra_length));
+
+                for (int ep = 0; ep < ifd.bNumEndpoints; ++ep) {
+                    libusb_endpoint_descriptor const& epd = ifd.endpoint[ep];
+                    out.push_back(epd.bLength);
+                    out.push_back(epd.bDescriptorType);
+                    out.push_back(epd.bEndpointAddress);
+                    out.push_back(epd.bmAttributes);
+                    append_le16(out, epd.wMaxPacketSize);
+                    out.push_back(epd.bInterval);
+                    if (epd.bLength >= LIBUSB_DT_ENDPOINT_AUDIO_SIZE) {
+                        out.push_back(epd.bRefresh);
+                        out.push_back(epd.bSynchAddress);
+                    }
+                    append(out, epd.extra, static_cast<std::size_t>(epd.extra_length));
+                }
+            }
+        }
+
+        return out;
+    }
+
+    /// One time limit for all the transfers to a device, so that a
+    /// device answering each one just in time can't hold up its worker
+    /// for several timeouts.
+    class deadline
+    {
+    private:
+        std::chrono::steady_clock::time_point end_;
+
+    public:
+        explicit deadline(unsigned timeout_ms) noexcept
+                : end_(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms))
+        {}
+
+        /// \returns the milliseconds left, rounded up; 0 once passed
+        /// (which libusb would take as no timeout at all)
+        unsigned
+        left_ms() const noexcept
+        {
+            using namespace std::chrono;
+            auto const left = end_ - steady_clock::now();
+            if (left <= left.zero())
+                return 0;
+            return static_cast<unsigned>(ceil<milliseconds>(left).count());
+        }
+    };
+
+    /// A GET_DESCRIPTOR request within \c dl.
+    /// \returns the bytes read, or a libusb_error
+    int
+    get_descriptor(libusb_device_handle* handle, std::uint16_t value, std::uint16_t index,
+            unsigned char* buf, std::uint16_t len, deadline const& dl)
+    {
+        unsigned const timeout_ms = dl.left_ms();
+        if (timeout_ms == 0)
+            return LIBUSB_ERROR_TIMEOUT;
+        return ::libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN,
+                LIBUSB_REQUEST_GET_DESCRIPTOR, value, index, buf, len, timeout_ms);
+    }
+
+    /// Reads string descriptor \c index in language \c langid as ASCII
+    /// (like libusb_get_string_descriptor_ascii(), but with a timeout).
+    /// \returns 0 or a libusb_error
+    int
+    get_string(libusb_device_handle* handle, std::uint8_t index, std::uint16_t langid,
+            deadline const& dl, std::string& out)
+    {
+        unsigned char buf[255];
+        auto const value = static_cast<std::uint16_t>(LIBUSB_DT_STRING << 8 | index);
+        int const n = get_descriptor(handle, value, langid, buf, sizeof(buf), dl);
+        if (n < 0)
+            return n;
+        if (n < 2 || buf[1] != LIBUSB_DT_STRING)
+            return LIBUSB_ERROR_IO;
+
+        int const len = std::min<int>(n, buf[0]);
+        out.clear();
+        for (int i = 2; i + 1 < len; i += 2)
+            out.push_back((buf[i + 1] == 0 && buf[i] < 0x80) ? static_cast<char>(buf[i]) : '?');
+        return 0;
+    }
+
+    /// Reads the BOS descriptor set as the device sends it, like
+    /// libusb_get_bos_descriptor() but unparsed and with a timeout.
+    /// \returns 0 or a libusb_error
+    int
+    get_bos(libusb_device_handle* handle, deadline const& dl, std::vector<std::uint8_t>& out)
+    {
+        unsigned char hdr[LIBUSB_DT_BOS_SIZE];
+        int n = get_descriptor(handle, LIBUSB_DT_BOS << 8, 0, hdr, sizeof(hdr), dl);
+        if (n < 0)
+            return n;
+        if (n < LIBUSB_DT_BOS_SIZE || hdr[1] != LIBUSB_DT_BOS)
+            return LIBUSB_ERROR_IO;
+
+        auto const total = static_cast<std::uint16_t>(hdr[2] | hdr[3] << 8);
+        out.resize(std::max<std::size_t>(total, LIBUSB_DT_BOS_SIZE));
+        n = get_descriptor(handle, LIBUSB_DT_BOS << 8, 0, out.data(),
+                static_cast<std::uint16_t>(out.size()), dl);
+        if (n < 0) {
+            out.clear();
+            return n;
+        }
+        out.resize(static_cast<std::size_t>(n));
+        return 0;
+    }
+
+    /// Best effort: needs write access to the device node. Gives up on
+    /// a device at its first timeout.
+    void
+    read_strings(libusb_device_handle* handle, usb_device& d, deadline const& dl)
+    {
+        if (d.desc.iManufacturer == 0 && d.desc.iProduct == 0 && d.desc.iSerialNumber == 0)
+            return;
+
+        // string descriptor 0 lists the supported languages
+        unsigned char langs[4];
+        int const n = get_descriptor(handle, LIBUSB_DT_STRING << 8, 0, langs, sizeof(langs), dl);
+        if (n == 4 && langs[1] == LIBUSB_DT_STRING) {
+            auto const langid = static_cast<std::uint16_t>(langs[2] | langs[3] << 8);
+            std::pair<std::uint8_t, std::string*> const strings[] = {
+                    {d.desc.iManufacturer, &d.manufacturer},
+                    {d.desc.iProduct, &d.product},
+                    {d.desc.iSerialNumber, &d.serial},
+            };
+            for (auto const& [index, out] : strings) {
+                if (index == 0)
+                    continue;
+                if (get_string(handle, index, langid, dl, *out) == LIBUSB_ERROR_TIMEOUT) {
+                    LOG_WARN("{}: {}-{}: string descriptor timeout", __builtin_FUNCTION(), d.bus,
+                            d.address);
+                    break;
+                }
+            }
+        } else if (n == LIBUSB_ERROR_TIMEOUT) {
+            LOG_WARN("{}: {}-{}: string descriptor timeout", __builtin_FUNCTION(), d.bus,
+                    d.address);
+        }
+    }
+
+    /// A device that has to be opened to read its strings or BOS.
+    struct pending_read
+    {
+        libusb_device* dev;
+        std::size_t index; ///< into the device list
+        bool strings;
+        bool bos;
+    };
+
+    /// The BOS only exists from USB 2.01 on.
+    bool
+    needs_bos(unsigned what, usb_device const& d) noexcept
+    {
+        return wants(what, fetch_bos) && d.desc.bcdUSB >= 0x0201;
+    }
+
+    /// Opens the device once for both reads, which share \c timeout_ms.
+    void
+    read_opened(pending_read const& p, usb_device& d, unsigned timeout_ms)
+    {
+        libusb_device_handle* handle = nullptr;
+        if (::libusb_open(p.dev, &handle) != 0)
+            return;
+
+        deadline const dl(timeout_ms);
+        if (p.bos && get_bos(handle, dl, d.bos) == LIBUSB_ERROR_TIMEOUT)
+            LOG_WARN("{}: {}-{}: BOS descriptor timeout", __builtin_FUNCTION(), d.bus, d.address);
+        else if (p.strings)
+            read_strings(handle, d, dl);
+
+        ::libusb_close(handle);
+    }
+
+    /// \returns false if a string the device has couldn't be read
+    bool
+    has_all_strings(usb_device const& d) noexcept
+    {
+        return (d.desc.iManufacturer == 0 || !d.manufacturer.empty())
+                && (d.desc.iProduct == 0 || !d.product.empty())
+                && (d.desc.iSerialNumber == 0 || !d.serial.empty());
+    }
+
+    /// Opens up to \c opts.jobs devices at a time, so that slow devices
+    /// only hold up their own worker.
+    void
+    read_parallel(std::span<pending_read const> todo, std::vector<usb_device>& devices,
+            string_fetch_options const& opts)
+    {
+        std::atomic<std::size_t> next{0};
+        auto worker = [&] {
+            for (std::size_t i = next++; i < todo.size(); i = next++)
+                read_opened(todo[i], devices[todo[i].index], opts.timeout_ms);
+        };
+
+        std::size_t const jobs = std::clamp<std::size_t>(opts.jobs, 1, todo.size());
+        std::vector<std::thread> threads;
+        threads.reserve(jobs - 1);
+        for (std::size_t i = 1; i < jobs; ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (std::thread& t : threads)
+            t.join();
+    }
+
+    /// The final filter check, once strings have been read.
+    bool
+    accepts(usb_filter const& filter, usb_device const& d)
+    {
+        std::vector<usb_class> classes;
+        for (auto const& config : d.configs)
+            collect_interface_classes(config, classes);
+
+        usb_facts facts;
+        facts.bus = d.bus;
+        facts.ports = {d.ports, d.num_ports};
+        facts.speed = d.speed;
+        facts.desc = &d.desc;
+        facts.interfaces = classes;
+        facts.serial = d.serial;
+        return filter.check(usb_stage::strings, facts) == usb_filter::verdict::accept;
+    }
+
+    /// Reads \c dev one stage at a time, up to but not including its
+    /// strings, until \c filter rejects it or everything in \c what has
+    /// been fetched.
+    /// \returns reject if the device was rejected or couldn't be read,
+    /// undecided if the filter needs the serial number
+    usb_filter::verdict
+    read_device(libusb_device* dev, unsigned what, usb_filter const& filter, usb_device& d)
+    {
+        d.bus = ::libusb_get_bus_number(dev);
+        d.address = ::libusb_get_device_address(dev);
+        d.speed = static_cast<libusb_speed>(::libusb_get_device_speed(dev));
+
+        int const num_ports = ::libusb_get_port_numbers(dev, d.ports, sizeof(d.ports));
+        if (num_ports < 0) {
+            LOG_ERROR("libusb_get_port_numbers failure ({})",
+                    ::libusb_strerror(static_cast<libusb_error>(num_ports)));
+        } else {
+            d.num_ports = static_cast<std::uint8_t>(num_ports);
+        }
+
+        usb_facts facts;
+        std::vector<usb_class> classes; // facts.interfaces
+        facts.bus = d.bus;
+        facts.ports = {d.ports, d.num_ports};
+        facts.speed = d.speed;
+        usb_filter::verdict v = filter.check(usb_stage::location, facts);
+        auto const need = [&v, what](fetch_flags f) {
+            return v == usb_filter::verdict::undecided
+                    || (v == usb_filter::verdict::accept && wants(what, f));
+        };
+
+        if (need(fetch_device_desc)) {
+            if (int rv = ::libusb_get_device_descriptor(dev, &d.desc); rv != 0) {
+                LOG_ERROR("libusb_get_device_descriptor failure ({})",
+                        ::libusb_strerror(static_cast<libusb_error>(rv)));
+                return usb_filter::verdict::reject;
+            }
+            facts.desc = &d.desc;
+            if (v == usb_filter::verdict::undecided)
+                v = filter.check(usb_stage::device_desc, facts);
+        }
+
+        if (need(fetch_configs)) {
+            d.configs.reserve(d.desc.bNumConfigurations);
+            for (int config_num = 0; config_num < d.desc.bNumConfigurations; ++config_num) {
+                libusb_config_descriptor* cd = nullptr;
+                if (int rv = ::libusb_get_config_descriptor(dev, config_num, &cd); rv != 0) {
+                    LOG_ERROR("libusb_get_config_descriptor failure ({})",
+                            ::libusb_strerror(static_cast<libusb_error>(rv)));
+                    return usb_filter::verdict::reject;
+                }
+
+                d.configs.push_back(serialize(cd));
+                ::libusb_free_config_descriptor(cd);
+            }
+
+            if (v == usb_filter::verdict::undecided) {
+                for (auto const& config : d.configs)
+                    collect_interface_classes(config, classes);
+                facts.interfaces = classes;
+                v = filter.check(usb_stage::configs, facts);
+            }
+        }
+
+        return v;
+    }
+
+    /// Puts \c list in the order sysfs_backend lists devices in, by bus,
+    /// then topology, rather than libusb's enumeration order. Takes no
+    /// I/O: bus and ports are known without opening a device.
+    void
+    sort_by_place(libusb_device** list, std::size_t num_devs)
+    {
+        struct place
+        {
+            libusb_device* dev;
+            std::uint8_t bus;
+            std::uint8_t num_ports;
+            std::uint8_t ports[7];
+        };
+
+        std::vector<place> places(num_devs);
+        for (std::size_t i = 0; i < num_devs; ++i) {
+            place& p = places[i];
+            p.dev = list[i];
+            p.bus = ::libusb_get_bus_number(list[i]);
+            int const n = ::libusb_get_port_numbers(list[i], p.ports, sizeof(p.ports));
+            p.num_ports = static_cast<std::uint8_t>(std::max(n, 0));
+        }
+        std::sort(places.begin(), places.end(), [](place const& a, place const& b) {
+            if (a.bus != b.bus)
+                return a.bus < b.bus;
+            return std::lexicographical_compare(
+                    a.ports, a.ports + a.num_ports, b.ports, b.ports + b.num_ports);
+        });
+        for (std::size_t i = 0; i < num_devs; ++i)
+            list[i] = places[i].dev;
+    }
+
+    /// \returns a context with \c list holding its devices, sorted by
+    /// place, or nullptr (after logging why) on failure
+    libusb_context*
+    open_list(bool debug, libusb_device**& list, std::size_t& num_devs)
+    {
+        libusb_context* ctx = nullptr;
+        if (int rv = ::libusb_init(&ctx); rv != 0) {
+            LOG_ERROR("libusb_init: failure ({})",
+                    ::libusb_strerror(static_cast<libusb_error>(rv)));
+            return nullptr;
+        }
+
+        if (debug) {
+            int rv = ::libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_DEBUG);
+            if (rv != 0) {
+                LOG_ERROR("libusb_set_option failure ({})",
+                        ::libusb_strerror(static_cast<libusb_error>(rv)));
+                ::libusb_exit(ctx);
+                return nullptr;
+            }
+        }
+
+        ssize_t const n = ::libusb_get_device_list(ctx, &list);
+        if (n < 0) {
+            LOG_ERROR("libusb_get_device_list failure ({})",
+                    ::libusb_strerror(static_cast<libusb_error>(n)));
+            ::libusb_exit(ctx);
+            return nullptr;
+        }
+        num_devs = static_cast<std::size_t>(n);
+        sort_by_place(list, num_devs);
+        return ctx;
+    }
+
+
+    /// Reads each device all the way, strings included, on the thread
+    /// that asks for it.
+    class libusb_source : public device_source
+    {
+    private:
+        libusb_context* ctx_;
+        libusb_device** list_;
+        std::size_t size_;
+        unsigned what_;
+        usb_filter const& filter_;
+        string_fetch_options opts_;
+        std::mutex cache_mutex_; ///< guards *opts_.cache
+
+    public:
+        libusb_source(libusb_context* ctx, libusb_device** list, std::size_t size, unsigned what,
+                usb_filter const& filter, string_fetch_options const& opts) noexcept
+                : ctx_(ctx)
+                , list_(list)
+                , size_(size)
+                , what_(what)
+                , filter_(filter)
+                , opts_(opts)
+        {}
+
+        ~libusb_source() override
+        {
+            ::libusb_free_device_list(list_, 1);
+            ::libusb_exit(ctx_);
+        }
+
+        libusb_source(libusb_source const&) = delete;
+        libusb_source& operator=(libusb_source const&) = delete;
+
+        std::size_t size() const noexcept override { return size_; }
+
+        bool
+        read(std::size_t i, usb_device& d) override
+        {
+            usb_filter::verdict const v = read_device(list_[i], what_, filter_, d);
+            if (v == usb_filter::verdict::reject)
+                return false;
+
+            // an undecided filter needs the serial, which is read from the
+            // device: a cached one may belong to another device since
+            bool const undecided = (v == usb_filter::verdict::undecided);
+            pending_read p{list_[i], i, wants(what_, fetch_strings) || undecided,
+                    needs_bos(what_, d)};
+            if (p.strings && opts_.cache && !undecided) {
+                std::lock_guard<std::mutex> lock(cache_mutex_);
+                if (string_cache::entry const* e = opts_.cache->find(string_cache::key(d))) {
+                    d.manufacturer = e->manufacturer;
+                    d.product = e->product;
+                    d.serial = e->serial;
+                    p.strings = false;
+                }
+            }
+            if (p.strings || p.bos)
+                read_opened(p, d, opts_.timeout_ms);
+            if (p.strings && opts_.cache && has_all_strings(d)) {
+                std::lock_guard<std::mutex> lock(cache_mutex_);
+                opts_.cache->insert(string_cache::key(d), {d.manufacturer, d.product, d.serial});
+            }
+            return v == usb_filter::verdict::accept || accepts(filter_, d);
+        }
+    };
+
+} // namespace
+
+
+bool
+read_libusb_device(libusb_device* dev, unsigned what, usb_filter const& filter,
+        unsigned string_timeout_ms, usb_device& d)
+{
+    usb_filter::verdict const v = read_device(dev, what, filter, d);
+    if (v == usb_filter::verdict::reject)
+        return false;
+    pending_read const p{dev, 0, wants(what, fetch_strings) || v == usb_filter::verdict::undecided,
+            needs_bos(what, d)};
+    if (p.strings || p.bos)
+        read_opened(p, d, string_timeout_ms);
+    return v == usb_filter::verdict::accept || accepts(filter, d);
+}
+
+
+bool
+enumerate_libusb(std::vector<usb_device>& devices, unsigned what, usb_filter const& filter,
+        string_fetch_options const& opts, bool debug)
+{
+    libusb_device** list = nullptr;
+    std::size_t num_devs = 0;
+    libusb_context* ctx = open_list(debug, list, num_devs);
+    if (!ctx)
+        return false;
+
+    std::size_t const first = devices.size();
+    std::vector<pending_read> todo;
+    std::vector<bool> needs_serial; // the filter is still undecided
+    devices.reserve(first + num_devs);
+    for (std::size_t i = 0; i < num_devs; ++i) {
+        usb_device d;
+        usb_filter::verdict const v = read_device(list[i], what, filter, d);
+        if (v == usb_filter::verdict::reject)
+            continue;
+
+        bool const undecided = (v == usb_filter::verdict::undecided);
+        pending_read p{list[i], devices.size(), false, needs_bos(what, d)};
+        if (wants(what, fetch_strings) || undecided) {
+            // the serial a filter is decided on is never taken from the cache
+            string_cache::entry const* e = (opts.cache && !undecided)
+                    ? opts.cache->find(string_cache::key(d))
+                    : nullptr;
+            if (e) {
+                d.manufacturer = e->manufacturer;
+                d.product = e->product;
+                d.serial = e->serial;
+            } else {
+                p.strings = true;
+            }
+        }
+        if (p.strings || p.bos)
+            todo.push_back(p);
+        needs_serial.push_back(undecided);
+        devices.push_back(std::move(d));
+    }
+
+    if (!todo.empty()) {
+        read_parallel(todo, devices, opts);
+        for (pending_read const& p : todo) {
+            usb_device const& d = devices[p.index];
+            if (opts.cache && p.strings && has_all_strings(d))
+                opts.cache->insert(string_cache::key(d), {d.manufacturer, d.product, d.serial});
+        }
+    }
+
+    std::size_t kept = first;
+    for (std::size_t i = first; i < devices.size(); ++i) {
+        if (needs_serial[i - first] && !accepts(filter, devices[i]))
+            continue;
+        if (kept != i)
+            devices[kept] = std::move(devices[i]);
+        ++kept;
+    }
+    devices.resize(kept);
+
+    ::libusb_free_device_list(list, 1);
+    ::libusb_exit(ctx);
+    return true;
+}
+
+
+std::unique_ptr<device_source>
+open_libusb(unsigned what, usb_filter const& filter, string_fetch_options const& opts, bool debug)
+{
+    libusb_device** list = nullptr;
+    std::size_t num_devs = 0;
+    libusb_context* ctx = open_list(debug, list, num_devs);
+    if (!ctx)
+        return nullptr;
+    return std::make_unique<libusb_source>(ctx, list, num_devs, what, filter, opts);
+}
@@ -1,22 +1,109 @@
 #include "arg_parse.hpp"
-#include "enums.hpp"
-#include "util/assert.hpp"
+#include "bandwidth.hpp"
+#include "backend.hpp"
+#include "format.hpp"
+#include "model.hpp"
+#include "output_template.hpp"
+#include "pipeline.hpp"
+#include "probe.hpp"
+#include "snapshot.hpp"
+#include "snapshot_diff.hpp"
+#include "speed_check.hpp"
+#include "string_cache.hpp"
+#include "top.hpp"
+#include "tree.hpp"
+#include "watch.hpp"
+#include "util/log.hpp"
+#include "util/usb_ids.hpp"
 #include <fmt/format.h>
-#include <libusb.h>
+#include <unistd.h>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
-#include <limits>
-#include <string>
+#include <ctime>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility> // std::move
+#include <vector>
+
+
+namespace { // unnamed
+
+    /// Compares args.diff_before with args.diff_after, or with \c live
+    /// if given.
+    /// \returns the exit status: failure if they differ
+    int
+    diff(cli_args const& args, usb_ids const* names, std::vector<usb_device> const* live)
+    {
+        try {
+            usb_snapshot const before(args.diff_before);
+            usb_snapshot const after = live
+                    ? usb_snapshot(make_snapshot(*live, std::time(nullptr)))
+                    : usb_snapshot(args.diff_after);
+            snapshot_diff const d = diff_snapshots(before, after, args.filter);
+
+            output_writer out(STDOUT_FILENO);
+            format_snapshot_diff(out.buffer(), before, args.diff_before, after,
+                    live ? "devices present" : std::string_view(args.diff_after), d, names);
+            return (out.flush() && d.changes.empty()) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } catch (std::runtime_error const& e) {
+            fmt::print(stderr, "error: {}\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
 
+    /// \returns true unless a report or snapshot was asked for instead
+    /// of the device listing
+    bool
+    is_listing(cli_args const& args) noexcept
+    {
+        return args.save.empty() && args.diff_before.empty() && !args.bandwidth
+                && !args.speed_check && !args.tree;
+    }
 
-bool print_device_desc(libusb_device*);
-bool print_config_desc(libusb_config_descriptor const*);
-bool print_interface_desc(libusb_interface_descriptor const*);
-bool print_endpoint_desc(libusb_endpoint_descriptor const*);
+    /// Lists the devices, reading, formatting and writing them in a
+    /// pipeline (see list_pipelined()).
+    /// \returns the exit status
+    int
+    list(cli_args const& args, output_template* tmpl, unsigned what,
+            string_fetch_options const& strings, usb_ids const* names)
+    {
+        std::unique_ptr<device_source> source;
+        bool enumerated = true;
+        if (args.sysfs_root.empty()) {
+            source = open_libusb(what, args.filter, strings, args.debug);
+        } else {
+            std::vector<usb_device> devices;
+            enumerated = enumerate_sysfs(devices, what, args.filter, args.sysfs_root);
+            if (enumerated || !devices.empty())
+                source = std::make_unique<device_list_source>(std::move(devices));
+        }
+        if (!source)
+            return EXIT_FAILURE;
 
+        std::unique_ptr<formatter> const out_fmt = tmpl
+                ? make_template_formatter(*tmpl)
+                : make_formatter(args.format, !args.filter.empty());
+        pipeline_options opts;
+        opts.jobs = args.jobs;
+        opts.names = names;
+        output_writer out(STDOUT_FILENO);
+
+        // a malformed device is rendered as far as it decodes; keep going
+        pipeline_result const r = list_pipelined(out, *out_fmt, *source, opts);
+        if (!args.filter.empty() && r.listed == 0 && !tmpl && args.format == output_format::text)
+            fmt::format_to(std::back_inserter(out.buffer()), "no device matching {} found\n",
+                    to_str(args.filter));
+
+        if (!out.flush() || !r.well_formed)
+            return EXIT_FAILURE;
+        return enumerated ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-/**********************************************************************/
+} // namespace
 
 
 int
@@ -24,250 +111,111 @@ main(int argc, char** argv)
 {
     cli_args const args = arg_parse(argc, argv);
 
-    std::uint16_t target_vid = 0;
-    std::uint16_t target_pid = 0;
-    if (args.vendor_id != -1) {
-        if (args.vendor_id < 0 || args.vendor_id > std::numeric_limits<std::uint16_t>::max()) {
-            fmt::print(stderr, "error: invalid vendor id: {:#06x}\n", args.vendor_id);
-            return EXIT_FAILURE;
-        }
-        if (args.product_id < 0 || args.product_id > std::numeric_limits<std::uint16_t>::max()) {
-            fmt::print(stderr, "error: invalid product id: {:#06x}\n", args.product_id);
+    // a template reads only the descriptor levels its fields refer to
+    std::optional<output_template> tmpl;
+    unsigned what = fetch_configs;
+    if (!args.output_template.empty()) {
+        try {
+            tmpl.emplace(args.output_template);
+        } catch (std::invalid_argument const& e) {
+            fmt::print(stderr, "error: invalid template: {}\n", e.what());
             return EXIT_FAILURE;
         }
-
-        target_vid = args.vendor_id;
-        target_pid = args.product_id;
+        what = tmpl->fetch();
     }
-
-    libusb_context* ctx = nullptr;
-    if (int rv = ::libusb_init(&ctx); rv != 0) {
-        fmt::print(stderr, "libusb_init: failure ({})\n",
-                ::libusb_strerror(static_cast<libusb_error>(rv)));
-        std::exit(EXIT_FAILURE);
-    }
-
-    if (args.debug) {
-        int rv = ::libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_DEBUG);
-        if (rv != 0) {
-            fmt::print(stderr, "libusb_get_port_numbers failure ({})\n",
-                    ::libusb_strerror(static_cast<libusb_error>(rv)));
-            ::libusb_exit(ctx);
-            std::exit(EXIT_FAILURE);
+    if (args.names)
+        what |= fetch_strings;
+    if (args.speed_check)
+        what |= fetch_bos | fetch_strings; // root hub serials pair up an xHCI's two buses
+    if (!args.save.empty() || !args.diff_before.empty())
+        what = fetch_configs | fetch_bos | fetch_strings; // everything; serials pair devices up
+
+    // names are optional: without an index, only IDs are shown
+    std::unique_ptr<usb_ids> names;
+    if (!args.usb_ids.empty() && std::filesystem::exists(args.usb_ids)) {
+        try {
+            names = std::make_unique<usb_ids>(args.usb_ids);
+        } catch (std::runtime_error const& e) {
+            LOG_WARN("{}", e.what());
         }
     }
 
-    libusb_device** devices = nullptr;
-    ssize_t num_devs = ::libusb_get_device_list(ctx, &devices);
-    if (num_devs < 0) {
-        fmt::print(stderr, "libusb_get_device_list failure ({})\n",
-                ::libusb_strerror(static_cast<libusb_error>(num_devs)));
-        ::libusb_free_device_list(devices, 1);
-        ::libusb_exit(ctx);
-        std::exit(EXIT_FAILURE);
-    }
-
-    if (target_vid != 0) {
-        // print only device that matches vendor_id:product_id
-        bool dev_found = false;
-        for (ssize_t i = 0; i < num_devs; ++i) {
-            libusb_device_descriptor dd;
-            if (int rv = ::libusb_get_device_descriptor(devices[i], &dd); rv != 0) {
-                fmt::print(stderr, "libusb_get_device_descriptor failure ({})\n",
-                        ::libusb_strerror(static_cast<libusb_error>(num_devs)));
-                ::libusb_free_device_list(devices, 1);
-                ::libusb_exit(ctx);
-                std::exit(EXIT_FAILURE);
-            }
-
-            if (dd.idVendor == target_vid && dd.idProduct == target_pid) {
-                fmt::print("device {}: {:04x}:{:04x}\n", i, target_vid, target_pid);
-                if (!print_device_desc(devices[i])) {
-                    ::libusb_free_device_list(devices, 1);
-                    ::libusb_exit(ctx);
-                    std::exit(EXIT_FAILURE);
-                }
-                dev_found = true;
-                break;
-            }
-        }
-
-        if (!dev_found)
-            fmt::print("no device {:04x}:{:04x} found\n", target_vid, target_pid);
-
-    } else {
-        // print all devices
-        for (ssize_t i = 0; i < num_devs; ++i) {
-            fmt::print("device {}:\n", i);
-            if (!print_device_desc(devices[i])) {
-                ::libusb_exit(ctx);
-                ::libusb_free_device_list(devices, 1);
-                std::exit(EXIT_FAILURE);
-            }
-        }
-    }
-
-    ::libusb_free_device_list(devices, 1);
-    ::libusb_exit(ctx);
-    return EXIT_SUCCESS;
-}
-
-bool
-print_device_desc(libusb_device* dev)
-{
-    DEBUG_ASSERT(dev != nullptr);
-    bool success = true;
-
-    std::uint8_t ports[7];
-    int const num_ports = ::libusb_get_port_numbers(dev, ports, sizeof(ports) / sizeof(ports[0]));
-    if (num_ports < 0) {
-        fmt::print(stderr, "libusb_get_port_numbers failure ({})\n",
-                ::libusb_strerror(static_cast<libusb_error>(num_ports)));
+    if (!args.diff_after.empty())
+        return diff(args, names.get(), nullptr);
+
+    if (args.probe != 0) {
+        probe_options opts;
+        opts.count = args.probe;
+        opts.jobs = args.jobs;
+        opts.filter = &args.filter;
+        opts.names = names.get();
+        opts.debug = args.debug;
+        output_writer out(STDOUT_FILENO);
+        bool const probed = probe_libusb(opts, out.buffer());
+        return (out.flush() && probed) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    std::string const ports_str = (num_ports == 0)
-            ? "<none>"
-            : fmt::format("{}", fmt::join(std::begin(ports), std::begin(ports) + num_ports, ","));
 
-    fmt::print("  bus:                {}\n"
-               "  address:            {}\n"
-               "  port(s):            {}\n"
-               "  speed:              {}\n",
-            ::libusb_get_bus_number(dev), ::libusb_get_device_address(dev), ports_str,
-            to_str(static_cast<libusb_speed>(::libusb_get_device_speed(dev))));
-
-    libusb_device_descriptor dd;
-    ::libusb_get_device_descriptor(dev, &dd);
-
-    DEBUG_ASSERT(dd.bLength == 18);
-    DEBUG_ASSERT(dd.bDescriptorType == LIBUSB_DT_DEVICE);
-
-    fmt::print("  usb spec release:   {}\n"
-               "  class:              {}\n"
-               "  subclass:           {}\n"
-               "  protocol:           {}\n"
-               "  max packet size:    {}\n"
-               "  vendor id:          {:#06x}\n"
-               "  product id:         {:#06x}\n"
-               "  device release:     {}\n"
-               "  manufacturer:       {}\n"
-               "  product:            {}\n"
-               "  serial number:      {}\n"
-               "  num configurations: {}\n",
-            to_version(dd.bcdUSB), to_str(static_cast<libusb_class_code>(dd.bDeviceClass)),
-            to_str(static_cast<libusb_class_code>(dd.bDeviceSubClass)), dd.bDeviceProtocol,
-            dd.bMaxPacketSize0, dd.idVendor, dd.idProduct, to_version(dd.bcdDevice),
-            dd.iManufacturer, dd.iProduct, dd.iSerialNumber, dd.bNumConfigurations);
-
-    for (int config_num = 0; config_num < dd.bNumConfigurations; ++config_num) {
-        libusb_config_descriptor* cd = nullptr;
-        if (int rv = ::libusb_get_config_descriptor(dev, config_num, &cd); rv != 0) {
-            fmt::print(stderr, "libusb_get_config_descriptor failure ({})\n",
-                    ::libusb_strerror(static_cast<libusb_error>(rv)));
-            success = false;
-            break;
-        }
-
-        fmt::print("    configuration {}:\n", config_num);
-
-        if (!print_config_desc(cd)) {
-            success = false;
-            ::libusb_free_config_descriptor(cd);
-            break;
-        }
-
-        ::libusb_free_config_descriptor(cd);
+    if (args.top_ms != 0) {
+        top_options opts;
+        opts.filter = &args.filter;
+        opts.names = names.get();
+        if (!args.sysfs_root.empty())
+            opts.sysfs_root = args.sysfs_root;
+        opts.interval_ms = args.top_ms;
+        return run_top(opts) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    return success;
-}
-
-bool
-print_config_desc(libusb_config_descriptor const* cd)
-{
-    DEBUG_ASSERT(cd != nullptr);
-    DEBUG_ASSERT(cd->bDescriptorType == LIBUSB_DT_CONFIG);
-    DEBUG_ASSERT(cd->bLength == 9);
-
-    fmt::print("      total length:    {}\n"
-               "      config value:    {}\n"
-               "      config:          {}\n"
-               "      attributes:      {}\n"
-               "      max power:       {}\n"
-               "      unknown configs: {}\n"
-               "      num interfaces:  {}\n",
-            cd->wTotalLength, cd->bConfigurationValue, cd->iConfiguration, cd->bmAttributes,
-            cd->MaxPower, cd->extra_length, cd->bNumInterfaces);
-
-    if (cd->bNumInterfaces > 0) {
-        libusb_interface const* iface = cd->interface;
-
-        for (int iface_num = 0; iface_num < iface->num_altsetting; ++iface_num) {
-            libusb_interface_descriptor const ifd = iface->altsetting[iface_num];
-            fmt::print("        interface {}:\n", iface_num);
-            if (!print_interface_desc(&ifd))
-                return false;
-        }
+    if (args.watch) {
+        watch_options opts;
+        opts.what = what;
+        opts.filter = &args.filter;
+        opts.names = names.get();
+        opts.string_timeout_ms = args.string_timeout_ms;
+        opts.json = (args.format == output_format::json);
+        opts.debug = args.debug;
+        return watch_libusb(opts) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    return true;
-}
-
-bool
-print_interface_desc(libusb_interface_descriptor const* ifd)
-{
-    DEBUG_ASSERT(ifd != nullptr);
-    DEBUG_ASSERT(ifd->bDescriptorType == LIBUSB_DT_INTERFACE);
-    DEBUG_ASSERT(ifd->bLength == 9);
-
-    fmt::print("          number:             {}\n"
-               "          alternate setting:  {}\n"
-               "          class:              {}\n"
-               "          sub-class:          {}\n"
-               "          protocol:           {}\n"
-               "          interface index:    {}\n"
-               "          unknown interfaces: {}\n"
-               "          num endpoints:      {}\n",
-            ifd->bInterfaceNumber, ifd->bAlternateSetting,
-            to_str(static_cast<libusb_class_code>(ifd->bInterfaceClass)),
-            to_str(static_cast<libusb_class_code>(ifd->bInterfaceSubClass)),
-            ifd->bInterfaceProtocol, ifd->iInterface, ifd->extra_length, ifd->bNumEndpoints);
-
-    for (int ep_num = 0; ep_num < ifd->bNumEndpoints; ++ep_num) {
-        libusb_endpoint_descriptor const epd = ifd->endpoint[ep_num];
-
-        fmt::print("            endpoint {}:\n", ep_num);
-        if (!print_endpoint_desc(&epd))
-            return false;
+    // only libusb needs the cache; sysfs has the strings at hand
+    string_cache cache;
+    string_fetch_options strings;
+    strings.jobs = args.jobs;
+    strings.timeout_ms = args.string_timeout_ms;
+    bool const use_cache = args.sysfs_root.empty() && !args.string_cache.empty()
+            && (wants(what, fetch_strings) || args.filter.max_stage() == usb_stage::strings);
+    if (use_cache && cache.load(args.string_cache))
+        strings.cache = &cache;
+
+    if (is_listing(args)) {
+        int const status = list(args, tmpl ? &*tmpl : nullptr, what, strings, names.get());
+        if (strings.cache)
+            cache.save(args.string_cache); // failure only costs the next run time
+        return status;
     }
 
-    return true;
-}
-
-bool
-print_endpoint_desc(libusb_endpoint_descriptor const* epd)
-{
-    DEBUG_ASSERT(epd != nullptr);
-    DEBUG_ASSERT(epd->bDescriptorType == LIBUSB_DT_ENDPOINT);
-    DEBUG_ASSERT(epd->bLength == 7);
-
-    fmt::print("              address:           {}\n"
-               "                number:            {}\n"
-               "                direction:         {}\n"
-               "              attrs:             {}\n"
-               "                transfer type:     {}\n"
-               "                iso sync type:     {}\n"
-               "                iso usage type:    {}\n"
-               "              max packet size:   {} bytes\n"
-               "              interval:          {} msec\n"
-               "              refresh:           {}\n"
-               "              sync address:      {}\n"
-               "              unknown endpoints: {}\n",
-            epd->bEndpointAddress, ep_addr_to_ep_num(epd->bEndpointAddress),
-            to_str(ep_addr_to_endpoint_direction(epd->bEndpointAddress)), epd->bmAttributes,
-            to_str(ep_attr_to_transfer_type(epd->bmAttributes)),
-            to_str(ep_attr_to_iso_sync_type(epd->bmAttributes)),
-            to_str(ep_attr_to_iso_usage_type(epd->bmAttributes)), epd->wMaxPacketSize,
-            epd->bInterval, epd->bRefresh, epd->bSynchAddress, epd->extra_length);
-
-    return true;
+    std::vector<usb_device> devices;
+    bool const enumerated = args.sysfs_root.empty()
+            ? enumerate_libusb(devices, what, args.filter, strings, args.debug)
+            : enumerate_sysfs(devices, what, args.filter, args.sysfs_root);
+    if (strings.cache)
+        cache.save(args.string_cache); // failure only costs the next run time
+    if (!enumerated && devices.empty())
+        return EXIT_FAILURE;
+
+    if (!args.save.empty())
+        return (save_snapshot(args.save, devices) && enumerated) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (!args.diff_before.empty())
+        return enumerated ? diff(args, names.get(), &devices) : EXIT_FAILURE;
+
+    bus_model const model = bus_model::build(devices, names.get());
+    devices = {}; // everything needed has been copied into the model
+
+    output_writer out(STDOUT_FILENO);
+    if (args.bandwidth)
+        format_periodic_report(out.buffer(), analyze_periodic(model));
+    else if (args.speed_check)
+        format_speed_report(out.buffer(), model, check_speeds(model));
+    else
+        format_tree(out.buffer(), model);
+    return (out.flush() && enumerated) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,252 @@
+#include "model.hpp"
+#include "util/log.hpp"
+#include <algorithm> // std::copy, std::stable_sort
+#include <iterator>
+
+
+namespace { // unnamed
+
+    template <typename T>
+    std::span<T const>
+    slice(std::vector<T> const& table, index_range r) noexcept
+    {
+        return {table.data() + r.first, r.count};
+    }
+
+    template <typename T>
+    std::uint32_t
+    next_index(std::vector<T> const& table) noexcept
+    {
+        return static_cast<std::uint32_t>(table.size());
+    }
+
+    std::string_view
+    copy_string(arena& a, std::string const& s)
+    {
+        std::span<char const> const copy = a.copy(std::span<char const>(s));
+        return {copy.data(), copy.size()};
+    }
+
+    device_node const*
+    node_at(std::span<device_node const> devices, std::uint32_t i) noexcept
+    {
+        return (i == usb_topology::npos) ? nullptr : &devices[i];
+    }
+
+    struct table_sizes
+    {
+        std::size_t configs = 0;
+        std::size_t altsettings = 0;
+        std::size_t endpoints = 0;
+        std::size_t extras = 0;
+    };
+
+    /// \returns how many nodes of each kind bus_model::add_config()
+    /// appends for \c devices, so that the tables never reallocate
+    table_sizes
+    count_nodes(std::span<usb_device const> devices) noexcept
+    {
+        table_sizes n;
+        for (usb_device const& d : devices) {
+            for (auto const& blob : d.configs) {
+                desc::descriptor_range const descs(blob);
+                auto it = descs.begin();
+                if (it == descs.end() || !desc::as<desc::config_desc>(*it))
+                    continue;
+                ++n.configs;
+
+                bool in_interface = false;
+                for (++it; it != descs.end(); ++it) {
+                    if (desc::as<desc::interface_desc>(*it)) {
+                        ++n.altsettings;
+                        in_interface = true;
+                    } else if (in_interface && desc::as<desc::endpoint_desc>(*it)) {
+                        ++n.endpoints;
+                    } else {
+                        ++n.extras;
+                    }
+                }
+            }
+        }
+        return n;
+    }
+
+} // namespace
+
+
+bus_model
+bus_model::build(std::span<usb_device const> devices, usb_ids const* names)
+{
+    bus_model m;
+
+    table_sizes const sizes = count_nodes(devices);
+    m.devices_.reserve(devices.size());
+    m.configs_.reserve(sizes.configs);
+    m.interfaces_.reserve(sizes.altsettings); // at most one per alternate setting
+    m.altsettings_.reserve(sizes.altsettings);
+    m.endpoints_.reserve(sizes.endpoints);
+    m.extras_.reserve(sizes.extras);
+
+    for (usb_device const& d : devices)
+        m.add_device(d, names);
+
+    m.pending_extras_ = {};
+
+    std::vector<usb_location> locations;
+    locations.reserve(m.devices_.size());
+    for (device_node const& n : m.devices_)
+        locations.push_back({n.bus, {n.ports, n.num_ports}});
+    m.topology_ = usb_topology(locations);
+    return m;
+}
+
+void
+bus_model::add_device(usb_device const& d, usb_ids const* names)
+{
+    std::uint32_t const index = next_index(devices_);
+    device_node& n = devices_.emplace_back();
+    n.bus = d.bus;
+    n.address = d.address;
+    n.num_ports = d.num_ports;
+    std::copy(std::begin(d.ports), std::end(d.ports), std::begin(n.ports));
+    n.speed = d.speed;
+    n.desc = d.desc;
+    n.manufacturer = copy_string(bytes_, d.manufacturer);
+    n.product = copy_string(bytes_, d.product);
+    n.serial = copy_string(bytes_, d.serial);
+    n.bos = bytes_.copy(std::span<std::uint8_t const>(d.bos));
+    if (names) {
+        n.vendor_name = names->vendor(d.desc.idVendor);
+        n.product_name = names->product(d.desc.idVendor, d.desc.idProduct);
+    }
+    n.configs.first = next_index(configs_);
+
+    for (auto const& blob : d.configs)
+        add_config(blob);
+
+    devices_[index].configs.count = next_index(configs_) - devices_[index].configs.first;
+}
+
+void
+bus_model::add_config(desc::bytes blob)
+{
+    desc::bytes const raw = bytes_.copy(blob);
+    desc::descriptor_range const descs(raw);
+
+    auto it = descs.begin();
+    auto const cd = (it == descs.end()) ? std::nullopt : desc::as<desc::config_desc>(*it);
+    if (!cd) {
+        LOG_WARN("{}: skipping malformed configuration descriptor", __builtin_FUNCTION());
+        return;
+    }
+
+    std::uint32_t const config_index = next_index(configs_);
+    configs_.push_back({*cd, {}, {}, static_cast<std::uint32_t>(descs.trailing_garbage())});
+
+    // Alternate settings are appended in wire order and grouped by
+    // interface number afterwards. Descriptors that belong to the
+    // configuration (those before the first interface, and interface
+    // associations, which sit between interfaces) are collected
+    // separately so that each node's extras stay contiguous.
+    std::uint32_t const first_alt = next_index(altsettings_);
+    enum class owner { config, altsetting, endpoint } cur = owner::config;
+    desc::context ctx;
+    pending_extras_.clear();
+
+    for (++it; it != descs.end(); ++it) {
+        if (auto const ifd = desc::as<desc::interface_desc>(*it)) {
+            altsettings_.push_back(
+                    {*ifd, {next_index(endpoints_), 0}, {next_index(extras_), 0}});
+            ctx = {ifd->interface_class(), ifd->interface_subclass(), ifd->protocol()};
+            cur = owner::altsetting;
+        } else if (auto const epd = desc::as<desc::endpoint_desc>(*it);
+                   epd && cur != owner::config) {
+            endpoints_.push_back({*epd, {next_index(extras_), 0}});
+            ++altsettings_.back().endpoints.count;
+            cur = owner::endpoint;
+        } else if (cur == owner::config || (*it).type() == desc::dt_interface_assoc) {
+            pending_extras_.push_back({*it, ctx});
+        } else {
+            extras_.push_back({*it, ctx});
+            if (cur == owner::altsetting)
+                ++altsettings_.back().extras.count;
+            else
+                ++endpoints_.back().extras.count;
+        }
+    }
+
+    configs_[config_index].extras = {next_index(extras_),
+            static_cast<std::uint32_t>(pending_extras_.size())};
+    extras_.insert(extras_.end(), pending_extras_.begin(), pending_extras_.end());
+
+    auto const alts_begin = altsettings_.begin() + first_alt;
+    std::stable_sort(alts_begin, altsettings_.end(),
+            [](altsetting_node const& a, altsetting_node const& b) {
+                return a.desc.number() < b.desc.number();
+            });
+
+    configs_[config_index].interfaces.first = next_index(interfaces_);
+    for (std::uint32_t i = first_alt; i < next_index(altsettings_); ++i) {
+        std::uint8_t const number = altsettings_[i].desc.number();
+        if (interfaces_.size() == configs_[config_index].interfaces.first
+                || interfaces_.back().number != number) {
+            interfaces_.push_back({number, {i, 0}});
+            ++configs_[config_index].interfaces.count;
+        }
+        ++interfaces_.back().altsettings.count;
+    }
+}
+
+device_node const*
+bus_model::find(std::uint8_t bus, std::span<std::uint8_t const> ports) const noexcept
+{
+    return node_at(devices_, topology_.find(bus, ports));
+}
+
+device_node const*
+bus_model::parent(device_node const& n) const noexcept
+{
+    return node_at(devices_, topology_.parent(index_of(n)));
+}
+
+std::span<config_node const>
+bus_model::configs(device_node const& n) const noexcept
+{
+    return slice(configs_, n.configs);
+}
+
+std::span<interface_node const>
+bus_model::interfaces(config_node const& n) const noexcept
+{
+    return slice(interfaces_, n.interfaces);
+}
+
+std::span<altsetting_node const>
+bus_model::altsettings(interface_node const& n) const noexcept
+{
+    return slice(altsettings_, n.altsettings);
+}
+
+std::span<endpoint_node const>
+bus_model::endpoints(altsetting_node const& n) const noexcept
+{
+    return slice(endpoints_, n.endpoints);
+}
+
+std::span<extra_node const>
+bus_model::extras(config_node const& n) const noexcept
+{
+    return slice(extras_, n.extras);
+}
+
+std::span<extra_node const>
+bus_model::extras(altsetting_node const& n) const noexcept
+{
+    return slice(extras_, n.extras);
+}
+
+std::span<extra_node const>
+bus_model::extras(endpoint_node const& n) const noexcept
+{
+    return slice(extras_, n.extras);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "descriptors.hpp"
+#include "device.hpp"
+#include "util/arena.hpp"
+#include "util/usb_ids.hpp"
+#include "util/usb_topology.hpp"
+#include <libusb.h>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+
+/// Half-open run of nodes in one of bus_model's tables.
+struct index_range
+{
+    std::uint32_t first = 0;
+    std::uint32_t count = 0;
+};
+
+/// A class-specific or vendor descriptor, with the interface it
+/// appeared under so that it can be decoded later.
+struct extra_node
+{
+    desc::descriptor desc;
+    desc::context ctx;
+};
+
+struct endpoint_node
+{
+    desc::endpoint_desc desc;
+    index_range extras;
+};
+
+struct altsetting_node
+{
+    desc::interface_desc desc;
+    index_range endpoints;
+    index_range extras;
+};
+
+/// All alternate settings sharing one bInterfaceNumber.
+struct interface_node
+{
+    std::uint8_t number = 0;
+    index_range altsettings;
+};
+
+struct config_node
+{
+    desc::config_desc desc;
+    index_range interfaces;
+    index_range extras; ///< e.g. interface association descriptors
+    std::uint32_t malformed_bytes = 0; ///< trailing bytes that did not parse
+};
+
+struct device_node
+{
+    std::uint8_t bus = 0;
+    std::uint8_t address = 0;
+    std::uint8_t num_ports = 0;
+    std::uint8_t ports[7] = {0};
+    libusb_speed speed = LIBUSB_SPEED_UNKNOWN;
+    libusb_device_descriptor desc{};
+    index_range configs;
+    std::string_view manufacturer; ///< empty unless strings were fetched
+    std::string_view product;
+    std::string_view serial;
+    desc::bytes bos; ///< raw BOS descriptor set; empty unless fetched
+    std::string_view vendor_name; ///< from usb.ids; empty if unknown
+    std::string_view product_name;
+};
+
+
+/// Everything enumerated on the bus, built in one pass and then only
+/// read. Descriptor bytes are copied into an arena and every node is a
+/// view into them; nodes refer to their children by index into flat
+/// per-kind tables, so walking the tree is a sequence of linear scans.
+/// Devices are also indexed by place on the bus (see topology()).
+class bus_model
+{
+private:
+    arena bytes_;
+    std::vector<device_node> devices_;
+    std::vector<config_node> configs_;
+    std::vector<interface_node> interfaces_;
+    std::vector<altsetting_node> altsettings_;
+    std::vector<endpoint_node> endpoints_;
+    std::vector<extra_node> extras_;
+    std::vector<extra_node> pending_extras_; ///< scratch for add_config()
+    usb_topology topology_; ///< over devices_
+
+public:
+    /// Vendor and product names are looked up in \c names if given,
+    /// which must outlive the model.
+    static bus_model build(std::span<usb_device const>, usb_ids const* names = nullptr);
+
+    std::span<device_node const> devices() const noexcept { return devices_; }
+
+    /// Hub tree and lookups; indices are into devices().
+    usb_topology const& topology() const noexcept { return topology_; }
+    /// \returns the device at \c ports on \c bus, or nullptr if not listed
+    device_node const* find(std::uint8_t bus, std::span<std::uint8_t const> ports) const noexcept;
+    /// \returns the nearest listed hub above \c n, or nullptr
+    device_node const* parent(device_node const& n) const noexcept;
+    std::uint32_t index_of(device_node const& n) const noexcept
+    {
+        return static_cast<std::uint32_t>(&n - devices_.data());
+    }
+
+    std::span<config_node const> configs(device_node const& n) const noexcept;
+    std::span<interface_node const> interfaces(config_node const& n) const noexcept;
+    std::span<altsetting_node const> altsettings(interface_node const& n) const noexcept;
+    std::span<endpoint_node const> endpoints(altsetting_node const& n) const noexcept;
+
+    std::span<extra_node const> extras(config_node const& n) const noexcept;
+    std::span<extra_node const> extras(altsetting_node const& n) const noexcept;
+    std::span<extra_node const> extras(endpoint_node const& n) const noexcept;
+
+private:
+    void add_device(usb_device const&, usb_ids const* names);
+    void add_config(desc::bytes blob);
+};
@@ -0,0 +1,307 @@
+#include "output_template.hpp"
+#include "util/usb_enums.hpp"
+#include <algorithm> // std::find_if
+#include <iterator>
+#include <stdexcept>
+
+
+namespace { // unnamed
+
+    using value = output_template::value;
+    using buffer = fmt::memory_buffer;
+
+    std::string_view
+    scratch_view(buffer const& scratch) noexcept
+    {
+        return std::string_view(scratch.data(), scratch.size());
+    }
+
+    unsigned
+    speed_mbps(libusb_speed s) noexcept
+    {
+        // clang-format off
+        switch (s) {
+            case LIBUSB_SPEED_LOW:          return 1; // 1.5, rounded down
+            case LIBUSB_SPEED_FULL:         return 12;
+            case LIBUSB_SPEED_HIGH:         return 480;
+            case LIBUSB_SPEED_SUPER:        return 5000;
+            case LIBUSB_SPEED_SUPER_PLUS:   return 10000;
+            default: break;
+        }
+        // clang-format on
+        return 0;
+    }
+
+    /// The active configuration is not known without opening the
+    /// device, so configuration fields describe the first one.
+    config_node const*
+    first_config(bus_model const& model, device_node const& dev) noexcept
+    {
+        auto const configs = model.configs(dev);
+        return configs.empty() ? nullptr : &configs.front();
+    }
+
+    value
+    interface_classes(bus_model const& model, device_node const& dev, buffer& scratch)
+    {
+        config_node const* config = first_config(model, dev);
+        if (!config)
+            return std::string_view();
+
+        char const* sep = "";
+        for (interface_node const& intf : model.interfaces(*config)) {
+            auto const alts = model.altsettings(intf);
+            if (alts.empty())
+                continue;
+            auto const cls = static_cast<libusb_class_code>(alts.front().desc.interface_class());
+            fmt::format_to(std::back_inserter(scratch), "{}{}", sep, to_str(cls));
+            sep = ",";
+        }
+        return scratch_view(scratch);
+    }
+
+    struct field
+    {
+        std::string_view name;
+        unsigned fetch;
+        bool numeric;
+        output_template::extractor extract;
+    };
+
+    // clang-format off
+    constexpr field fields[] = {
+        {"bus", 0, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value { return d.bus; }},
+        {"addr", 0, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value { return d.address; }},
+        {"ports", 0, false,
+            [](bus_model const&, device_node const& d, buffer& s) -> value {
+                fmt::format_to(std::back_inserter(s), "{}",
+                        fmt::join(d.ports, d.ports + d.num_ports, "."));
+                return scratch_view(s);
+            }},
+        {"speed", 0, false,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return std::string_view(to_str(d.speed));
+            }},
+        {"speed_mbps", 0, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return speed_mbps(d.speed);
+            }},
+        {"vid", fetch_device_desc, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.desc.idVendor;
+            }},
+        {"pid", fetch_device_desc, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.desc.idProduct;
+            }},
+        {"vendor_name", fetch_device_desc, false,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.vendor_name;
+            }},
+        {"product_name", fetch_device_desc, false,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.product_name;
+            }},
+        {"class", fetch_device_desc, false,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return std::string_view(
+                        to_str(static_cast<libusb_class_code>(d.desc.bDeviceClass)));
+            }},
+        {"class_id", fetch_device_desc, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.desc.bDeviceClass;
+            }},
+        {"subclass", fetch_device_desc, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.desc.bDeviceSubClass;
+            }},
+        {"protocol", fetch_device_desc, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.desc.bDeviceProtocol;
+            }},
+        {"usb_version", fetch_device_desc, false,
+            [](bus_model const&, device_node const& d, buffer& s) -> value {
+                fmt::format_to(std::back_inserter(s), "{}", to_version(d.desc.bcdUSB));
+                return scratch_view(s);
+            }},
+        {"device_version", fetch_device_desc, false,
+            [](bus_model const&, device_node const& d, buffer& s) -> value {
+                fmt::format_to(std::back_inserter(s), "{}", to_version(d.desc.bcdDevice));
+                return scratch_view(s);
+            }},
+        {"max_packet_size", fetch_device_desc, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.desc.bMaxPacketSize0;
+            }},
+        {"num_configs", fetch_device_desc, true,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.desc.bNumConfigurations;
+            }},
+        {"manufacturer", fetch_strings, false,
+            [](bus_model const&, device_node const& d, buffer&) -> value {
+                return d.manufacturer;
+            }},
+        {"product", fetch_strings, false,
+            [](bus_model const&, device_node const& d, buffer&) -> value { return d.product; }},
+        {"serial", fetch_strings, false,
+            [](bus_model const&, device_node const& d, buffer&) -> value { return d.serial; }},
+        {"num_interfaces", fetch_configs, true,
+            [](bus_model const& m, device_node const& d, buffer&) -> value {
+                config_node const* c = first_config(m, d);
+                return c ? c->desc.num_interfaces() : 0u;
+            }},
+        {"max_power_ma", fetch_configs, true,
+            [](bus_model const& m, device_node const& d, buffer&) -> value {
+                // bMaxPower is in 8mA units at SuperSpeed, 2mA below
+                config_node const* c = first_config(m, d);
+                unsigned const unit = (d.speed >= LIBUSB_SPEED_SUPER) ? 8 : 2;
+                return c ? c->desc.max_power() * unit : 0u;
+            }},
+        {"interface_classes", fetch_configs, false, interface_classes},
+    };
+    // clang-format on
+
+    field const*
+    find_field(std::string_view name) noexcept
+    {
+        auto const it = std::find_if(std::begin(fields), std::end(fields),
+                [name](field const& f) { return f.name == name; });
+        return (it == std::end(fields)) ? nullptr : it;
+    }
+
+
+    class template_formatter : public formatter
+    {
+    private:
+        output_template& tmpl_;
+
+    public:
+        explicit template_formatter(output_template& tmpl) noexcept
+                : tmpl_(tmpl)
+        {}
+
+        bool
+        device(buffer& buf, bus_model const& model, device_node const& dev,
+                std::size_t /*index*/) override
+        {
+            tmpl_.render(buf, model, dev);
+            return true;
+        }
+
+        bool
+        device_part(buffer& buf, bus_model const& model, device_node const& dev,
+                std::size_t /*index*/) const override
+        {
+            buffer scratch;
+            tmpl_.render(buf, model, dev, scratch);
+            return true;
+        }
+    };
+
+} // namespace
+
+
+output_template::output_template(std::string_view tmpl)
+{
+    std::string literal;
+    auto flush_literal = [this, &literal] {
+        if (!literal.empty())
+            segments_.push_back({nullptr, std::move(literal)});
+        literal.clear();
+    };
+
+    std::size_t i = 0;
+    while (i < tmpl.size()) {
+        char const c = tmpl[i];
+        if ((c == '{' || c == '}') && i + 1 < tmpl.size() && tmpl[i + 1] == c) {
+            literal += c;
+            i += 2;
+            continue;
+        }
+        if (c == '}')
+            throw std::invalid_argument(fmt::format("unmatched '}}' at offset {}", i));
+        if (c != '{') {
+            literal += c;
+            ++i;
+            continue;
+        }
+
+        std::size_t const close = tmpl.find('}', i + 1);
+        if (close == std::string_view::npos)
+            throw std::invalid_argument(fmt::format("unterminated field at offset {}", i));
+
+        std::string_view const body = tmpl.substr(i + 1, close - i - 1);
+        std::size_t const colon = body.find(':');
+        std::string_view const name = body.substr(0, colon);
+        std::string_view const spec =
+                (colon == std::string_view::npos) ? std::string_view() : body.substr(colon + 1);
+
+        field const* f = find_field(name);
+        if (!f)
+            throw std::invalid_argument(fmt::format("unknown field '{}'", name));
+
+        std::string fmt_str = fmt::format("{{:{}}}", spec);
+        try {
+            // reject bad specs now rather than on every device
+            if (f->numeric)
+                (void)fmt::format(fmt_str, std::uint64_t(0));
+            else
+                (void)fmt::format(fmt_str, std::string_view());
+        } catch (fmt::format_error const& e) {
+            throw std::invalid_argument(
+                    fmt::format("invalid format '{}' for field '{}': {}", spec, name, e.what()));
+        }
+
+        flush_literal();
+        segments_.push_back({f->extract, std::move(fmt_str)});
+        fetch_ |= f->fetch;
+        i = close + 1;
+    }
+    flush_literal();
+}
+
+
+void
+output_template::render(buffer& buf, bus_model const& model, device_node const& dev)
+{
+    render(buf, model, dev, scratch_);
+}
+
+void
+output_template::render(
+        buffer& buf, bus_model const& model, device_node const& dev, buffer& scratch) const
+{
+    auto out = std::back_inserter(buf);
+    for (segment const& seg : segments_) {
+        if (!seg.extract) {
+            buf.append(seg.text.data(), seg.text.data() + seg.text.size());
+            continue;
+        }
+        scratch.clear();
+        value const v = seg.extract(model, dev, scratch);
+        std::visit([&](auto x) { fmt::format_to(out, seg.text, x); }, v);
+    }
+    buf.push_back('\n');
+}
+
+
+std::string
+output_template::field_names()
+{
+    std::string names;
+    for (field const& f : fields) {
+        if (!names.empty())
+            names += ' ';
+        names += f.name;
+    }
+    return names;
+}
+
+
+std::unique_ptr<formatter>
+make_template_formatter(output_template& tmpl)
+{
+    return std::make_unique<template_formatter>(tmpl);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "format.hpp"
+#include "model.hpp"
+#include <fmt/format.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+
+/// A user supplied one-line-per-device template such as
+/// "{bus}:{addr} {vid:04x}:{pid:04x} {speed} {class}", parsed once into
+/// a flat list of literal segments and field extractors.
+///
+/// Fields take an optional fmt format spec after a colon; "{{" and
+/// "}}" are literal braces. See field_names() for the fields.
+class output_template
+{
+public:
+    /// Integer fields format as numbers, everything else as text.
+    using value = std::variant<std::uint64_t, std::string_view>;
+
+    /// May use \c scratch to hold a computed string it returns a view of.
+    using extractor = value (*)(bus_model const&, device_node const&, fmt::memory_buffer& scratch);
+
+private:
+    struct segment
+    {
+        extractor extract = nullptr; ///< nullptr for a literal
+        std::string text; ///< the literal, or "{:<spec>}" for a field
+    };
+
+    std::vector<segment> segments_;
+    unsigned fetch_ = 0;
+    fmt::memory_buffer scratch_;
+
+public:
+    /// \throws std::invalid_argument describing the first error
+    explicit output_template(std::string_view tmpl);
+
+    /// \returns the fetch_flags the referenced fields need
+    unsigned fetch() const noexcept { return fetch_; }
+
+    /// Appends one line for \c dev.
+    void render(fmt::memory_buffer&, bus_model const&, device_node const&);
+    /// Same, with a scratch buffer of the caller's, so that devices can
+    /// be rendered on several threads at once.
+    void render(fmt::memory_buffer&, bus_model const&, device_node const&,
+            fmt::memory_buffer& scratch) const;
+
+    /// \returns all field names, for usage output
+    static std::string field_names();
+};
+
+std::unique_ptr<formatter> make_template_formatter(output_template&);
@@ -0,0 +1,135 @@
+#include "pipeline.hpp"
+#include "model.hpp"
+#include <algorithm> // std::max, std::min
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <thread>
+
+
+namespace { // unnamed
+
+    struct slot
+    {
+        enum class state : std::uint8_t
+        {
+            pending,
+            read, ///< waiting for its number, then for a worker to format it
+            rejected,
+            formatted,
+        };
+
+        state st = state::pending;
+        std::size_t index = 0; ///< among the devices listed
+        usb_device dev;
+        fmt::memory_buffer part;
+        bool well_formed = true;
+    };
+
+    /// Everything the workers and the writer share; guarded by \c mutex
+    /// except for a slot's contents while a worker owns it.
+    struct shared_state
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<slot> slots;
+        std::size_t next_read = 0;
+        std::size_t numbered = 0; ///< slots before this are done reading
+        std::size_t listed = 0;
+        std::deque<std::size_t> to_format; ///< numbered, in order
+
+        /// Numbers the devices read so far, in device order.
+        void
+        number()
+        {
+            for (; numbered < slots.size() && slots[numbered].st != slot::state::pending;
+                    ++numbered) {
+                if (slots[numbered].st == slot::state::read) {
+                    slots[numbered].index = listed++;
+                    to_format.push_back(numbered);
+                }
+            }
+        }
+    };
+
+    void
+    format(slot& s, formatter const& out_fmt, usb_ids const* names)
+    {
+        bus_model const model = bus_model::build(std::span<usb_device const>(&s.dev, 1), names);
+        s.dev = {}; // copied into the model
+        s.well_formed = out_fmt.device_part(s.part, model, model.devices()[0], s.index);
+    }
+
+    void
+    work(shared_state& sh, formatter const& out_fmt, device_source& source,
+            usb_ids const* names)
+    {
+        std::unique_lock<std::mutex> lock(sh.mutex);
+        for (;;) {
+            if (!sh.to_format.empty()) {
+                std::size_t const i = sh.to_format.front();
+                sh.to_format.pop_front();
+                lock.unlock();
+                format(sh.slots[i], out_fmt, names);
+                lock.lock();
+                sh.slots[i].st = slot::state::formatted;
+                sh.changed.notify_all();
+            } else if (sh.next_read < sh.slots.size()) {
+                std::size_t const i = sh.next_read++;
+                lock.unlock();
+                bool const listed = source.read(i, sh.slots[i].dev);
+                lock.lock();
+                sh.slots[i].st = listed ? slot::state::read : slot::state::rejected;
+                sh.number();
+                sh.changed.notify_all();
+            } else if (sh.numbered == sh.slots.size()) {
+                return; // the other workers format what is left
+            } else {
+                sh.changed.wait(lock);
+            }
+        }
+    }
+
+} // namespace
+
+
+pipeline_result
+list_pipelined(output_writer& out, formatter& out_fmt, device_source& source,
+        pipeline_options const& opts)
+{
+    shared_state sh;
+    sh.slots.resize(source.size());
+
+    std::size_t const jobs = std::min<std::size_t>(std::max(opts.jobs, 1u), sh.slots.size());
+    std::vector<std::thread> workers;
+    workers.reserve(jobs);
+    for (std::size_t i = 0; i < jobs; ++i)
+        workers.emplace_back([&] { work(sh, out_fmt, source, opts.names); });
+
+    pipeline_result r;
+    out_fmt.begin(out.buffer());
+    for (slot& s : sh.slots) {
+        {
+            std::unique_lock<std::mutex> lock(sh.mutex);
+            sh.changed.wait(lock, [&s] {
+                return s.st == slot::state::formatted || s.st == slot::state::rejected;
+            });
+        }
+        if (s.st == slot::state::rejected)
+            continue;
+
+        if (r.listed++ != 0)
+            out_fmt.separator(out.buffer());
+        out.buffer().append(s.part.data(), s.part.data() + s.part.size());
+        s.part = fmt::memory_buffer();
+        r.well_formed &= s.well_formed;
+        out.flush_if_full();
+    }
+    out_fmt.end(out.buffer());
+
+    for (std::thread& t : workers)
+        t.join();
+    return r;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "backend.hpp"
+#include "format.hpp"
+#include "util/usb_ids.hpp"
+#include <cstddef> // std::size_t
+#include <utility> // std::move
+#include <vector>
+
+
+// Lists devices in three overlapping stages: a pool of workers reads
+// devices from a device_source, then builds a model of each device on
+// its own and renders it into a buffer of its own
+// (formatter::device_part()), while the calling thread writes the
+// buffers out in device order. A worker formats a device read earlier
+// before it reads another, so the writer is never far behind.
+//
+// Devices are numbered as they are written, counting only those
+// listed, so the output is the same as that of a sequential listing
+// whatever the number of workers.
+
+
+/// Devices that have been read already, e.g. by enumerate_sysfs(); only
+/// the formatting is then done in parallel.
+class device_list_source : public device_source
+{
+private:
+    std::vector<usb_device> devices_;
+
+public:
+    explicit device_list_source(std::vector<usb_device> devices) noexcept
+            : devices_(std::move(devices))
+    {}
+
+    std::size_t size() const noexcept override { return devices_.size(); }
+
+    bool
+    read(std::size_t i, usb_device& d) override
+    {
+        d = std::move(devices_[i]);
+        return true;
+    }
+};
+
+
+struct pipeline_options
+{
+    unsigned jobs = 8; ///< workers, each reading and formatting
+    usb_ids const* names = nullptr; ///< see bus_model::build()
+};
+
+struct pipeline_result
+{
+    std::size_t listed = 0; ///< devices written
+    bool well_formed = true; ///< see formatter::device()
+};
+
+/// Writes every device \c source yields to \c out with \c out_fmt, between
+/// its begin() and end().
+pipeline_result list_pipelined(output_writer& out, formatter& out_fmt, device_source& source,
+        pipeline_options const& opts);
@@ -0,0 +1,196 @@
+#include "probe.hpp"
+#include "backend.hpp"
+#include "util/log.hpp"
+#include <libusb.h>
+#include <algorithm> // std::clamp, std::lexicographical_compare, std::sort
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+    using clock = std::chrono::steady_clock;
+
+    struct probe_result
+    {
+        libusb_device* dev = nullptr;
+        usb_device d;
+        int open_error = 0;
+        unsigned failed = 0;
+        int last_error = 0;
+        std::vector<std::uint32_t> usecs; ///< round trips of the requests that succeeded
+    };
+
+    /// One request; alternating between two keeps a device from
+    /// answering the same thing from a cache.
+    int
+    request(libusb_device_handle* handle, unsigned i, unsigned timeout_ms)
+    {
+        unsigned char buf[LIBUSB_DT_DEVICE_SIZE];
+        if (i % 2 == 0) {
+            return ::libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN,
+                    LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_DEVICE << 8, 0, buf, sizeof(buf),
+                    timeout_ms);
+        }
+        return ::libusb_control_transfer(
+                handle, LIBUSB_ENDPOINT_IN, LIBUSB_REQUEST_GET_STATUS, 0, 0, buf, 2, timeout_ms);
+    }
+
+    void
+    probe(probe_result& r, probe_options const& opts)
+    {
+        libusb_device_handle* handle = nullptr;
+        if (int rv = ::libusb_open(r.dev, &handle); rv != 0) {
+            r.open_error = rv;
+            return;
+        }
+
+        r.usecs.reserve(opts.count);
+        for (unsigned i = 0; i < opts.count; ++i) {
+            clock::time_point const start = clock::now();
+            int const rv = request(handle, i, opts.timeout_ms);
+            auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                    clock::now() - start);
+            if (rv < 0) {
+                ++r.failed;
+                r.last_error = rv;
+                if (rv == LIBUSB_ERROR_NO_DEVICE)
+                    break; // unplugged
+                continue;
+            }
+            r.usecs.push_back(static_cast<std::uint32_t>(elapsed.count()));
+        }
+
+        ::libusb_close(handle);
+    }
+
+    /// Same pool as for string descriptors: a slow device only holds up
+    /// its own worker.
+    void
+    probe_parallel(std::span<probe_result> results, probe_options const& opts)
+    {
+        std::atomic<std::size_t> next{0};
+        auto worker = [&] {
+            for (std::size_t i = next++; i < results.size(); i = next++)
+                probe(results[i], opts);
+        };
+
+        std::size_t const jobs = std::clamp<std::size_t>(opts.jobs, 1, results.size());
+        std::vector<std::thread> threads;
+        threads.reserve(jobs - 1);
+        for (std::size_t i = 1; i < jobs; ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (std::thread& t : threads)
+            t.join();
+    }
+
+    /// Nearest-rank percentile of sorted, non-empty \c v: the smallest
+    /// value that at least \c p percent of them are less than or equal to.
+    std::uint32_t
+    percentile(std::vector<std::uint32_t> const& v, unsigned p) noexcept
+    {
+        std::size_t const rank = (v.size() * p + 99) / 100; // ceil(p/100 * n)
+        return v[(rank == 0) ? 0 : rank - 1];
+    }
+
+    void
+    format_result(buffer& buf, probe_result& r, usb_ids const* names)
+    {
+        auto out = std::back_inserter(buf);
+        usb_device const& d = r.d;
+        fmt::memory_buffer loc;
+        if (d.num_ports == 0)
+            fmt::format_to(std::back_inserter(loc), "usb{}", d.bus);
+        else
+            fmt::format_to(std::back_inserter(loc), "{}-{}", d.bus,
+                    fmt::join(d.ports, d.ports + d.num_ports, "."));
+        fmt::format_to(out, "{:<12} {:04x}:{:04x}", std::string_view(loc.data(), loc.size()),
+                d.desc.idVendor, d.desc.idProduct);
+
+        if (r.open_error != 0) {
+            fmt::format_to(out, "  not opened ({})", ::libusb_error_name(r.open_error));
+        } else {
+            fmt::format_to(out, " {:>6} {:>6}", r.usecs.size() + r.failed, r.failed);
+            if (r.usecs.empty()) {
+                fmt::format_to(out, " {:>7} {:>7} {:>7} {:>7}", "-", "-", "-", "-");
+            } else {
+                std::sort(r.usecs.begin(), r.usecs.end());
+                fmt::format_to(out, " {:>7} {:>7} {:>7} {:>7}", r.usecs.front(),
+                        percentile(r.usecs, 50), percentile(r.usecs, 99), r.usecs.back());
+            }
+            if (r.failed != 0)
+                fmt::format_to(out, "  last error {}", ::libusb_error_name(r.last_error));
+        }
+
+        std::string_view const name = names ? names->product(d.desc.idVendor, d.desc.idProduct)
+                                            : std::string_view();
+        if (!name.empty())
+            fmt::format_to(out, "  {}", name);
+        buf.push_back('\n');
+    }
+
+} // namespace
+
+
+bool
+probe_libusb(probe_options const& opts, buffer& out)
+{
+    libusb_context* ctx = nullptr;
+    if (int rv = ::libusb_init(&ctx); rv != 0) {
+        LOG_ERROR("libusb_init: failure ({})", ::libusb_strerror(static_cast<libusb_error>(rv)));
+        return false;
+    }
+
+    if (opts.debug) {
+        int rv = ::libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_DEBUG);
+        if (rv != 0) {
+            LOG_ERROR("libusb_set_option failure ({})",
+                    ::libusb_strerror(static_cast<libusb_error>(rv)));
+            ::libusb_exit(ctx);
+            return false;
+        }
+    }
+
+    libusb_device** list = nullptr;
+    ssize_t const num_devs = ::libusb_get_device_list(ctx, &list);
+    if (num_devs < 0) {
+        LOG_ERROR("libusb_get_device_list failure ({})",
+                ::libusb_strerror(static_cast<libusb_error>(num_devs)));
+        ::libusb_exit(ctx);
+        return false;
+    }
+
+    std::vector<probe_result> results;
+    for (ssize_t i = 0; i < num_devs; ++i) {
+        probe_result r;
+        r.dev = list[i];
+        if (read_libusb_device(list[i], fetch_device_desc, *opts.filter, opts.timeout_ms, r.d))
+            results.push_back(std::move(r));
+    }
+    std::sort(results.begin(), results.end(), [](probe_result const& a, probe_result const& b) {
+        if (a.d.bus != b.d.bus)
+            return a.d.bus < b.d.bus;
+        return std::lexicographical_compare(
+                a.d.ports, a.d.ports + a.d.num_ports, b.d.ports, b.d.ports + b.d.num_ports);
+    });
+
+    if (!results.empty())
+        probe_parallel(results, opts);
+
+    fmt::format_to(std::back_inserter(out), "{:<12} {:<9} {:>6} {:>6} {:>7} {:>7} {:>7} {:>7}\n",
+            "location", "id", "sent", "failed", "min_us", "p50_us", "p99_us", "max_us");
+    for (probe_result& r : results)
+        format_result(out, r, opts.names);
+
+    ::libusb_free_device_list(list, 1);
+    ::libusb_exit(ctx);
+    return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "util/usb_filter.hpp"
+#include "util/usb_ids.hpp"
+#include <fmt/format.h>
+
+
+struct probe_options
+{
+    unsigned count = 100; ///< requests per device
+    unsigned jobs = 8; ///< devices probed at the same time
+    unsigned timeout_ms = 1000; ///< per request
+    usb_filter const* filter = nullptr;
+    usb_ids const* names = nullptr;
+    bool debug = false;
+};
+
+/// Sends \c count cheap standard requests (GET_DESCRIPTOR for the device
+/// descriptor and GET_STATUS, alternately) to every device \c filter
+/// accepts, one at a time per device and to up to \c jobs devices at
+/// once. Appends a table of the round-trip latencies (min, median,
+/// 99th percentile, max) and failures per device.
+/// \returns false (after logging why) if libusb can't be set up
+bool probe_libusb(probe_options const&, fmt::memory_buffer& out);
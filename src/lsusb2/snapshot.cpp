@@ -0,0 +1,132 @@
+#include "snapshot.hpp"
+#include "util/log.hpp"
+#include <fmt/format.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring> // std::memcpy, std::strerror
+#include <ctime>
+#include <filesystem>
+#include <memory>
+
+
+namespace { // unnamed
+
+    namespace snap = usb_snapshot_file;
+
+    using file_ptr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+    class pool_builder
+    {
+    private:
+        std::vector<std::byte> bytes_;
+
+    public:
+        snap::blob
+        add(void const* p, std::size_t n)
+        {
+            snap::blob const b{static_cast<std::uint32_t>(bytes_.size()),
+                    static_cast<std::uint32_t>(n)};
+            auto const* first = static_cast<std::byte const*>(p);
+            bytes_.insert(bytes_.end(), first, first + n);
+            return b;
+        }
+
+        snap::blob add(std::string const& s) { return add(s.data(), s.size()); }
+        snap::blob add(std::vector<std::uint8_t> const& v) { return add(v.data(), v.size()); }
+
+        std::vector<std::byte>&
+        padded()
+        {
+            bytes_.resize((bytes_.size() + 7) & ~std::size_t(7));
+            return bytes_;
+        }
+    };
+
+    template <typename T>
+    void
+    append(std::vector<std::byte>& out, T const* p, std::size_t n)
+    {
+        auto const* first = reinterpret_cast<std::byte const*>(p);
+        out.insert(out.end(), first, first + n * sizeof(T));
+    }
+
+} // namespace
+
+
+std::vector<std::byte>
+make_snapshot(std::span<usb_device const> devices, std::int64_t saved_at)
+{
+    std::vector<snap::device> records;
+    std::vector<snap::blob> blobs;
+    pool_builder pool;
+    records.reserve(devices.size());
+
+    for (usb_device const& d : devices) {
+        snap::device& r = records.emplace_back();
+        r.bus = d.bus;
+        r.address = d.address;
+        r.num_ports = d.num_ports;
+        r.speed = static_cast<std::uint8_t>(d.speed);
+        std::memcpy(r.ports, d.ports, sizeof(r.ports));
+        r.desc = d.desc;
+        r.manufacturer = pool.add(d.manufacturer);
+        r.product = pool.add(d.product);
+        r.serial = pool.add(d.serial);
+        r.bos = pool.add(d.bos);
+        r.configs = {static_cast<std::uint32_t>(blobs.size()),
+                static_cast<std::uint32_t>(d.configs.size())};
+        for (auto const& config : d.configs)
+            blobs.push_back(pool.add(config));
+    }
+
+    std::vector<std::byte> const& pool_bytes = pool.padded();
+    snap::header h;
+    h.num_devices = static_cast<std::uint32_t>(records.size());
+    h.num_blobs = static_cast<std::uint32_t>(blobs.size());
+    h.pool_size = pool_bytes.size();
+    h.saved_at = saved_at;
+
+    std::vector<std::byte> out;
+    out.reserve(snap::file_size(h));
+    append(out, &h, 1);
+    append(out, records.data(), records.size());
+    append(out, blobs.data(), blobs.size());
+    append(out, pool_bytes.data(), pool_bytes.size());
+    return out;
+}
+
+bool
+save_snapshot(std::string const& path, std::span<usb_device const> devices)
+{
+    std::vector<std::byte> const bytes = make_snapshot(devices, std::time(nullptr));
+
+    std::error_code ec;
+    std::filesystem::path const parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent, ec);
+
+    // write beside the target and rename, so that a reader never maps
+    // a half-written snapshot
+    std::string const tmp = path + ".tmp";
+    {
+        file_ptr f(std::fopen(tmp.c_str(), "wb"), &std::fclose);
+        if (!f) {
+            LOG_ERROR("{}: fopen({}) failure ({})", __builtin_FUNCTION(), tmp,
+                    std::strerror(errno));
+            return false;
+        }
+        if (std::fwrite(bytes.data(), bytes.size(), 1, f.get()) != 1
+                || std::fflush(f.get()) != 0) {
+            LOG_ERROR("{}: writing {} failure ({})", __builtin_FUNCTION(), tmp,
+                    std::strerror(errno));
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("{}: writing {} failure ({})", __builtin_FUNCTION(), path, std::strerror(errno));
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
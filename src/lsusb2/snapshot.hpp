@@ -0,0 +1,18 @@
+#pragma once
+
+#include "device.hpp"
+#include "util/usb_snapshot.hpp"
+#include <cstddef> // std::byte
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+
+/// Lays out \c devices as a snapshot file (see usb_snapshot).
+std::vector<std::byte> make_snapshot(std::span<usb_device const> devices, std::int64_t saved_at);
+
+/// Writes make_snapshot() of \c devices to \c path, replacing it
+/// atomically.
+/// \returns false (after logging why) on failure
+bool save_snapshot(std::string const& path, std::span<usb_device const> devices);
@@ -0,0 +1,296 @@
+#include "snapshot_diff.hpp"
+#include "util/usb_enums.hpp"
+#include "util/usb_topology.hpp"
+#include <algorithm> // std::equal, std::lexicographical_compare, std::sort
+#include <ctime>
+#include <iterator>
+#include <unordered_map>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+    using device = usb_snapshot::device;
+    using field = device_change::field;
+
+    /// The devices of one side that the filter accepts, indexed.
+    struct side
+    {
+        usb_snapshot const& snap;
+        std::vector<device const*> devices;
+        usb_topology paths; ///< over devices
+        std::unordered_map<std::string_view, std::uint32_t> serials; ///< first with each
+        std::vector<bool> paired;
+
+        side(usb_snapshot const& s, usb_filter const& filter)
+                : snap(s)
+        {
+            devices.reserve(s.devices().size());
+            for (device const& d : s.devices()) {
+                if (filter.empty() || s.accepted(filter, d))
+                    devices.push_back(&d);
+            }
+
+            std::vector<usb_location> locations;
+            locations.reserve(devices.size());
+            serials.reserve(devices.size());
+            for (std::uint32_t i = 0; i < devices.size(); ++i) {
+                device const& d = *devices[i];
+                locations.push_back({d.bus, {d.ports, d.num_ports}});
+                if (std::string_view const serial = s.string(d.serial); !serial.empty())
+                    serials.emplace(serial, i);
+            }
+            paths = usb_topology(locations);
+            paired.assign(devices.size(), false);
+        }
+    };
+
+    bool
+    same_ids(device const& a, device const& b) noexcept
+    {
+        return a.desc.idVendor == b.desc.idVendor && a.desc.idProduct == b.desc.idProduct;
+    }
+
+    bool
+    same_bytes(std::span<std::uint8_t const> a, std::span<std::uint8_t const> b) noexcept
+    {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end());
+    }
+
+    bool
+    same_desc(libusb_device_descriptor const& a, libusb_device_descriptor const& b) noexcept
+    {
+        return a.bcdUSB == b.bcdUSB && a.bDeviceClass == b.bDeviceClass
+                && a.bDeviceSubClass == b.bDeviceSubClass
+                && a.bDeviceProtocol == b.bDeviceProtocol
+                && a.bMaxPacketSize0 == b.bMaxPacketSize0 && a.idVendor == b.idVendor
+                && a.idProduct == b.idProduct && a.bcdDevice == b.bcdDevice
+                && a.iManufacturer == b.iManufacturer && a.iProduct == b.iProduct
+                && a.iSerialNumber == b.iSerialNumber
+                && a.bNumConfigurations == b.bNumConfigurations;
+    }
+
+    unsigned
+    compare(usb_snapshot const& sa, device const& a, usb_snapshot const& sb, device const& b)
+    {
+        unsigned fields = 0;
+        if (a.bus != b.bus || !same_bytes({a.ports, a.num_ports}, {b.ports, b.num_ports}))
+            fields |= field::moved;
+        if (a.speed != b.speed)
+            fields |= field::speed;
+        if (!same_desc(a.desc, b.desc))
+            fields |= field::device_desc;
+        if (sa.string(a.manufacturer) != sb.string(b.manufacturer)
+                || sa.string(a.product) != sb.string(b.product)
+                || sa.string(a.serial) != sb.string(b.serial))
+            fields |= field::strings;
+        if (!same_bytes(sa.bytes(a.bos), sb.bytes(b.bos)))
+            fields |= field::bos;
+
+        auto const ca = sa.configs(a);
+        auto const cb = sb.configs(b);
+        bool same_configs = (ca.size() == cb.size());
+        for (std::size_t i = 0; same_configs && i < ca.size(); ++i)
+            same_configs = same_bytes(sa.bytes(ca[i]), sb.bytes(cb[i]));
+        if (!same_configs)
+            fields |= field::configs;
+        return fields;
+    }
+
+    bool
+    path_less(device const& a, device const& b) noexcept
+    {
+        if (a.bus != b.bus)
+            return a.bus < b.bus;
+        return std::lexicographical_compare(
+                a.ports, a.ports + a.num_ports, b.ports, b.ports + b.num_ports);
+    }
+
+    void
+    format_location(buffer& buf, device const& d)
+    {
+        auto out = std::back_inserter(buf);
+        if (d.num_ports == 0)
+            fmt::format_to(out, "usb{}", d.bus);
+        else
+            fmt::format_to(out, "{}-{}", d.bus, fmt::join(d.ports, d.ports + d.num_ports, "."));
+    }
+
+    void
+    format_device(buffer& buf, char sign, usb_snapshot const& s, device const& d,
+            usb_ids const* names)
+    {
+        auto out = std::back_inserter(buf);
+        buf.push_back(sign);
+        buf.push_back(' ');
+        format_location(buf, d);
+        fmt::format_to(out, "  {:04x}:{:04x}", d.desc.idVendor, d.desc.idProduct);
+        std::string_view name = s.string(d.product);
+        if (name.empty() && names)
+            name = names->product(d.desc.idVendor, d.desc.idProduct);
+        if (!name.empty())
+            fmt::format_to(out, "  {}", name);
+        if (std::string_view const serial = s.string(d.serial); !serial.empty())
+            fmt::format_to(out, "  serial {}", serial);
+        buf.push_back('\n');
+    }
+
+    void
+    format_label(buffer& buf, char const* prefix, std::string_view label, usb_snapshot const& s)
+    {
+        char when[32] = "";
+        std::time_t const t = static_cast<std::time_t>(s.saved_at());
+        std::tm tm;
+        if (::localtime_r(&t, &tm))
+            std::strftime(when, sizeof(when), "%F %T", &tm);
+        fmt::format_to(std::back_inserter(buf), "{} {} ({})\n", prefix, label, when);
+    }
+
+    template <typename T>
+    void
+    format_field(buffer& buf, char const* name, T a, T b)
+    {
+        if (a != b)
+            fmt::format_to(std::back_inserter(buf), "    {}: {:#x} -> {:#x}\n", name, a, b);
+    }
+
+    void
+    format_string(buffer& buf, char const* name, std::string_view a, std::string_view b)
+    {
+        if (a != b)
+            fmt::format_to(std::back_inserter(buf), "    {}: \"{}\" -> \"{}\"\n", name, a, b);
+    }
+
+    void
+    format_changes(buffer& buf, usb_snapshot const& sa, usb_snapshot const& sb,
+            device_change const& c)
+    {
+        auto out = std::back_inserter(buf);
+        device const& a = *c.before;
+        device const& b = *c.after;
+        if (c.fields & field::moved) {
+            buf.append(std::string_view("    moved from "));
+            format_location(buf, a);
+            buf.push_back('\n');
+        }
+        if (c.fields & field::speed) {
+            fmt::format_to(out, "    speed: {} -> {}\n", to_str(static_cast<libusb_speed>(a.speed)),
+                    to_str(static_cast<libusb_speed>(b.speed)));
+        }
+        if (c.fields & field::device_desc) {
+            format_field(buf, "bcdUSB", a.desc.bcdUSB, b.desc.bcdUSB);
+            format_field(buf, "bDeviceClass", a.desc.bDeviceClass, b.desc.bDeviceClass);
+            format_field(buf, "bDeviceSubClass", a.desc.bDeviceSubClass, b.desc.bDeviceSubClass);
+            format_field(buf, "bDeviceProtocol", a.desc.bDeviceProtocol, b.desc.bDeviceProtocol);
+            format_field(buf, "bMaxPacketSize0", a.desc.bMaxPacketSize0, b.desc.bMaxPacketSize0);
+            format_field(buf, "bcdDevice", a.desc.bcdDevice, b.desc.bcdDevice);
+            format_field(buf, "iManufacturer", a.desc.iManufacturer, b.desc.iManufacturer);
+            format_field(buf, "iProduct", a.desc.iProduct, b.desc.iProduct);
+            format_field(buf, "iSerialNumber", a.desc.iSerialNumber, b.desc.iSerialNumber);
+            format_field(buf, "bNumConfigurations", a.desc.bNumConfigurations,
+                    b.desc.bNumConfigurations);
+        }
+        if (c.fields & field::strings) {
+            format_string(
+                    buf, "manufacturer", sa.string(a.manufacturer), sb.string(b.manufacturer));
+            format_string(buf, "product", sa.string(a.product), sb.string(b.product));
+            format_string(buf, "serial", sa.string(a.serial), sb.string(b.serial));
+        }
+        if (c.fields & field::configs)
+            buf.append(std::string_view("    configuration descriptors differ\n"));
+        if (c.fields & field::bos)
+            buf.append(std::string_view("    BOS descriptors differ\n"));
+    }
+
+} // namespace
+
+
+snapshot_diff
+diff_snapshots(usb_snapshot const& before, usb_snapshot const& after, usb_filter const& filter)
+{
+    side a(before, filter);
+    side b(after, filter);
+    snapshot_diff d;
+
+    auto pair = [&](std::uint32_t i, std::uint32_t j) {
+        a.paired[i] = b.paired[j] = true;
+        unsigned const fields = compare(before, *a.devices[i], after, *b.devices[j]);
+        if (fields == 0)
+            ++d.unchanged;
+        else
+            d.changes.push_back({device_change::kind::changed, a.devices[i], b.devices[j], fields});
+    };
+
+    // by serial number first, so that a device moved to another port
+    // isn't mistaken for one removed and another added
+    for (std::uint32_t i = 0; i < a.devices.size(); ++i) {
+        std::string_view const serial = before.string(a.devices[i]->serial);
+        if (serial.empty())
+            continue;
+        auto const it = b.serials.find(serial);
+        if (it != b.serials.end() && !b.paired[it->second]
+                && same_ids(*a.devices[i], *b.devices[it->second]))
+            pair(i, it->second);
+    }
+
+    for (std::uint32_t i = 0; i < a.devices.size(); ++i) {
+        if (a.paired[i])
+            continue;
+        device const& da = *a.devices[i];
+        std::uint32_t const j = b.paths.find(da.bus, {da.ports, da.num_ports});
+        if (j == usb_topology::npos || b.paired[j] || !same_ids(da, *b.devices[j]))
+            continue;
+        // a device with another serial number is another device
+        std::string_view const sa = before.string(da.serial);
+        std::string_view const sb = after.string(b.devices[j]->serial);
+        if (sa.empty() || sb.empty() || sa == sb)
+            pair(i, j);
+    }
+
+    for (std::uint32_t i = 0; i < a.devices.size(); ++i) {
+        if (!a.paired[i])
+            d.changes.push_back({device_change::kind::removed, a.devices[i], nullptr, 0});
+    }
+    for (std::uint32_t j = 0; j < b.devices.size(); ++j) {
+        if (!b.paired[j])
+            d.changes.push_back({device_change::kind::added, nullptr, b.devices[j], 0});
+    }
+
+    std::sort(d.changes.begin(), d.changes.end(),
+            [](device_change const& x, device_change const& y) {
+                device const& dx = x.after ? *x.after : *x.before;
+                device const& dy = y.after ? *y.after : *y.before;
+                return path_less(dx, dy);
+            });
+    return d;
+}
+
+
+void
+format_snapshot_diff(buffer& buf, usb_snapshot const& before, std::string_view before_label,
+        usb_snapshot const& after, std::string_view after_label, snapshot_diff const& d,
+        usb_ids const* names)
+{
+    format_label(buf, "---", before_label, before);
+    format_label(buf, "+++", after_label, after);
+
+    std::size_t counts[3] = {0};
+    for (device_change const& c : d.changes) {
+        ++counts[static_cast<int>(c.what)];
+        switch (c.what) {
+            case device_change::kind::removed:
+                format_device(buf, '-', before, *c.before, names);
+                break;
+            case device_change::kind::added:
+                format_device(buf, '+', after, *c.after, names);
+                break;
+            case device_change::kind::changed:
+                format_device(buf, '~', after, *c.after, names);
+                format_changes(buf, before, after, c);
+                break;
+        }
+    }
+
+    fmt::format_to(std::back_inserter(buf), "{} removed, {} added, {} changed, {} unchanged\n",
+            counts[0], counts[1], counts[2], d.unchanged);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "util/usb_snapshot.hpp"
+#include "util/usb_filter.hpp"
+#include "util/usb_ids.hpp"
+#include <fmt/format.h>
+#include <cstddef> // std::size_t
+#include <string_view>
+#include <vector>
+
+
+// Structural diff of two snapshots. A device in one is paired with one
+// in the other by serial number first, which follows it to another
+// port, and failing that by bus and port path; either way only if
+// vendor and product IDs agree. Paired devices are compared field by
+// field, unpaired ones are removed or added. Both sides are indexed in
+// hash maps, so the diff takes linear time.
+
+struct device_change
+{
+    enum class kind
+    {
+        removed,
+        added,
+        changed,
+    };
+
+    /// What differs between the two sides of a changed device.
+    enum field : unsigned
+    {
+        moved = 1u << 0, ///< bus or port path
+        speed = 1u << 1,
+        device_desc = 1u << 2,
+        strings = 1u << 3,
+        configs = 1u << 4,
+        bos = 1u << 5,
+    };
+
+    kind what = kind::changed;
+    usb_snapshot::device const* before = nullptr; ///< null if added
+    usb_snapshot::device const* after = nullptr; ///< null if removed
+    unsigned fields = 0;
+};
+
+struct snapshot_diff
+{
+    std::vector<device_change> changes; ///< by port path
+    std::size_t unchanged = 0;
+};
+
+/// Compares the devices of \c before and \c after that \c filter accepts.
+snapshot_diff diff_snapshots(
+        usb_snapshot const& before, usb_snapshot const& after, usb_filter const&);
+
+/// Appends a text report of \c d, one paragraph per change, headed by
+/// the two sides' labels (e.g. file names).
+void format_snapshot_diff(fmt::memory_buffer&, usb_snapshot const& before,
+        std::string_view before_label, usb_snapshot const& after, std::string_view after_label,
+        snapshot_diff const& d, usb_ids const* names);
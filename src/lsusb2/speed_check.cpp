@@ -0,0 +1,223 @@
+#include "speed_check.hpp"
+#include "util/usb_enums.hpp"
+#include <algorithm> // std::equal, std::max
+#include <iterator>
+#include <string_view>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+
+    constexpr char const*
+    short_name(libusb_speed s) noexcept
+    {
+        // clang-format off
+        switch (s) {
+            case LIBUSB_SPEED_LOW:          return "low";
+            case LIBUSB_SPEED_FULL:         return "full";
+            case LIBUSB_SPEED_HIGH:         return "high";
+            case LIBUSB_SPEED_SUPER:        return "super";
+            case LIBUSB_SPEED_SUPER_PLUS:   return "super+";
+            default: break;
+        }
+        // clang-format on
+        return "unknown";
+    }
+
+    desc::bytes
+    container_id(device_node const& dev) noexcept
+    {
+        for (desc::descriptor const d : desc::descriptor_range(dev.bos)) {
+            if (auto c = desc::as<desc::container_id_cap_desc>(d))
+                return c->container_id();
+        }
+        return {};
+    }
+
+    /// The speed of the other half of a USB 3 hub, which shows up
+    /// twice, with the same container ID; or of the SuperSpeed root hub
+    /// of the same xHCI, which has the same serial number (the
+    /// controller's name).
+    libusb_speed
+    twin_speed(bus_model const& model, device_node const& dev) noexcept
+    {
+        libusb_speed fastest = LIBUSB_SPEED_UNKNOWN;
+        bool const root = (dev.num_ports == 0);
+        desc::bytes const id = root ? desc::bytes() : container_id(dev);
+        if (root ? dev.serial.empty() : id.empty())
+            return fastest;
+
+        for (device_node const& other : model.devices()) {
+            if (&other == &dev || (other.num_ports == 0) != root)
+                continue;
+            bool const same = root ? other.serial == dev.serial : [&] {
+                desc::bytes const other_id = container_id(other);
+                return std::equal(id.begin(), id.end(), other_id.begin(), other_id.end());
+            }();
+            if (same)
+                fastest = std::max(fastest, other.speed);
+        }
+        return fastest;
+    }
+
+    /// The root hub and the hubs down to \c dev, as far as listed.
+    std::vector<device_node const*>
+    upstream(bus_model const& model, device_node const& dev)
+    {
+        std::vector<device_node const*> hops;
+        for (std::uint8_t depth = 0; depth < dev.num_ports; ++depth) {
+            if (device_node const* hub = model.find(dev.bus, {dev.ports, depth}))
+                hops.push_back(hub);
+        }
+        return hops;
+    }
+
+    void
+    format_location(buffer& buf, device_node const& d)
+    {
+        auto out = std::back_inserter(buf);
+        if (d.num_ports == 0)
+            fmt::format_to(out, "usb{}", d.bus);
+        else
+            fmt::format_to(out, "{}-{}", d.bus, fmt::join(d.ports, d.ports + d.num_ports, "."));
+    }
+
+    void
+    format_device(buffer& buf, device_node const& d)
+    {
+        format_location(buf, d);
+        auto out = std::back_inserter(buf);
+        fmt::format_to(out, " {:04x}:{:04x}", d.desc.idVendor, d.desc.idProduct);
+        std::string_view const name = d.product_name.empty() ? d.product : d.product_name;
+        if (!name.empty())
+            fmt::format_to(out, " {}", name);
+    }
+
+    void
+    format_mismatch(buffer& buf, bus_model const& model, speed_mismatch const& m)
+    {
+        auto out = std::back_inserter(buf);
+        device_node const& dev = *m.dev;
+        format_device(buf, dev);
+        fmt::format_to(out, ": {}, capable of {}\n  path:", to_str(dev.speed), to_str(m.capable));
+        for (device_node const* hop : upstream(model, dev)) {
+            buf.push_back(' ');
+            format_location(buf, *hop);
+            fmt::format_to(out, " ({}) >", short_name(hop->speed));
+        }
+        buf.push_back(' ');
+        format_location(buf, dev);
+        fmt::format_to(out, " ({})\n  bottleneck: ", short_name(dev.speed));
+
+        device_node const& b = *m.bottleneck;
+        switch (m.why) {
+            case speed_mismatch::cause::bus:
+                format_location(buf, b);
+                fmt::format_to(out, ", a {} bus\n", to_str(b.speed));
+                break;
+            case speed_mismatch::cause::hub:
+                format_device(buf, b);
+                fmt::format_to(out, ", capable of {} only\n", to_str(capable_speed(b)));
+                break;
+            case speed_mismatch::cause::hub_link:
+                format_device(buf, b);
+                fmt::format_to(out, ", running at {} though capable of {}\n", to_str(b.speed),
+                        to_str(capable_speed(b)));
+                break;
+            case speed_mismatch::cause::link:
+                buf.append(std::string_view("the device's own link (port or cable)"));
+                if (m.hub_speed > dev.speed)
+                    fmt::format_to(out, ", its hub runs at {}", to_str(m.hub_speed));
+                buf.push_back('\n');
+                break;
+        }
+    }
+
+} // namespace
+
+
+libusb_speed
+capable_speed(device_node const& dev) noexcept
+{
+    libusb_speed best = dev.speed;
+    if (dev.desc.bcdUSB >= 0x0300)
+        best = std::max(best, LIBUSB_SPEED_SUPER);
+    else if (dev.desc.bcdUSB >= 0x0200)
+        best = std::max(best, LIBUSB_SPEED_HIGH);
+    for (desc::descriptor const d : desc::descriptor_range(dev.bos)) {
+        if (desc::as<desc::ssp_usb_cap_desc>(d))
+            best = std::max(best, LIBUSB_SPEED_SUPER_PLUS);
+        else if (auto ss = desc::as<desc::ss_usb_cap_desc>(d); ss && (ss->speeds_supported() & 0x8))
+            best = std::max(best, LIBUSB_SPEED_SUPER);
+    }
+    return best;
+}
+
+
+speed_report
+check_speeds(bus_model const& model)
+{
+    speed_report r;
+    for (device_node const& dev : model.devices()) {
+        // every device from USB 2.01 on has one; root hubs needn't
+        if (dev.num_ports != 0 && dev.bos.empty() && dev.desc.bcdUSB >= 0x0201
+                && dev.speed < LIBUSB_SPEED_SUPER_PLUS)
+            ++r.unknown;
+
+        libusb_speed const capable = capable_speed(dev);
+        if (capable <= dev.speed || twin_speed(model, dev) >= capable)
+            continue;
+
+        speed_mismatch m;
+        m.dev = &dev;
+        m.capable = capable;
+        m.bottleneck = &dev;
+
+        // the first hop, from the root down, that can't carry the
+        // speed; failing that, the first that could but doesn't
+        std::vector<device_node const*> const hops = upstream(model, dev);
+        if (device_node const* hub = model.parent(dev); hub && hub->num_ports + 1 == dev.num_ports)
+            m.hub_speed = std::max(hub->speed, twin_speed(model, *hub));
+        for (device_node const* hop : hops) {
+            if (std::max(capable_speed(*hop), twin_speed(model, *hop)) < capable) {
+                m.why = (hop->num_ports == 0) ? speed_mismatch::cause::bus
+                                              : speed_mismatch::cause::hub;
+                m.bottleneck = hop;
+                break;
+            }
+        }
+        if (m.bottleneck == &dev) {
+            for (device_node const* hop : hops) {
+                if (hop->num_ports != 0 && hop->speed < capable
+                        && twin_speed(model, *hop) < capable) {
+                    m.why = speed_mismatch::cause::hub_link;
+                    m.bottleneck = hop;
+                    break;
+                }
+            }
+        }
+        r.mismatches.push_back(m);
+    }
+    return r;
+}
+
+
+void
+format_speed_report(buffer& buf, bus_model const& model, speed_report const& r)
+{
+    for (speed_mismatch const& m : r.mismatches)
+        format_mismatch(buf, model, m);
+
+    auto out = std::back_inserter(buf);
+    if (r.mismatches.empty())
+        fmt::format_to(out, "no device runs below the speed it is capable of\n");
+    else
+        fmt::format_to(out, "{} device(s) run below the speed they are capable of\n",
+                r.mismatches.size());
+    if (r.unknown != 0)
+        fmt::format_to(out,
+                "{} device(s) not checked: BOS descriptor not readable (needs access to the "
+                "device nodes, or Linux 6.4 or later with --sysfs)\n",
+                r.unknown);
+}
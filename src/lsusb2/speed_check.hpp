@@ -0,0 +1,54 @@
+#pragma once
+
+#include "model.hpp"
+#include <fmt/format.h>
+#include <libusb.h>
+#include <cstddef> // std::size_t
+#include <vector>
+
+
+// Devices whose link runs slower than they can. What a device can do
+// comes from its BOS (SuperSpeed and SuperSpeedPlus capabilities) and
+// from the USB version it declares: 2.0 counts as high speed, 3.0 as
+// SuperSpeed. So this finds devices declaring USB 2.0 stuck at full
+// speed, SuperSpeed devices stuck at high speed or below, and
+// SuperSpeedPlus devices stuck at 5 Gbit/s. Some full-speed-only
+// devices declare USB 2.0 too; they show up with their own link as the
+// bottleneck, running below the hub they are plugged into.
+//
+// The hubs above a device are found by port path, so they need to be
+// listed as well.
+
+struct speed_mismatch
+{
+    /// What holds the device back, from the root down.
+    enum class cause
+    {
+        bus, ///< the root hub is slower (e.g. a USB 2.0 bus)
+        hub, ///< a hub in between is slower
+        hub_link, ///< a hub in between runs slower than it can
+        link, ///< the device's own link (port or cable)
+    };
+
+    device_node const* dev = nullptr;
+    libusb_speed capable = LIBUSB_SPEED_UNKNOWN;
+    cause why = cause::link;
+    device_node const* bottleneck = nullptr; ///< the hub or root hub; \c dev for cause::link
+    /// The speed of the hub \c dev is plugged into (or of its twin, the
+    /// other half of a USB 3 hub); unknown if that hub isn't listed
+    libusb_speed hub_speed = LIBUSB_SPEED_UNKNOWN;
+};
+
+struct speed_report
+{
+    std::vector<speed_mismatch> mismatches;
+    std::size_t unknown = 0; ///< devices that should have a BOS, but it wasn't read
+};
+
+/// \returns the fastest speed \c dev declares, at least its current one
+libusb_speed capable_speed(device_node const& dev) noexcept;
+
+speed_report check_speeds(bus_model const&);
+
+/// Appends a text report of \c r, one paragraph per mismatch.
+void format_speed_report(fmt::memory_buffer&, bus_model const&, speed_report const& r);
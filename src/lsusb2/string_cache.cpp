@@ -0,0 +1,213 @@
+#include "string_cache.hpp"
+#include "util/log.hpp"
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm> // std::min, std::sort
+#include <cerrno>
+#include <charconv> // std::from_chars
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib> // std::free, std::getenv
+#include <cstring> // std::strerror
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+
+namespace { // unnamed
+
+    using file_ptr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+    /// FNV-1a, over the descriptor's fields rather than its bytes, so
+    /// that padding doesn't matter.
+    std::uint64_t
+    hash(libusb_device_descriptor const& dd) noexcept
+    {
+        std::uint64_t h = 0xcbf29ce484222325ull;
+        auto mix = [&h](unsigned v) {
+            h = (h ^ v) * 0x100000001b3ull;
+        };
+        mix(dd.bcdUSB);
+        mix(dd.bDeviceClass);
+        mix(dd.bDeviceSubClass);
+        mix(dd.bDeviceProtocol);
+        mix(dd.bMaxPacketSize0);
+        mix(dd.idVendor);
+        mix(dd.idProduct);
+        mix(dd.bcdDevice);
+        mix(dd.iManufacturer);
+        mix(dd.iProduct);
+        mix(dd.iSerialNumber);
+        mix(dd.bNumConfigurations);
+        return h;
+    }
+
+    /// Tabs and newlines would break the file format.
+    std::string
+    sanitize(std::string s)
+    {
+        for (char& c : s) {
+            if (c == '\t' || c == '\n')
+                c = ' ';
+        }
+        return s;
+    }
+
+    std::int64_t
+    unix_now() noexcept
+    {
+        return static_cast<std::int64_t>(std::time(nullptr));
+    }
+
+    /// Splits off the text up to the next tab.
+    std::string_view
+    next_field(std::string_view& line) noexcept
+    {
+        std::size_t const tab = line.find('\t');
+        std::string_view const f = line.substr(0, tab);
+        line = (tab == std::string_view::npos) ? std::string_view() : line.substr(tab + 1);
+        return f;
+    }
+
+} // namespace
+
+
+std::string
+string_cache::default_path()
+{
+    if (char const* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        return fmt::format("{}/lsusb2/strings", xdg);
+    if (char const* home = std::getenv("HOME"); home && *home)
+        return fmt::format("{}/.cache/lsusb2/strings", home);
+    return {};
+}
+
+std::string
+string_cache::key(usb_device const& d)
+{
+    return fmt::format("{}-{}:{:016x}", d.bus, fmt::join(d.ports, d.ports + d.num_ports, "."),
+            hash(d.desc));
+}
+
+
+bool
+string_cache::load(std::string const& path)
+{
+    file_ptr f(std::fopen(path.c_str(), "r"), &std::fclose);
+    if (!f) {
+        if (errno == ENOENT)
+            return true;
+        LOG_ERROR("{}: fopen({}) failure ({})", __builtin_FUNCTION(), path, std::strerror(errno));
+        return false;
+    }
+
+    // no fixed-size buffer: three strings of up to 126 UTF-16 units each,
+    // converted to UTF-8, may take more than a kilobyte
+    std::int64_t const now = unix_now();
+    char* buf = nullptr;
+    std::size_t cap = 0;
+    ssize_t n = 0;
+    while ((n = ::getline(&buf, &cap, f.get())) != -1) {
+        std::string_view line(buf, static_cast<std::size_t>(n));
+        if (!line.empty() && line.back() == '\n')
+            line.remove_suffix(1);
+
+        std::string_view const k = next_field(line);
+        entry e;
+        e.manufacturer = next_field(line);
+        e.product = next_field(line);
+        e.serial = next_field(line);
+
+        // lines written before entries had a time count as used now
+        std::string_view const used = next_field(line);
+        if (std::from_chars(used.data(), used.data() + used.size(), e.used).ec != std::errc())
+            e.used = now;
+        if (now - e.used > max_age_secs)
+            dirty_ = true; // dropped
+        else if (!k.empty())
+            entries_.insert_or_assign(std::string(k), std::move(e));
+    }
+    std::free(buf);
+    return true;
+}
+
+bool
+string_cache::save(std::string const& path) const
+{
+    if (!dirty_)
+        return true;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+    // private: it holds serial numbers
+    std::string const tmp = path + ".tmp";
+    std::remove(tmp.c_str());
+    int const fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        LOG_ERROR("{}: open({}) failure ({})", __builtin_FUNCTION(), tmp, std::strerror(errno));
+        return false;
+    }
+    file_ptr f(::fdopen(fd, "w"), &std::fclose);
+    if (!f) {
+        LOG_ERROR("{}: fdopen({}) failure ({})", __builtin_FUNCTION(), tmp, std::strerror(errno));
+        ::close(fd);
+        std::remove(tmp.c_str());
+        return false;
+    }
+
+    // the most recently used first, cut off at max_entries
+    using value_type = decltype(entries_)::value_type;
+    std::vector<value_type const*> order;
+    order.reserve(entries_.size());
+    for (value_type const& kv : entries_)
+        order.push_back(&kv);
+    std::sort(order.begin(), order.end(), [](value_type const* a, value_type const* b) {
+        return a->second.used > b->second.used;
+    });
+    order.resize(std::min(order.size(), max_entries));
+
+    for (value_type const* kv : order) {
+        entry const& e = kv->second;
+        fmt::print(f.get(), "{}\t{}\t{}\t{}\t{}\n", kv->first, e.manufacturer, e.product,
+                e.serial, e.used);
+    }
+
+    if (std::fflush(f.get()) != 0 || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("{}: writing {} failure ({})", __builtin_FUNCTION(), path, std::strerror(errno));
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+string_cache::entry const*
+string_cache::find(std::string const& key) noexcept
+{
+    auto const it = entries_.find(key);
+    if (it == entries_.end())
+        return nullptr;
+
+    // to the day, so that a run with nothing but hits doesn't rewrite the file
+    if (std::int64_t const now = unix_now(); now - it->second.used >= 24 * 3600) {
+        it->second.used = now;
+        dirty_ = true;
+    }
+    return &it->second;
+}
+
+void
+string_cache::insert(std::string key, entry e)
+{
+    e.manufacturer = sanitize(std::move(e.manufacturer));
+    e.product = sanitize(std::move(e.product));
+    e.serial = sanitize(std::move(e.serial));
+    e.used = unix_now();
+    entries_.insert_or_assign(std::move(key), std::move(e));
+    dirty_ = true;
+}
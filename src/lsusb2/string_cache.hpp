@@ -0,0 +1,58 @@
+#pragma once
+
+#include "device.hpp"
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+
+/// Manufacturer, product and serial strings from earlier runs, so that
+/// devices don't have to be opened again to resolve them. Entries are
+/// keyed by bus, port path and a hash of the device descriptor: a
+/// device plugged into another port, or with different descriptors, is
+/// a miss. Two identical devices swapped between ports are not noticed,
+/// so a serial number filter is never decided on a cached serial.
+///
+/// The file holds one tab-separated line per device, with the time it
+/// was last used. It is created readable by its owner only, since it
+/// holds serial numbers. Entries unused for max_age_secs are dropped on
+/// load, and only the max_entries most recently used are saved.
+class string_cache
+{
+public:
+    struct entry
+    {
+        std::string manufacturer;
+        std::string product;
+        std::string serial;
+        std::int64_t used = 0; ///< unix time of the last insert, or hit (to the day)
+    };
+
+    static constexpr std::int64_t max_age_secs = 30 * 24 * 3600;
+    static constexpr std::size_t max_entries = 1024;
+
+private:
+    std::unordered_map<std::string, entry> entries_;
+    bool dirty_ = false;
+
+public:
+    /// $XDG_CACHE_HOME/lsusb2/strings or ~/.cache/lsusb2/strings, or
+    /// empty if neither is known
+    static std::string default_path();
+
+    static std::string key(usb_device const&);
+
+    /// A missing file is an empty cache.
+    /// \returns false (after logging why) if the file couldn't be read
+    bool load(std::string const& path);
+
+    /// Writes the cache if anything changed since load(), replacing the
+    /// file atomically.
+    /// \returns false (after logging why) on failure
+    bool save(std::string const& path) const;
+
+    /// Counts as a use of the entry, if there is one.
+    entry const* find(std::string const& key) noexcept;
+    void insert(std::string key, entry);
+};
@@ -0,0 +1,299 @@
+#include "backend.hpp"
+#include "util/log.hpp"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm> // std::sort, std::lexicographical_compare
+#include <cerrno>
+#include <charconv> // std::from_chars
+#include <cstring> // std::memcpy, std::strchr, std::strerror
+#include <string>
+#include <string_view>
+
+
+namespace { // unnamed
+
+    constexpr std::uint16_t
+    le16(std::uint8_t const* p) noexcept
+    {
+        return static_cast<std::uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    /// Reads a whole (small) sysfs attribute of \c dir_fd.
+    /// \returns number of bytes read, or -1 on failure
+    ssize_t
+    read_attr(int dir_fd, char const* name, void* buf, std::size_t len) noexcept
+    {
+        int const fd = ::openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return -1;
+
+        std::size_t total = 0;
+        while (total < len) {
+            ssize_t const n = ::read(fd, static_cast<char*>(buf) + total, len - total);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                if (n == -1)
+                    total = static_cast<std::size_t>(-1);
+                break;
+            }
+            total += static_cast<std::size_t>(n);
+        }
+
+        ::close(fd);
+        return static_cast<ssize_t>(total);
+    }
+
+    /// \returns text attribute without the trailing newline, or an
+    /// empty view on failure
+    std::string_view
+    read_text_attr(int dir_fd, char const* name, char (&buf)[32]) noexcept
+    {
+        ssize_t const n = read_attr(dir_fd, name, buf, sizeof(buf));
+        if (n <= 0)
+            return {};
+
+        std::string_view s(buf, static_cast<std::size_t>(n));
+        while (!s.empty() && (s.back() == '\n' || s.back() == ' '))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    /// Reads a binary attribute of any size into \c buf, growing it as
+    /// needed. \returns number of bytes read, or -1 on failure
+    ssize_t
+    read_binary_attr(int dir_fd, char const* name, std::vector<std::uint8_t>& buf)
+    {
+        while (true) {
+            ssize_t const n = read_attr(dir_fd, name, buf.data(), buf.size());
+            if (n < 0 || static_cast<std::size_t>(n) < buf.size())
+                return n;
+            buf.resize(buf.size() * 2);
+        }
+    }
+
+    void
+    read_string_attr(int dir_fd, char const* name, std::string& out)
+    {
+        char buf[256]; // string descriptors are at most 126 UTF-16 code units
+        ssize_t n = read_attr(dir_fd, name, buf, sizeof(buf));
+        while (n > 0 && buf[n - 1] == '\n')
+            --n;
+        if (n > 0)
+            out.assign(buf, static_cast<std::size_t>(n));
+    }
+
+    template <typename T>
+    bool
+    parse_uint(std::string_view s, T& v) noexcept
+    {
+        auto const [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+        return !s.empty() && ec == std::errc() && ptr == s.data() + s.size();
+    }
+
+    /// \c speed is in Mbit/s, as written by the kernel
+    libusb_speed
+    parse_speed(std::string_view speed) noexcept
+    {
+        // clang-format off
+        if (speed == "1.5")     return LIBUSB_SPEED_LOW;
+        if (speed == "12")      return LIBUSB_SPEED_FULL;
+        if (speed == "480")     return LIBUSB_SPEED_HIGH;
+        if (speed == "5000")    return LIBUSB_SPEED_SUPER;
+        if (speed == "10000" || speed == "20000") return LIBUSB_SPEED_SUPER_PLUS;
+        // clang-format on
+        return LIBUSB_SPEED_UNKNOWN;
+    }
+
+    /// \c devpath is "0" for a root hub, otherwise the dot separated
+    /// port numbers (e.g. "1.4.2")
+    void
+    parse_devpath(std::string_view devpath, usb_device& d) noexcept
+    {
+        if (devpath == "0")
+            return;
+
+        while (!devpath.empty() && d.num_ports < sizeof(d.ports)) {
+            std::string_view::size_type const dot = devpath.find('.');
+            if (std::uint8_t port = 0; parse_uint(devpath.substr(0, dot), port))
+                d.ports[d.num_ports++] = port;
+            devpath = (dot == std::string_view::npos) ? std::string_view()
+                                                      : devpath.substr(dot + 1);
+        }
+    }
+
+    /// The "descriptors" attribute holds the 18 byte device descriptor
+    /// followed by every configuration descriptor as the device sent
+    /// it (little-endian).
+    bool
+    parse_device_desc(std::uint8_t const* p, std::size_t len, usb_device& d) noexcept
+    {
+        if (len < LIBUSB_DT_DEVICE_SIZE || p[0] != LIBUSB_DT_DEVICE_SIZE
+                || p[1] != LIBUSB_DT_DEVICE)
+            return false;
+
+        d.desc.bLength = p[0];
+        d.desc.bDescriptorType = p[1];
+        d.desc.bcdUSB = le16(p + 2);
+        d.desc.bDeviceClass = p[4];
+        d.desc.bDeviceSubClass = p[5];
+        d.desc.bDeviceProtocol = p[6];
+        d.desc.bMaxPacketSize0 = p[7];
+        d.desc.idVendor = le16(p + 8);
+        d.desc.idProduct = le16(p + 10);
+        d.desc.bcdDevice = le16(p + 12);
+        d.desc.iManufacturer = p[14];
+        d.desc.iProduct = p[15];
+        d.desc.iSerialNumber = p[16];
+        d.desc.bNumConfigurations = p[17];
+        return true;
+    }
+
+    /// \c p and \c len as for parse_device_desc()
+    void
+    parse_configs(std::uint8_t const* p, std::size_t len, usb_device& d)
+    {
+        std::size_t off = LIBUSB_DT_DEVICE_SIZE;
+        while (len - off >= LIBUSB_DT_CONFIG_SIZE && p[off + 1] == LIBUSB_DT_CONFIG) {
+            std::size_t const total = std::min<std::size_t>(le16(p + off + 2), len - off);
+            if (total < LIBUSB_DT_CONFIG_SIZE)
+                break;
+            d.configs.emplace_back(p + off, p + off + total);
+            off += total;
+        }
+    }
+
+    /// Reads the device in \c dev_fd one stage at a time, until
+    /// \c filter rejects it or everything in \c what has been fetched.
+    /// \returns false if the device was rejected or could not be read
+    /// (typically because it was unplugged while enumerating), in which
+    /// case \c unreadable tells which
+    bool
+    read_device(int dev_fd, unsigned what, usb_filter const& filter, std::vector<std::uint8_t>& buf,
+            usb_device& d, bool& unreadable)
+    {
+        unreadable = true;
+        char text[32];
+        if (!parse_uint(read_text_attr(dev_fd, "busnum", text), d.bus)
+                || !parse_uint(read_text_attr(dev_fd, "devnum", text), d.address))
+            return false;
+
+        d.speed = parse_speed(read_text_attr(dev_fd, "speed", text));
+        parse_devpath(read_text_attr(dev_fd, "devpath", text), d);
+
+        usb_facts facts;
+        std::vector<usb_class> classes; // facts.interfaces
+        facts.bus = d.bus;
+        facts.ports = {d.ports, d.num_ports};
+        facts.speed = d.speed;
+        usb_filter::verdict v = filter.check(usb_stage::location, facts);
+        auto const need = [&v, what](fetch_flags f) {
+            return v == usb_filter::verdict::undecided
+                    || (v == usb_filter::verdict::accept && wants(what, f));
+        };
+
+        if (need(fetch_device_desc)) {
+            // configurations come in the same attribute: read them now if
+            // they may be needed, rather than opening it twice
+            bool const with_configs = wants(what, fetch_configs)
+                    || filter.max_stage() >= usb_stage::configs;
+            ssize_t n = 0;
+            if (!with_configs) {
+                n = read_attr(dev_fd, "descriptors", buf.data(), LIBUSB_DT_DEVICE_SIZE);
+            } else {
+                // may be larger than a page for composite devices
+                n = read_binary_attr(dev_fd, "descriptors", buf);
+            }
+
+            std::size_t const len = (n < 0) ? 0 : static_cast<std::size_t>(n);
+            if (!parse_device_desc(buf.data(), len, d))
+                return false;
+            facts.desc = &d.desc;
+            if (v == usb_filter::verdict::undecided)
+                v = filter.check(usb_stage::device_desc, facts);
+
+            if (with_configs && need(fetch_configs)) {
+                parse_configs(buf.data(), len, d);
+                if (v == usb_filter::verdict::undecided) {
+                    for (auto const& config : d.configs)
+                        collect_interface_classes(config, classes);
+                    facts.interfaces = classes;
+                    v = filter.check(usb_stage::configs, facts);
+                }
+            }
+        }
+
+        if (need(fetch_strings)) {
+            // absent if the device doesn't provide the string
+            read_string_attr(dev_fd, "manufacturer", d.manufacturer);
+            read_string_attr(dev_fd, "product", d.product);
+            read_string_attr(dev_fd, "serial", d.serial);
+            facts.serial = d.serial;
+            if (v == usb_filter::verdict::undecided)
+                v = filter.check(usb_stage::strings, facts);
+        }
+
+        // only there since Linux 6.4; without it, the capabilities are
+        // unknown
+        if (v == usb_filter::verdict::accept && wants(what, fetch_bos)
+                && d.desc.bcdUSB >= 0x0201) {
+            ssize_t const n = read_binary_attr(dev_fd, "bos_descriptors", buf);
+            if (n >= LIBUSB_DT_BOS_SIZE && buf[1] == LIBUSB_DT_BOS)
+                d.bos.assign(buf.data(), buf.data() + n);
+        }
+
+        unreadable = false;
+        return v == usb_filter::verdict::accept;
+    }
+
+} // namespace
+
+
+bool
+enumerate_sysfs(std::vector<usb_device>& devices, unsigned what, usb_filter const& filter,
+        std::string const& root)
+{
+    std::string const path = root + "/bus/usb/devices";
+    int const dir_fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* const dir = (dir_fd == -1) ? nullptr : ::fdopendir(dir_fd);
+    if (dir == nullptr) {
+        LOG_ERROR("{}: open({}) failure ({})", __builtin_FUNCTION(), path, std::strerror(errno));
+        if (dir_fd != -1)
+            ::close(dir_fd);
+        return false;
+    }
+
+    std::size_t const first = devices.size();
+    std::vector<std::uint8_t> buf(4096);
+
+    while (dirent const* e = ::readdir(dir)) {
+        // interfaces ("1-1.2:1.0") live in the same directory
+        if (e->d_name[0] == '.' || std::strchr(e->d_name, ':') != nullptr)
+            continue;
+
+        int const dev_fd = ::openat(dir_fd, e->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dev_fd == -1)
+            continue;
+
+        usb_device d;
+        bool unreadable = false;
+        if (read_device(dev_fd, what, filter, buf, d, unreadable))
+            devices.push_back(std::move(d));
+        else if (unreadable)
+            LOG_WARN("{}: skipping {}: unreadable device", __builtin_FUNCTION(), e->d_name);
+        ::close(dev_fd);
+    }
+    ::closedir(dir);
+
+    // readdir order is arbitrary; list by bus, then topology
+    std::sort(devices.begin() + static_cast<std::ptrdiff_t>(first), devices.end(),
+            [](usb_device const& a, usb_device const& b) {
+                if (a.bus != b.bus)
+                    return a.bus < b.bus;
+                return std::lexicographical_compare(
+                        a.ports, a.ports + a.num_ports, b.ports, b.ports + b.num_ports);
+            });
+
+    return true;
+}
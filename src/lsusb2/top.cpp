@@ -0,0 +1,417 @@
+#include "top.hpp"
+#include "backend.hpp"
+#include "format.hpp"
+#include "util/log.hpp"
+#include "util/usbmon.hpp"
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm> // std::sort, std::lower_bound
+#include <cerrno>
+#include <charconv> // std::from_chars
+#include <cstdint>
+#include <cstring> // std::strerror
+#include <ctime>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility> // std::exchange, std::swap
+#include <vector>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+
+    /// Counters kept per device: endpoint numbers 0-15 OUT, then IN.
+    /// Control transfers all count toward endpoint 0, whichever their
+    /// direction.
+    constexpr std::size_t endpoint_slots = 32;
+
+    /// Addresses per bus in the map from bus and address to slot.
+    constexpr std::size_t addresses = 128;
+
+    /// How often the devices are listed again, for arrivals and
+    /// departures.
+    constexpr std::int64_t relist_nsecs = 5'000'000'000;
+
+    /// Events fetched from usbmon at a time.
+    constexpr std::size_t fetch_batch = 1024;
+
+    constexpr std::size_t
+    endpoint_slot(usbmon::packet_header const& h) noexcept
+    {
+        if (h.xfer_type == usbmon::control)
+            return 0;
+        return (h.epnum & 0x0f) | ((h.epnum & LIBUSB_ENDPOINT_IN) ? 16 : 0);
+    }
+
+    std::int64_t
+    now_nsecs() noexcept
+    {
+        timespec ts{};
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return std::int64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+    }
+
+    /// A sysfs urbnum: URBs submitted to the device since it arrived.
+    std::optional<std::uint64_t>
+    read_urbnum(int fd) noexcept
+    {
+        char buf[24];
+        ssize_t const n = ::pread(fd, buf, sizeof(buf), 0);
+        std::uint64_t v = 0;
+        if (n <= 0 || std::from_chars(buf, buf + n, v).ec != std::errc())
+            return std::nullopt;
+        return v;
+    }
+
+    struct counters
+    {
+        std::uint64_t urbs = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    /// A listed device, apart from its counters.
+    struct device_slot
+    {
+        std::uint8_t bus = 0;
+        std::uint8_t address = 0;
+        std::uint16_t vid = 0;
+        std::uint16_t pid = 0;
+        std::string location; ///< "usb<bus>" for a root hub, "<bus>-<ports>" otherwise
+        std::string name;
+        int urbnum_fd = -1; ///< open while counting from sysfs
+    };
+
+    /// One row of the table.
+    struct rate
+    {
+        std::size_t slot = 0; ///< of the device, or of its endpoint's counters
+        double urbs = 0;
+        double bytes = 0;
+    };
+
+    bool
+    busier(rate const& a, rate const& b) noexcept
+    {
+        if (a.bytes != b.bytes)
+            return a.bytes > b.bytes;
+        if (a.urbs != b.urbs)
+            return a.urbs > b.urbs;
+        return a.slot < b.slot;
+    }
+
+
+    /// The counters of the listed devices, in flat arrays indexed by
+    /// slot: counting an event is two array lookups and a sample one
+    /// pass over the arrays, however many devices there are.
+    class traffic_table
+    {
+    private:
+        std::vector<std::uint16_t> slot_of_; ///< by bus * addresses + address: slot + 1, or 0
+        std::vector<device_slot> devices_;
+        std::vector<counters> now_; ///< running totals, endpoint_slots per device
+        std::vector<counters> before_; ///< the totals at the last sample
+        bool urbnum_; ///< counting from sysfs, not usbmon
+
+    public:
+        explicit traffic_table(bool urbnum)
+                : slot_of_(256 * addresses)
+                , urbnum_(urbnum)
+        {}
+
+        ~traffic_table() noexcept
+        {
+            for (device_slot const& d : devices_)
+                close_urbnum(d);
+        }
+
+        traffic_table(traffic_table const&) = delete;
+        traffic_table& operator=(traffic_table const&) = delete;
+
+        /// Replaces the devices with \c listed, carrying the counters of
+        /// those still there over.
+        void relist(std::vector<usb_device> const& listed, std::string const& devices_dir,
+                usb_ids const* names);
+
+        /// Counts a completion.
+        void
+        count(usbmon::packet_header const& h) noexcept
+        {
+            if (h.busnum > 255 || h.devnum >= addresses)
+                return;
+            std::uint16_t const s = slot_of_[h.busnum * addresses + h.devnum];
+            if (s == 0)
+                return; // not listed yet, or filtered out
+            counters& c = now_[(s - 1) * endpoint_slots + endpoint_slot(h)];
+            ++c.urbs;
+            c.bytes += h.length;
+        }
+
+        /// Re-reads the urbnum of every device.
+        void read_urbnums() noexcept;
+
+        /// Appends the rates since the last sample, \c secs ago, at most
+        /// \c max_rows rows below the headings, and starts the next
+        /// sample.
+        void sample(buffer& buf, double secs, std::size_t max_rows);
+
+    private:
+        static void
+        close_urbnum(device_slot const& d) noexcept
+        {
+            if (d.urbnum_fd != -1)
+                ::close(d.urbnum_fd);
+        }
+    };
+
+    void
+    traffic_table::relist(std::vector<usb_device> const& listed, std::string const& devices_dir,
+            usb_ids const* names)
+    {
+        std::vector<std::uint16_t> slot_of(slot_of_.size());
+        std::vector<device_slot> devices;
+        std::vector<counters> now;
+        std::vector<counters> before;
+        devices.reserve(listed.size());
+        now.reserve(listed.size() * endpoint_slots);
+        before.reserve(listed.size() * endpoint_slots);
+
+        for (usb_device const& d : listed) {
+            if (d.address >= addresses || devices.size() == 0xffff)
+                continue;
+            device_slot s;
+            s.bus = d.bus;
+            s.address = d.address;
+            s.vid = d.desc.idVendor;
+            s.pid = d.desc.idProduct;
+            s.location = (d.num_ports == 0)
+                    ? fmt::format("usb{}", d.bus)
+                    : fmt::format("{}-{}", d.bus, fmt::join(d.ports, d.ports + d.num_ports, "."));
+            std::string_view const known = names ? names->product(s.vid, s.pid) : "";
+            s.name = known.empty() ? d.product : std::string(known);
+
+            std::size_t const key = d.bus * addresses + d.address;
+            std::uint16_t const old = slot_of_[key];
+            if (old != 0 && devices_[old - 1].vid == s.vid && devices_[old - 1].pid == s.pid
+                    && devices_[old - 1].location == s.location) {
+                // the same device: carry on counting
+                s.urbnum_fd = std::exchange(devices_[old - 1].urbnum_fd, -1);
+                auto const first = static_cast<std::ptrdiff_t>((old - 1) * endpoint_slots);
+                now.insert(now.end(), now_.begin() + first,
+                        now_.begin() + first + endpoint_slots);
+                before.insert(before.end(), before_.begin() + first,
+                        before_.begin() + first + endpoint_slots);
+            } else {
+                now.resize(now.size() + endpoint_slots);
+                before.resize(before.size() + endpoint_slots);
+                if (urbnum_) {
+                    std::string const path = devices_dir + '/' + s.location + "/urbnum";
+                    s.urbnum_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                    // rates from now on, not since the device arrived
+                    std::optional<std::uint64_t> const v =
+                            (s.urbnum_fd == -1) ? std::nullopt : read_urbnum(s.urbnum_fd);
+                    if (v) {
+                        now[now.size() - endpoint_slots].urbs = *v;
+                        before[before.size() - endpoint_slots].urbs = *v;
+                    } else if (s.urbnum_fd != -1) {
+                        close_urbnum(s);
+                        s.urbnum_fd = -1;
+                    }
+                }
+            }
+            devices.push_back(std::move(s));
+            slot_of[key] = static_cast<std::uint16_t>(devices.size());
+        }
+
+        for (device_slot const& d : devices_)
+            close_urbnum(d); // those gone
+        std::swap(slot_of_, slot_of);
+        std::swap(devices_, devices);
+        std::swap(now_, now);
+        std::swap(before_, before);
+    }
+
+    void
+    traffic_table::read_urbnums() noexcept
+    {
+        for (std::size_t i = 0; i < devices_.size(); ++i) {
+            if (devices_[i].urbnum_fd == -1)
+                continue;
+            if (std::optional<std::uint64_t> const v = read_urbnum(devices_[i].urbnum_fd))
+                now_[i * endpoint_slots].urbs = *v;
+        }
+    }
+
+    void
+    traffic_table::sample(buffer& buf, double secs, std::size_t max_rows)
+    {
+        std::vector<rate> device_rates;
+        std::vector<rate> endpoint_rates; ///< busy ones only
+        device_rates.reserve(devices_.size());
+        std::size_t idle = 0;
+        for (std::size_t d = 0; d < devices_.size(); ++d) {
+            rate r{d};
+            for (std::size_t e = d * endpoint_slots; e < (d + 1) * endpoint_slots; ++e) {
+                counters const delta{now_[e].urbs - before_[e].urbs,
+                        now_[e].bytes - before_[e].bytes};
+                if (delta.urbs == 0 && delta.bytes == 0)
+                    continue;
+                endpoint_rates.push_back({e, delta.urbs / secs, delta.bytes / secs});
+                r.urbs += endpoint_rates.back().urbs;
+                r.bytes += endpoint_rates.back().bytes;
+            }
+            if (r.urbs == 0 && r.bytes == 0)
+                ++idle;
+            else
+                device_rates.push_back(r);
+        }
+        before_ = now_;
+
+        // devices busiest first; each one's endpoints likewise
+        std::sort(device_rates.begin(), device_rates.end(), busier);
+        std::sort(endpoint_rates.begin(), endpoint_rates.end(), [](rate const& a, rate const& b) {
+            if (a.slot / endpoint_slots != b.slot / endpoint_slots)
+                return a.slot < b.slot;
+            return busier(a, b);
+        });
+
+        auto out = std::back_inserter(buf);
+        fmt::format_to(out, "{} devices, {} idle, over {:.2f} s\n", devices_.size(), idle, secs);
+        fmt::format_to(out, "{:<14} {:>7} {:<9} {:>10} {:>13}  {}\n", "device", "address",
+                "vid:pid", "URBs/s", "bytes/s", "name");
+
+        std::size_t rows = 0;
+        for (rate const& r : device_rates) {
+            if (rows++ == max_rows)
+                return;
+            device_slot const& d = devices_[r.slot];
+            fmt::format_to(out, "{:<14} {:>7} {:04x}:{:04x} {:>10.1f} ", d.location, d.address,
+                    d.vid, d.pid, r.urbs);
+            if (urbnum_)
+                fmt::format_to(out, "{:>13}  {}\n", "-", d.name);
+            else
+                fmt::format_to(out, "{:>13.0f}  {}\n", r.bytes, d.name);
+            if (urbnum_)
+                continue; // a single counter per device
+
+            auto e = std::lower_bound(endpoint_rates.begin(), endpoint_rates.end(),
+                    r.slot * endpoint_slots,
+                    [](rate const& a, std::size_t slot) { return a.slot < slot; });
+            for (; e != endpoint_rates.end() && e->slot / endpoint_slots == r.slot; ++e) {
+                if (rows++ == max_rows)
+                    return;
+                std::size_t const i = e->slot % endpoint_slots;
+                std::string const ep = (i == 0)
+                        ? std::string("ep 0x00 control")
+                        : fmt::format("ep {:#04x} {}", (i & 0x0f) | (i >= 16 ? 0x80 : 0),
+                                  i >= 16 ? "in" : "out");
+                fmt::format_to(out, "  {:<30} {:>10.1f} {:>13.0f}\n", ep, e->urbs, e->bytes);
+            }
+        }
+    }
+
+    /// Rows of the terminal on stdout below the headings; no limit
+    /// unless it is one.
+    std::size_t
+    terminal_rows() noexcept
+    {
+        winsize ws{};
+        if (::ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_row < 4)
+            return std::numeric_limits<std::size_t>::max();
+        return ws.ws_row - 3u;
+    }
+
+    void
+    format_clock(buffer& buf)
+    {
+        time_t const secs = std::time(nullptr);
+        std::tm tm{};
+        ::localtime_r(&secs, &tm);
+        fmt::format_to(std::back_inserter(buf), "{:02}:{:02}:{:02}", tm.tm_hour, tm.tm_min,
+                tm.tm_sec);
+    }
+
+} // namespace
+
+
+bool
+run_top(top_options const& opts)
+{
+    std::optional<usbmon::ring> ring;
+    try {
+        ring.emplace(0, usbmon::ring::max_size);
+    } catch (std::runtime_error const& e) {
+        LOG_WARN("{}; counting URBs from sysfs urbnum instead", e.what());
+    }
+
+    traffic_table table(!ring);
+    std::string const devices_dir = opts.sysfs_root + "/bus/usb/devices";
+    bool const tty = ::isatty(STDOUT_FILENO) == 1;
+    std::int64_t const interval = std::int64_t(opts.interval_ms) * 1'000'000;
+    std::vector<std::uint32_t> offsets(fetch_batch);
+    output_writer out(STDOUT_FILENO);
+
+    std::int64_t listed_at = 0;
+    std::int64_t sampled_at = now_nsecs();
+    for (bool first = true;; first = false) {
+        std::int64_t now = now_nsecs();
+        if (first || now - listed_at >= relist_nsecs) {
+            std::vector<usb_device> devices;
+            if (!enumerate_sysfs(
+                        devices, fetch_device_desc | fetch_strings, *opts.filter, opts.sysfs_root))
+                return false;
+            table.relist(devices, devices_dir, opts.names);
+            listed_at = now;
+        }
+
+        // count until the interval is over
+        std::int64_t const due = sampled_at + interval;
+        if (ring) {
+            while ((now = now_nsecs()) < due) {
+                int const ready = ring->poll(static_cast<int>((due - now + 999'999) / 1'000'000));
+                int const n = (ready > 0) ? ring->fetch(offsets, 0) : ready;
+                if (n == -1 && errno != EINTR) {
+                    LOG_ERROR("{}: usbmon fetch failure ({})", __builtin_FUNCTION(),
+                            std::strerror(errno));
+                    return false;
+                }
+                // each event is read in place, then released
+                for (int i = 0; i < n; ++i) {
+                    usbmon::packet_header h;
+                    if (usbmon::read_header(ring->event(offsets[i]), sizeof(h), false, h)
+                            && h.type == 'C')
+                        table.count(h);
+                }
+                if (n > 0)
+                    ring->flush(static_cast<std::uint32_t>(n));
+            }
+        } else {
+            timespec const ts{static_cast<time_t>(due / 1'000'000'000),
+                    static_cast<long>(due % 1'000'000'000)};
+            while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+            table.read_urbnums();
+        }
+
+        now = now_nsecs();
+        buffer& buf = out.buffer();
+        if (tty)
+            buf.append(std::string_view("\x1b[H\x1b[J")); // home, clear
+        format_clock(buf);
+        buf.append(ring ? std::string_view(" usbmon, completed URBs: ")
+                        : std::string_view(" sysfs urbnum, submitted URBs: "));
+        table.sample(buf, (now - sampled_at) / 1e9,
+                tty ? terminal_rows() : std::numeric_limits<std::size_t>::max());
+        if (!tty)
+            buf.push_back('\n');
+        sampled_at = now;
+        if (!out.flush())
+            return false;
+    }
+}
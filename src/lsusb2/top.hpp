@@ -0,0 +1,23 @@
+#pragma once
+
+#include "util/usb_filter.hpp"
+#include "util/usb_ids.hpp"
+#include <string>
+
+
+struct top_options
+{
+    usb_filter const* filter = nullptr;
+    usb_ids const* names = nullptr;
+    std::string sysfs_root = "/sys"; ///< where the devices, and their urbnum, are read
+    unsigned interval_ms = 1000;
+};
+
+/// Prints the traffic of each device every interval, busiest first,
+/// until killed: completed URBs and bytes per second, per device and
+/// endpoint, counted from usbmon (/dev/usbmon0) if it can be opened;
+/// otherwise URBs submitted per second per device, from sysfs's
+/// urbnum. The devices are listed from sysfs every few seconds.
+/// \returns false if the devices can't be listed (after logging why),
+/// or stdout can't be written
+bool run_top(top_options const&);
@@ -0,0 +1,90 @@
+#include "tree.hpp"
+#include "util/usb_enums.hpp"
+#include <iterator>
+#include <string>
+#include <string_view>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+
+    constexpr char const*
+    short_speed(libusb_speed s) noexcept
+    {
+        // clang-format off
+        switch (s) {
+            case LIBUSB_SPEED_LOW:          return "1.5M";
+            case LIBUSB_SPEED_FULL:         return "12M";
+            case LIBUSB_SPEED_HIGH:         return "480M";
+            case LIBUSB_SPEED_SUPER:        return "5000M";
+            case LIBUSB_SPEED_SUPER_PLUS:   return "10000M";
+            default: break;
+        }
+        // clang-format on
+        return "?";
+    }
+
+    /// The device class, or for devices that declare it per interface,
+    /// the classes of the first configuration's interfaces.
+    void
+    format_class(buffer& buf, bus_model const& model, device_node const& d)
+    {
+        auto out = std::back_inserter(buf);
+        auto const configs = model.configs(d);
+        if (d.desc.bDeviceClass != LIBUSB_CLASS_PER_INTERFACE || configs.empty()) {
+            fmt::format_to(out, "{}", to_str(static_cast<libusb_class_code>(d.desc.bDeviceClass)));
+            return;
+        }
+        char const* sep = "";
+        for (interface_node const& in : model.interfaces(configs.front())) {
+            auto const alts = model.altsettings(in);
+            if (alts.empty())
+                continue;
+            auto const cls = static_cast<libusb_class_code>(alts.front().desc.interface_class());
+            fmt::format_to(out, "{}{}", sep, to_str(cls));
+            sep = "/";
+        }
+    }
+
+    void
+    format_node(buffer& buf, bus_model const& model, std::uint32_t i, std::string& prefix,
+            bool last, bool top)
+    {
+        device_node const& d = model.devices()[i];
+        auto out = std::back_inserter(buf);
+        buf.append(std::string_view(prefix));
+        if (!top)
+            buf.append(std::string_view(last ? "└─ " : "├─ "));
+
+        if (d.num_ports == 0)
+            fmt::format_to(out, "usb{}", d.bus);
+        else
+            fmt::format_to(out, "{}-{}", d.bus, fmt::join(d.ports, d.ports + d.num_ports, "."));
+        fmt::format_to(out, "  {:04x}:{:04x}  {}  ", d.desc.idVendor, d.desc.idProduct,
+                short_speed(d.speed));
+        format_class(buf, model, d);
+        std::string_view const name = d.product.empty() ? d.product_name : d.product;
+        if (!name.empty())
+            fmt::format_to(out, "  {}", name);
+        buf.push_back('\n');
+
+        std::size_t const len = prefix.size();
+        if (!top)
+            prefix += last ? "   " : "│  ";
+        auto const children = model.topology().children(i);
+        for (std::size_t c = 0; c < children.size(); ++c)
+            format_node(buf, model, children[c], prefix, c + 1 == children.size(), false);
+        prefix.resize(len);
+    }
+
+} // namespace
+
+
+void
+format_tree(buffer& buf, bus_model const& model)
+{
+    std::string prefix;
+    for (std::uint32_t root : model.topology().roots())
+        format_node(buf, model, root, prefix, true, true);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "model.hpp"
+#include <fmt/format.h>
+
+
+/// Appends the hub tree, one device per line under the hub it is
+/// plugged into, walking the model's topology index. Devices whose hub
+/// isn't listed start a tree of their own.
+void format_tree(fmt::memory_buffer&, bus_model const&);
@@ -0,0 +1,264 @@
+#include "watch.hpp"
+#include "backend.hpp"
+#include "format.hpp"
+#include "model.hpp"
+#include "util/log.hpp"
+#include <fmt/format.h>
+#include <libusb.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm> // std::copy
+#include <cstdint>
+#include <ctime>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <utility> // std::swap
+#include <vector>
+
+
+namespace { // unnamed
+
+    using buffer = fmt::memory_buffer;
+
+    struct hotplug_event
+    {
+        libusb_device* dev; ///< referenced by the callback
+        libusb_hotplug_event event;
+        std::uint64_t timestamp_nsecs;
+    };
+
+    /// What a departure line needs once the device is gone.
+    struct present_device
+    {
+        std::uint8_t bus;
+        std::uint8_t address;
+        std::uint8_t num_ports;
+        std::uint8_t ports[7];
+        std::uint16_t vid;
+        std::uint16_t pid;
+    };
+
+    std::uint64_t
+    now_nsecs() noexcept
+    {
+        timespec ts{};
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000
+                + static_cast<std::uint64_t>(ts.tv_nsec);
+    }
+
+    /// Same format as the log timestamps.
+    void
+    format_time(buffer& buf, std::uint64_t nsecs)
+    {
+        time_t const secs = static_cast<time_t>(nsecs / 1'000'000'000);
+        std::tm tm{};
+        ::localtime_r(&secs, &tm);
+        fmt::format_to(std::back_inserter(buf), "{:04}-{:02}-{:02}T{:02}:{:02}:{:02}.{:06}",
+                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                (nsecs % 1'000'000'000) / 1000);
+    }
+
+    /// "usb<bus>" for a root hub, "<bus>-<port>.<port>..." otherwise,
+    /// as in sysfs.
+    void
+    format_location(buffer& buf, present_device const& p)
+    {
+        auto out = std::back_inserter(buf);
+        if (p.num_ports == 0)
+            fmt::format_to(out, "usb{}", p.bus);
+        else
+            fmt::format_to(out, "{}-{}", p.bus, fmt::join(p.ports, p.ports + p.num_ports, "."));
+    }
+
+    /// Runs inside libusb_handle_events(), where the device must not be
+    /// opened; the event is only queued for the loop in watch_libusb().
+    int LIBUSB_CALL
+    on_hotplug(libusb_context*, libusb_device* dev, libusb_hotplug_event event, void* user)
+    {
+        auto& queue = *static_cast<std::vector<hotplug_event>*>(user);
+        queue.push_back({::libusb_ref_device(dev), event, now_nsecs()});
+        return 0; // stay registered
+    }
+
+
+    class watcher
+    {
+    private:
+        watch_options const& opts_;
+        std::unique_ptr<formatter> text_;
+        std::unordered_map<libusb_device*, present_device> present_; ///< holds a reference
+        std::size_t index_ = 0; ///< devices listed so far
+
+    public:
+        explicit watcher(watch_options const& opts)
+                : opts_(opts)
+                , text_(make_text_formatter(/*show_ids=*/true))
+        {}
+
+        ~watcher() noexcept
+        {
+            for (auto const& [dev, p] : present_)
+                ::libusb_unref_device(dev);
+        }
+
+        watcher(watcher const&) = delete;
+        watcher& operator=(watcher const&) = delete;
+
+        /// Consumes the reference taken by on_hotplug().
+        void
+        handle(buffer& buf, hotplug_event const& ev)
+        {
+            if (ev.event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+                arrived(buf, ev);
+            else
+                departed(buf, ev);
+        }
+
+    private:
+        void
+        arrived(buffer& buf, hotplug_event const& ev)
+        {
+            usb_device d;
+            if (!read_libusb_device(
+                        ev.dev, opts_.what, *opts_.filter, opts_.string_timeout_ms, d)) {
+                ::libusb_unref_device(ev.dev);
+                return;
+            }
+
+            present_device p{d.bus, d.address, d.num_ports, {}, d.desc.idVendor,
+                    d.desc.idProduct};
+            std::copy(d.ports, d.ports + d.num_ports, p.ports);
+            if (!present_.try_emplace(ev.dev, p).second)
+                ::libusb_unref_device(ev.dev); // already listed (hotplug racing enumeration)
+
+            bus_model const model = bus_model::build(std::span(&d, 1), opts_.names);
+            device_node const& node = model.devices().front();
+            auto out = std::back_inserter(buf);
+            if (opts_.json) {
+                buf.append(std::string_view(R"({"time":")"));
+                format_time(buf, ev.timestamp_nsecs);
+                buf.append(std::string_view(R"(","event":"arrived","device":)"));
+                format_json_device(buf, model, node, index_++);
+                buf.append(std::string_view("}\n"));
+            } else {
+                format_time(buf, ev.timestamp_nsecs);
+                buf.append(std::string_view(" arrived "));
+                format_location(buf, p);
+                fmt::format_to(out, " address {}\n", p.address);
+                text_->device(buf, model, node, index_++);
+            }
+        }
+
+        void
+        departed(buffer& buf, hotplug_event const& ev)
+        {
+            auto const it = present_.find(ev.dev);
+            if (it == present_.end()) { // filtered out, or never readable
+                ::libusb_unref_device(ev.dev);
+                return;
+            }
+
+            present_device const& p = it->second;
+            auto out = std::back_inserter(buf);
+            if (opts_.json) {
+                buf.append(std::string_view(R"({"time":")"));
+                format_time(buf, ev.timestamp_nsecs);
+                fmt::format_to(out,
+                        R"(","event":"departed","device":{{"bus":{},"address":{},"ports":[{}],)"
+                        R"("vendor_id":{},"product_id":{}}}}})"
+                        "\n",
+                        p.bus, p.address, fmt::join(p.ports, p.ports + p.num_ports, ","), p.vid,
+                        p.pid);
+            } else {
+                format_time(buf, ev.timestamp_nsecs);
+                buf.append(std::string_view(" departed "));
+                format_location(buf, p);
+                fmt::format_to(out, " address {} {:04x}:{:04x}\n", p.address, p.vid, p.pid);
+            }
+
+            ::libusb_unref_device(it->first);
+            ::libusb_unref_device(ev.dev);
+            present_.erase(it);
+        }
+    };
+
+} // namespace
+
+
+bool
+watch_libusb(watch_options const& opts)
+{
+    if (!::libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        LOG_ERROR("libusb has no hotplug support on this platform");
+        return false;
+    }
+
+    libusb_context* ctx = nullptr;
+    if (int rv = ::libusb_init(&ctx); rv != 0) {
+        LOG_ERROR("libusb_init: failure ({})", ::libusb_strerror(static_cast<libusb_error>(rv)));
+        return false;
+    }
+
+    if (opts.debug) {
+        int rv = ::libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_DEBUG);
+        if (rv != 0) {
+            LOG_ERROR("libusb_set_option failure ({})",
+                    ::libusb_strerror(static_cast<libusb_error>(rv)));
+            ::libusb_exit(ctx);
+            return false;
+        }
+    }
+
+    // ENUMERATE queues an arrival for every device already present, so
+    // the initial listing goes through the same path as later events
+    std::vector<hotplug_event> queue;
+    libusb_hotplug_callback_handle handle;
+    int rv = ::libusb_hotplug_register_callback(ctx,
+            LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+            LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+            LIBUSB_HOTPLUG_MATCH_ANY, on_hotplug, &queue, &handle);
+    if (rv != LIBUSB_SUCCESS) {
+        LOG_ERROR("libusb_hotplug_register_callback failure ({})",
+                ::libusb_strerror(static_cast<libusb_error>(rv)));
+        ::libusb_exit(ctx);
+        return false;
+    }
+
+    bool ok = true;
+    {
+        watcher w(opts);
+        output_writer out(STDOUT_FILENO);
+        std::vector<hotplug_event> batch;
+        while (ok) {
+            // reading a device runs control transfers, which can
+            // dispatch more hotplug events into the queue meanwhile
+            while (!queue.empty()) {
+                std::swap(batch, queue);
+                for (hotplug_event const& ev : batch)
+                    w.handle(out.buffer(), ev);
+                batch.clear();
+            }
+            if (!out.flush()) {
+                ok = false; // stdout is gone (e.g. a closed pipe)
+                break;
+            }
+
+            // sleeps in poll() until the kernel reports a change
+            rv = ::libusb_handle_events_completed(ctx, nullptr);
+            if (rv != LIBUSB_SUCCESS && rv != LIBUSB_ERROR_INTERRUPTED) {
+                LOG_ERROR("libusb_handle_events failure ({})",
+                        ::libusb_strerror(static_cast<libusb_error>(rv)));
+                ok = false;
+            }
+        }
+        for (hotplug_event const& ev : queue)
+            ::libusb_unref_device(ev.dev);
+    }
+
+    ::libusb_hotplug_deregister_callback(ctx, handle);
+    ::libusb_exit(ctx);
+    return ok;
+}
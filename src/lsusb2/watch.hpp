@@ -0,0 +1,22 @@
+#pragma once
+
+#include "util/usb_filter.hpp"
+#include "util/usb_ids.hpp"
+
+
+struct watch_options
+{
+    unsigned what = 0; ///< fetch_flags for arriving devices
+    usb_filter const* filter = nullptr;
+    usb_ids const* names = nullptr;
+    unsigned string_timeout_ms = 250;
+    bool json = false; ///< one JSON object per line instead of text
+    bool debug = false;
+};
+
+/// Prints the devices present, then every arrival (with its full
+/// descriptors) and departure as libusb reports them, until killed.
+/// Blocks in libusb's event loop in between, so it uses no CPU while
+/// the bus is quiet.
+/// \returns false (after logging why) if hotplug can't be set up
+bool watch_libusb(watch_options const&);
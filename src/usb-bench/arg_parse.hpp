@@ -0,0 +1,242 @@
+#pragma once
+
+#include "bench.hpp"
+#include "version.h"
+#include "util/compiler.hpp"
+#include "util/usb_filter.hpp"
+#include <filesystem>
+#include <getopt.h>
+#include <climits> // INT_MAX, ULONG_MAX
+#include <cstdint>
+#include <cstdio>  // std::fprintf
+#include <cstdlib> // std::exit, std::strtod, std::strtoul
+#include <cstring> // std::strcmp
+#include <stdexcept>
+
+
+struct cli_args
+{
+    usb_filter filter;
+    bench_options bench;
+    bool debug = false;
+};
+
+cli_args
+arg_parse(int argc, char** argv)
+{
+    auto usage = [](std::FILE* outerr, std::filesystem::path const& app) {
+        std::fprintf(outerr,
+                "usage: %s [-Dhv] [-e <endpoint>] [-i <interface>] [-a <alt>] [-q <depth>]\n"
+                "       [-s <size>] [-t <seconds>] [-n <count>] [--timeout=<ms>] [-p zero|mod63]\n"
+                "       <filter options>\n"
+                "Measures the throughput of a bulk or interrupt endpoint of the first device the\n"
+                "filter options select: keeps <depth> asynchronous transfers of <size> bytes in\n"
+                "flight, then prints MB/s, transfers/s, completion latency percentiles and CPU\n"
+                "time per byte. IN endpoints are read, OUT endpoints written.\n"
+                "options:\n"
+                "  -a, --alt-setting=<n>            Alternate setting of the interface (default:\n"
+                "                                   the endpoint's, searching them all).\n"
+                "  -D, --debug                      Enable libusb debugging (to stderr).\n"
+                "  -e, --endpoint=<address>         Endpoint address, direction bit included (e.g.\n"
+                "                                   0x81, 0x01; default: the first bulk IN endpoint,\n"
+                "                                   else the first interrupt IN endpoint).\n"
+                "  -h, --help                       This output.\n"
+                "  -i, --interface=<n>              Only look for the endpoint in interface <n>.\n"
+                "  -n, --count=<n>                  Submit <n> transfers, and with no --time, take as\n"
+                "                                   long as they need.\n"
+                "  -p, --pattern=zero|mod63         What OUT transfers write: zeroes (default) or\n"
+                "                                   byte i is i %% 63, as gadget zero's pattern=0|1\n"
+                "                                   checks.\n"
+                "  -q, --queue=<depth>              Transfers in flight (default: 8).\n"
+                "  -s, --size=<bytes>[k|M]          Bytes per transfer (default: 64k).\n"
+                "  -t, --time=<seconds>             Submit transfers for this long (default: 10).\n"
+                "      --timeout=<ms>               Of each transfer; 0 for none (default: 1000).\n"
+                "  -v, --version                    Print application version information.\n"
+                "filter options (comma-separated lists; all given must match; at least one):\n"
+                "  -d, --device=<vid>:<pid>,...     Vendor and product IDs in hex; * matches any.\n"
+                "      --bus=<n>,...                Bus number.\n"
+                "      --class=<class>[:<sub>],...  Device class, or any interface's class, in hex.\n"
+                "      --port=<path>,...            Port path prefix (e.g. 1.4 matches 1.4 and\n"
+                "                                   1.4.2).\n"
+                "      --serial=<serial>            Serial number; may be repeated.\n"
+                "      --speed=<speed>,...          low, full, high, super or super_plus, or Mbit/s.\n",
+                app.c_str());
+        std::exit(outerr == stdout ? EXIT_SUCCESS : EXIT_FAILURE);
+    };
+
+    auto const app = std::filesystem::path(argv[0]).filename();
+
+    auto number = [&](char const* what, unsigned long max) {
+        char* end = nullptr;
+        unsigned long const n = std::strtoul(optarg, &end, 0);
+        if (end == optarg || *end != '\0' || n > max) {
+            std::fprintf(stderr, "invalid %s \"%s\"\n", what, optarg);
+            usage(stderr, app);
+        }
+        return n;
+    };
+
+    cli_args args;
+    bool timed = false;
+    while (true) {
+        // clang-format off
+        static option const long_options[] = {
+                { "alt-setting", required_argument, nullptr,    'a' },
+                { "bus",        required_argument,  nullptr,    'B' },
+                { "class",      required_argument,  nullptr,    'C' },
+                { "count",      required_argument,  nullptr,    'n' },
+                { "debug",      no_argument,        nullptr,    'D' },
+                { "device",     required_argument,  nullptr,    'd' },
+                { "endpoint",   required_argument,  nullptr,    'e' },
+                { "help",       no_argument,        nullptr,    'h' },
+                { "interface",  required_argument,  nullptr,    'i' },
+                { "pattern",    required_argument,  nullptr,    'p' },
+                { "port",       required_argument,  nullptr,    'P' },
+                { "queue",      required_argument,  nullptr,    'q' },
+                { "serial",     required_argument,  nullptr,    'N' },
+                { "size",       required_argument,  nullptr,    's' },
+                { "speed",      required_argument,  nullptr,    'S' },
+                { "time",       required_argument,  nullptr,    't' },
+                { "timeout",    required_argument,  nullptr,    'T' },
+                { "version",    no_argument,        nullptr,    'v' },
+                { nullptr,      0,                  nullptr,    0 },
+        };
+        // clang-format on
+
+        int const c = ::getopt_long(argc, argv, "a:d:De:hi:n:p:q:s:t:v",
+                static_cast<option const*>(long_options), nullptr);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'a':
+                args.bench.alt_setting = static_cast<int>(number("alternate setting", 255));
+                break;
+
+            case 'd':
+            case 'B':
+            case 'C':
+            case 'P':
+            case 'N':
+            case 'S':
+                try {
+                    // clang-format off
+                    switch (c) {
+                        case 'd': args.filter.add_ids(optarg); break;
+                        case 'B': args.filter.add_buses(optarg); break;
+                        case 'C': args.filter.add_classes(optarg); break;
+                        case 'P': args.filter.add_port_prefixes(optarg); break;
+                        case 'N': args.filter.add_serial(optarg); break;
+                        case 'S': args.filter.add_speeds(optarg); break;
+                    }
+                    // clang-format on
+                } catch (std::invalid_argument const& e) {
+                    std::fprintf(stderr, "%s\n", e.what());
+                    usage(stderr, app);
+                }
+                break;
+
+            case 'D':
+                args.debug = true;
+                break;
+
+            case 'e':
+                args.bench.endpoint = static_cast<int>(number("endpoint address", 0xff));
+                if ((args.bench.endpoint & 0x0f) == 0) {
+                    std::fprintf(stderr, "endpoint 0 is control only\n");
+                    usage(stderr, app);
+                }
+                break;
+
+            case 'h':
+                usage(stdout, app);
+                break;
+
+            case 'i':
+                args.bench.interface = static_cast<int>(number("interface", 255));
+                break;
+
+            case 'n':
+                args.bench.count = number("count", ULONG_MAX);
+                break;
+
+            case 'p':
+                if (std::strcmp(optarg, "zero") == 0) {
+                    args.bench.pattern = out_pattern::zero;
+                } else if (std::strcmp(optarg, "mod63") == 0) {
+                    args.bench.pattern = out_pattern::mod63;
+                } else {
+                    std::fprintf(stderr, "invalid pattern \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                break;
+
+            case 'q':
+                args.bench.queue = static_cast<unsigned>(number("queue depth", 4096));
+                if (args.bench.queue == 0) {
+                    std::fprintf(stderr, "queue depth must be at least 1\n");
+                    usage(stderr, app);
+                }
+                break;
+
+            case 's': {
+                char* end = nullptr;
+                unsigned long n = std::strtoul(optarg, &end, 0);
+                if (end != optarg && (*end == 'k' || *end == 'K')) {
+                    n *= 1024;
+                    ++end;
+                } else if (end != optarg && *end == 'M') {
+                    n *= 1024 * 1024;
+                    ++end;
+                }
+                // libusb's transfer length is an int
+                if (end == optarg || *end != '\0' || n == 0 || n > INT_MAX) {
+                    std::fprintf(stderr, "invalid size \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                args.bench.size = n;
+                break;
+            }
+
+            case 't': {
+                char* end = nullptr;
+                double const seconds = std::strtod(optarg, &end);
+                if (end == optarg || *end != '\0' || !(seconds > 0.0) || seconds > 86400.0) {
+                    std::fprintf(stderr, "invalid time \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                args.bench.duration_ms = static_cast<std::uint32_t>(seconds * 1000.0 + 0.5);
+                timed = true;
+                break;
+            }
+
+            case 'T':
+                args.bench.timeout_ms = static_cast<unsigned>(number("timeout", UINT32_MAX));
+                break;
+
+            case 'v':
+                std::fprintf(stdout, "app_version=%s\n%s\n", ::VERSION,
+                        get_version_info_multiline().c_str());
+                std::exit(EXIT_SUCCESS);
+                break;
+
+            case '?':
+            default:
+                usage(stderr, app);
+                break;
+        }
+    } // while
+
+    if (optind != argc) {
+        std::fprintf(stderr, "extra argument(s): %s\n\n", argv[optind]);
+        usage(stderr, app);
+    }
+    if (args.bench.count != 0 && !timed)
+        args.bench.duration_ms = UINT32_MAX; // as long as the count takes, near enough
+    if (args.filter.empty()) {
+        std::fprintf(stderr, "missing filter option(s): which device to measure\n\n");
+        usage(stderr, app);
+    }
+
+    return args;
+}
@@ -0,0 +1,503 @@
+#include "bench.hpp"
+#include "util/log.hpp"
+#include "util/log_histogram.hpp"
+#include "util/usb_enums.hpp"
+#include <fmt/format.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <algorithm> // std::all_of, std::max, std::min
+#include <cerrno>
+#include <cstring> // std::memset, std::strerror
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+
+namespace { // unnamed
+
+    std::int64_t
+    now_nsecs() noexcept
+    {
+        timespec ts{};
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return std::int64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+    }
+
+    struct cpu_times
+    {
+        std::int64_t user_ns = 0;
+        std::int64_t system_ns = 0;
+    };
+
+    /// CPU time of the whole process, all threads.
+    cpu_times
+    process_cpu() noexcept
+    {
+        rusage ru{};
+        ::getrusage(RUSAGE_SELF, &ru);
+        auto const ns = [](timeval const& tv) {
+            return std::int64_t(tv.tv_sec) * 1'000'000'000 + std::int64_t(tv.tv_usec) * 1000;
+        };
+        return {ns(ru.ru_utime), ns(ru.ru_stime)};
+    }
+
+    constexpr char const*
+    to_str(libusb_transfer_status e) noexcept
+    {
+        // clang-format off
+        switch (e) {
+            case LIBUSB_TRANSFER_COMPLETED: return "completed";
+            case LIBUSB_TRANSFER_ERROR:     return "error";
+            case LIBUSB_TRANSFER_TIMED_OUT: return "timed out";
+            case LIBUSB_TRANSFER_CANCELLED: return "cancelled";
+            case LIBUSB_TRANSFER_STALL:     return "stall";
+            case LIBUSB_TRANSFER_NO_DEVICE: return "no device";
+            case LIBUSB_TRANSFER_OVERFLOW:  return "overflow";
+            default: break;
+        }
+        // clang-format on
+        return "<unknown>";
+    }
+
+
+    struct endpoint_choice
+    {
+        std::uint8_t interface = 0;
+        std::uint8_t alt_setting = 0;
+        std::uint8_t address = 0;
+        libusb_transfer_type type = LIBUSB_TRANSFER_TYPE_BULK;
+        std::uint16_t max_packet = 0;
+    };
+
+    /// Looks for \c opts.endpoint (or the default) among the interfaces
+    /// and alternate settings \c opts allows, in the active configuration.
+    /// \throws std::runtime_error if there is none, or it is a control or
+    /// isochronous endpoint
+    endpoint_choice
+    find_endpoint(libusb_device* dev, bench_options const& opts)
+    {
+        libusb_config_descriptor* cd = nullptr;
+        if (int rv = ::libusb_get_active_config_descriptor(dev, &cd); rv != 0) {
+            throw std::runtime_error(
+                    fmt::format("{}: libusb_get_active_config_descriptor failure ({})",
+                            __builtin_FUNCTION(),
+                            ::libusb_strerror(static_cast<libusb_error>(rv))));
+        }
+
+        std::optional<endpoint_choice> found;
+        std::optional<endpoint_choice> interrupt_in;
+        for (int intf = 0; intf < cd->bNumInterfaces && !found; ++intf) {
+            libusb_interface const& iface = cd->interface[intf];
+            for (int alt = 0; alt < iface.num_altsetting && !found; ++alt) {
+                libusb_interface_descriptor const& id = iface.altsetting[alt];
+                if ((opts.interface >= 0 && id.bInterfaceNumber != opts.interface)
+                        || (opts.alt_setting >= 0 && id.bAlternateSetting != opts.alt_setting))
+                    continue;
+                for (int e = 0; e < id.bNumEndpoints && !found; ++e) {
+                    libusb_endpoint_descriptor const& ed = id.endpoint[e];
+                    endpoint_choice const c{id.bInterfaceNumber, id.bAlternateSetting,
+                            ed.bEndpointAddress, ep_attr_to_transfer_type(ed.bmAttributes),
+                            static_cast<std::uint16_t>(ed.wMaxPacketSize & 0x7ff)};
+                    if (opts.endpoint >= 0) {
+                        if (c.address == opts.endpoint)
+                            found = c;
+                    } else if (c.address & LIBUSB_ENDPOINT_IN) {
+                        if (c.type == LIBUSB_TRANSFER_TYPE_BULK)
+                            found = c;
+                        else if (c.type == LIBUSB_TRANSFER_TYPE_INTERRUPT && !interrupt_in)
+                            interrupt_in = c;
+                    }
+                }
+            }
+        }
+        ::libusb_free_config_descriptor(cd);
+
+        if (!found)
+            found = interrupt_in;
+        if (!found) {
+            throw std::runtime_error(opts.endpoint >= 0
+                            ? fmt::format("{}: no endpoint {:#04x} in the active configuration",
+                                    __builtin_FUNCTION(), opts.endpoint)
+                            : fmt::format("{}: no bulk or interrupt IN endpoint in the active "
+                                          "configuration",
+                                    __builtin_FUNCTION()));
+        }
+        if (found->type != LIBUSB_TRANSFER_TYPE_BULK
+                && found->type != LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+            throw std::runtime_error(
+                    fmt::format("{}: endpoint {:#04x} is {}, not bulk or interrupt",
+                            __builtin_FUNCTION(), found->address, to_str(found->type)));
+        }
+        return *found;
+    }
+
+
+    /// Claims an interface (detaching its kernel driver, if any, until
+    /// released) and selects an alternate setting.
+    class claimed_interface
+    {
+    private:
+        libusb_device_handle* dev_;
+        int interface_;
+
+    public:
+        /// \throws std::runtime_error on failure
+        claimed_interface(libusb_device_handle* dev, int interface, int alt_setting, bool set_alt)
+                : dev_(dev)
+                , interface_(interface)
+        {
+            if (int rv = ::libusb_set_auto_detach_kernel_driver(dev_, /*enable=*/1);
+                    rv != 0 && rv != LIBUSB_ERROR_NOT_SUPPORTED) {
+                throw std::runtime_error(
+                        fmt::format("{}: libusb_set_auto_detach_kernel_driver failure ({})",
+                                __builtin_FUNCTION(),
+                                ::libusb_strerror(static_cast<libusb_error>(rv))));
+            }
+            if (int rv = ::libusb_claim_interface(dev_, interface_); rv != 0) {
+                throw std::runtime_error(fmt::format("{}: libusb_claim_interface {} failure ({})",
+                        __builtin_FUNCTION(), interface_,
+                        ::libusb_strerror(static_cast<libusb_error>(rv))));
+            }
+            if (set_alt) {
+                if (int rv = ::libusb_set_interface_alt_setting(dev_, interface_, alt_setting);
+                        rv != 0) {
+                    ::libusb_release_interface(dev_, interface_);
+                    throw std::runtime_error(
+                            fmt::format("{}: libusb_set_interface_alt_setting {} failure ({})",
+                                    __builtin_FUNCTION(), alt_setting,
+                                    ::libusb_strerror(static_cast<libusb_error>(rv))));
+                }
+            }
+        }
+
+        ~claimed_interface() noexcept
+        {
+            ::libusb_release_interface(dev_, interface_);
+        }
+
+        claimed_interface(claimed_interface const&) = delete;
+        claimed_interface& operator=(claimed_interface const&) = delete;
+    };
+
+
+    class transfer_queue;
+
+    /// One transfer of the queue, and its buffer.
+    struct slot
+    {
+        transfer_queue* queue = nullptr;
+        libusb_transfer* transfer = nullptr;
+        unsigned char* buffer = nullptr;
+        std::int64_t submitted_ns = 0;
+        bool in_flight = false;
+    };
+
+    /// The transfers, resubmitted from their completion callbacks (which
+    /// libusb calls from handle_events(), on this thread) until more()
+    /// says no, and what they did.
+    class transfer_queue
+    {
+    public:
+        std::uint64_t submitted = 0;
+        std::uint64_t in_flight = 0;
+        std::uint64_t completed = 0;
+        std::uint64_t short_transfers = 0; ///< completed with less than the size
+        std::uint64_t timed_out = 0;
+        std::uint64_t failed = 0;
+        std::uint64_t bytes = 0; ///< of completed and timed out transfers
+        libusb_transfer_status first_failure = LIBUSB_TRANSFER_COMPLETED;
+        int submit_error = 0; ///< of the first failed submission
+        std::int64_t last_completion_ns = 0;
+        log_histogram latency_us; ///< submission to completion, of completed transfers
+        std::int64_t latency_min_ns = std::numeric_limits<std::int64_t>::max();
+        std::int64_t latency_max_ns = 0;
+        bool dev_mem = false; ///< buffers are usbfs memory, which needs no copying
+
+    private:
+        libusb_device_handle* dev_;
+        bench_options const& opts_;
+        std::vector<slot> slots_;
+        std::int64_t deadline_ns_ = 0;
+        bool stopping_ = false;
+
+    public:
+        /// \throws std::runtime_error if transfers can't be allocated
+        transfer_queue(libusb_device_handle* dev, endpoint_choice const& ep,
+                bench_options const& opts)
+                : dev_(dev)
+                , opts_(opts)
+                , slots_(opts.queue)
+        {
+            // usbfs memory is mapped into the process, so that the kernel
+            // needn't copy each transfer; where it isn't supported (or
+            // runs out) the buffers all come from the heap instead
+            for (slot& s : slots_) {
+                s.queue = this;
+                s.buffer = ::libusb_dev_mem_alloc(dev_, opts_.size);
+            }
+            dev_mem = std::all_of(slots_.begin(), slots_.end(),
+                    [](slot const& s) { return s.buffer != nullptr; });
+            for (slot& s : slots_) {
+                if (dev_mem)
+                    break;
+                if (s.buffer != nullptr)
+                    ::libusb_dev_mem_free(dev_, s.buffer, opts_.size);
+                s.buffer = new unsigned char[opts_.size];
+            }
+
+            for (slot& s : slots_) {
+                fill(s.buffer);
+
+                if (s.transfer = ::libusb_alloc_transfer(0); s.transfer == nullptr) {
+                    release();
+                    throw std::runtime_error(
+                            fmt::format("{}: libusb_alloc_transfer failure", __builtin_FUNCTION()));
+                }
+                auto const length = static_cast<int>(opts_.size);
+                if (ep.type == LIBUSB_TRANSFER_TYPE_BULK) {
+                    ::libusb_fill_bulk_transfer(s.transfer, dev_, ep.address, s.buffer, length,
+                            on_complete, &s, opts_.timeout_ms);
+                } else {
+                    ::libusb_fill_interrupt_transfer(s.transfer, dev_, ep.address, s.buffer,
+                            length, on_complete, &s, opts_.timeout_ms);
+                }
+            }
+        }
+
+        /// Transfers still in flight are leaked rather than freed.
+        ~transfer_queue() noexcept
+        {
+            release();
+        }
+
+        transfer_queue(transfer_queue const&) = delete;
+        transfer_queue& operator=(transfer_queue const&) = delete;
+
+        /// Submits the first transfers, up to the queue depth.
+        void
+        start(std::int64_t deadline_ns)
+        {
+            deadline_ns_ = deadline_ns;
+            for (slot& s : slots_) {
+                std::int64_t const now = now_nsecs();
+                if (!more(now) || !submit(s, now))
+                    break;
+            }
+        }
+
+        /// Submits no more, and cancels the transfers in flight.
+        void
+        stop() noexcept
+        {
+            if (stopping_)
+                return;
+            stopping_ = true;
+            for (slot& s : slots_)
+                ::libusb_cancel_transfer(s.transfer); // LIBUSB_ERROR_NOT_FOUND if not in flight
+        }
+
+    private:
+        bool
+        more(std::int64_t now) const noexcept
+        {
+            return !stopping_ && now < deadline_ns_
+                    && (opts_.count == 0 || submitted < opts_.count)
+                    && (opts_.stop == nullptr || !opts_.stop->load(std::memory_order_relaxed));
+        }
+
+        bool
+        submit(slot& s, std::int64_t now) noexcept
+        {
+            s.submitted_ns = now;
+            if (int rv = ::libusb_submit_transfer(s.transfer); rv != 0) {
+                if (submit_error == 0)
+                    submit_error = rv;
+                stopping_ = true;
+                return false;
+            }
+            s.in_flight = true;
+            ++submitted;
+            ++in_flight;
+            return true;
+        }
+
+        void
+        fill(unsigned char* buffer) const noexcept
+        {
+            if (opts_.pattern == out_pattern::zero) {
+                std::memset(buffer, 0, opts_.size);
+            } else {
+                for (std::size_t i = 0; i < opts_.size; ++i)
+                    buffer[i] = static_cast<unsigned char>(i % 63);
+            }
+        }
+
+        void
+        release() noexcept
+        {
+            for (slot& s : slots_) {
+                if (s.in_flight)
+                    continue;
+                ::libusb_free_transfer(s.transfer);
+                s.transfer = nullptr;
+                if (dev_mem)
+                    ::libusb_dev_mem_free(dev_, s.buffer, opts_.size);
+                else
+                    delete[] s.buffer;
+                s.buffer = nullptr;
+            }
+        }
+
+        static void LIBUSB_CALL
+        on_complete(libusb_transfer* t)
+        {
+            slot& s = *static_cast<slot*>(t->user_data);
+            transfer_queue& q = *s.queue;
+            std::int64_t const now = now_nsecs();
+            s.in_flight = false;
+            --q.in_flight;
+            q.last_completion_ns = now;
+
+            switch (t->status) {
+                case LIBUSB_TRANSFER_COMPLETED: {
+                    ++q.completed;
+                    q.bytes += static_cast<std::uint64_t>(t->actual_length);
+                    if (t->actual_length < t->length)
+                        ++q.short_transfers;
+                    std::int64_t const latency = now - s.submitted_ns;
+                    q.latency_us.add(static_cast<std::uint64_t>(latency) / 1000);
+                    q.latency_min_ns = std::min(q.latency_min_ns, latency);
+                    q.latency_max_ns = std::max(q.latency_max_ns, latency);
+                    break;
+                }
+                case LIBUSB_TRANSFER_TIMED_OUT:
+                    // not fatal: a slow device is what is being measured
+                    ++q.timed_out;
+                    q.bytes += static_cast<std::uint64_t>(t->actual_length);
+                    break;
+                case LIBUSB_TRANSFER_CANCELLED:
+                    break;
+                default:
+                    ++q.failed;
+                    if (q.first_failure == LIBUSB_TRANSFER_COMPLETED)
+                        q.first_failure = t->status;
+                    q.stop();
+                    break;
+            }
+
+            if (q.more(now))
+                q.submit(s, now);
+        }
+    };
+
+
+    double
+    per_second(double n, std::int64_t ns) noexcept
+    {
+        return ns > 0 ? n * 1e9 / static_cast<double>(ns) : 0.0;
+    }
+
+    void
+    format_report(fmt::memory_buffer& buf, libusb_device* dev, endpoint_choice const& ep,
+            bench_options const& opts, transfer_queue const& q, std::int64_t elapsed_ns,
+            cpu_times const& cpu)
+    {
+        auto out = std::back_inserter(buf);
+
+        libusb_device_descriptor dd{};
+        ::libusb_get_device_descriptor(dev, &dd);
+        fmt::format_to(out, "device:     {:03}:{:03} {:04x}:{:04x}, speed {}\n",
+                ::libusb_get_bus_number(dev), ::libusb_get_device_address(dev), dd.idVendor,
+                dd.idProduct, to_str(static_cast<libusb_speed>(::libusb_get_device_speed(dev))));
+        fmt::format_to(out,
+                "endpoint:   {:#04x} {} {}, max packet {}, interface {}, alternate setting {}\n",
+                ep.address, (ep.address & LIBUSB_ENDPOINT_IN) ? "IN" : "OUT", to_str(ep.type),
+                ep.max_packet, ep.interface, ep.alt_setting);
+        fmt::format_to(out, "queue:      {} x {} bytes, in {} memory, {:.3f} s\n", opts.queue,
+                opts.size, q.dev_mem ? "usbfs" : "heap", static_cast<double>(elapsed_ns) / 1e9);
+
+        fmt::format_to(out,
+                "transfers:  {} ({:.1f}/s), {} short, {} timed out, {} failed\n", q.completed,
+                per_second(static_cast<double>(q.completed), elapsed_ns), q.short_transfers,
+                q.timed_out, q.failed);
+        fmt::format_to(out, "throughput: {:.2f} MB/s\n",
+                per_second(static_cast<double>(q.bytes), elapsed_ns) / 1e6);
+
+        if (q.completed != 0) {
+            auto const max_us = static_cast<std::uint64_t>(q.latency_max_ns) / 1000;
+            auto const percentile = [&](unsigned per_mille) {
+                return std::min(q.latency_us.percentile(per_mille), max_us);
+            };
+            fmt::format_to(out,
+                    "latency:    min {} us, p50 {} us, p90 {} us, p99 {} us, p99.9 {} us, "
+                    "max {} us\n",
+                    q.latency_min_ns / 1000, percentile(500), percentile(900), percentile(990),
+                    percentile(999), max_us);
+        }
+
+        auto const cpu_ns = static_cast<double>(cpu.user_ns + cpu.system_ns);
+        auto const wall_ns = static_cast<double>(std::max<std::int64_t>(elapsed_ns, 1));
+        fmt::format_to(out, "cpu:        {:.1f}% of a core (user {:.3f} s, system {:.3f} s)",
+                100.0 * cpu_ns / wall_ns, static_cast<double>(cpu.user_ns) / 1e9,
+                static_cast<double>(cpu.system_ns) / 1e9);
+        if (q.bytes != 0)
+            fmt::format_to(out, ", {:.3f} ns/byte", cpu_ns / static_cast<double>(q.bytes));
+        buf.push_back('\n');
+
+        if (q.first_failure != LIBUSB_TRANSFER_COMPLETED)
+            fmt::format_to(out, "error:      transfer {}\n", to_str(q.first_failure));
+        if (q.submit_error != 0) {
+            fmt::format_to(out, "error:      libusb_submit_transfer failure ({})\n",
+                    ::libusb_strerror(static_cast<libusb_error>(q.submit_error)));
+        }
+    }
+
+} // namespace
+
+
+bool
+run_bench(libusb_context* ctx, libusb_device_handle* dev, bench_options const& opts,
+        std::FILE* out)
+{
+    endpoint_choice const ep = find_endpoint(::libusb_get_device(dev), opts);
+    // setting alternate setting 0 resets the interface's endpoints, so
+    // it is left alone unless asked for
+    claimed_interface const claim(dev, ep.interface, ep.alt_setting,
+            ep.alt_setting != 0 || opts.alt_setting >= 0);
+    transfer_queue q(dev, ep, opts);
+
+    cpu_times const cpu_before = process_cpu();
+    std::int64_t const start_ns = now_nsecs();
+    q.start(start_ns + std::int64_t(opts.duration_ms) * 1'000'000);
+
+    bool ok = true;
+    while (q.in_flight != 0) {
+        if (opts.stop != nullptr && opts.stop->load(std::memory_order_relaxed))
+            q.stop();
+        timeval tv{0, 100'000};
+        if (int rv = ::libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+                rv != 0 && rv != LIBUSB_ERROR_INTERRUPTED) {
+            LOG_ERROR("{}: libusb_handle_events_timeout_completed failure ({})",
+                    __builtin_FUNCTION(), ::libusb_strerror(static_cast<libusb_error>(rv)));
+            ok = false;
+            break;
+        }
+    }
+
+    cpu_times const cpu_after = process_cpu();
+    std::int64_t const elapsed_ns = (q.last_completion_ns != 0 ? q.last_completion_ns : now_nsecs())
+            - start_ns;
+    cpu_times const cpu{cpu_after.user_ns - cpu_before.user_ns,
+            cpu_after.system_ns - cpu_before.system_ns};
+
+    fmt::memory_buffer buf;
+    format_report(buf, ::libusb_get_device(dev), ep, opts, q, elapsed_ns, cpu);
+    if (std::fwrite(buf.data(), 1, buf.size(), out) != buf.size() || std::fflush(out) != 0) {
+        LOG_ERROR("{}: writing the report failure ({})", __builtin_FUNCTION(),
+                std::strerror(errno));
+        ok = false;
+    }
+    return ok && q.failed == 0 && q.submit_error == 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <libusb.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+
+// Throughput of one bulk or interrupt endpoint: a queue of asynchronous
+// transfers of one size is kept full for a while, and completions are
+// counted as they come. What is measured is the whole data path: the
+// host controller, the kernel's usbfs, libusb and, on the other end,
+// the device (or a gadget on dummy_hcd, which has no bus in between).
+
+enum class out_pattern : std::uint8_t
+{
+    zero, ///< all zeroes
+    mod63, ///< byte i of each transfer is i % 63
+};
+
+struct bench_options
+{
+    int interface = -1; ///< -1 for the first with a suitable endpoint
+    int alt_setting = -1; ///< -1 for the endpoint's; set only if not 0
+    int endpoint = -1; ///< address with direction bit; -1 for the first bulk, else interrupt, IN
+    unsigned queue = 8; ///< transfers in flight
+    std::size_t size = 64 * 1024; ///< bytes per transfer
+    std::uint32_t duration_ms = 10'000; ///< no transfer is submitted after
+    std::uint64_t count = 0; ///< transfers to submit (timed out ones included); 0 for no limit
+    unsigned timeout_ms = 1000; ///< per transfer
+    out_pattern pattern = out_pattern::zero; ///< data written to OUT endpoints
+    std::atomic<bool> const* stop = nullptr; ///< set to end early, e.g. on SIGINT
+};
+
+/// Claims the endpoint's interface on \c dev, keeps \c opts.queue
+/// transfers in flight until the duration or count is reached, handling
+/// \c ctx's events until the last completes, and prints a report to
+/// \c out: transfers and throughput, completion latency percentiles and
+/// CPU time per byte (of the whole process, libusb's threads included).
+/// \returns false if a transfer failed (the report says how), or the
+/// report can't be written
+/// \throws std::runtime_error if there is no such endpoint, or the
+/// interface can't be claimed
+bool run_bench(libusb_context* ctx, libusb_device_handle* dev, bench_options const& opts,
+        std::FILE* out);
@@ -0,0 +1,65 @@
+#include "arg_parse.hpp"
+#include "bench.hpp"
+#include "util/usb_open.hpp"
+#include <fmt/format.h>
+#include <signal.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+
+namespace { // unnamed
+
+    std::atomic<bool> stop_requested = false;
+
+    void
+    request_stop(int /*signum*/)
+    {
+        stop_requested.store(true, std::memory_order_relaxed);
+    }
+
+} // namespace
+
+
+int
+main(int argc, char** argv)
+{
+    cli_args const args = arg_parse(argc, argv);
+
+    libusb_context* ctx = nullptr;
+    if (int rv = ::libusb_init(&ctx); rv != 0) {
+        fmt::print(stderr, "error: libusb_init failure ({})\n",
+                ::libusb_strerror(static_cast<libusb_error>(rv)));
+        return EXIT_FAILURE;
+    }
+    if (args.debug)
+        ::libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_DEBUG);
+
+    libusb_device_handle* const dev = open_usb_device(ctx, args.filter);
+    if (dev == nullptr) {
+        fmt::print(stderr, "error: no device matching {} could be opened\n", to_str(args.filter));
+        ::libusb_exit(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // without SA_RESTART, so that a signal ends a wait for events; the
+    // transfers in flight are then cancelled and the report printed
+    struct sigaction sa = {};
+    sa.sa_handler = request_stop;
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+
+    bench_options opts = args.bench;
+    opts.stop = &stop_requested;
+    int status = EXIT_FAILURE;
+    try {
+        status = run_bench(ctx, dev, opts, stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (std::runtime_error const& e) {
+        fmt::print(stderr, "error: {}\n", e.what());
+    }
+
+    ::libusb_close(dev);
+    ::libusb_exit(ctx);
+    return status;
+}
@@ -0,0 +1,4 @@
+MODULE_CPPFLAGS = -isystem/usr/include/libusb-1.0
+MODULE_LIBRARIES = util
+$(use-fmt)
+$(call add-executable-module,$(get-path))
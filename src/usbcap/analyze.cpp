@@ -0,0 +1,503 @@
+#include "analyze.hpp"
+#include "util/log.hpp"
+#include "util/log_histogram.hpp"
+#include "util/usb_enums.hpp"
+#include <fmt/format.h>
+#include <algorithm> // std::max, std::min, std::none_of, std::sort
+#include <cerrno>
+#include <cstring> // std::strerror
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+namespace { // unnamed
+
+    /// Bus, device address and endpoint address in one number, which
+    /// also orders the table. Control transfers are all endpoint 0,
+    /// whichever their direction.
+    using endpoint_key = std::uint32_t;
+
+    endpoint_key
+    make_key(usbmon::packet_header const& h) noexcept
+    {
+        std::uint8_t const ep = (h.xfer_type == usbmon::control) ? (h.epnum & 0x7f) : h.epnum;
+        return std::uint32_t(h.busnum) << 16 | std::uint32_t(h.devnum) << 8 | ep;
+    }
+
+    /// Bus and device address.
+    constexpr std::uint32_t
+    device_of(endpoint_key k) noexcept
+    {
+        return k >> 8;
+    }
+
+    // usbmon's status of URBs unlinked or killed rather than failed
+    constexpr std::int32_t status_stall = -EPIPE;
+    constexpr std::int32_t status_unlinked = -ENOENT;
+    constexpr std::int32_t status_reset = -ECONNRESET;
+    constexpr std::int32_t status_shutdown = -ESHUTDOWN;
+
+    constexpr std::size_t no_segment = std::numeric_limits<std::size_t>::max();
+
+
+    /// Bytes per interval, kept as the first and last intervals seen
+    /// (which a neighbouring part of the file may add to) and the
+    /// busiest of those between. Packets out of time order count
+    /// toward the last interval.
+    class busiest_interval
+    {
+    private:
+        std::int64_t first_ = -1;
+        std::int64_t last_ = -1;
+        std::uint64_t first_bytes_ = 0;
+        std::uint64_t last_bytes_ = 0; ///< the same as first_bytes_ while first_ == last_
+        std::uint64_t between_ = 0;
+
+    public:
+        void
+        add(std::int64_t interval, std::uint64_t bytes) noexcept
+        {
+            if (first_ < 0) {
+                first_ = last_ = interval;
+                first_bytes_ = last_bytes_ = bytes;
+            } else if (interval <= last_) {
+                last_bytes_ += bytes;
+                if (first_ == last_)
+                    first_bytes_ = last_bytes_;
+            } else {
+                if (first_ != last_)
+                    between_ = std::max(between_, last_bytes_);
+                last_ = interval;
+                last_bytes_ = bytes;
+            }
+        }
+
+        /// Appends the intervals of a later part of the file.
+        void
+        merge(busiest_interval const& later) noexcept
+        {
+            if (later.first_ < 0)
+                return;
+            add(later.first_, later.first_bytes_);
+            if (later.first_ == later.last_)
+                return;
+            if (first_ != last_)
+                between_ = std::max(between_, last_bytes_);
+            between_ = std::max(between_, later.between_);
+            last_ = later.last_;
+            last_bytes_ = later.last_bytes_;
+        }
+
+        std::uint64_t
+        peak() const noexcept
+        {
+            return std::max({first_bytes_, last_bytes_, between_});
+        }
+    };
+
+
+    struct endpoint_stats
+    {
+        std::uint8_t xfer_type = 0;
+        std::uint64_t urbs = 0; ///< completed
+        std::uint64_t bytes = 0; ///< transferred, as completions report
+        std::uint64_t errors = 0; ///< completed with an error, or failed to submit
+        std::uint64_t stalls = 0;
+        std::uint64_t unlinked = 0; ///< cancelled, or killed at disconnect
+        std::uint64_t orphans = 0; ///< completed without a submission in the capture
+        log_histogram latency;
+        std::uint64_t latency_sum_ns = 0;
+        std::uint64_t latency_max_ns = 0;
+        busiest_interval throughput;
+        // queue depth, of URBs submitted in this part of the file
+        std::int64_t depth = 0;
+        std::size_t segment = no_segment; ///< the latest in part_stats::segments
+        std::int64_t max_depth = 0; ///< over the whole capture, once merged
+
+        void
+        add_latency(std::int64_t ns) noexcept
+        {
+            auto const v = static_cast<std::uint64_t>(std::max<std::int64_t>(ns, 0));
+            latency.add(v / 1000);
+            latency_sum_ns += v;
+            latency_max_ns = std::max(latency_max_ns, v);
+        }
+    };
+
+    /// The most URBs of one endpoint submitted in a part of the file
+    /// and in flight at once, between two unmatched events (of any
+    /// endpoint): the URBs in flight since earlier parts, which these
+    /// events may complete or replace, are only known when merging.
+    struct depth_segment
+    {
+        std::size_t first_event = 0; ///< unmatched events before it
+        endpoint_key key = 0;
+        std::int64_t max = 0;
+    };
+
+    struct pending_urb
+    {
+        std::int64_t ts_ns = 0;
+        endpoint_key key = 0;
+    };
+
+    /// A completion whose submission isn't in the same part of the
+    /// file, or the first submission of a URB id in the part, which
+    /// replaces one an earlier part left pending (its completion lost).
+    struct unmatched_event
+    {
+        std::uint64_t id = 0;
+        std::int64_t ts_ns = 0;
+        endpoint_key key = 0;
+        char type = 'C'; ///< 'C', 'E' (a failed submission) or 'S'
+    };
+
+    struct device_label
+    {
+        std::uint16_t vid = 0;
+        std::uint16_t pid = 0;
+        std::uint8_t device_class = 0;
+    };
+
+
+    /// The statistics of one part of the file.
+    struct part_stats
+    {
+        std::unordered_map<endpoint_key, endpoint_stats> endpoints;
+        std::unordered_map<std::uint64_t, pending_urb> pending; ///< by URB id
+        std::vector<unmatched_event> unmatched; ///< in file order
+        std::vector<depth_segment> segments; ///< in file order
+        std::unordered_set<std::uint64_t> submitted; ///< URB ids
+        std::unordered_map<std::uint32_t, device_label> devices; ///< by device_of()
+        std::uint64_t packets = 0;
+        std::uint64_t skipped = 0; ///< not usbmon
+        std::int64_t first_ns = std::numeric_limits<std::int64_t>::max();
+        std::int64_t last_ns = std::numeric_limits<std::int64_t>::min();
+
+        void add(usbmon::packet_header const& h, std::int64_t interval_ns);
+
+        /// Counts a submission on \c ep; a depth segment starts at its
+        /// first since an unmatched event.
+        void raise_depth(endpoint_key key, endpoint_stats& ep);
+
+        /// Labels the device if \c h completes a read of its device
+        /// descriptor, as the host does at enumeration.
+        void label(usbmon::packet_header const& h, std::span<std::byte const> data);
+    };
+
+    void
+    part_stats::add(usbmon::packet_header const& h, std::int64_t interval_ns)
+    {
+        std::int64_t const ts = h.ts_sec * 1'000'000'000 + h.ts_usec * 1000;
+        first_ns = std::min(first_ns, ts);
+        last_ns = std::max(last_ns, ts);
+
+        endpoint_key const key = make_key(h);
+        endpoint_stats& ep = endpoints[key];
+        ep.xfer_type = h.xfer_type;
+
+        if (h.type == 'S') {
+            auto const [it, inserted] = pending.try_emplace(h.id, pending_urb{ts, key});
+            if (!inserted) {
+                // the earlier submission's completion was lost (dropped
+                // by the kernel, or before the capture ended)
+                --endpoints[it->second.key].depth;
+                it->second = {ts, key};
+            } else if (submitted.insert(h.id).second) {
+                // as this may be to an earlier part's pending submission
+                unmatched.push_back({h.id, ts, key, 'S'});
+            }
+            raise_depth(key, ep);
+            return;
+        }
+        if (h.type != 'C' && h.type != 'E')
+            return;
+
+        if (h.type == 'E') {
+            ++ep.errors;
+        } else {
+            ++ep.urbs;
+            ep.bytes += h.length;
+            ep.throughput.add(ts / interval_ns, h.length);
+            if (h.status == status_stall) {
+                ++ep.stalls;
+            } else if (h.status == status_unlinked || h.status == status_reset
+                    || h.status == status_shutdown) {
+                ++ep.unlinked;
+            } else if (h.status != 0) {
+                ++ep.errors;
+            }
+        }
+
+        auto const it = pending.find(h.id);
+        if (it != pending.end()) {
+            if (h.type == 'C')
+                ep.add_latency(ts - it->second.ts_ns);
+            --endpoints[it->second.key].depth;
+            pending.erase(it);
+        } else {
+            unmatched.push_back({h.id, ts, key, h.type});
+        }
+    }
+
+    void
+    part_stats::raise_depth(endpoint_key key, endpoint_stats& ep)
+    {
+        ++ep.depth;
+        if (ep.segment == no_segment || segments[ep.segment].first_event != unmatched.size()) {
+            ep.segment = segments.size();
+            segments.push_back({unmatched.size(), key, ep.depth});
+        } else {
+            segments[ep.segment].max = std::max(segments[ep.segment].max, ep.depth);
+        }
+    }
+
+    void
+    part_stats::label(usbmon::packet_header const& h, std::span<std::byte const> data)
+    {
+        if (h.type == 'C' && h.xfer_type == usbmon::control && h.status == 0 && data.size() >= 18
+                && data[0] == std::byte{18} && data[1] == std::byte{LIBUSB_DT_DEVICE}) {
+            auto const u8 = [&](std::size_t i) { return static_cast<std::uint8_t>(data[i]); };
+            devices[device_of(make_key(h))] = {static_cast<std::uint16_t>(u8(8) | u8(9) << 8),
+                    static_cast<std::uint16_t>(u8(10) | u8(11) << 8), u8(4)};
+        }
+    }
+
+
+    /// The statistics of the parts merged so far, in file order.
+    struct capture_stats
+    {
+        std::unordered_map<endpoint_key, endpoint_stats> endpoints;
+        std::unordered_map<std::uint64_t, pending_urb> pending;
+        std::unordered_map<endpoint_key, std::int64_t> in_flight; ///< of \c pending
+        std::unordered_map<std::uint32_t, device_label> devices;
+        std::uint64_t packets = 0;
+        std::uint64_t skipped = 0;
+        std::int64_t first_ns = std::numeric_limits<std::int64_t>::max();
+        std::int64_t last_ns = std::numeric_limits<std::int64_t>::min();
+
+        void merge(part_stats& p);
+    };
+
+    void
+    capture_stats::merge(part_stats& p)
+    {
+        // the URBs in flight when the part starts add to its depths
+        // until their completions, which are among its unmatched events
+        std::size_t next_segment = 0;
+        auto const add_segments = [&](std::size_t events_done) {
+            for (; next_segment < p.segments.size()
+                    && p.segments[next_segment].first_event <= events_done;
+                    ++next_segment) {
+                depth_segment const& seg = p.segments[next_segment];
+                endpoint_stats& e = endpoints[seg.key];
+                e.max_depth = std::max(e.max_depth, in_flight[seg.key] + seg.max);
+            }
+        };
+        add_segments(0);
+        for (std::size_t i = 0; i < p.unmatched.size(); ++i) {
+            unmatched_event const& c = p.unmatched[i];
+            endpoint_stats& e = endpoints[c.key];
+            auto const it = pending.find(c.id);
+            if (it != pending.end()) {
+                if (c.type == 'C')
+                    e.add_latency(c.ts_ns - it->second.ts_ns);
+                --in_flight[it->second.key];
+                pending.erase(it);
+            } else if (c.type != 'S') {
+                ++e.orphans;
+            }
+            add_segments(i + 1);
+        }
+
+        for (auto& [key, pe] : p.endpoints) {
+            endpoint_stats& e = endpoints[key];
+            e.xfer_type = pe.xfer_type;
+            e.urbs += pe.urbs;
+            e.bytes += pe.bytes;
+            e.errors += pe.errors;
+            e.stalls += pe.stalls;
+            e.unlinked += pe.unlinked;
+            e.latency.merge(pe.latency);
+            e.latency_sum_ns += pe.latency_sum_ns;
+            e.latency_max_ns = std::max(e.latency_max_ns, pe.latency_max_ns);
+            e.throughput.merge(pe.throughput);
+        }
+        for (auto const& [id, u] : p.pending) {
+            auto const [it, inserted] = pending.try_emplace(id, u);
+            if (!inserted) {
+                --in_flight[it->second.key];
+                it->second = u;
+            }
+            ++in_flight[u.key];
+        }
+        for (auto const& [dev, label] : p.devices)
+            devices[dev] = label;
+
+        packets += p.packets;
+        skipped += p.skipped;
+        first_ns = std::min(first_ns, p.first_ns);
+        last_ns = std::max(last_ns, p.last_ns);
+        p = part_stats();
+    }
+
+
+    void
+    read_part(capture_reader& in, capture_range* r, analyze_options const& opts,
+            part_stats& part)
+    {
+        std::int64_t const interval_ns = std::int64_t(opts.interval_ms) * 1'000'000;
+        capture_packet p;
+        while (r ? in.next(*r, p) : in.next(p)) {
+            std::size_t const size = usbmon_header_size(p.linktype);
+            usbmon::packet_header h;
+            if (size == 0 || !usbmon::read_header(p.data, size, in.swapped(), h)) {
+                ++part.skipped;
+                continue;
+            }
+            ++part.packets;
+            part.label(h, usbmon::payload(p.data, size, h)); // whatever the filter
+            if (opts.filter.accepts(h))
+                part.add(h, interval_ns);
+        }
+    }
+
+    char const*
+    direction(endpoint_key k, std::uint8_t xfer_type) noexcept
+    {
+        if (xfer_type == usbmon::control)
+            return "";
+        return (k & LIBUSB_ENDPOINT_IN) ? " in" : " out";
+    }
+
+    libusb_transfer_type
+    to_transfer_type(std::uint8_t xfer_type) noexcept
+    {
+        // clang-format off
+        switch (xfer_type) {
+            case usbmon::iso:       return LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+            case usbmon::interrupt: return LIBUSB_TRANSFER_TYPE_INTERRUPT;
+            case usbmon::control:   return LIBUSB_TRANSFER_TYPE_CONTROL;
+            default: break;
+        }
+        // clang-format on
+        return LIBUSB_TRANSFER_TYPE_BULK;
+    }
+
+    void
+    format_report(fmt::memory_buffer& buf, capture_stats const& st, analyze_options const& opts)
+    {
+        auto out = std::back_inserter(buf);
+        double const secs = (st.last_ns > st.first_ns) ? (st.last_ns - st.first_ns) / 1e9 : 0;
+        double const interval_secs = opts.interval_ms / 1e3;
+        fmt::format_to(out, "{} usbmon packets over {:.3f} s\n", st.packets, secs);
+        fmt::format_to(out,
+                "{:<8} {:<4} {:<15} {:>9} {:>13} {:>8} {:>8} {:>7} {:>7} {:>7} {:>6} {:>5} "
+                "{:>8} {:>8} {:>8} {:>8}  {}\n",
+                "bus-dev", "ep", "type", "URBs", "bytes", "MB/s", "peak", "errors", "stalls",
+                "unlinks", "depth", "max", "p50 us", "p90 us", "p99 us", "max us", "device");
+
+        std::vector<endpoint_key> keys;
+        keys.reserve(st.endpoints.size());
+        for (auto const& [key, e] : st.endpoints)
+            keys.push_back(key);
+        std::sort(keys.begin(), keys.end());
+
+        for (endpoint_key const key : keys) {
+            endpoint_stats const& e = st.endpoints.at(key);
+            std::uint64_t const max_us = e.latency_max_ns / 1000;
+            auto const percentile = [&](unsigned per_mille) {
+                return std::min(e.latency.percentile(per_mille), max_us);
+            };
+            std::string const type = fmt::format("{}{}",
+                    to_str(to_transfer_type(e.xfer_type)), direction(key, e.xfer_type));
+            // Little's law: the average in flight is the time spent in
+            // flight over the time
+            double const depth = (secs > 0) ? e.latency_sum_ns / 1e9 / secs : 0;
+            fmt::format_to(out,
+                    "{:<8} {:#04x} {:<15} {:>9} {:>13} {:>8.2f} {:>8.2f} {:>7} {:>7} {:>7} "
+                    "{:>6.1f} {:>5} {:>8} {:>8} {:>8} {:>8}  ",
+                    fmt::format("{}-{}", key >> 16, (key >> 8) & 0xff), key & 0xff, type,
+                    e.urbs, e.bytes, (secs > 0) ? e.bytes / secs / 1e6 : 0,
+                    e.throughput.peak() / interval_secs / 1e6, e.errors, e.stalls, e.unlinked,
+                    depth, e.max_depth, percentile(500), percentile(900), percentile(990),
+                    max_us);
+            auto const label = st.devices.find(device_of(key));
+            if (label != st.devices.end()) {
+                fmt::format_to(out, "{:04x}:{:04x} {}", label->second.vid, label->second.pid,
+                        to_str(static_cast<libusb_class_code>(label->second.device_class)));
+            }
+            buf.push_back('\n');
+        }
+    }
+
+} // namespace
+
+
+bool
+analyze(capture_reader& in, analyze_options const& opts, std::FILE* out)
+{
+    capture_stats st;
+    bool split = std::max<std::size_t>(opts.jobs, 1) > 1;
+    if (split) {
+        std::vector<capture_range> ranges = in.split(opts.jobs);
+        std::vector<part_stats> parts(ranges.size());
+        std::vector<std::exception_ptr> failures(ranges.size());
+        std::vector<std::thread> workers;
+        workers.reserve(ranges.size());
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            workers.emplace_back([&, i] {
+                try {
+                    read_part(in, &ranges[i], opts, parts[i]);
+                } catch (...) {
+                    failures[i] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread& t : workers)
+            t.join();
+
+        // A run that doesn't end where the next starts means a cut was
+        // made at a false boundary, and whatever the next run read
+        // (or failed on) is garbage; a section or interface block met
+        // after the first packet is only followed by the reader itself.
+        split = std::none_of(ranges.begin(), ranges.end(),
+                [](capture_range const& r) { return r.unsplittable; });
+        if (split) {
+            for (std::exception_ptr const& e : failures) {
+                if (e)
+                    std::rethrow_exception(e);
+            }
+            for (part_stats& part : parts)
+                st.merge(part);
+        }
+    }
+    if (!split) {
+        part_stats part;
+        read_part(in, nullptr, opts, part);
+        st.merge(part);
+    }
+
+    std::uint64_t orphans = 0;
+    for (auto const& [key, e] : st.endpoints)
+        orphans += e.orphans;
+    fmt::print(stderr,
+            "{} packets read, {} skipped (not usbmon); {} URBs still in flight at the end, {} "
+            "completed without a submission\n",
+            st.packets + st.skipped, st.skipped, st.pending.size(), orphans);
+
+    fmt::memory_buffer buf;
+    format_report(buf, st, opts);
+    if (std::fwrite(buf.data(), 1, buf.size(), out) != buf.size() || std::fflush(out) != 0) {
+        LOG_ERROR("{}: writing the report failure ({})", __builtin_FUNCTION(),
+                std::strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "pcap.hpp"
+#include "util/usbmon.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+
+// Per-endpoint statistics of a usbmon capture, read in one pass:
+// URBs, bytes and throughput, errors and stalls, submission to
+// completion latency, and queue depth (URBs submitted, not yet
+// completed). Submissions are matched to their completions by URB id.
+// Memory grows with the endpoints and the URBs in flight, not with the
+// capture's length.
+
+struct analyze_options
+{
+    usbmon::capture_filter filter;
+    std::size_t jobs = 1; ///< threads, each reading its own part of the file
+    std::uint32_t interval_ms = 1000; ///< peak throughput is the busiest such interval
+};
+
+/// Reads the whole of \c in and prints a table of its endpoints to
+/// \c out, and a summary to stderr. With more than one job the file is
+/// split (see capture_reader::split()) and the parts' statistics merged
+/// in file order, giving the same table as one job. A file that can't
+/// be split after all (see capture_range::unsplittable) is read with one
+/// job.
+/// \returns false (after logging why) if the table can't be written
+/// \throws std::runtime_error if the capture is truncated or corrupt
+bool analyze(capture_reader& in, analyze_options const& opts, std::FILE* out);
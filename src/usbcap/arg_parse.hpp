@@ -0,0 +1,204 @@
+#pragma once
+
+#include "pcap.hpp"
+#include "version.h"
+#include "util/compiler.hpp"
+#include "util/usbmon.hpp"
+#include <filesystem>
+#include <getopt.h>
+#include <algorithm> // std::max
+#include <climits> // ULONG_MAX
+#include <cstdint>
+#include <cstdio>  // std::fprintf
+#include <cstdlib> // std::exit, std::strtoul
+#include <cstring> // std::strcmp
+#include <string>
+
+
+struct cli_args
+{
+    usbmon::capture_filter filter;
+    std::string read_file; ///< read packets from a capture instead of usbmon
+    std::string write_file; ///< "-" for stdout; one line per packet on stdout if empty
+    capture_format format = capture_format::pcapng;
+    std::uint64_t count = 0; ///< stop after this many packets; 0 for no limit
+    std::uint32_t snaplen = 256 * 1024; ///< bytes kept of each packet, header included
+    std::size_t ring_size = usbmon::ring::max_size;
+    bool analyze = false; ///< per-endpoint statistics of --read instead of its packets
+    std::size_t jobs = 8; ///< threads analyzing
+    std::uint32_t interval_ms = 1000; ///< of peak throughput
+};
+
+cli_args
+arg_parse(int argc, char** argv)
+{
+    auto usage = [](std::FILE* outerr, std::filesystem::path const& app) {
+        std::fprintf(outerr,
+                "usage: %s [-hv] [-b <bus>] [-d <address>] [-e <endpoint>] [-c <count>]\n"
+                "       [-s <snaplen>] [--ring-size=<bytes>] [-w <file> [-F pcap|pcapng]]\n"
+                "       %s [-hv] -r <file> [-b <bus>] [-d <address>] [-e <endpoint>] [-c <count>]\n"
+                "       [-w <file> [-F pcap|pcapng]]\n"
+                "       %s [-hv] -a -r <file> [-b <bus>] [-d <address>] [-e <endpoint>] [-j <jobs>]\n"
+                "       [-i <ms>]\n"
+                "Captures USB traffic through usbmon (/dev/usbmon<bus>, needs the usbmon module and\n"
+                "read access) until interrupted, or reads a capture back. Packets are written as\n"
+                "pcap or pcapng with LINKTYPE_USB_LINUX_MMAPPED, or printed one per line; or, with\n"
+                "--analyze, summed up per endpoint: URBs, bytes and throughput, errors, queue depth\n"
+                "and submission to completion latency.\n"
+                "options:\n"
+                "  -a, --analyze                Print per-endpoint statistics of --read.\n"
+                "  -b, --bus=<n>                Only bus <n> (default: all buses).\n"
+                "  -c, --count=<n>              Stop after <n> packets.\n"
+                "  -d, --device=<address>       Only the device with this address.\n"
+                "  -e, --endpoint=<n>           Only endpoint <n>, both directions.\n"
+                "  -F, --format=pcap|pcapng     Format of --write (default: pcapng).\n"
+                "  -h, --help                   This output.\n"
+                "  -i, --interval=<ms>          Interval of the peak throughput (default: 1000).\n"
+                "  -j, --jobs=<n>               Threads analyzing, each a part of the file\n"
+                "                               (default: 8).\n"
+                "  -r, --read=<file>            Read a pcap or pcapng capture of USB traffic instead\n"
+                "                               of capturing.\n"
+                "      --ring-size=<bytes>      Size of the kernel's event ring (default and most:\n"
+                "                               1228800); a smaller ring drops events sooner.\n"
+                "  -s, --snaplen=<bytes>        Bytes kept of each packet, 64-byte header included\n"
+                "                               (default: 262144).\n"
+                "  -v, --version                Print application version information.\n"
+                "  -w, --write=<file>           Write the packets to <file>, or stdout if \"-\".\n",
+                app.c_str(), app.c_str(), app.c_str());
+        std::exit(outerr == stdout ? EXIT_SUCCESS : EXIT_FAILURE);
+    };
+
+    auto const app = std::filesystem::path(argv[0]).filename();
+
+    auto number = [&](char const* what, unsigned long max) {
+        char* end = nullptr;
+        unsigned long const n = std::strtoul(optarg, &end, 0);
+        if (end == optarg || *end != '\0' || n > max) {
+            std::fprintf(stderr, "invalid %s \"%s\"\n", what, optarg);
+            usage(stderr, app);
+        }
+        return n;
+    };
+
+    cli_args args;
+    while (true) {
+        // clang-format off
+        static option const long_options[] = {
+                { "analyze",    no_argument,        nullptr,    'a' },
+                { "bus",        required_argument,  nullptr,    'b' },
+                { "count",      required_argument,  nullptr,    'c' },
+                { "device",     required_argument,  nullptr,    'd' },
+                { "endpoint",   required_argument,  nullptr,    'e' },
+                { "format",     required_argument,  nullptr,    'F' },
+                { "help",       no_argument,        nullptr,    'h' },
+                { "interval",   required_argument,  nullptr,    'i' },
+                { "jobs",       required_argument,  nullptr,    'j' },
+                { "read",       required_argument,  nullptr,    'r' },
+                { "ring-size",  required_argument,  nullptr,    'R' },
+                { "snaplen",    required_argument,  nullptr,    's' },
+                { "version",    no_argument,        nullptr,    'v' },
+                { "write",      required_argument,  nullptr,    'w' },
+                { nullptr,      0,                  nullptr,    0 },
+        };
+        // clang-format on
+
+        int const c = ::getopt_long(argc, argv, "ab:c:d:e:F:hi:j:r:s:vw:",
+                static_cast<option const*>(long_options), nullptr);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'a':
+                args.analyze = true;
+                break;
+
+            case 'b':
+                args.filter.bus = static_cast<int>(number("bus", 255));
+                if (args.filter.bus == 0)
+                    args.filter.bus = -1;
+                break;
+
+            case 'c':
+                args.count = number("count", ULONG_MAX);
+                break;
+
+            case 'd':
+                args.filter.devnum = static_cast<int>(number("device address", 127));
+                break;
+
+            case 'e':
+                args.filter.endpoint = static_cast<int>(number("endpoint", 15));
+                break;
+
+            case 'F':
+                if (std::strcmp(optarg, "pcap") == 0) {
+                    args.format = capture_format::pcap;
+                } else if (std::strcmp(optarg, "pcapng") == 0) {
+                    args.format = capture_format::pcapng;
+                } else {
+                    std::fprintf(stderr, "invalid format \"%s\"\n", optarg);
+                    usage(stderr, app);
+                }
+                break;
+
+            case 'h':
+                usage(stdout, app);
+                break;
+
+            case 'i':
+                args.interval_ms = static_cast<std::uint32_t>(number("interval", 3'600'000));
+                if (args.interval_ms == 0) {
+                    std::fprintf(stderr, "interval must be at least 1 ms\n");
+                    usage(stderr, app);
+                }
+                break;
+
+            case 'j':
+                args.jobs = std::max<std::size_t>(number("number of jobs", 1024), 1);
+                break;
+
+            case 'r':
+                args.read_file = optarg;
+                break;
+
+            case 'R':
+                args.ring_size = number("ring size", usbmon::ring::max_size);
+                break;
+
+            case 's':
+                args.snaplen = static_cast<std::uint32_t>(number("snapshot length", UINT32_MAX));
+                if (args.snaplen < sizeof(usbmon::packet_header)) {
+                    std::fprintf(stderr, "snapshot length must be at least %zu\n",
+                            sizeof(usbmon::packet_header));
+                    usage(stderr, app);
+                }
+                break;
+
+            case 'v':
+                std::fprintf(stdout, "app_version=%s\n%s\n", ::VERSION,
+                        get_version_info_multiline().c_str());
+                std::exit(EXIT_SUCCESS);
+                break;
+
+            case 'w':
+                args.write_file = optarg;
+                break;
+
+            case '?':
+            default:
+                usage(stderr, app);
+                break;
+        }
+    } // while
+
+    if (optind != argc) {
+        std::fprintf(stderr, "extra argument(s): %s\n\n", argv[optind]);
+        usage(stderr, app);
+    }
+    if (args.analyze && (args.read_file.empty() || !args.write_file.empty())) {
+        std::fprintf(stderr, "--analyze needs --read, and writes no capture\n\n");
+        usage(stderr, app);
+    }
+
+    return args;
+}
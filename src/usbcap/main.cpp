@@ -0,0 +1,278 @@
+#include "analyze.hpp"
+#include "arg_parse.hpp"
+#include "pcap.hpp"
+#include "util/byte_order.hpp"
+#include "util/log.hpp"
+#include "util/usbmon.hpp"
+#include <fmt/format.h>
+#include <signal.h>
+#include <algorithm> // std::min
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // std::memcpy, std::strerror
+#include <iterator>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+
+namespace { // unnamed
+
+    std::atomic<bool> stop_requested = false;
+
+    void
+    request_stop(int /*signum*/)
+    {
+        stop_requested.store(true, std::memory_order_relaxed);
+    }
+
+    /// Events fetched from the ring at a time.
+    constexpr std::size_t fetch_batch = 1024;
+
+    char
+    xfer_letter(std::uint8_t xfer_type) noexcept
+    {
+        // as in the usbmon text interface
+        // clang-format off
+        switch (xfer_type) {
+            case usbmon::iso:       return 'Z';
+            case usbmon::interrupt: return 'I';
+            case usbmon::control:   return 'C';
+            case usbmon::bulk:      return 'B';
+            default: break;
+        }
+        // clang-format on
+        return '?';
+    }
+
+    /// One line per packet, close to the usbmon text interface's:
+    /// time, URB, event, type and direction:bus:device:endpoint, status,
+    /// length, then the setup packet and the first bytes of data.
+    void
+    format_packet(fmt::memory_buffer& buf, usbmon::packet_header const& h,
+            std::span<std::byte const> data)
+    {
+        auto out = std::back_inserter(buf);
+        fmt::format_to(out, "{}.{:06} {:016x} {} {}{}:{}:{:03}:{} {} {}", h.ts_sec, h.ts_usec, h.id,
+                h.type, xfer_letter(h.xfer_type), (h.epnum & 0x80) ? 'i' : 'o', h.busnum, h.devnum,
+                h.epnum & 0x7f, h.status, h.length);
+        if (h.type == 'S' && h.xfer_type == usbmon::control && h.flag_setup == 0) {
+            // bmRequestType bRequest wValue wIndex wLength
+            fmt::format_to(out, " s {:02x} {:02x} {:02x}{:02x} {:02x}{:02x} {:02x}{:02x}",
+                    h.setup[0], h.setup[1], h.setup[3], h.setup[2], h.setup[5], h.setup[4],
+                    h.setup[7], h.setup[6]);
+        }
+        if (!data.empty()) {
+            buf.append(std::string_view(" ="));
+            for (std::byte b : data.first(std::min<std::size_t>(data.size(), 16)))
+                fmt::format_to(out, " {:02x}", static_cast<unsigned>(b));
+        }
+        buf.push_back('\n');
+    }
+
+
+    /// Where kept packets go: a capture file, created with the link type
+    /// of the first packet, or lines on stdout.
+    class packet_sink
+    {
+    private:
+        cli_args const& args_;
+        std::optional<capture_writer> writer_;
+        std::uint16_t linktype_ = 0;
+        fmt::memory_buffer text_;
+        bool failed_ = false;
+
+    public:
+        explicit packet_sink(cli_args const& args) noexcept
+                : args_(args)
+        {}
+
+        /// \returns false if the packet's link type differs from the
+        /// first's, which a pcap file can't mix
+        /// \throws std::runtime_error if the output can't be created
+        bool
+        put(std::uint16_t linktype, std::int64_t ts_nsecs, usbmon::packet_header const& h,
+                std::span<std::byte const> packet, std::uint32_t orig_len)
+        {
+            if (args_.write_file.empty()) {
+                std::size_t const size = usbmon_header_size(linktype);
+                format_packet(text_, h, usbmon::payload(packet, size, h));
+                if (text_.size() >= capture_writer::flush_threshold)
+                    flush_text();
+                return true;
+            }
+
+            if (!writer_) {
+                writer_.emplace(args_.write_file, args_.format, linktype, args_.snaplen);
+                linktype_ = linktype;
+            }
+            if (linktype != linktype_)
+                return false;
+            writer_->write(ts_nsecs, orig_len,
+                    packet.first(std::min<std::size_t>(packet.size(), args_.snaplen)));
+            return true;
+        }
+
+        /// \returns false (after logging why) if any output failed
+        bool
+        finish()
+        {
+            if (!args_.write_file.empty() && !writer_)
+                writer_.emplace(args_.write_file, args_.format, linktype_usb_linux_mmapped,
+                        args_.snaplen); // nothing kept; still an empty capture
+            if (writer_)
+                return writer_->flush();
+            flush_text();
+            return !failed_;
+        }
+
+    private:
+        void
+        flush_text()
+        {
+            if (std::fwrite(text_.data(), 1, text_.size(), stdout) != text_.size())
+                failed_ = true;
+            text_.clear();
+        }
+    };
+
+
+    /// The ISO descriptors of a mmapped-header packet are four 32-bit
+    /// fields each.
+    void
+    swap_iso_descs(std::span<std::byte> after_header, usbmon::packet_header const& h) noexcept
+    {
+        std::size_t const n = std::min<std::size_t>(
+                std::size_t(h.ndesc) * sizeof(usbmon::iso_desc), after_header.size());
+        for (std::size_t at = 0; at + 4 <= n; at += 4) {
+            std::uint32_t v;
+            std::memcpy(&v, after_header.data() + at, sizeof(v));
+            v = byteswap(v);
+            std::memcpy(after_header.data() + at, &v, sizeof(v));
+        }
+    }
+
+
+    int
+    capture(cli_args const& args)
+    {
+        usbmon::ring ring(args.filter.bus < 0 ? 0 : static_cast<unsigned>(args.filter.bus),
+                args.ring_size);
+        packet_sink sink(args);
+
+        // without SA_RESTART, so that a signal ends a fetch that is
+        // waiting for events
+        struct sigaction sa = {};
+        sa.sa_handler = request_stop;
+        ::sigaction(SIGINT, &sa, nullptr);
+        ::sigaction(SIGTERM, &sa, nullptr);
+
+        std::uint64_t seen = 0;
+        std::uint64_t kept = 0;
+        std::vector<std::uint32_t> offsets(fetch_batch);
+        std::uint32_t flush = 0;
+        bool ok = true;
+        while (!stop_requested.load(std::memory_order_relaxed)
+                && (args.count == 0 || kept < args.count)) {
+            int const n = ring.fetch(offsets, flush);
+            flush = 0;
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                LOG_ERROR("{}: usbmon fetch failure ({})", __builtin_FUNCTION(),
+                        std::strerror(errno));
+                ok = false;
+                break;
+            }
+
+            // the events stay in the ring, and are only read, until the
+            // next fetch releases them
+            for (int i = 0; i < n && (args.count == 0 || kept < args.count); ++i) {
+                std::span<std::byte const> const ev = ring.event(offsets[i]);
+                usbmon::packet_header h;
+                if (!usbmon::read_header(ev, sizeof(h), false, h) || h.type == '@')
+                    continue;
+                ++seen;
+                if (!args.filter.accepts(h))
+                    continue;
+                std::int64_t const ts = h.ts_sec * 1'000'000'000 + h.ts_usec * 1000;
+                auto const orig_len = static_cast<std::uint32_t>(
+                        sizeof(h) + std::size_t(h.ndesc) * sizeof(usbmon::iso_desc) + h.length);
+                sink.put(linktype_usb_linux_mmapped, ts, h, ev, orig_len);
+                ++kept;
+            }
+            flush = static_cast<std::uint32_t>(n);
+        }
+
+        ok &= sink.finish();
+        fmt::print(stderr, "{} packets captured, {} kept, {} dropped by the kernel\n", seen, kept,
+                ring.stats().dropped);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int
+    read_back(cli_args const& args)
+    {
+        capture_reader in(args.read_file);
+        packet_sink sink(args);
+
+        std::uint64_t seen = 0;
+        std::uint64_t kept = 0;
+        std::uint64_t skipped = 0;
+        std::vector<std::byte> scratch;
+        capture_packet p;
+        while ((args.count == 0 || kept < args.count) && in.next(p)) {
+            std::size_t const header_size = usbmon_header_size(p.linktype);
+            usbmon::packet_header h;
+            if (header_size == 0 || !usbmon::read_header(p.data, header_size, in.swapped(), h)) {
+                ++skipped;
+                continue;
+            }
+            ++seen;
+            if (!args.filter.accepts(h))
+                continue;
+
+            // written out in this host's byte order
+            std::span<std::byte const> packet = p.data;
+            if (in.swapped()) {
+                scratch.assign(p.data.begin(), p.data.end());
+                std::memcpy(scratch.data(), &h, header_size);
+                swap_iso_descs(std::span(scratch).subspan(header_size), h);
+                packet = scratch;
+            }
+            if (sink.put(p.linktype, p.ts_nsecs, h, packet, p.orig_len))
+                ++kept;
+            else
+                ++skipped;
+        }
+
+        bool const ok = sink.finish();
+        fmt::print(stderr,
+                "{} packets read, {} kept, {} skipped (not usbmon, or another link type)\n", seen,
+                kept, skipped);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+} // namespace
+
+
+int
+main(int argc, char** argv)
+{
+    cli_args const args = arg_parse(argc, argv);
+    try {
+        if (args.analyze) {
+            capture_reader in(args.read_file);
+            analyze_options const opts{args.filter, args.jobs, args.interval_ms};
+            return analyze(in, opts, stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        return args.read_file.empty() ? capture(args) : read_back(args);
+    } catch (std::runtime_error const& e) {
+        fmt::print(stderr, "error: {}\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
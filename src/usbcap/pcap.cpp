@@ -0,0 +1,536 @@
+#include "pcap.hpp"
+#include "util/byte_order.hpp"
+#include "util/log.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm> // std::max, std::min
+#include <cerrno>
+#include <cstring> // std::memcpy, std::strerror
+#include <stdexcept>
+#include <utility> // std::move
+
+
+namespace { // unnamed
+
+    constexpr std::uint32_t pcap_magic_usecs = 0xa1b2c3d4;
+    constexpr std::uint32_t pcap_magic_nsecs = 0xa1b23c4d;
+
+    struct pcap_file_header
+    {
+        std::uint32_t magic = pcap_magic_usecs;
+        std::uint16_t version_major = 2;
+        std::uint16_t version_minor = 4;
+        std::int32_t thiszone = 0;
+        std::uint32_t sigfigs = 0;
+        std::uint32_t snaplen = 0;
+        std::uint32_t linktype = 0;
+    };
+    static_assert(sizeof(pcap_file_header) == 24);
+
+    struct pcap_record_header
+    {
+        std::uint32_t ts_sec = 0;
+        std::uint32_t ts_frac = 0; ///< usecs, or nsecs
+        std::uint32_t incl_len = 0;
+        std::uint32_t orig_len = 0;
+    };
+    static_assert(sizeof(pcap_record_header) == 16);
+
+    // pcapng block types
+    constexpr std::uint32_t section_header_block = 0x0a0d0d0a;
+    constexpr std::uint32_t interface_description_block = 1;
+    constexpr std::uint32_t simple_packet_block = 3;
+    constexpr std::uint32_t enhanced_packet_block = 6;
+    constexpr std::uint32_t byte_order_magic = 0x1a2b3c4d;
+
+    constexpr std::uint16_t opt_endofopt = 0;
+    constexpr std::uint16_t if_tsresol = 9;
+
+    constexpr std::size_t
+    padded(std::size_t n) noexcept
+    {
+        return (n + 3) & ~std::size_t(3);
+    }
+
+    template <typename T>
+    void
+    append(fmt::memory_buffer& buf, T const& v)
+    {
+        auto const* p = reinterpret_cast<char const*>(&v);
+        buf.append(p, p + sizeof(v));
+    }
+
+    std::int64_t
+    to_nsecs(std::uint64_t ts, std::uint64_t units_per_sec) noexcept
+    {
+        auto const frac = static_cast<unsigned __int128>(ts % units_per_sec) * 1'000'000'000;
+        return static_cast<std::int64_t>(ts / units_per_sec * 1'000'000'000
+                + static_cast<std::uint64_t>(frac / units_per_sec));
+    }
+
+} // namespace
+
+
+capture_writer::capture_writer(
+        std::string path, capture_format format, std::uint16_t linktype, std::uint32_t snaplen)
+        : path_(std::move(path))
+        , format_(format)
+{
+    fd_ = (path_ == "-") ? STDOUT_FILENO
+                         : ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+        throw std::runtime_error(fmt::format(
+                "{}: open({}) failure ({})", __builtin_FUNCTION(), path_, std::strerror(errno)));
+    }
+
+    if (format_ == capture_format::pcap) {
+        pcap_file_header h;
+        h.snaplen = snaplen;
+        h.linktype = linktype;
+        append(buf_, h);
+        return;
+    }
+
+    // section header: byte order magic, version 1.0, unknown length
+    append(buf_, section_header_block);
+    append(buf_, std::uint32_t(28));
+    append(buf_, byte_order_magic);
+    append(buf_, std::uint16_t(1));
+    append(buf_, std::uint16_t(0));
+    append(buf_, std::int64_t(-1));
+    append(buf_, std::uint32_t(28));
+
+    // one interface, microsecond timestamps (the default resolution)
+    append(buf_, interface_description_block);
+    append(buf_, std::uint32_t(20));
+    append(buf_, linktype);
+    append(buf_, std::uint16_t(0));
+    append(buf_, snaplen);
+    append(buf_, std::uint32_t(20));
+}
+
+capture_writer::~capture_writer() noexcept
+{
+    flush();
+    if (fd_ != STDOUT_FILENO)
+        ::close(fd_);
+}
+
+void
+capture_writer::write(
+        std::int64_t ts_nsecs, std::uint32_t orig_len, std::span<std::byte const> data)
+{
+    auto const len = static_cast<std::uint32_t>(data.size());
+    auto const usecs = static_cast<std::uint64_t>(ts_nsecs / 1000);
+    if (format_ == capture_format::pcap) {
+        pcap_record_header const r{static_cast<std::uint32_t>(usecs / 1'000'000),
+                static_cast<std::uint32_t>(usecs % 1'000'000), len, orig_len};
+        append(buf_, r);
+        buf_.append(reinterpret_cast<char const*>(data.data()),
+                reinterpret_cast<char const*>(data.data() + data.size()));
+    } else {
+        auto const block_len = static_cast<std::uint32_t>(32 + padded(len));
+        append(buf_, enhanced_packet_block);
+        append(buf_, block_len);
+        append(buf_, std::uint32_t(0)); // interface
+        append(buf_, static_cast<std::uint32_t>(usecs >> 32));
+        append(buf_, static_cast<std::uint32_t>(usecs));
+        append(buf_, len);
+        append(buf_, orig_len);
+        buf_.append(reinterpret_cast<char const*>(data.data()),
+                reinterpret_cast<char const*>(data.data() + data.size()));
+        static constexpr char zeros[4] = {0};
+        buf_.append(zeros, zeros + (padded(len) - len));
+        append(buf_, block_len);
+    }
+
+    if (buf_.size() >= flush_threshold)
+        flush();
+}
+
+bool
+capture_writer::flush()
+{
+    char const* p = buf_.data();
+    std::size_t left = buf_.size();
+    while (left != 0 && !failed_) {
+        ssize_t const n = ::write(fd_, p, left);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            LOG_ERROR("{}: writing {} failure ({})", __builtin_FUNCTION(), path_,
+                    std::strerror(errno));
+            failed_ = true;
+            break;
+        }
+        p += n;
+        left -= static_cast<std::size_t>(n);
+    }
+
+    buf_.clear();
+    return !failed_;
+}
+
+
+capture_reader::capture_reader(std::string const& path)
+        : path_(path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(fmt::format(
+                "{}: open({}) failure ({})", __builtin_FUNCTION(), path, std::strerror(errno)));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(pcap_file_header)) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format("capture: {} is not a pcap or pcapng file", path));
+    }
+
+    length_ = static_cast<std::size_t>(st.st_size);
+    base_ = ::mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+    int const e = errno;
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+        throw std::runtime_error(
+                fmt::format("{}: mmap failure ({})", __builtin_FUNCTION(), std::strerror(e)));
+    }
+
+    // packets are read once, front to back
+    ::madvise(base_, length_, MADV_SEQUENTIAL);
+
+    std::uint32_t const magic = load<std::uint32_t>(0);
+    if (magic == pcap_magic_usecs || magic == pcap_magic_nsecs
+            || byteswap(magic) == pcap_magic_usecs || byteswap(magic) == pcap_magic_nsecs) {
+        format_ = capture_format::pcap;
+        swapped_ = (magic != pcap_magic_usecs && magic != pcap_magic_nsecs);
+        nsecs_ = (magic == pcap_magic_nsecs || byteswap(magic) == pcap_magic_nsecs);
+        snaplen_ = load<std::uint32_t>(16);
+        linktype_ = static_cast<std::uint16_t>(load<std::uint32_t>(20));
+        pos_ = sizeof(pcap_file_header);
+        if (length_ - pos_ >= sizeof(pcap_record_header))
+            first_sec_ = load<std::uint32_t>(pos_);
+    } else if (magic == section_header_block) {
+        format_ = capture_format::pcapng;
+        try {
+            read_section_header(0); // sets pos_
+            // the interfaces normally all come before the first packet
+            while (length_ - pos_ >= 12
+                    && load<std::uint32_t>(pos_) == interface_description_block) {
+                std::size_t const block_len = block_length(pos_);
+                if (block_len < 20)
+                    corrupt(pos_);
+                read_interface(pos_, block_len);
+                pos_ += block_len;
+            }
+        } catch (...) {
+            ::munmap(base_, length_);
+            throw;
+        }
+    } else {
+        ::munmap(base_, length_);
+        throw std::runtime_error(fmt::format("capture: {} is not a pcap or pcapng file", path));
+    }
+    data_start_ = pos_;
+}
+
+capture_reader::~capture_reader() noexcept
+{
+    ::munmap(base_, length_);
+}
+
+template <typename T>
+T
+capture_reader::load(std::size_t at) const noexcept
+{
+    T v;
+    std::memcpy(&v, static_cast<std::byte const*>(base_) + at, sizeof(v));
+    return swapped_ ? byteswap(v) : v;
+}
+
+void
+capture_reader::corrupt(std::size_t at) const
+{
+    throw std::runtime_error(
+            fmt::format("capture: {} is truncated or corrupt at offset {}", path_, at));
+}
+
+bool
+capture_reader::next(capture_packet& p)
+{
+    return (format_ == capture_format::pcap) ? next_pcap(pos_, length_, p) : next_pcapng(p);
+}
+
+bool
+capture_reader::next(capture_range& r, capture_packet& p) const
+{
+    if (r.unsplittable)
+        return false;
+
+    if (format_ == capture_format::pcap) {
+        std::size_t pos = r.first;
+        if (!next_pcap(pos, r.last, p))
+            return false;
+        if (pos > r.last) {
+            r.unsplittable = true;
+            return false;
+        }
+        r.first = pos;
+        return true;
+    }
+
+    while (r.first < r.last) {
+        std::size_t const at = r.first;
+        if (length_ - at < 12)
+            corrupt(at);
+        std::uint32_t const type = load<std::uint32_t>(at);
+        if (type == section_header_block || type == interface_description_block) {
+            r.unsplittable = true;
+            return false;
+        }
+        std::size_t const block_len = block_length(at);
+        if (block_len > r.last - at) {
+            r.unsplittable = true;
+            return false;
+        }
+        r.first = at + block_len;
+        if (packet_block(at, block_len, p))
+            return true;
+    }
+    return false;
+}
+
+bool
+capture_reader::next_pcap(std::size_t& pos, std::size_t end, capture_packet& p) const
+{
+    if (pos >= end)
+        return false;
+    if (length_ - pos < sizeof(pcap_record_header))
+        corrupt(pos);
+
+    std::uint32_t const sec = load<std::uint32_t>(pos);
+    std::uint32_t const frac = load<std::uint32_t>(pos + 4);
+    std::uint32_t const incl_len = load<std::uint32_t>(pos + 8);
+    if (length_ - pos - sizeof(pcap_record_header) < incl_len)
+        corrupt(pos);
+
+    p.ts_nsecs = std::int64_t(sec) * 1'000'000'000 + (nsecs_ ? frac : std::int64_t(frac) * 1000);
+    p.orig_len = load<std::uint32_t>(pos + 12);
+    p.linktype = linktype_;
+    p.data = {static_cast<std::byte const*>(base_) + pos + sizeof(pcap_record_header), incl_len};
+    pos += sizeof(pcap_record_header) + incl_len;
+    return true;
+}
+
+void
+capture_reader::read_section_header(std::size_t at)
+{
+    // the byte order magic decides how everything in the section,
+    // including the block length before it, is read
+    if (length_ - at < 28)
+        corrupt(at);
+    swapped_ = false;
+    std::uint32_t const bom = load<std::uint32_t>(at + 8);
+    if (bom != byte_order_magic) {
+        if (byteswap(bom) != byte_order_magic)
+            corrupt(at);
+        swapped_ = true;
+    }
+    std::uint32_t const block_len = load<std::uint32_t>(at + 4);
+    if (block_len < 28 || block_len % 4 != 0 || block_len > length_ - at)
+        corrupt(at);
+    interfaces_.clear();
+    pos_ = at + block_len;
+}
+
+void
+capture_reader::read_interface(std::size_t at, std::size_t block_len)
+{
+    interface i;
+    i.linktype = load<std::uint16_t>(at + 8);
+
+    // options: code, length, value padded to 4 bytes
+    std::size_t opt = at + 16;
+    std::size_t const end = at + block_len - 4;
+    while (end - opt >= 4) {
+        std::uint16_t const code = load<std::uint16_t>(opt);
+        std::uint16_t const len = load<std::uint16_t>(opt + 2);
+        if (code == opt_endofopt || end - opt - 4 < len)
+            break;
+        if (code == if_tsresol && len == 1) {
+            auto const v = static_cast<std::uint8_t>(load<std::uint8_t>(opt + 4));
+            std::uint64_t units = 1;
+            for (unsigned n = 0; n < (v & 0x7f) && units < (std::uint64_t(1) << 62); ++n)
+                units *= (v & 0x80) ? 2 : 10;
+            i.units_per_sec = units;
+        }
+        opt += 4 + padded(len);
+    }
+    interfaces_.push_back(i);
+}
+
+std::size_t
+capture_reader::block_length(std::size_t at) const
+{
+    std::uint32_t const block_len = load<std::uint32_t>(at + 4);
+    if (block_len < 12 || block_len % 4 != 0 || block_len > length_ - at)
+        corrupt(at);
+    return block_len;
+}
+
+bool
+capture_reader::packet_block(std::size_t at, std::size_t block_len, capture_packet& p) const
+{
+    auto const* base = static_cast<std::byte const*>(base_);
+    std::uint32_t const type = load<std::uint32_t>(at);
+    if (type == enhanced_packet_block) {
+        if (block_len < 32)
+            corrupt(at);
+        std::uint32_t const id = load<std::uint32_t>(at + 8);
+        std::uint32_t const caplen = load<std::uint32_t>(at + 20);
+        if (id >= interfaces_.size() || caplen > block_len - 32)
+            corrupt(at);
+        std::uint64_t const ts = std::uint64_t(load<std::uint32_t>(at + 12)) << 32
+                | load<std::uint32_t>(at + 16);
+        p.ts_nsecs = to_nsecs(ts, interfaces_[id].units_per_sec);
+        p.orig_len = load<std::uint32_t>(at + 24);
+        p.linktype = interfaces_[id].linktype;
+        p.data = {base + at + 28, caplen};
+        return true;
+    }
+    if (type == simple_packet_block) {
+        if (block_len < 16 || interfaces_.empty())
+            corrupt(at);
+        p.ts_nsecs = 0; // simple packets have none
+        p.orig_len = load<std::uint32_t>(at + 8);
+        p.linktype = interfaces_[0].linktype;
+        p.data = {base + at + 12, std::min<std::size_t>(p.orig_len, block_len - 16)};
+        return true;
+    }
+    // anything else (statistics, name resolution, ...) holds no packet
+    return false;
+}
+
+bool
+capture_reader::next_pcapng(capture_packet& p)
+{
+    while (pos_ != length_) {
+        std::size_t const at = pos_;
+        if (length_ - at < 12)
+            corrupt(at);
+        std::uint32_t const type = load<std::uint32_t>(at);
+        if (type == section_header_block) {
+            read_section_header(at);
+            continue;
+        }
+
+        std::size_t const block_len = block_length(at);
+        pos_ = at + block_len;
+        if (type == interface_description_block) {
+            if (block_len < 20)
+                corrupt(at);
+            read_interface(at, block_len);
+        } else if (packet_block(at, block_len, p)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+namespace { // unnamed
+
+    /// Records, or blocks, that must follow a cut for it to count as a
+    /// boundary, and how far past the cut one is looked for.
+    constexpr int resync_chain = 8;
+    constexpr std::size_t resync_window = 16 * 1024 * 1024;
+
+    /// Seconds a capture is taken to span at most.
+    constexpr std::uint32_t max_capture_secs = 400 * 24 * 3600;
+
+} // namespace
+
+bool
+capture_reader::plausible_record(std::size_t at, std::size_t& next) const noexcept
+{
+    if (length_ - at < sizeof(pcap_record_header))
+        return false;
+    std::uint32_t const sec = load<std::uint32_t>(at);
+    std::uint32_t const frac = load<std::uint32_t>(at + 4);
+    std::uint32_t const incl_len = load<std::uint32_t>(at + 8);
+    std::uint32_t const orig_len = load<std::uint32_t>(at + 12);
+    std::int64_t const since_first = std::int64_t(sec) - first_sec_;
+    if (since_first < -3600 || since_first > max_capture_secs
+            || frac >= (nsecs_ ? 1'000'000'000u : 1'000'000u) || incl_len > orig_len
+            || incl_len > std::max<std::uint32_t>(snaplen_, 256 * 1024)
+            || length_ - at - sizeof(pcap_record_header) < incl_len)
+        return false;
+    next = at + sizeof(pcap_record_header) + incl_len;
+    return true;
+}
+
+bool
+capture_reader::plausible_block(std::size_t at, std::size_t& next) const noexcept
+{
+    if (length_ - at < 12)
+        return false;
+    std::uint32_t const type = load<std::uint32_t>(at);
+    std::uint32_t const block_len = load<std::uint32_t>(at + 4);
+    // the standard block types; a section header's length may be in
+    // the other byte order, and ends the search
+    if (type == section_header_block) {
+        next = length_;
+        return true;
+    }
+    if (type < interface_description_block || type > enhanced_packet_block
+            || block_len < 12 || block_len % 4 != 0 || block_len > length_ - at
+            || load<std::uint32_t>(at + block_len - 4) != block_len)
+        return false;
+    next = at + block_len;
+    return true;
+}
+
+std::size_t
+capture_reader::resync(std::size_t at) const noexcept
+{
+    // pcapng blocks are 32-bit aligned
+    std::size_t const step = (format_ == capture_format::pcap) ? 1 : 4;
+    at = (at + step - 1) / step * step;
+    if (at >= length_)
+        return length_;
+    std::size_t const end = at + std::min(length_ - at, resync_window);
+    for (; at < end; at += step) {
+        std::size_t pos = at;
+        int n = 0;
+        for (; n < resync_chain && pos < length_; ++n) {
+            bool const ok = (format_ == capture_format::pcap) ? plausible_record(pos, pos)
+                                                              : plausible_block(pos, pos);
+            if (!ok)
+                break;
+        }
+        if (n == resync_chain || pos == length_)
+            return at;
+    }
+    return length_;
+}
+
+std::vector<capture_range>
+capture_reader::split(std::size_t parts) const
+{
+    std::vector<capture_range> ranges;
+    std::size_t first = data_start_;
+    std::size_t const size = length_ - data_start_;
+    for (std::size_t i = 1; i < parts; ++i) {
+        std::size_t const cut = resync(std::max(first, data_start_ + size / parts * i));
+        if (cut >= length_)
+            break;
+        if (cut > first) {
+            ranges.push_back({first, cut});
+            first = cut;
+        }
+    }
+    ranges.push_back({first, length_});
+    return ranges;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "util/usbmon.hpp"
+#include <fmt/format.h>
+#include <cstddef> // std::byte, std::size_t
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+
+// Capture files: classic pcap and pcapng, written and read back. Only
+// what usbcap needs: one link type per file, microsecond timestamps on
+// write; on read, either byte order, nanosecond pcap, and pcapng's
+// if_tsresol. Timestamps are carried as nanoseconds since the epoch.
+
+constexpr std::uint16_t linktype_usb_linux = 189; ///< 48-byte usbmon header
+constexpr std::uint16_t linktype_usb_linux_mmapped = 220; ///< 64-byte usbmon header
+
+/// The size of the usbmon header the packets of \c linktype start
+/// with; 0 for link types other than the two above.
+constexpr std::size_t
+usbmon_header_size(std::uint16_t linktype) noexcept
+{
+    // clang-format off
+    switch (linktype) {
+        case linktype_usb_linux:            return usbmon::short_header_size;
+        case linktype_usb_linux_mmapped:    return sizeof(usbmon::packet_header);
+        default: break;
+    }
+    // clang-format on
+    return 0;
+}
+
+enum class capture_format
+{
+    pcap,
+    pcapng,
+};
+
+struct capture_packet
+{
+    std::int64_t ts_nsecs = 0;
+    std::uint32_t orig_len = 0; ///< before truncation to the snapshot length
+    std::uint16_t linktype = 0;
+    std::span<std::byte const> data; ///< captured bytes
+};
+
+/// A run of whole records (pcap) or blocks (pcapng), by file offset.
+struct capture_range
+{
+    std::size_t first = 0;
+    std::size_t last = 0;
+    /// set by capture_reader::next() if a record crosses \c last (the
+    /// run was cut at a false boundary), or a block starts a section or
+    /// describes an interface: the file must be read in one piece
+    bool unsplittable = false;
+};
+
+
+/// Writes packets to a file, or to stdout for "-", through a large
+/// buffer: a write(2) per megabyte, not per packet.
+class capture_writer
+{
+private:
+    fmt::memory_buffer buf_;
+    std::string path_;
+    int fd_ = -1;
+    capture_format format_;
+    bool failed_ = false;
+
+public:
+    static constexpr std::size_t flush_threshold = 1024 * 1024;
+
+    /// \throws std::runtime_error if \c path can't be created
+    capture_writer(std::string path, capture_format, std::uint16_t linktype, std::uint32_t snaplen);
+    ~capture_writer() noexcept;
+    capture_writer(capture_writer const&) = delete;
+    capture_writer& operator=(capture_writer const&) = delete;
+
+    /// Appends a packet of \c orig_len bytes, of which \c data were
+    /// captured.
+    void write(std::int64_t ts_nsecs, std::uint32_t orig_len, std::span<std::byte const> data);
+
+    /// \returns false (after logging why) if any write so far has
+    /// failed
+    bool flush();
+};
+
+
+/// Memory-mapped capture file, read one packet at a time.
+class capture_reader
+{
+private:
+    void* base_ = nullptr;
+    std::size_t length_ = 0;
+    std::string path_;
+    capture_format format_ = capture_format::pcap;
+    bool swapped_ = false; ///< written on a host of the other byte order
+    std::size_t pos_ = 0;
+    std::size_t data_start_ = 0; ///< the first record, or block after the interfaces
+    // pcap
+    std::uint16_t linktype_ = 0;
+    bool nsecs_ = false;
+    std::uint32_t snaplen_ = 0;
+    std::uint32_t first_sec_ = 0;
+    // pcapng, per interface of the current section
+    struct interface
+    {
+        std::uint16_t linktype = 0;
+        std::uint64_t units_per_sec = 1'000'000;
+    };
+    std::vector<interface> interfaces_;
+
+public:
+    /// \throws std::runtime_error if \c path can't be mapped or is
+    /// neither pcap nor pcapng
+    explicit capture_reader(std::string const& path);
+    ~capture_reader() noexcept;
+    capture_reader(capture_reader const&) = delete;
+    capture_reader& operator=(capture_reader const&) = delete;
+
+    capture_format format() const noexcept { return format_; }
+
+    /// Multi-byte fields of the packets are in the writer's byte order.
+    bool swapped() const noexcept { return swapped_; }
+
+    /// Reads the next packet, skipping blocks that hold none.
+    /// \returns false at the end of the file
+    /// \throws std::runtime_error if the file is truncated or corrupt
+    bool next(capture_packet& p);
+
+    /// Splits the packets into at most \c parts runs of about the same
+    /// size. Cuts are moved forward to where a chain of plausible
+    /// records starts, or dropped if none is found soon after.
+    std::vector<capture_range> split(std::size_t parts) const;
+
+    /// Reads the next packet of \c r, with the interfaces described
+    /// before the first packet. Unlike next(p), safe to call from
+    /// several threads, each with its own run.
+    /// \returns false at the end of the run, or if it turns out not to
+    /// be one (see capture_range::unsplittable)
+    /// \throws std::runtime_error if the run is truncated or corrupt
+    bool next(capture_range& r, capture_packet& p) const;
+
+private:
+    template <typename T>
+    T load(std::size_t at) const noexcept;
+
+    bool next_pcap(std::size_t& pos, std::size_t end, capture_packet& p) const;
+    bool next_pcapng(capture_packet& p);
+    std::size_t block_length(std::size_t at) const;
+    bool packet_block(std::size_t at, std::size_t block_len, capture_packet& p) const;
+    bool plausible_record(std::size_t at, std::size_t& next) const noexcept;
+    bool plausible_block(std::size_t at, std::size_t& next) const noexcept;
+    std::size_t resync(std::size_t at) const noexcept;
+    void read_section_header(std::size_t at);
+    void read_interface(std::size_t at, std::size_t block_len);
+    [[noreturn]] void corrupt(std::size_t at) const;
+};
@@ -0,0 +1,3 @@
+MODULE_LIBRARIES = util
+$(use-fmt)
+$(call add-executable-module,$(get-path))
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "version.h"
+#include "util/compiler.hpp"
+#include "util/usb_ids.hpp"
+#include <filesystem>
+#include <getopt.h>
+#include <cstdio>  // std::fprintf
+#include <cstdlib> // std::exit
+#include <string>
+
+
+struct cli_args
+{
+    std::string input = "/usr/share/hwdata/usb.ids";
+    std::string output = usb_ids::default_path;
+};
+
+cli_args
+arg_parse(int argc, char** argv)
+{
+    auto usage = [](std::FILE* outerr, std::filesystem::path const& app) {
+        std::fprintf(outerr,
+                "usage: %s [-hv] [-o <file>] [<usb.ids>]\n"
+                "arguments:\n"
+                "   usb.ids                 The usb.ids database to compile (default:\n"
+                "                           /usr/share/hwdata/usb.ids).\n"
+                "options:\n"
+                "  -h, --help               This output.\n"
+                "  -o, --output=<file>      Write the index to <file> (default: %s).\n"
+                "  -v, --version            Print application version information.\n",
+                app.c_str(), usb_ids::default_path);
+        std::exit(outerr == stdout ? EXIT_SUCCESS : EXIT_FAILURE);
+    };
+
+    auto const app = std::filesystem::path(argv[0]).filename();
+
+    cli_args args;
+    while (true) {
+        // clang-format off
+        static option const long_options[] = {
+                { "help",       no_argument,        nullptr,    'h' },
+                { "output",     required_argument,  nullptr,    'o' },
+                { "version",    no_argument,        nullptr,    'v' },
+                { nullptr,      0,                  nullptr,    0 },
+        };
+        // clang-format on
+
+        int const c = ::getopt_long(
+                argc, argv, "ho:v", static_cast<option const*>(long_options), nullptr);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'h':
+                usage(stdout, app);
+                break;
+
+            case 'o':
+                args.output = optarg;
+                break;
+
+            case 'v':
+                std::fprintf(stdout, "app_version=%s\n%s\n", ::VERSION,
+                        get_version_info_multiline().c_str());
+                std::exit(EXIT_SUCCESS);
+                break;
+
+            case '?':
+            default:
+                usage(stderr, app);
+                break;
+        }
+    } // while
+
+    if (optind < argc)
+        args.input = argv[optind++];
+
+    for (; optind != argc; ++optind) {
+        std::fprintf(stderr, "extra argument(s): %s\n\n", argv[optind]);
+        usage(stderr, app);
+    }
+
+    return args;
+}
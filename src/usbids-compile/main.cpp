@@ -0,0 +1,296 @@
+#include "arg_parse.hpp"
+#include "util/usb_ids.hpp"
+#include <fmt/format.h>
+#include <algorithm> // std::stable_sort, std::unique
+#include <cerrno>
+#include <charconv> // std::from_chars
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // std::strerror
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+
+namespace { // unnamed
+
+    namespace idx = usb_ids_file;
+
+    using file_ptr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+    template <typename Id>
+    struct named
+    {
+        Id id = 0;
+        std::string name;
+    };
+
+    struct parsed_vendor : named<std::uint16_t>
+    {
+        std::vector<named<std::uint16_t>> products;
+    };
+
+    struct parsed_subclass : named<std::uint8_t>
+    {
+        std::vector<named<std::uint8_t>> protocols;
+    };
+
+    struct parsed_class : named<std::uint8_t>
+    {
+        std::vector<parsed_subclass> subclasses;
+    };
+
+    struct database
+    {
+        std::vector<parsed_vendor> vendors;
+        std::vector<parsed_class> classes;
+    };
+
+
+    /// Parses "<hex id>  <name>", where the id is exactly \c digits
+    /// long. \returns false if \c line isn't one
+    template <typename Id>
+    bool
+    parse_entry(std::string_view line, int digits, named<Id>& out)
+    {
+        if (line.size() < static_cast<std::size_t>(digits) + 2 || line[digits] != ' ')
+            return false;
+
+        unsigned v = 0;
+        auto const [ptr, ec] = std::from_chars(line.data(), line.data() + digits, v, 16);
+        if (ec != std::errc() || ptr != line.data() + digits)
+            return false;
+
+        std::string_view name = line.substr(static_cast<std::size_t>(digits));
+        name.remove_prefix(std::min(name.find_first_not_of(' '), name.size()));
+        out.id = static_cast<Id>(v);
+        out.name = name;
+        return true;
+    }
+
+    /// Reads the vendor/product and class/subclass/protocol lists; the
+    /// other lists (HID usages, languages, ...) are skipped.
+    bool
+    parse(std::FILE* in, database& db)
+    {
+        enum class section { other, vendors, classes };
+        section sect = section::other;
+        std::size_t line_num = 0;
+
+        char buf[1024];
+        while (std::fgets(buf, sizeof(buf), in)) {
+            ++line_num;
+            std::string_view line(buf);
+            while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+                line.remove_suffix(1);
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::size_t depth = 0;
+            while (depth < line.size() && line[depth] == '\t')
+                ++depth;
+            line.remove_prefix(depth);
+
+            bool ok = true;
+            if (depth == 0) {
+                if (parsed_vendor v; parse_entry(line, 4, v)) {
+                    db.vendors.push_back(std::move(v));
+                    sect = section::vendors;
+                } else if (parsed_class c;
+                           line.starts_with("C ") && parse_entry(line.substr(2), 2, c)) {
+                    db.classes.push_back(std::move(c));
+                    sect = section::classes;
+                } else {
+                    sect = section::other;
+                }
+            } else if (sect == section::vendors && depth == 1) {
+                named<std::uint16_t> p;
+                ok = parse_entry(line, 4, p);
+                if (ok)
+                    db.vendors.back().products.push_back(std::move(p));
+            } else if (sect == section::classes && depth == 1) {
+                parsed_subclass s;
+                ok = parse_entry(line, 2, s);
+                if (ok)
+                    db.classes.back().subclasses.push_back(std::move(s));
+            } else if (sect == section::classes && depth == 2) {
+                named<std::uint8_t> p;
+                ok = parse_entry(line, 2, p) && !db.classes.back().subclasses.empty();
+                if (ok)
+                    db.classes.back().subclasses.back().protocols.push_back(std::move(p));
+            }
+            // vendor interface lines (depth 2) are not indexed
+
+            if (!ok)
+                fmt::print(stderr, "warning: line {}: unrecognized entry \"{}\"\n", line_num, line);
+        }
+
+        if (std::ferror(in)) {
+            fmt::print(stderr, "error: read failure ({})\n", std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    /// Sorts by id and drops later duplicates, which lookups couldn't
+    /// reach anyway.
+    template <typename T>
+    void
+    sort_unique(std::vector<T>& v)
+    {
+        std::stable_sort(v.begin(), v.end(), [](T const& a, T const& b) { return a.id < b.id; });
+        auto const same = [](T const& a, T const& b) { return a.id == b.id; };
+        v.erase(std::unique(v.begin(), v.end(), same), v.end());
+    }
+
+
+    /// Lays out the index in memory, in file order.
+    class index_builder
+    {
+    private:
+        idx::header hdr_;
+        std::vector<idx::vendor> vendors_;
+        std::vector<idx::product> products_;
+        std::vector<idx::class_entry> classes_;
+        std::vector<idx::class_entry> subclasses_;
+        std::vector<idx::protocol> protocols_;
+        std::string strings_;
+        std::unordered_map<std::string, std::uint32_t> interned_;
+
+    public:
+        explicit index_builder(database& db)
+        {
+            strings_.push_back('\0'); // offset 0 is the empty name
+
+            sort_unique(db.vendors);
+            for (parsed_vendor& v : db.vendors) {
+                sort_unique(v.products);
+                idx::vendor& e = vendors_.emplace_back();
+                e.id = v.id;
+                e.name = intern(v.name);
+                e.products = {static_cast<std::uint32_t>(products_.size()),
+                        static_cast<std::uint32_t>(v.products.size())};
+                for (auto const& p : v.products)
+                    products_.push_back({p.id, 0, intern(p.name)});
+            }
+
+            // a class's subclasses are appended together, so they form
+            // one run; likewise a subclass's protocols
+            sort_unique(db.classes);
+            for (parsed_class& c : db.classes) {
+                sort_unique(c.subclasses);
+                idx::class_entry& e = classes_.emplace_back();
+                e.id = c.id;
+                e.name = intern(c.name);
+                e.children = {static_cast<std::uint32_t>(subclasses_.size()),
+                        static_cast<std::uint32_t>(c.subclasses.size())};
+                for (parsed_subclass& s : c.subclasses) {
+                    sort_unique(s.protocols);
+                    idx::class_entry& se = subclasses_.emplace_back();
+                    se.id = s.id;
+                    se.name = intern(s.name);
+                    se.children = {static_cast<std::uint32_t>(protocols_.size()),
+                            static_cast<std::uint32_t>(s.protocols.size())};
+                    for (auto const& p : s.protocols)
+                        protocols_.push_back({p.id, {0}, intern(p.name)});
+                }
+            }
+
+            hdr_.num_vendors = static_cast<std::uint32_t>(vendors_.size());
+            hdr_.num_products = static_cast<std::uint32_t>(products_.size());
+            hdr_.num_classes = static_cast<std::uint32_t>(classes_.size());
+            hdr_.num_subclasses = static_cast<std::uint32_t>(subclasses_.size());
+            hdr_.num_protocols = static_cast<std::uint32_t>(protocols_.size());
+            hdr_.strings_size = static_cast<std::uint32_t>(strings_.size());
+        }
+
+        idx::header const& header() const noexcept { return hdr_; }
+
+        bool
+        write(std::FILE* out) const
+        {
+            auto put = [out](void const* p, std::size_t n) {
+                return n == 0 || std::fwrite(p, n, 1, out) == 1;
+            };
+            auto put_table = [&put](auto const& v) {
+                return put(v.data(), v.size() * sizeof(v[0]));
+            };
+            return put(&hdr_, sizeof(hdr_)) && put_table(vendors_) && put_table(products_)
+                    && put_table(classes_) && put_table(subclasses_) && put_table(protocols_)
+                    && put(strings_.data(), strings_.size());
+        }
+
+    private:
+        /// Identical names (e.g. "Keyboard") are stored once.
+        std::uint32_t
+        intern(std::string const& s)
+        {
+            if (s.empty())
+                return 0;
+            auto const [it, inserted] =
+                    interned_.try_emplace(s, static_cast<std::uint32_t>(strings_.size()));
+            if (inserted) {
+                strings_ += s;
+                strings_.push_back('\0');
+            }
+            return it->second;
+        }
+    };
+
+} // namespace
+
+
+int
+main(int argc, char** argv)
+{
+    cli_args const args = arg_parse(argc, argv);
+
+    database db;
+    {
+        file_ptr in(std::fopen(args.input.c_str(), "r"), &std::fclose);
+        if (!in) {
+            fmt::print(stderr, "error: fopen({}) failure ({})\n", args.input, std::strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (!parse(in.get(), db))
+            return EXIT_FAILURE;
+    }
+
+    index_builder const index(db);
+
+    // write beside the target and rename, so that a running lsusb2
+    // never maps a half-written index
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(args.output).parent_path(), ec);
+    std::string const tmp = args.output + ".tmp";
+    {
+        file_ptr out(std::fopen(tmp.c_str(), "wb"), &std::fclose);
+        if (!out) {
+            fmt::print(stderr, "error: fopen({}) failure ({})\n", tmp, std::strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (!index.write(out.get()) || std::fflush(out.get()) != 0) {
+            fmt::print(stderr, "error: writing {} failure ({})\n", tmp, std::strerror(errno));
+            std::remove(tmp.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    if (std::rename(tmp.c_str(), args.output.c_str()) != 0) {
+        fmt::print(stderr, "error: rename({}, {}) failure ({})\n", tmp, args.output,
+                std::strerror(errno));
+        std::remove(tmp.c_str());
+        return EXIT_FAILURE;
+    }
+
+    idx::header const& h = index.header();
+    fmt::print("{}: {} vendors, {} products, {} classes, {} subclasses, {} protocols, "
+               "{} bytes\n",
+            args.output, h.num_vendors, h.num_products, h.num_classes, h.num_subclasses,
+            h.num_protocols, idx::file_size(h));
+    return EXIT_SUCCESS;
+}
@@ -1,2 +1,3 @@
+MODULE_CPPFLAGS = -isystem/usr/include/libusb-1.0
 $(use-fmt)
 $(call add-static-library-module,$(get-path))
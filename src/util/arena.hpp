@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm> // std::max
+#include <cstddef> // std::byte, std::max_align_t, std::size_t
+#include <cstdint>
+#include <cstring> // std::memcpy
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <utility> // std::exchange
+#include <vector>
+
+
+/// Bump allocator. Allocations are carved out of large blocks and are
+/// only released together, when the arena is destroyed, so addresses
+/// stay stable and allocating is a pointer increment. Meant for
+/// trivially destructible data that is built once and then only read.
+class arena
+{
+private:
+    std::size_t block_size_;
+    std::vector<std::unique_ptr<std::byte[]>> blocks_;
+    std::byte* cur_ = nullptr;
+    std::size_t left_ = 0;
+    std::size_t used_ = 0;
+
+public:
+    static constexpr std::size_t default_block_size = 64 * 1024;
+
+    explicit arena(std::size_t block_size = default_block_size) noexcept
+            : block_size_(block_size)
+    {}
+
+    arena(arena&& rhs) noexcept
+            : block_size_(rhs.block_size_)
+            , blocks_(std::move(rhs.blocks_))
+            , cur_(std::exchange(rhs.cur_, nullptr))
+            , left_(std::exchange(rhs.left_, 0))
+            , used_(std::exchange(rhs.used_, 0))
+    {}
+
+    arena&
+    operator=(arena&& rhs) noexcept
+    {
+        block_size_ = rhs.block_size_;
+        blocks_ = std::move(rhs.blocks_);
+        cur_ = std::exchange(rhs.cur_, nullptr);
+        left_ = std::exchange(rhs.left_, 0);
+        used_ = std::exchange(rhs.used_, 0);
+        return *this;
+    }
+
+    arena(arena const&) = delete;
+    arena& operator=(arena const&) = delete;
+
+    void*
+    allocate(std::size_t size, std::size_t align = alignof(std::max_align_t))
+    {
+        std::size_t const pad = (align - reinterpret_cast<std::uintptr_t>(cur_) % align) % align;
+        if (cur_ == nullptr || pad + size > left_) {
+            // oversized requests get a block of their own
+            std::size_t const len = std::max(block_size_, size + align);
+            blocks_.push_back(std::make_unique_for_overwrite<std::byte[]>(len));
+            cur_ = blocks_.back().get();
+            left_ = len;
+            return allocate(size, align);
+        }
+
+        void* p = cur_ + pad;
+        cur_ += pad + size;
+        left_ -= pad + size;
+        used_ += size;
+        return p;
+    }
+
+    /// \returns a copy of \c src that lives as long as the arena
+    template <typename T>
+    std::span<T const>
+    copy(std::span<T const> src)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (src.empty())
+            return {};
+        void* p = allocate(src.size_bytes(), alignof(T));
+        std::memcpy(p, src.data(), src.size_bytes());
+        return {static_cast<T const*>(p), src.size()};
+    }
+
+    /// \returns bytes handed out so far (excluding alignment padding)
+    std::size_t used() const noexcept { return used_; }
+};
@@ -1,4 +1,5 @@
 #include "assert.hpp"
+#include "log.hpp"
 #include <fmt/format.h>
 #include <cstdlib> // std::abort
 
@@ -7,6 +8,8 @@ void
 handle_failed_debug_assertion(
         char const* msg, char const* func, char const* file, int line) noexcept
 {
+    logging::flush(); // don't lose the messages leading up to the failure (if any)
+
     try {
         fmt::print(stderr, "debug assertion failure in {} ({}:{}): {}\n", func, file, line, msg);
     } catch (...) {}
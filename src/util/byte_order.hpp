@@ -0,0 +1,20 @@
+#pragma once
+
+#include <concepts>
+#include <cstdint>
+
+
+/// std::byteswap, which is C++23.
+template <std::integral T>
+constexpr T
+byteswap(T v) noexcept
+{
+    if constexpr (sizeof(T) == 1)
+        return v;
+    else if constexpr (sizeof(T) == 2)
+        return static_cast<T>(__builtin_bswap16(static_cast<std::uint16_t>(v)));
+    else if constexpr (sizeof(T) == 4)
+        return static_cast<T>(__builtin_bswap32(static_cast<std::uint32_t>(v)));
+    else
+        return static_cast<T>(__builtin_bswap64(static_cast<std::uint64_t>(v)));
+}
@@ -0,0 +1,313 @@
+#include "log.hpp"
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib> // std::atexit
+#include <ctime>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+
+namespace logging {
+
+    namespace { // unnamed
+
+        constexpr std::size_t queue_capacity = 1024; ///< must be a power of two
+        static_assert((queue_capacity & (queue_capacity - 1)) == 0);
+
+        struct alignas(64) record
+        {
+            std::atomic<std::uint64_t> seq;
+            std::uint64_t timestamp_nsecs = 0; ///< CLOCK_REALTIME
+            detail::format_fn format = nullptr;
+            std::uint32_t suppressed = 0;
+            Level level = Level::Info;
+            alignas(std::max_align_t) std::byte args[detail::arg_capacity];
+        };
+
+        constexpr char const*
+        to_str(Level e) noexcept
+        {
+            // clang-format off
+            switch (e) {
+                case Level::Debug:      return "DEBUG";
+                case Level::Info:       return "INFO";
+                case Level::Warning:    return "WARN";
+                case Level::Error:      return "ERROR";
+                default: break;
+            }
+            // clang-format on
+            return "<unknown>";
+        }
+
+        std::uint64_t
+        now_nsecs(clockid_t clock) noexcept
+        {
+            timespec ts{};
+            ::clock_gettime(clock, &ts);
+            return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+        }
+
+        /// Bounded multi-producer queue of unformatted records, drained
+        /// by a background thread that formats and writes them to
+        /// stderr in batches.
+        class logger
+        {
+        private:
+            record slots_[queue_capacity];
+            alignas(64) std::atomic<std::uint64_t> enqueue_pos_ = 0;
+            std::atomic<std::uint64_t> dropped_ = 0;
+
+            alignas(64) std::mutex consume_lock_; ///< held while draining
+            std::uint64_t dequeue_pos_ = 0;
+            std::uint64_t reported_dropped_ = 0;
+            fmt::memory_buffer buf_;
+
+            std::mutex wait_lock_;
+            std::condition_variable wait_cv_;
+            std::atomic<bool> consumer_waiting_ = false;
+            std::atomic<bool> stopped_ = false;
+            std::thread thread_;
+
+        public:
+            logger()
+            {
+                for (std::size_t i = 0; i < queue_capacity; ++i)
+                    slots_[i].seq.store(i, std::memory_order_relaxed);
+                thread_ = std::thread([this] { run(); });
+            }
+
+            detail::claimed_record
+            claim(Level level, std::uint32_t suppressed, detail::format_fn format) noexcept
+            {
+                std::uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+                record* rec = nullptr;
+                while (true) {
+                    rec = &slots_[pos & (queue_capacity - 1)];
+                    std::uint64_t const seq = rec->seq.load(std::memory_order_acquire);
+                    auto const diff = static_cast<std::int64_t>(seq - pos);
+                    if (diff == 0) {
+                        if (enqueue_pos_.compare_exchange_weak(
+                                    pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    } else if (diff < 0) {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                        return {};
+                    } else {
+                        pos = enqueue_pos_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                rec->timestamp_nsecs = now_nsecs(CLOCK_REALTIME);
+                rec->format = format;
+                rec->suppressed = suppressed;
+                rec->level = level;
+                return {rec, rec->args};
+            }
+
+            void
+            publish(detail::claimed_record claimed) noexcept
+            {
+                auto* rec = static_cast<record*>(claimed.record);
+                std::uint64_t const seq = rec->seq.load(std::memory_order_relaxed);
+                rec->seq.store(seq + 1, std::memory_order_seq_cst);
+
+                if (stopped_.load(std::memory_order_relaxed)) {
+                    // background thread is gone (process is exiting)
+                    flush();
+                } else if (consumer_waiting_.load(std::memory_order_seq_cst)) {
+                    std::lock_guard l(wait_lock_);
+                    wait_cv_.notify_one();
+                }
+            }
+
+            void
+            flush() noexcept
+            {
+                std::lock_guard l(consume_lock_);
+                drain();
+            }
+
+            std::uint64_t
+            dropped() const noexcept
+            {
+                return dropped_.load(std::memory_order_relaxed);
+            }
+
+            void
+            shutdown() noexcept
+            {
+                {
+                    std::lock_guard l(wait_lock_);
+                    stopped_.store(true, std::memory_order_relaxed);
+                    wait_cv_.notify_one();
+                }
+                if (thread_.joinable())
+                    thread_.join();
+                flush();
+            }
+
+        private:
+            bool
+            empty() const noexcept
+            {
+                record const& rec = slots_[dequeue_pos_ & (queue_capacity - 1)];
+                return rec.seq.load(std::memory_order_seq_cst) != dequeue_pos_ + 1;
+            }
+
+            void
+            run() noexcept
+            {
+                while (!stopped_.load(std::memory_order_relaxed)) {
+                    flush();
+
+                    std::unique_lock l(wait_lock_);
+                    consumer_waiting_.store(true, std::memory_order_seq_cst);
+                    bool idle = false;
+                    {
+                        std::lock_guard cl(consume_lock_);
+                        idle = empty();
+                    }
+                    if (idle && !stopped_.load(std::memory_order_relaxed))
+                        wait_cv_.wait_for(l, std::chrono::milliseconds(100));
+                    consumer_waiting_.store(false, std::memory_order_relaxed);
+                }
+            }
+
+            /// Formats every published record into one buffer and
+            /// writes it with as few syscalls as possible. Requires
+            /// consume_lock_.
+            void
+            drain() noexcept
+            {
+                buf_.clear();
+
+                while (!empty()) {
+                    record& rec = slots_[dequeue_pos_ & (queue_capacity - 1)];
+                    append(rec);
+                    rec.seq.store(dequeue_pos_ + queue_capacity, std::memory_order_release);
+                    ++dequeue_pos_;
+                }
+
+                if (std::uint64_t const d = dropped(); d != reported_dropped_) {
+                    try {
+                        fmt::format_to(std::back_inserter(buf_),
+                                "{} log messages dropped (queue full)\n", d - reported_dropped_);
+                    } catch (...) {}
+                    reported_dropped_ = d;
+                }
+
+                char const* p = buf_.data();
+                std::size_t left = buf_.size();
+                while (left != 0) {
+                    ssize_t const n = ::write(STDERR_FILENO, p, left);
+                    if (n <= 0)
+                        break;
+                    p += n;
+                    left -= static_cast<std::size_t>(n);
+                }
+            }
+
+            void
+            append(record const& rec) noexcept
+            {
+                try {
+                    time_t const secs = static_cast<time_t>(rec.timestamp_nsecs / 1'000'000'000);
+                    std::tm tm{};
+                    ::localtime_r(&secs, &tm);
+
+                    auto out = std::back_inserter(buf_);
+                    fmt::format_to(out, "{:04}-{:02}-{:02}T{:02}:{:02}:{:02}.{:06} {:5} ",
+                            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+                            tm.tm_sec, (rec.timestamp_nsecs % 1'000'000'000) / 1000,
+                            to_str(rec.level));
+                    rec.format(buf_, rec.args);
+                    if (rec.suppressed != 0)
+                        fmt::format_to(out, " ({} similar messages suppressed)", rec.suppressed);
+                    buf_.push_back('\n');
+                } catch (std::exception const& e) {
+                    try {
+                        fmt::format_to(
+                                std::back_inserter(buf_), "<bad log record: {}>\n", e.what());
+                    } catch (...) {}
+                }
+            }
+        };
+
+        /// The logger, once the first message has started it.
+        std::atomic<logger*> started = nullptr;
+
+        logger&
+        instance()
+        {
+            // Never destroyed, so that logging from other static
+            // destructors stays safe; the background thread is stopped
+            // (and the queue drained) at exit instead.
+            static logger* const l = [] {
+                auto* p = new logger;
+                std::atexit([] { instance().shutdown(); });
+                started.store(p, std::memory_order_release);
+                return p;
+            }();
+            return *l;
+        }
+
+    } // namespace
+
+
+    void
+    flush() noexcept
+    {
+        if (logger* const l = started.load(std::memory_order_acquire))
+            l->flush();
+    }
+
+    std::uint64_t
+    dropped() noexcept
+    {
+        logger const* const l = started.load(std::memory_order_acquire);
+        return l ? l->dropped() : 0;
+    }
+
+    rate_limiter::rate_limiter(std::uint64_t interval_msecs) noexcept
+            : interval_nsecs_(interval_msecs * 1'000'000)
+    {}
+
+    std::uint32_t
+    rate_limiter::acquire() noexcept
+    {
+        std::uint64_t const now = now_nsecs(CLOCK_MONOTONIC_COARSE);
+        std::uint64_t next = next_nsecs_.load(std::memory_order_relaxed);
+        if (now < next
+                || !next_nsecs_.compare_exchange_strong(
+                        next, now + interval_nsecs_, std::memory_order_relaxed)) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        return suppressed_.exchange(0, std::memory_order_relaxed) + 1;
+    }
+
+
+    namespace detail {
+
+        claimed_record
+        claim(Level level, std::uint32_t suppressed, format_fn format) noexcept
+        {
+            try {
+                return instance().claim(level, suppressed, format);
+            } catch (...) {
+                return {}; // failed to start the logger
+            }
+        }
+
+        void
+        publish(claimed_record rec) noexcept
+        {
+            instance().publish(rec);
+        }
+
+    } // namespace detail
+
+} // namespace logging
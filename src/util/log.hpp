@@ -0,0 +1,218 @@
+#pragma once
+
+#include <fmt/format.h>
+#include <atomic>
+#include <cstddef> // std::size_t, std::max_align_t
+#include <cstdint>
+#include <cstdlib> // std::free, std::malloc
+#include <cstring> // std::memcpy
+#include <iterator>
+#include <new>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+
+// Messages below LOG_LEVEL are compiled out (arguments are not even
+// evaluated). 0=debug, 1=info, 2=warning, 3=error.
+#ifndef LOG_LEVEL
+#    ifndef NDEBUG
+#        define LOG_LEVEL 0
+#    else
+#        define LOG_LEVEL 1
+#    endif
+#endif
+
+#define LOG_AT(level, ...)                                          \
+    do {                                                            \
+        if constexpr (::logging::enabled(level))                    \
+            ::logging::write(level, /*suppressed=*/0, __VA_ARGS__); \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(::logging::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(::logging::Level::Info, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(::logging::Level::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(::logging::Level::Error, __VA_ARGS__)
+
+/// Like LOG_ERROR, but emits at most one message per interval from
+/// this call site; the next emitted message reports how many were
+/// suppressed in between.
+#define LOG_ERROR_RATE_LIMITED(interval_msecs, ...)                                 \
+    do {                                                                            \
+        if constexpr (::logging::enabled(::logging::Level::Error)) {                \
+            static ::logging::rate_limiter log_limiter_((interval_msecs));          \
+            if (std::uint32_t const log_n_ = log_limiter_.acquire(); log_n_ != 0)   \
+                ::logging::write(::logging::Level::Error, log_n_ - 1, __VA_ARGS__); \
+        }                                                                           \
+    } while (0)
+
+
+namespace logging {
+
+    enum class Level : std::uint8_t
+    {
+        Debug = 0,
+        Info = 1,
+        Warning = 2,
+        Error = 3,
+    };
+
+    inline constexpr int min_level = LOG_LEVEL;
+
+    constexpr bool
+    enabled(Level level) noexcept
+    {
+        return static_cast<int>(level) >= min_level;
+    }
+
+    /// Blocks until every message logged so far has been written. Does
+    /// nothing, and starts no thread, if nothing was ever logged.
+    void flush() noexcept;
+
+    /// \returns number of messages dropped because the queue was full
+    std::uint64_t dropped() noexcept;
+
+
+    class rate_limiter
+    {
+    private:
+        std::uint64_t interval_nsecs_;
+        std::atomic<std::uint64_t> next_nsecs_ = 0;
+        std::atomic<std::uint32_t> suppressed_ = 0;
+
+    public:
+        explicit rate_limiter(std::uint64_t interval_msecs) noexcept;
+
+        /// \returns 0 if the message should be suppressed, otherwise
+        /// 1 + the number of messages suppressed since the last one
+        std::uint32_t acquire() noexcept;
+    };
+
+
+    namespace detail {
+
+        inline constexpr std::size_t arg_capacity = 224;
+
+        /// String arguments are copied into the record since the
+        /// caller's buffer may be gone by the time the background thread
+        /// formats the message. Short ones are kept inline, longer ones
+        /// in a heap copy that formatting frees; should that allocation
+        /// fail, the inline prefix ends in "..." to show the cut.
+        struct captured_string
+        {
+            std::uint32_t size = 0;
+            char* heap = nullptr;
+            char data[48];
+
+            explicit captured_string(std::string_view s) noexcept
+            {
+                if (s.size() > sizeof(data))
+                    heap = static_cast<char*>(std::malloc(s.size()));
+                if (heap != nullptr) {
+                    size = static_cast<std::uint32_t>(s.size());
+                    std::memcpy(heap, s.data(), size);
+                } else if (s.size() > sizeof(data)) {
+                    size = sizeof(data);
+                    std::memcpy(data, s.data(), size - 3);
+                    std::memcpy(data + size - 3, "...", 3);
+                } else {
+                    size = static_cast<std::uint32_t>(s.size());
+                    std::memcpy(data, s.data(), size);
+                }
+            }
+
+            std::string_view view() const noexcept { return {heap ? heap : data, size}; }
+        };
+        static_assert(sizeof(captured_string) == 64);
+
+        using format_fn = void (*)(fmt::memory_buffer&, std::byte const*);
+
+        /// A queue record reserved by a producer; \c args is where the
+        /// captured arguments are to be constructed.
+        struct claimed_record
+        {
+            void* record = nullptr;
+            std::byte* args = nullptr; ///< nullptr if the queue was full
+        };
+
+        claimed_record claim(Level, std::uint32_t suppressed, format_fn) noexcept;
+        void publish(claimed_record) noexcept;
+
+        template <typename T>
+        auto
+        capture(T const& v) noexcept
+        {
+            if constexpr (std::is_convertible_v<T const&, std::string_view>)
+                return captured_string(std::string_view(v));
+            else
+                return v;
+        }
+
+        template <typename T>
+        decltype(auto)
+        unwrap(T const& v) noexcept
+        {
+            if constexpr (std::is_same_v<T, captured_string>)
+                return v.view();
+            else
+                return (v);
+        }
+
+        template <typename T>
+        void
+        release(T const& v) noexcept
+        {
+            if constexpr (std::is_same_v<T, captured_string>)
+                std::free(v.heap);
+        }
+
+        template <typename Tuple>
+        void
+        format(fmt::memory_buffer& buf, std::byte const* p)
+        {
+            auto const& args = *std::launder(reinterpret_cast<Tuple const*>(p));
+            // each record is formatted once, so the heap copies go now,
+            // whether or not formatting succeeds
+            struct releaser
+            {
+                Tuple const& args;
+                ~releaser()
+                {
+                    std::apply([](char const*, auto const&... a) { (release(a), ...); }, args);
+                }
+            } const guard{args};
+            std::apply(
+                    [&buf](char const* fmt_str, auto const&... a) {
+                        fmt::vformat_to(std::back_inserter(buf), fmt::string_view(fmt_str),
+                                fmt::make_format_args(unwrap(a)...));
+                    },
+                    args);
+        }
+
+    } // namespace detail
+
+
+    /// Captures \c fmt_str (which must be a string literal) and a copy
+    /// of \c args; formatting and writing happen on a background
+    /// thread.
+    template <typename... Args>
+    void
+    write(Level level, std::uint32_t suppressed, char const* fmt_str, Args const&... args) noexcept
+    {
+        using tuple = std::tuple<char const*, decltype(detail::capture(args))...>;
+        static_assert(sizeof(tuple) <= detail::arg_capacity, "too many log arguments");
+        static_assert(alignof(tuple) <= alignof(std::max_align_t));
+        static_assert((std::is_trivially_copyable_v<decltype(detail::capture(args))> && ...),
+                "log arguments must be strings or trivially copyable");
+
+        detail::claimed_record const rec
+                = detail::claim(level, suppressed, &detail::format<tuple>);
+        if (rec.args == nullptr)
+            return;
+
+        new (rec.args) tuple(fmt_str, detail::capture(args)...);
+        detail::publish(rec);
+    }
+
+} // namespace logging
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+
+/// Counts of unsigned values (latencies, sizes): exact below 16, then
+/// eight buckets to each power of two, so percentiles are within 12.5%.
+/// Fixed size, so adding never allocates.
+class log_histogram
+{
+private:
+    static constexpr std::size_t exact = 16;
+    static constexpr std::size_t sub = 8;
+    std::array<std::uint64_t, exact + 60 * sub> counts_ = {};
+    std::uint64_t total_ = 0;
+
+    static std::size_t
+    bucket(std::uint64_t v) noexcept
+    {
+        if (v < exact)
+            return v;
+        auto const e = static_cast<unsigned>(std::bit_width(v) - 1); // at least 4
+        return exact + (e - 4) * sub + ((v >> (e - 3)) & (sub - 1));
+    }
+
+    /// The largest value in bucket \c b.
+    static std::uint64_t
+    upper(std::size_t b) noexcept
+    {
+        if (b < exact)
+            return b;
+        auto const e = static_cast<unsigned>((b - exact) / sub + 4);
+        return ((sub + (b - exact) % sub + 1) << (e - 3)) - 1;
+    }
+
+public:
+    void
+    add(std::uint64_t v) noexcept
+    {
+        ++counts_[bucket(v)];
+        ++total_;
+    }
+
+    void
+    merge(log_histogram const& other) noexcept
+    {
+        for (std::size_t b = 0; b < counts_.size(); ++b)
+            counts_[b] += other.counts_[b];
+        total_ += other.total_;
+    }
+
+    /// \returns at most the value \c per_mille of all are below or
+    /// equal to (rounded up to its bucket); 0 if empty
+    std::uint64_t
+    percentile(unsigned per_mille) const noexcept
+    {
+        std::uint64_t const rank =
+                std::max<std::uint64_t>((total_ * per_mille + 999) / 1000, 1);
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < counts_.size(); ++b) {
+            seen += counts_[b];
+            if (seen >= rank)
+                return upper(b);
+        }
+        return 0;
+    }
+};
@@ -0,0 +1,196 @@
+#include "trace.hpp"
+#include <fmt/format.h>
+#include <sys/stat.h>
+#include <sys/syscall.h> // SYS_gettid
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring> // std::memcpy, std::memcmp, std::strerror
+#include <ctime>   // ::clock_gettime
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+
+namespace trace {
+
+    namespace { // unnamed
+
+        struct ring
+        {
+            std::uint32_t thread_id = 0;
+            std::atomic<std::uint64_t> head = 0;
+            event events[ring_capacity];
+        };
+
+        struct file_header
+        {
+            char magic[8] = {'U', 'S', 'B', 'T', 'R', 'A', 'C', 'E'};
+            std::uint32_t version = 1;
+            std::uint32_t event_size = sizeof(event);
+            std::uint64_t num_events = 0;
+        };
+
+        // Rings outlive their threads so that events from threads that
+        // have already exited can still be collected. An exited thread's
+        // ring is handed to the next new thread, which overwrites its
+        // oldest events first, so the rings are as many as the most
+        // threads ever traced at once rather than ever started.
+        std::mutex registry_lock;
+        std::vector<std::unique_ptr<ring>> registry;
+        std::vector<ring*> free_rings; ///< of exited threads
+
+        /// A thread's ring, given back when the thread exits.
+        struct ring_lease
+        {
+            ring* r = nullptr;
+
+            ~ring_lease()
+            {
+                if (r == nullptr)
+                    return;
+                try {
+                    std::lock_guard l(registry_lock);
+                    free_rings.push_back(r);
+                } catch (...) {
+                    // out of memory; the ring just isn't reused
+                }
+            }
+        };
+
+        ring*
+        this_thread_ring()
+        {
+            thread_local ring_lease lease;
+            if (lease.r == nullptr) {
+                std::lock_guard l(registry_lock);
+                if (free_rings.empty()) {
+                    lease.r = registry.emplace_back(std::make_unique<ring>()).get();
+                } else {
+                    lease.r = free_rings.back();
+                    free_rings.pop_back();
+                }
+                lease.r->thread_id = static_cast<std::uint32_t>(::syscall(SYS_gettid));
+            }
+            return lease.r;
+        }
+
+    } // namespace
+
+
+    std::uint64_t
+    now_nsecs() noexcept
+    {
+        timespec ts{};
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+    }
+
+    void
+    record_control_transfer(std::uint64_t begin_nsecs, std::uint8_t request_type,
+            std::uint8_t request, std::uint16_t value, std::uint16_t index,
+            std::uint8_t const* payload, std::size_t length, int result) noexcept
+    {
+        ring* r = nullptr;
+        try {
+            r = this_thread_ring();
+        } catch (...) {
+            return; // out of memory; tracing is best effort
+        }
+
+        std::uint64_t const head = r->head.load(std::memory_order_relaxed);
+        event& ev = r->events[head & (ring_capacity - 1)];
+        ev.begin_nsecs = begin_nsecs;
+        ev.end_nsecs = now_nsecs();
+        ev.thread_id = r->thread_id;
+        ev.result = result;
+        ev.request_type = request_type;
+        ev.request = request;
+        ev.value = value;
+        ev.index = index;
+        ev.length = static_cast<std::uint16_t>(std::min(length, sizeof(ev.payload)));
+        std::memcpy(ev.payload, payload, ev.length);
+        r->head.store(head + 1, std::memory_order_release);
+    }
+
+    std::vector<event>
+    collect()
+    {
+        std::vector<event> events;
+
+        {
+            std::lock_guard l(registry_lock);
+            for (auto const& r : registry) {
+                std::uint64_t const head = r->head.load(std::memory_order_acquire);
+                std::uint64_t const first = (head > ring_capacity) ? head - ring_capacity : 0;
+                for (std::uint64_t i = first; i != head; ++i)
+                    events.push_back(r->events[i & (ring_capacity - 1)]);
+            }
+        }
+
+        std::sort(events.begin(), events.end(),
+                [](event const& a, event const& b) { return a.begin_nsecs < b.begin_nsecs; });
+        return events;
+    }
+
+    bool
+    dump(std::string const& path)
+    {
+        std::vector<event> const events = collect();
+
+        std::FILE* f = std::fopen(path.c_str(), "wb");
+        if (f == nullptr) {
+            fmt::print(stderr, "{}: fopen({}) failure ({})\n", __builtin_FUNCTION(), path,
+                    std::strerror(errno));
+            return false;
+        }
+
+        file_header hdr;
+        hdr.num_events = events.size();
+        bool const ok = std::fwrite(&hdr, sizeof(hdr), 1, f) == 1
+                && std::fwrite(events.data(), sizeof(event), events.size(), f) == events.size();
+        return (std::fclose(f) == 0) && ok;
+    }
+
+    std::vector<event>
+    load(std::string const& path)
+    {
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> f(
+                std::fopen(path.c_str(), "rb"), &std::fclose);
+        if (!f) {
+            throw std::runtime_error(fmt::format("{}: fopen({}) failure ({})",
+                    __builtin_FUNCTION(), path, std::strerror(errno)));
+        }
+
+        file_header hdr;
+        file_header const expected;
+        if (std::fread(&hdr, sizeof(hdr), 1, f.get()) != 1
+                || std::memcmp(hdr.magic, expected.magic, sizeof(hdr.magic)) != 0
+                || hdr.version != expected.version || hdr.event_size != expected.event_size) {
+            throw std::runtime_error(
+                    fmt::format("{}: {} is not a trace file", __builtin_FUNCTION(), path));
+        }
+
+        // the count is checked against the file before anything is
+        // allocated for it
+        struct stat st;
+        if (::fstat(::fileno(f.get()), &st) == -1
+                || static_cast<std::uint64_t>(st.st_size) < sizeof(hdr)
+                || hdr.num_events != (static_cast<std::uint64_t>(st.st_size) - sizeof(hdr))
+                                / sizeof(event)) {
+            throw std::runtime_error(
+                    fmt::format("{}: {} is truncated or corrupt", __builtin_FUNCTION(), path));
+        }
+
+        std::vector<event> events(hdr.num_events);
+        if (std::fread(events.data(), sizeof(event), events.size(), f.get()) != events.size()) {
+            throw std::runtime_error(
+                    fmt::format("{}: {} is truncated", __builtin_FUNCTION(), path));
+        }
+
+        return events;
+    }
+
+} // namespace trace
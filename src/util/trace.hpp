@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Trace points are compiled in unless DISABLE_TRACE is defined. Each
+// one stores a fixed-size binary event into a per-thread ring buffer;
+// nothing is formatted on the traced path.
+#ifndef DISABLE_TRACE
+#    define TRACE_BEGIN(name) std::uint64_t const name = ::trace::now_nsecs()
+#    define TRACE_CONTROL_TRANSFER(begin, ...) ::trace::record_control_transfer(begin, __VA_ARGS__)
+#else
+#    define TRACE_BEGIN(name)
+#    define TRACE_CONTROL_TRANSFER(begin, ...)
+#endif
+
+
+namespace trace {
+
+    /// A single control transfer as seen by the host.
+    struct event
+    {
+        std::uint64_t begin_nsecs = 0; ///< CLOCK_MONOTONIC
+        std::uint64_t end_nsecs = 0;
+        std::uint32_t thread_id = 0;
+        std::int32_t result = 0; ///< bytes transferred, or libusb_error if negative
+        std::uint8_t request_type = 0;
+        std::uint8_t request = 0;
+        std::uint16_t value = 0;
+        std::uint16_t index = 0;
+        std::uint16_t length = 0; ///< of payload actually captured
+        std::uint8_t payload[8] = {0};
+    };
+    static_assert(sizeof(event) == 40);
+
+    /// Events kept per thread; older ones are overwritten.
+    inline constexpr std::size_t ring_capacity = 4096;
+
+    std::uint64_t now_nsecs() noexcept;
+
+    void record_control_transfer(std::uint64_t begin_nsecs, std::uint8_t request_type,
+            std::uint8_t request, std::uint16_t value, std::uint16_t index,
+            std::uint8_t const* payload, std::size_t length, int result) noexcept;
+
+    /// Collects the events of all threads, ordered by begin time. Not
+    /// synchronized with writers; call once traced threads are idle.
+    std::vector<event> collect();
+
+    /// Writes \c collect() to a binary file for offline decoding.
+    bool dump(std::string const& path);
+
+    /// Reads a file written by \c dump. Throws on failure.
+    std::vector<event> load(std::string const& path);
+
+} // namespace trace
@@ -0,0 +1,311 @@
+#include "usb_filter.hpp"
+#include <fmt/format.h>
+#include <algorithm> // std::any_of, std::equal
+#include <charconv>
+#include <iterator>
+#include <stdexcept>
+
+
+namespace { // unnamed
+
+    using verdict = usb_filter::verdict;
+
+    /// Calls \c f for each non-empty comma-separated item.
+    template <typename F>
+    void
+    for_each_item(std::string_view list, F&& f)
+    {
+        while (!list.empty()) {
+            std::size_t const comma = list.find(',');
+            std::string_view const item = list.substr(0, comma);
+            if (!item.empty())
+                f(item);
+            if (comma == std::string_view::npos)
+                break;
+            list.remove_prefix(comma + 1);
+        }
+    }
+
+    unsigned
+    parse_number(std::string_view s, int base, unsigned max, char const* what)
+    {
+        if (base == 16 && (s.starts_with("0x") || s.starts_with("0X")))
+            s.remove_prefix(2);
+
+        unsigned v = 0;
+        auto const [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v, base);
+        if (s.empty() || ec != std::errc() || ptr != s.data() + s.size() || v > max)
+            throw std::invalid_argument(fmt::format("invalid {} \"{}\"", what, s));
+        return v;
+    }
+
+    /// \c s is "*" or a hex number
+    int
+    parse_id(std::string_view s, char const* what)
+    {
+        return (s == "*") ? -1 : static_cast<int>(parse_number(s, 16, 0xffff, what));
+    }
+
+    libusb_speed
+    parse_speed(std::string_view s)
+    {
+        // clang-format off
+        if (s == "low"          || s == "1.5")      return LIBUSB_SPEED_LOW;
+        if (s == "full"         || s == "12")       return LIBUSB_SPEED_FULL;
+        if (s == "high"         || s == "480")      return LIBUSB_SPEED_HIGH;
+        if (s == "super"        || s == "5000")     return LIBUSB_SPEED_SUPER;
+        if (s == "super_plus"   || s == "10000")    return LIBUSB_SPEED_SUPER_PLUS;
+        // clang-format on
+        throw std::invalid_argument(fmt::format("invalid speed \"{}\"", s));
+    }
+
+    char const*
+    speed_name(libusb_speed s) noexcept
+    {
+        // clang-format off
+        switch (s) {
+            case LIBUSB_SPEED_LOW:          return "low";
+            case LIBUSB_SPEED_FULL:         return "full";
+            case LIBUSB_SPEED_HIGH:         return "high";
+            case LIBUSB_SPEED_SUPER:        return "super";
+            case LIBUSB_SPEED_SUPER_PLUS:   return "super_plus";
+            default: break;
+        }
+        // clang-format on
+        return "unknown";
+    }
+
+    template <typename T, typename Pred>
+    verdict
+    any_of(std::vector<T> const& patterns, Pred&& pred)
+    {
+        if (patterns.empty())
+            return verdict::accept;
+        return std::any_of(patterns.begin(), patterns.end(), pred) ? verdict::accept
+                                                                   : verdict::reject;
+    }
+
+    /// Combines criteria: any rejection wins over needing more.
+    verdict
+    both(verdict a, verdict b) noexcept
+    {
+        if (a == verdict::reject || b == verdict::reject)
+            return verdict::reject;
+        if (a == verdict::undecided || b == verdict::undecided)
+            return verdict::undecided;
+        return verdict::accept;
+    }
+
+    /// Devices that declare their class per interface (0x00) or use
+    /// interface association descriptors (0xef) say nothing useful in
+    /// bDeviceClass.
+    bool
+    class_in_interfaces(std::uint8_t device_class) noexcept
+    {
+        return device_class == LIBUSB_CLASS_PER_INTERFACE || device_class == 0xef;
+    }
+
+} // namespace
+
+
+void
+collect_interface_classes(std::span<std::uint8_t const> config, std::vector<usb_class>& out)
+{
+    std::size_t off = 0;
+    while (config.size() - off >= 2) {
+        std::uint8_t const len = config[off];
+        if (len < 2 || len > config.size() - off)
+            break; // malformed; the caller's parser reports it
+        if (config[off + 1] == LIBUSB_DT_INTERFACE && len >= LIBUSB_DT_INTERFACE_SIZE)
+            out.push_back({config[off + 5], config[off + 6]});
+        off += len;
+    }
+}
+
+
+void
+usb_filter::add_ids(std::string_view list)
+{
+    for_each_item(list, [this](std::string_view item) {
+        std::size_t const colon = item.find(':');
+        if (colon == std::string_view::npos)
+            throw std::invalid_argument(
+                    fmt::format("invalid vendor_id:product_id \"{}\"", item));
+        ids_.push_back({parse_id(item.substr(0, colon), "vendor id"),
+                parse_id(item.substr(colon + 1), "product id")});
+    });
+}
+
+void
+usb_filter::add_id(std::uint16_t vid, std::uint16_t pid)
+{
+    ids_.push_back({vid, pid});
+}
+
+void
+usb_filter::add_classes(std::string_view list)
+{
+    for_each_item(list, [this](std::string_view item) {
+        std::size_t const colon = item.find(':');
+        class_pattern p;
+        p.cls = static_cast<std::uint8_t>(parse_number(item.substr(0, colon), 16, 0xff, "class"));
+        if (colon != std::string_view::npos)
+            p.subclass = static_cast<int>(
+                    parse_number(item.substr(colon + 1), 16, 0xff, "subclass"));
+        classes_.push_back(p);
+    });
+}
+
+void
+usb_filter::add_speeds(std::string_view list)
+{
+    for_each_item(list, [this](std::string_view item) { speeds_.push_back(parse_speed(item)); });
+}
+
+void
+usb_filter::add_buses(std::string_view list)
+{
+    for_each_item(list, [this](std::string_view item) {
+        buses_.push_back(static_cast<std::uint8_t>(parse_number(item, 10, 0xff, "bus")));
+    });
+}
+
+void
+usb_filter::add_port_prefixes(std::string_view list)
+{
+    for_each_item(list, [this](std::string_view item) {
+        std::vector<std::uint8_t> path;
+        std::string_view rest = item;
+        while (true) {
+            std::size_t const dot = rest.find('.');
+            path.push_back(
+                    static_cast<std::uint8_t>(parse_number(rest.substr(0, dot), 10, 0xff, "port")));
+            if (dot == std::string_view::npos)
+                break;
+            rest.remove_prefix(dot + 1);
+        }
+        port_prefixes_.push_back(std::move(path));
+    });
+}
+
+void
+usb_filter::add_serial(std::string_view serial)
+{
+    serials_.emplace_back(serial);
+}
+
+
+bool
+usb_filter::empty() const noexcept
+{
+    return ids_.empty() && classes_.empty() && speeds_.empty() && buses_.empty()
+            && port_prefixes_.empty() && serials_.empty();
+}
+
+usb_stage
+usb_filter::max_stage() const noexcept
+{
+    if (!serials_.empty())
+        return usb_stage::strings;
+    if (!classes_.empty())
+        return usb_stage::configs; // only for per-interface devices
+    if (!ids_.empty())
+        return usb_stage::device_desc;
+    return usb_stage::location;
+}
+
+
+usb_filter::verdict
+usb_filter::check(usb_stage reached, usb_facts const& facts) const noexcept
+{
+    // location
+    verdict v = any_of(buses_, [&facts](std::uint8_t b) { return b == facts.bus; });
+    v = both(v, any_of(speeds_, [&facts](libusb_speed s) { return s == facts.speed; }));
+    v = both(v, any_of(port_prefixes_, [&facts](std::vector<std::uint8_t> const& prefix) {
+        return prefix.size() <= facts.ports.size()
+                && std::equal(prefix.begin(), prefix.end(), facts.ports.begin());
+    }));
+    if (v == verdict::reject)
+        return v;
+
+    // device descriptor
+    bool const have_desc = reached >= usb_stage::device_desc && facts.desc != nullptr;
+    if (!ids_.empty()) {
+        if (!have_desc)
+            return verdict::undecided;
+        v = both(v, any_of(ids_, [&dd = *facts.desc](id_pattern const& p) {
+            return (p.vid == -1 || p.vid == dd.idVendor) && (p.pid == -1 || p.pid == dd.idProduct);
+        }));
+        if (v == verdict::reject)
+            return v;
+    }
+
+    // class: from the device descriptor if it says, else the interfaces
+    if (!classes_.empty()) {
+        if (!have_desc)
+            return verdict::undecided;
+        libusb_device_descriptor const& dd = *facts.desc;
+        if (!class_in_interfaces(dd.bDeviceClass)) {
+            v = both(v, any_of(classes_, [&dd](class_pattern const& p) {
+                return p.cls == dd.bDeviceClass
+                        && (p.subclass == -1 || p.subclass == dd.bDeviceSubClass);
+            }));
+        } else if (reached < usb_stage::configs) {
+            v = both(v, verdict::undecided);
+        } else {
+            v = both(v, any_of(classes_, [&facts](class_pattern const& p) {
+                return std::any_of(facts.interfaces.begin(), facts.interfaces.end(),
+                        [&p](usb_class const& c) {
+                            return p.cls == c.cls && (p.subclass == -1 || p.subclass == c.subclass);
+                        });
+            }));
+        }
+        if (v == verdict::reject)
+            return v;
+    }
+
+    // strings
+    if (!serials_.empty()) {
+        if (reached < usb_stage::strings)
+            return both(v, verdict::undecided);
+        v = both(v, any_of(serials_, [&facts](std::string const& s) { return s == facts.serial; }));
+    }
+
+    return v;
+}
+
+
+std::string
+to_str(usb_filter const& f)
+{
+    std::string s;
+    auto out = std::back_inserter(s);
+    auto sep = [&s] { return s.empty() ? "" : " "; };
+
+    for (auto const& p : f.ids_) {
+        fmt::format_to(out, "{}", sep());
+        if (p.vid == -1)
+            fmt::format_to(out, "*:");
+        else
+            fmt::format_to(out, "{:04x}:", p.vid);
+        if (p.pid == -1)
+            fmt::format_to(out, "*");
+        else
+            fmt::format_to(out, "{:04x}", p.pid);
+    }
+    for (auto const& p : f.classes_) {
+        fmt::format_to(out, "{}class={:02x}", sep(), p.cls);
+        if (p.subclass != -1)
+            fmt::format_to(out, ":{:02x}", p.subclass);
+    }
+    for (libusb_speed sp : f.speeds_)
+        fmt::format_to(out, "{}speed={}", sep(), speed_name(sp));
+    for (std::uint8_t b : f.buses_)
+        fmt::format_to(out, "{}bus={}", sep(), b);
+    for (auto const& p : f.port_prefixes_)
+        fmt::format_to(out, "{}port={}", sep(), fmt::join(p, "."));
+    for (auto const& sn : f.serials_)
+        fmt::format_to(out, "{}serial={}", sep(), sn);
+
+    return s.empty() ? "any" : s;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <libusb.h>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/// How much of a device has been read, cheapest first. Each stage
+/// includes the ones before it.
+enum class usb_stage : std::uint8_t
+{
+    location, ///< bus, port path and speed
+    device_desc, ///< the 18-byte device descriptor
+    configs, ///< interface classes, from the configuration descriptors
+    strings, ///< the serial number string descriptor
+};
+
+struct usb_class
+{
+    std::uint8_t cls = 0;
+    std::uint8_t subclass = 0;
+};
+
+/// What is known about a device when it reaches a usb_stage. Fields of
+/// later stages are not looked at.
+struct usb_facts
+{
+    std::uint8_t bus = 0;
+    std::span<std::uint8_t const> ports; ///< from the root hub down
+    libusb_speed speed = LIBUSB_SPEED_UNKNOWN;
+    libusb_device_descriptor const* desc = nullptr;
+    std::span<usb_class const> interfaces; ///< every alternate setting's class
+    std::string_view serial;
+};
+
+/// Appends the class of every interface descriptor in a raw
+/// configuration descriptor (wTotalLength bytes).
+void collect_interface_classes(std::span<std::uint8_t const> config, std::vector<usb_class>& out);
+
+
+/// Selects devices by any combination of vendor:product (with "*"
+/// wildcards), class[:subclass], speed, bus, port path prefix and serial
+/// number. Each criterion is a list that matches if any entry does;
+/// a device must match every criterion that was given.
+///
+/// Enumerators call check() as each stage is read and stop reading a
+/// device as soon as it is decided, so configurations and strings are
+/// only fetched for devices that are still candidates.
+///
+/// The add_*() functions parse comma-separated lists and throw
+/// std::invalid_argument on malformed input.
+class usb_filter
+{
+public:
+    enum class verdict
+    {
+        reject,
+        accept,
+        undecided, ///< needs a later stage
+    };
+
+private:
+    struct id_pattern
+    {
+        int vid = -1; ///< -1 matches any
+        int pid = -1;
+    };
+
+    struct class_pattern
+    {
+        std::uint8_t cls = 0;
+        int subclass = -1; ///< -1 matches any
+    };
+
+    std::vector<id_pattern> ids_;
+    std::vector<class_pattern> classes_;
+    std::vector<libusb_speed> speeds_;
+    std::vector<std::uint8_t> buses_;
+    std::vector<std::vector<std::uint8_t>> port_prefixes_;
+    std::vector<std::string> serials_;
+
+public:
+    /// "046d:085e,0fc5:*", IDs in hex
+    void add_ids(std::string_view list);
+    void add_id(std::uint16_t vid, std::uint16_t pid);
+    /// "03,ef:02", in hex
+    void add_classes(std::string_view list);
+    /// "480,5000" (Mbit/s) or "low,full,high,super,super_plus"
+    void add_speeds(std::string_view list);
+    /// "1,3"
+    void add_buses(std::string_view list);
+    /// "1.4,2", matching 1-1.4, 1-1.4.2, ... and 2-2, 2-2.1, ...
+    void add_port_prefixes(std::string_view list);
+    /// exact serial numbers; no list syntax, as serials may contain ','
+    void add_serial(std::string_view serial);
+
+    bool empty() const noexcept;
+
+    /// \returns the latest stage any criterion may need
+    usb_stage max_stage() const noexcept;
+
+    /// \returns accept or reject once \c facts up to \c reached decide
+    /// the device, undecided if a later stage is needed
+    verdict check(usb_stage reached, usb_facts const& facts) const noexcept;
+
+    friend std::string to_str(usb_filter const&);
+};
+
+std::string to_str(usb_filter const&);
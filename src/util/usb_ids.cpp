@@ -0,0 +1,157 @@
+#include "usb_ids.hpp"
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm> // std::lower_bound
+#include <cerrno>
+#include <cstring> // std::memcmp, std::strerror
+#include <stdexcept>
+
+
+namespace { // unnamed
+
+    namespace idx = usb_ids_file;
+
+    /// \returns the entry with \c id in \c table (sorted by id), or
+    /// nullptr
+    template <typename T, typename Id>
+    T const*
+    find(std::span<T const> table, Id id) noexcept
+    {
+        auto const it = std::lower_bound(table.begin(), table.end(), id,
+                [](T const& e, Id v) { return e.id < v; });
+        return (it == table.end() || it->id != id) ? nullptr : &*it;
+    }
+
+    /// \returns the run \c r of \c table, or an empty span if the index
+    /// is inconsistent
+    template <typename T>
+    std::span<T const>
+    children(std::span<T const> table, idx::range r) noexcept
+    {
+        if (r.first > table.size() || r.count > table.size() - r.first)
+            return {};
+        return table.subspan(r.first, r.count);
+    }
+
+    template <typename T>
+    std::span<T const>
+    take(std::byte const*& p, std::uint32_t n) noexcept
+    {
+        std::span<T const> const s(reinterpret_cast<T const*>(p), n);
+        p += n * sizeof(T);
+        return s;
+    }
+
+} // namespace
+
+
+usb_ids::usb_ids(std::string const& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(fmt::format(
+                "{}: open({}) failure ({})", __builtin_FUNCTION(), path, std::strerror(errno)));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(idx::header)) {
+        ::close(fd);
+        throw std::runtime_error(
+                fmt::format("{}: {} is not a usb.ids index", __builtin_FUNCTION(), path));
+    }
+
+    length_ = static_cast<std::size_t>(st.st_size);
+    base_ = ::mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+    int const e = errno;
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+        throw std::runtime_error(
+                fmt::format("{}: mmap failure ({})", __builtin_FUNCTION(), std::strerror(e)));
+    }
+
+    auto const* hdr = static_cast<idx::header const*>(base_);
+    idx::header const expected;
+    if (std::memcmp(hdr->magic, expected.magic, sizeof(expected.magic)) != 0
+            || hdr->version != expected.version || hdr->byte_order != expected.byte_order
+            || idx::file_size(*hdr) != length_) {
+        ::munmap(base_, length_);
+        throw std::runtime_error(fmt::format(
+                "{}: {} is not a (compatible) usb.ids index", __builtin_FUNCTION(), path));
+    }
+
+    // lookups jump around; don't read ahead
+    ::madvise(base_, length_, MADV_RANDOM);
+
+    auto const* p = static_cast<std::byte const*>(base_) + sizeof(idx::header);
+    vendors_ = take<idx::vendor>(p, hdr->num_vendors);
+    products_ = take<idx::product>(p, hdr->num_products);
+    classes_ = take<idx::class_entry>(p, hdr->num_classes);
+    subclasses_ = take<idx::class_entry>(p, hdr->num_subclasses);
+    protocols_ = take<idx::protocol>(p, hdr->num_protocols);
+    strings_ = std::string_view(reinterpret_cast<char const*>(p), hdr->strings_size);
+}
+
+usb_ids::~usb_ids() noexcept
+{
+    ::munmap(base_, length_);
+}
+
+
+std::string_view
+usb_ids::string_at(std::uint32_t offset) const noexcept
+{
+    if (offset >= strings_.size())
+        return {};
+    std::string_view const s = strings_.substr(offset);
+    return s.substr(0, s.find('\0'));
+}
+
+std::string_view
+usb_ids::vendor(std::uint16_t vid) const noexcept
+{
+    idx::vendor const* v = find(vendors_, vid);
+    return v ? string_at(v->name) : std::string_view();
+}
+
+std::string_view
+usb_ids::product(std::uint16_t vid, std::uint16_t pid) const noexcept
+{
+    idx::vendor const* v = find(vendors_, vid);
+    if (!v)
+        return {};
+    idx::product const* p = find(children(products_, v->products), pid);
+    return p ? string_at(p->name) : std::string_view();
+}
+
+std::string_view
+usb_ids::class_name(std::uint8_t cls) const noexcept
+{
+    idx::class_entry const* c = find(classes_, cls);
+    return c ? string_at(c->name) : std::string_view();
+}
+
+std::string_view
+usb_ids::subclass_name(std::uint8_t cls, std::uint8_t subclass) const noexcept
+{
+    idx::class_entry const* c = find(classes_, cls);
+    if (!c)
+        return {};
+    idx::class_entry const* s = find(children(subclasses_, c->children), subclass);
+    return s ? string_at(s->name) : std::string_view();
+}
+
+std::string_view
+usb_ids::protocol_name(std::uint8_t cls, std::uint8_t subclass, std::uint8_t proto) const noexcept
+{
+    idx::class_entry const* c = find(classes_, cls);
+    if (!c)
+        return {};
+    idx::class_entry const* s = find(children(subclasses_, c->children), subclass);
+    if (!s)
+        return {};
+    idx::protocol const* p = find(children(protocols_, s->children), proto);
+    return p ? string_at(p->name) : std::string_view();
+}
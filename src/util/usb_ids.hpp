@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+
+// Compiled form of the usb.ids database (see usbids-compile), made to be
+// memory-mapped and used in place: fixed-size tables sorted by ID, whose
+// names are offsets into a pool of NUL-terminated strings. Products
+// are stored per vendor, subclasses per class and protocols per
+// subclass, each as a contiguous run of the next table. Byte order is
+// native; an index from another host fails the magic check.
+
+namespace usb_ids_file {
+
+    struct header
+    {
+        char magic[8] = {'U', 'S', 'B', 'I', 'D', 'I', 'D', 'X'};
+        std::uint32_t version = 1;
+        std::uint32_t byte_order = 0x01020304;
+        std::uint32_t num_vendors = 0;
+        std::uint32_t num_products = 0;
+        std::uint32_t num_classes = 0;
+        std::uint32_t num_subclasses = 0;
+        std::uint32_t num_protocols = 0;
+        std::uint32_t strings_size = 0; ///< bytes in the string pool
+        std::uint32_t reserved[6] = {0};
+    };
+    static_assert(sizeof(header) == 64);
+
+    /// A run of entries in the next table down.
+    struct range
+    {
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+    };
+
+    struct vendor
+    {
+        std::uint16_t id = 0;
+        std::uint16_t reserved = 0;
+        std::uint32_t name = 0; ///< offset into the string pool
+        range products;
+    };
+    static_assert(sizeof(vendor) == 16);
+
+    struct product
+    {
+        std::uint16_t id = 0;
+        std::uint16_t reserved = 0;
+        std::uint32_t name = 0;
+    };
+    static_assert(sizeof(product) == 8);
+
+    /// A class, or a subclass within a class.
+    struct class_entry
+    {
+        std::uint8_t id = 0;
+        std::uint8_t reserved[3] = {0};
+        std::uint32_t name = 0;
+        range children; ///< subclasses of a class, protocols of a subclass
+    };
+    static_assert(sizeof(class_entry) == 16);
+
+    struct protocol
+    {
+        std::uint8_t id = 0;
+        std::uint8_t reserved[3] = {0};
+        std::uint32_t name = 0;
+    };
+    static_assert(sizeof(protocol) == 8);
+
+    /// File layout: the header, then the vendor, product, class,
+    /// subclass and protocol tables, then the string pool.
+    constexpr std::size_t
+    file_size(header const& h) noexcept
+    {
+        return sizeof(header) + h.num_vendors * sizeof(vendor) + h.num_products * sizeof(product)
+                + (h.num_classes + h.num_subclasses) * sizeof(class_entry)
+                + h.num_protocols * sizeof(protocol) + h.strings_size;
+    }
+
+} // namespace usb_ids_file
+
+
+/// Read-only, memory-mapped view of a compiled usb.ids index. Opening
+/// it reads only the header, and a lookup is a binary search touching
+/// a few pages, which stay in the page cache for the next process.
+/// Every lookup returns an empty view if the ID is not listed.
+class usb_ids
+{
+private:
+    void* base_ = nullptr;
+    std::size_t length_ = 0;
+    std::span<usb_ids_file::vendor const> vendors_;
+    std::span<usb_ids_file::product const> products_;
+    std::span<usb_ids_file::class_entry const> classes_;
+    std::span<usb_ids_file::class_entry const> subclasses_;
+    std::span<usb_ids_file::protocol const> protocols_;
+    std::string_view strings_;
+
+public:
+    /// Where usbids-compile writes by default.
+    static constexpr char const* default_path = "/usr/share/lsusb2/usb.ids.idx";
+
+    /// \throws std::runtime_error if \c path can't be mapped or is not
+    /// an index
+    explicit usb_ids(std::string const& path);
+    ~usb_ids() noexcept;
+    usb_ids(usb_ids const&) = delete;
+    usb_ids& operator=(usb_ids const&) = delete;
+
+    std::string_view vendor(std::uint16_t vid) const noexcept;
+    std::string_view product(std::uint16_t vid, std::uint16_t pid) const noexcept;
+    std::string_view class_name(std::uint8_t cls) const noexcept;
+    std::string_view subclass_name(std::uint8_t cls, std::uint8_t subclass) const noexcept;
+    std::string_view protocol_name(
+            std::uint8_t cls, std::uint8_t subclass, std::uint8_t protocol) const noexcept;
+
+private:
+    std::string_view string_at(std::uint32_t offset) const noexcept;
+};
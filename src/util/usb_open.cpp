@@ -0,0 +1,134 @@
+#include "usb_open.hpp"
+#include "log.hpp"
+#include <algorithm> // std::max
+#include <string_view>
+#include <vector>
+
+
+namespace { // unnamed
+
+    /// The class of every alternate setting of every configuration.
+    /// \returns false on failure
+    bool
+    read_interface_classes(libusb_device* dev, std::uint8_t num_configs,
+            std::vector<usb_class>& classes)
+    {
+        for (std::uint8_t i = 0; i < num_configs; ++i) {
+            libusb_config_descriptor* cd = nullptr;
+            if (int rv = ::libusb_get_config_descriptor(dev, i, &cd); rv != 0) {
+                LOG_ERROR("libusb_get_config_descriptor failure ({})",
+                        ::libusb_strerror(static_cast<libusb_error>(rv)));
+                return false;
+            }
+            for (int intf = 0; intf < cd->bNumInterfaces; ++intf) {
+                libusb_interface const& iface = cd->interface[intf];
+                for (int alt = 0; alt < iface.num_altsetting; ++alt) {
+                    classes.push_back({iface.altsetting[alt].bInterfaceClass,
+                            iface.altsetting[alt].bInterfaceSubClass});
+                }
+            }
+            ::libusb_free_config_descriptor(cd);
+        }
+        return true;
+    }
+
+    /// Reads \c dev only as far as \c filter needs to decide on it.
+    /// \returns the opened device if accepted (and the serial number
+    /// had to be read to decide), else nullptr; \c accepted tells
+    /// whether it was
+    libusb_device_handle*
+    check_device(libusb_device* dev, usb_filter const& filter, bool& accepted)
+    {
+        accepted = false;
+
+        std::uint8_t ports[7];
+        int const num_ports = ::libusb_get_port_numbers(dev, ports, sizeof(ports));
+        usb_facts facts;
+        facts.bus = ::libusb_get_bus_number(dev);
+        facts.ports = {ports, static_cast<std::size_t>(std::max(num_ports, 0))};
+        facts.speed = static_cast<libusb_speed>(::libusb_get_device_speed(dev));
+        usb_filter::verdict v = filter.check(usb_stage::location, facts);
+
+        libusb_device_descriptor dd;
+        if (v == usb_filter::verdict::undecided) {
+            if (int rv = ::libusb_get_device_descriptor(dev, &dd); rv != 0) {
+                LOG_ERROR("libusb_get_device_descriptor failure ({})",
+                        ::libusb_strerror(static_cast<libusb_error>(rv)));
+                return nullptr;
+            }
+            facts.desc = &dd;
+            v = filter.check(usb_stage::device_desc, facts);
+        }
+
+        std::vector<usb_class> classes;
+        if (v == usb_filter::verdict::undecided) {
+            if (!read_interface_classes(dev, dd.bNumConfigurations, classes))
+                return nullptr;
+            facts.interfaces = classes;
+            v = filter.check(usb_stage::configs, facts);
+        }
+
+        libusb_device_handle* handle = nullptr;
+        if (v == usb_filter::verdict::undecided) {
+            // the serial number needs a control transfer, so the
+            // device has to be opened anyway
+            if (int rv = ::libusb_open(dev, &handle); rv != 0) {
+                LOG_ERROR("libusb_open failure ({})",
+                        ::libusb_strerror(static_cast<libusb_error>(rv)));
+                return nullptr;
+            }
+            unsigned char serial[256];
+            int const n = (dd.iSerialNumber == 0) ? 0
+                    : ::libusb_get_string_descriptor_ascii(
+                            handle, dd.iSerialNumber, serial, sizeof(serial));
+            facts.serial = std::string_view(reinterpret_cast<char const*>(serial),
+                    static_cast<std::size_t>(std::max(n, 0)));
+            v = filter.check(usb_stage::strings, facts);
+            if (v != usb_filter::verdict::accept) {
+                ::libusb_close(handle);
+                handle = nullptr;
+            }
+        }
+
+        accepted = (v == usb_filter::verdict::accept);
+        return handle;
+    }
+
+} // namespace
+
+
+libusb_device_handle*
+open_usb_device(libusb_context* const ctx, usb_filter const& filter)
+{
+    libusb_device** devices = nullptr;
+    ssize_t num_devs = ::libusb_get_device_list(ctx, &devices);
+    if (num_devs < 0) {
+        LOG_ERROR("libusb_get_device_list failure ({})",
+                ::libusb_strerror(static_cast<libusb_error>(num_devs)));
+        ::libusb_free_device_list(devices, 1);
+        return nullptr;
+    }
+
+    libusb_device* dev = nullptr;
+    libusb_device_handle* dev_handle = nullptr;
+    for (ssize_t i = 0; i < num_devs; ++i) {
+        bool accepted = false;
+        dev_handle = check_device(devices[i], filter, accepted);
+        if (accepted) {
+            dev = devices[i];
+            break;
+        }
+    }
+
+    if (dev != nullptr && dev_handle == nullptr) {
+        if (int rv = ::libusb_open(dev, &dev_handle); rv != 0) {
+            LOG_ERROR("libusb_open failure ({})",
+                    ::libusb_strerror(static_cast<libusb_error>(rv)));
+            dev_handle = nullptr;
+        }
+    }
+
+    // decrements all device counts by 1
+    ::libusb_free_device_list(devices, 1);
+    return dev_handle;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "usb_filter.hpp"
+#include <libusb.h>
+
+
+/// Opens the first device \c filter accepts, reading each device only
+/// as far as the filter needs to decide on it.
+/// \returns nullptr if none is accepted, or it can't be opened (after
+/// logging why)
+libusb_device_handle* open_usb_device(libusb_context* ctx, usb_filter const& filter);
@@ -0,0 +1,132 @@
+#include "usb_snapshot.hpp"
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring> // std::memcmp, std::strerror
+#include <stdexcept>
+#include <utility> // std::move
+
+
+namespace { // unnamed
+
+    namespace snap = usb_snapshot_file;
+
+    template <typename T>
+    std::span<T const>
+    take(std::byte const*& p, std::size_t n) noexcept
+    {
+        std::span<T const> const s(reinterpret_cast<T const*>(p), n);
+        p += n * sizeof(T);
+        return s;
+    }
+
+    bool
+    in_pool(snap::blob b, std::uint64_t pool_size) noexcept
+    {
+        return b.offset <= pool_size && b.size <= pool_size - b.offset;
+    }
+
+} // namespace
+
+
+usb_snapshot::usb_snapshot(std::string const& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(fmt::format(
+                "{}: open({}) failure ({})", __builtin_FUNCTION(), path, std::strerror(errno)));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(snap::header)) {
+        ::close(fd);
+        throw std::runtime_error(
+                fmt::format("{}: {} is not an lsusb2 snapshot", __builtin_FUNCTION(), path));
+    }
+
+    length_ = static_cast<std::size_t>(st.st_size);
+    base_ = ::mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+    int const e = errno;
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+        base_ = nullptr;
+        throw std::runtime_error(
+                fmt::format("{}: mmap failure ({})", __builtin_FUNCTION(), std::strerror(e)));
+    }
+
+    // read front to back, once
+    ::madvise(base_, length_, MADV_SEQUENTIAL);
+
+    try {
+        attach(static_cast<std::byte const*>(base_), length_, path.c_str());
+    } catch (...) {
+        ::munmap(base_, length_);
+        throw;
+    }
+}
+
+usb_snapshot::usb_snapshot(std::vector<std::byte> bytes)
+        : owned_(std::move(bytes))
+{
+    if (owned_.size() < sizeof(snap::header))
+        throw std::runtime_error("snapshot: truncated");
+    attach(owned_.data(), owned_.size(), "snapshot");
+}
+
+usb_snapshot::~usb_snapshot() noexcept
+{
+    if (base_)
+        ::munmap(base_, length_);
+}
+
+void
+usb_snapshot::attach(std::byte const* p, std::size_t length, char const* what)
+{
+    auto const* hdr = reinterpret_cast<snap::header const*>(p);
+    snap::header const expected;
+    if (std::memcmp(hdr->magic, expected.magic, sizeof(expected.magic)) != 0
+            || hdr->version != expected.version || hdr->byte_order != expected.byte_order
+            || !snap::has_size(*hdr, length)) {
+        throw std::runtime_error(
+                fmt::format("snapshot: {} is not a (compatible) lsusb2 snapshot", what));
+    }
+
+    header_ = hdr;
+    p += sizeof(snap::header);
+    devices_ = take<device>(p, hdr->num_devices);
+    blobs_ = take<blob>(p, hdr->num_blobs);
+    pool_ = take<std::byte>(p, hdr->pool_size);
+
+    bool consistent = true;
+    for (blob const& b : blobs_)
+        consistent &= in_pool(b, hdr->pool_size);
+    for (device const& d : devices_) {
+        consistent &= d.num_ports <= sizeof(d.ports) && in_pool(d.manufacturer, hdr->pool_size)
+                && in_pool(d.product, hdr->pool_size) && in_pool(d.serial, hdr->pool_size)
+                && in_pool(d.bos, hdr->pool_size) && d.configs.first <= blobs_.size()
+                && d.configs.count <= blobs_.size() - d.configs.first;
+    }
+    if (!consistent) {
+        throw std::runtime_error(fmt::format("snapshot: {} is corrupt", what));
+    }
+}
+
+bool
+usb_snapshot::accepted(usb_filter const& filter, device const& d) const
+{
+    std::vector<usb_class> interfaces;
+    for (blob const& b : configs(d))
+        collect_interface_classes(bytes(b), interfaces);
+
+    usb_facts facts;
+    facts.bus = d.bus;
+    facts.ports = std::span<std::uint8_t const>(d.ports, d.num_ports);
+    facts.speed = static_cast<libusb_speed>(d.speed);
+    facts.desc = &d.desc;
+    facts.interfaces = interfaces;
+    facts.serial = string(d.serial);
+    return filter.check(usb_stage::strings, facts) == usb_filter::verdict::accept;
+}
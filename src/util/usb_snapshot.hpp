@@ -0,0 +1,149 @@
+#pragma once
+
+#include "usb_filter.hpp"
+#include <libusb.h>
+#include <cstddef> // std::byte, std::size_t
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Snapshot of an enumeration (lsusb2 --save), made to be memory-mapped
+// and read in place: a header, a fixed-size record per device, a table
+// of configuration descriptor blobs, and a pool with the strings and
+// raw descriptors the records and blobs point into. Tables start at
+// multiples of 8 bytes. Byte order is native; a snapshot from another
+// host fails the magic check.
+
+namespace usb_snapshot_file {
+
+    struct header
+    {
+        char magic[8] = {'L', 'S', 'U', 'S', 'B', 'S', 'N', 'P'};
+        std::uint32_t version = 1;
+        std::uint32_t byte_order = 0x01020304;
+        std::uint32_t num_devices = 0;
+        std::uint32_t num_blobs = 0;
+        std::uint64_t pool_size = 0; ///< bytes, a multiple of 8
+        std::int64_t saved_at = 0; ///< seconds since the epoch
+        std::uint32_t reserved[6] = {0};
+    };
+    static_assert(sizeof(header) == 64);
+
+    /// A run of bytes in the pool.
+    struct blob
+    {
+        std::uint32_t offset = 0;
+        std::uint32_t size = 0;
+    };
+    static_assert(sizeof(blob) == 8);
+
+    /// A run of entries in the blob table.
+    struct range
+    {
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+    };
+
+    struct device
+    {
+        std::uint8_t bus = 0;
+        std::uint8_t address = 0;
+        std::uint8_t num_ports = 0;
+        std::uint8_t speed = 0; ///< libusb_speed
+        std::uint8_t ports[7] = {0};
+        std::uint8_t reserved0 = 0;
+        libusb_device_descriptor desc{}; ///< host byte order
+        std::uint16_t reserved1 = 0;
+        blob manufacturer; ///< empty if not read
+        blob product;
+        blob serial;
+        blob bos; ///< raw BOS descriptor set
+        range configs; ///< raw, wTotalLength bytes each
+        std::uint32_t reserved2[2] = {0};
+    };
+    static_assert(sizeof(device) == 80);
+
+    constexpr std::size_t
+    file_size(header const& h) noexcept
+    {
+        return sizeof(header) + h.num_devices * sizeof(device) + h.num_blobs * sizeof(blob)
+                + h.pool_size;
+    }
+
+    /// \returns whether \c length bytes are exactly the file \c h
+    /// describes. Unlike comparing with file_size(), each count is
+    /// bounded by the bytes left first, so that corrupt counts can't
+    /// overflow the sum.
+    constexpr bool
+    has_size(header const& h, std::size_t length) noexcept
+    {
+        if (length < sizeof(header))
+            return false;
+        std::size_t left = length - sizeof(header);
+        if (h.num_devices > left / sizeof(device))
+            return false;
+        left -= h.num_devices * sizeof(device);
+        if (h.num_blobs > left / sizeof(blob))
+            return false;
+        left -= h.num_blobs * sizeof(blob);
+        return h.pool_size == left;
+    }
+
+} // namespace usb_snapshot_file
+
+
+/// Read-only view of a snapshot, either a memory-mapped file or bytes
+/// laid out in memory (as lsusb2 --diff does for the devices present).
+/// Every record's blobs are checked to lie within the file when it is
+/// opened, so the accessors don't check again.
+class usb_snapshot
+{
+public:
+    using device = usb_snapshot_file::device;
+    using blob = usb_snapshot_file::blob;
+
+private:
+    void* base_ = nullptr; ///< mapping, if from a file
+    std::size_t length_ = 0;
+    std::vector<std::byte> owned_; ///< if from memory
+    usb_snapshot_file::header const* header_ = nullptr;
+    std::span<device const> devices_;
+    std::span<blob const> blobs_;
+    std::span<std::byte const> pool_;
+
+public:
+    /// \throws std::runtime_error if \c path can't be mapped or is not
+    /// a (compatible, consistent) snapshot
+    explicit usb_snapshot(std::string const& path);
+    /// \throws std::runtime_error if \c bytes are not a snapshot
+    explicit usb_snapshot(std::vector<std::byte> bytes);
+    ~usb_snapshot() noexcept;
+    usb_snapshot(usb_snapshot const&) = delete;
+    usb_snapshot& operator=(usb_snapshot const&) = delete;
+
+    std::int64_t saved_at() const noexcept { return header_->saved_at; }
+    std::span<device const> devices() const noexcept { return devices_; }
+
+    std::span<blob const> configs(device const& d) const noexcept
+    {
+        return blobs_.subspan(d.configs.first, d.configs.count);
+    }
+    std::span<std::uint8_t const> bytes(blob b) const noexcept
+    {
+        return {reinterpret_cast<std::uint8_t const*>(pool_.data()) + b.offset, b.size};
+    }
+    std::string_view string(blob b) const noexcept
+    {
+        return {reinterpret_cast<char const*>(pool_.data()) + b.offset, b.size};
+    }
+
+    /// \returns whether \c filter accepts \c d, as it would have when
+    /// enumerating
+    bool accepted(usb_filter const& filter, device const& d) const;
+
+private:
+    void attach(std::byte const* p, std::size_t length, char const* what);
+};
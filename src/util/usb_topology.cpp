@@ -0,0 +1,83 @@
+#include "usb_topology.hpp"
+#include <algorithm> // std::lexicographical_compare, std::min, std::sort
+#include <numeric>   // std::iota
+
+
+namespace { // unnamed
+
+    /// Bus and ports packed into one word, a byte each from the top.
+    /// Port numbers start at 1, so paths of different lengths differ.
+    std::uint64_t
+    path_key(std::uint8_t bus, std::span<std::uint8_t const> ports) noexcept
+    {
+        std::uint64_t key = std::uint64_t(bus) << 56;
+        std::size_t const n = std::min(ports.size(), usb_topology::max_ports);
+        for (std::size_t i = 0; i < n; ++i)
+            key |= std::uint64_t(ports[i]) << (48 - 8 * i);
+        return key;
+    }
+
+} // namespace
+
+
+usb_topology::usb_topology(std::span<usb_location const> devices)
+{
+    auto const n = static_cast<std::uint32_t>(devices.size());
+    nodes_.resize(n);
+    paths_.reserve(n);
+    for (std::uint32_t i = 0; i < n; ++i)
+        paths_.emplace(path_key(devices[i].bus, devices[i].ports), i);
+
+    // everything below is laid out in port path order
+    std::vector<std::uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+        usb_location const& la = devices[a];
+        usb_location const& lb = devices[b];
+        if (la.bus != lb.bus)
+            return la.bus < lb.bus;
+        return std::lexicographical_compare(
+                la.ports.begin(), la.ports.end(), lb.ports.begin(), lb.ports.end());
+    });
+
+    for (std::uint32_t i = 0; i < n; ++i) {
+        usb_location const& l = devices[i];
+        for (std::size_t depth = l.ports.size(); depth-- > 0;) {
+            if (std::uint32_t p = find(l.bus, l.ports.first(depth)); p != npos) {
+                nodes_[i].parent = p;
+                ++nodes_[p].children.count;
+                break;
+            }
+        }
+    }
+
+    // children as runs of one table, filled in port path order
+    std::uint32_t first = 0;
+    for (node& nd : nodes_) {
+        nd.children.first = first;
+        first += nd.children.count;
+        nd.children.count = 0;
+    }
+    children_.resize(first);
+    for (std::uint32_t i : order) {
+        if (std::uint32_t p = nodes_[i].parent; p != npos)
+            children_[nodes_[p].children.first + nodes_[p].children.count++] = i;
+        else
+            roots_.push_back(i);
+    }
+}
+
+std::uint32_t
+usb_topology::find(std::uint8_t bus, std::span<std::uint8_t const> ports) const noexcept
+{
+    if (ports.size() > max_ports)
+        return npos;
+    auto const it = paths_.find(path_key(bus, ports));
+    return (it == paths_.end()) ? npos : it->second;
+}
+
+std::span<std::uint32_t const>
+usb_topology::children(std::uint32_t i) const noexcept
+{
+    return {children_.data() + nodes_[i].children.first, nodes_[i].children.count};
+}
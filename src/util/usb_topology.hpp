@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef> // std::size_t
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+
+/// Where one device sits, as far as usb_topology needs to know.
+struct usb_location
+{
+    std::uint8_t bus = 0;
+    std::span<std::uint8_t const> ports; ///< from the root hub down; empty for a root hub
+};
+
+
+/// Index over the devices of one enumeration, built once so that
+/// lookups by port path, and walks up or down the hub tree, don't scan
+/// the device list. Devices
+/// are referred to by their position in the list the index was built
+/// from.
+///
+/// A device whose hub isn't listed (e.g. filtered out) hangs off its
+/// nearest listed ancestor, or is a root of its own.
+class usb_topology
+{
+public:
+    static constexpr std::uint32_t npos = UINT32_MAX;
+    static constexpr std::size_t max_ports = 7; ///< tiers below the root hub
+
+private:
+    struct range
+    {
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+    };
+
+    struct node
+    {
+        std::uint32_t parent = npos;
+        range children;
+    };
+
+    std::vector<node> nodes_;
+    std::vector<std::uint32_t> children_; ///< runs per node, by port number
+    std::vector<std::uint32_t> roots_; ///< by bus, then port path
+    std::unordered_map<std::uint64_t, std::uint32_t> paths_;
+
+public:
+    usb_topology() = default;
+    /// Of devices listed twice at the same place, the first one counts.
+    explicit usb_topology(std::span<usb_location const>);
+
+    std::size_t size() const noexcept { return nodes_.size(); }
+
+    /// \returns the device at \c ports on \c bus (the root hub for no
+    /// ports), or npos
+    std::uint32_t find(std::uint8_t bus, std::span<std::uint8_t const> ports) const noexcept;
+
+    /// \returns the nearest listed hub above \c i, or npos
+    std::uint32_t parent(std::uint32_t i) const noexcept { return nodes_[i].parent; }
+    /// \returns the listed devices right below \c i, by port number
+    std::span<std::uint32_t const> children(std::uint32_t i) const noexcept;
+    /// \returns the devices without a listed hub above, usually root hubs
+    std::span<std::uint32_t const> roots() const noexcept { return roots_; }
+};
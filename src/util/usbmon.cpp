@@ -0,0 +1,170 @@
+#include "usbmon.hpp"
+#include "byte_order.hpp"
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm> // std::clamp, std::min
+#include <cerrno>
+#include <cstring> // std::memcpy, std::strerror
+#include <stdexcept>
+#include <string>
+
+
+namespace usbmon {
+
+    namespace { // unnamed
+
+        // from drivers/usb/mon/mon_bin.c, which has no uapi header
+        struct mon_bin_stats
+        {
+            std::uint32_t queued;
+            std::uint32_t dropped;
+        };
+
+        struct mon_bin_mfetch
+        {
+            std::uint32_t* offvec;
+            std::uint32_t nfetch;
+            std::uint32_t nflush;
+        };
+
+        constexpr unsigned mon_ioc_magic = 0x92;
+        constexpr unsigned long mon_iocg_stats = _IOR(mon_ioc_magic, 3, mon_bin_stats);
+        constexpr unsigned long mon_ioct_ring_size = _IO(mon_ioc_magic, 4);
+        constexpr unsigned long mon_iocq_ring_size = _IO(mon_ioc_magic, 5);
+        constexpr unsigned long mon_iocx_mfetch = _IOWR(mon_ioc_magic, 7, mon_bin_mfetch);
+        constexpr unsigned long mon_ioch_mflush = _IO(mon_ioc_magic, 8);
+
+        /// BUFF_MIN
+        constexpr std::size_t min_ring_size = 8 * 1024;
+
+        template <typename T>
+        void
+        swap(T& v) noexcept
+        {
+            v = byteswap(v);
+        }
+
+    } // namespace
+
+
+    bool
+    read_header(std::span<std::byte const> packet, std::size_t size, bool swapped,
+            packet_header& h) noexcept
+    {
+        if (packet.size() < size || size > sizeof(h))
+            return false;
+        h = {};
+        std::memcpy(&h, packet.data(), size);
+        if (swapped) {
+            swap(h.id);
+            swap(h.busnum);
+            swap(h.ts_sec);
+            swap(h.ts_usec);
+            swap(h.status);
+            swap(h.length);
+            swap(h.len_cap);
+            swap(h.interval);
+            swap(h.start_frame);
+            swap(h.xfer_flags);
+            swap(h.ndesc);
+        }
+        return true;
+    }
+
+    std::span<std::byte const>
+    payload(std::span<std::byte const> packet, std::size_t size, packet_header const& h) noexcept
+    {
+        // only the mmapped header is followed by ISO descriptors
+        std::size_t const skip =
+                (size == sizeof(h)) ? size + std::size_t(h.ndesc) * sizeof(iso_desc) : size;
+        if (skip >= packet.size())
+            return {};
+        packet = packet.subspan(skip);
+        return packet.first(std::min<std::size_t>(packet.size(), h.len_cap));
+    }
+
+
+    ring::ring(unsigned bus, std::size_t size)
+    {
+        std::string const path = fmt::format("/dev/usbmon{}", bus);
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ == -1) {
+            throw std::runtime_error(fmt::format("{}: open({}) failure ({})", __builtin_FUNCTION(),
+                    path, std::strerror(errno)));
+        }
+
+        size = std::clamp(size, min_ring_size, max_size);
+        int const rv = ::ioctl(fd_, mon_ioct_ring_size, size);
+        int const got = (rv == -1) ? -1 : ::ioctl(fd_, mon_iocq_ring_size);
+        if (got <= 0) {
+            int const e = errno;
+            ::close(fd_);
+            throw std::runtime_error(fmt::format(
+                    "{}: sizing the ring of {} failed ({})", __builtin_FUNCTION(), path,
+                    std::strerror(e)));
+        }
+        size_ = static_cast<std::size_t>(got);
+
+        void* const p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            int const e = errno;
+            ::close(fd_);
+            throw std::runtime_error(fmt::format(
+                    "{}: mmap of {} failed ({})", __builtin_FUNCTION(), path, std::strerror(e)));
+        }
+        base_ = static_cast<std::byte*>(p);
+    }
+
+    ring::~ring() noexcept
+    {
+        ::munmap(base_, size_);
+        ::close(fd_);
+    }
+
+    int
+    ring::fetch(std::span<std::uint32_t> offsets, std::uint32_t flush) noexcept
+    {
+        mon_bin_mfetch m{offsets.data(), static_cast<std::uint32_t>(offsets.size()), flush};
+        if (::ioctl(fd_, mon_iocx_mfetch, &m) == -1)
+            return -1;
+        return static_cast<int>(m.nfetch);
+    }
+
+    int
+    ring::flush(std::uint32_t n) noexcept
+    {
+        return ::ioctl(fd_, mon_ioch_mflush, n);
+    }
+
+    int
+    ring::poll(int timeout_ms) noexcept
+    {
+        pollfd p{fd_, POLLIN, 0};
+        return ::poll(&p, 1, timeout_ms);
+    }
+
+    std::span<std::byte const>
+    ring::event(std::uint32_t offset) const noexcept
+    {
+        if (offset > size_ || size_ - offset < sizeof(packet_header))
+            return {};
+        packet_header const* h = reinterpret_cast<packet_header const*>(base_ + offset);
+        std::size_t const length =
+                sizeof(packet_header) + std::size_t(h->ndesc) * sizeof(iso_desc) + h->len_cap;
+        return {base_ + offset, std::min(length, size_ - offset)};
+    }
+
+    ring_stats
+    ring::stats() const noexcept
+    {
+        mon_bin_stats st{};
+        if (::ioctl(fd_, mon_iocg_stats, &st) == -1)
+            return {};
+        return {st.queued, st.dropped};
+    }
+
+} // namespace usbmon
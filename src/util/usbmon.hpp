@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef> // std::byte, std::size_t
+#include <cstdint>
+#include <span>
+
+
+// The usbmon binary interface (Documentation/usb/usbmon.rst): one
+// character device per bus, /dev/usbmon<bus>, and /dev/usbmon0 for all
+// of them. Every URB submission, completion and submission error is an
+// event: a fixed header followed by ISO descriptors (if any) and up to
+// len_cap bytes of data. The same header is the packet header of the
+// LINKTYPE_USB_LINUX(_MMAPPED) pcap link types.
+
+namespace usbmon {
+
+    enum xfer_type : std::uint8_t
+    {
+        iso = 0,
+        interrupt = 1,
+        control = 2,
+        bulk = 3,
+    };
+
+    /// struct mon_bin_hdr; host byte order
+    struct packet_header
+    {
+        std::uint64_t id = 0; ///< URB, the same from submission to completion
+        char type = 0; ///< 'S'ubmission, 'C'ompletion, 'E'rror; '@' pads the ring
+        std::uint8_t xfer_type = 0;
+        std::uint8_t epnum = 0; ///< endpoint address, 0x80 set for IN
+        std::uint8_t devnum = 0;
+        std::uint16_t busnum = 0;
+        char flag_setup = 0; ///< 0 if setup is valid
+        char flag_data = 0; ///< 0 if data follows
+        std::int64_t ts_sec = 0;
+        std::int32_t ts_usec = 0;
+        std::int32_t status = 0; ///< -errno
+        std::uint32_t length = 0; ///< submitted or transferred
+        std::uint32_t len_cap = 0; ///< data bytes that follow
+        std::uint8_t setup[8] = {0}; ///< control submissions; ISO error_count, numdesc otherwise
+        // from here on only in the mmapped variant (LINKTYPE_USB_LINUX_MMAPPED)
+        std::int32_t interval = 0;
+        std::int32_t start_frame = 0;
+        std::uint32_t xfer_flags = 0;
+        std::uint32_t ndesc = 0; ///< ISO descriptors following the header
+    };
+    static_assert(sizeof(packet_header) == 64);
+
+    /// The header of LINKTYPE_USB_LINUX, which ends before \c interval.
+    constexpr std::size_t short_header_size = 48;
+
+    struct iso_desc
+    {
+        std::int32_t status = 0;
+        std::uint32_t offset = 0;
+        std::uint32_t length = 0;
+        std::uint32_t pad = 0;
+    };
+    static_assert(sizeof(iso_desc) == 16);
+
+    /// Copies the header at the start of \c packet, of \c size bytes
+    /// (short_header_size or sizeof(packet_header)), swapping its byte
+    /// order if it was written on a host of the other byte order. Fields
+    /// the packet doesn't have are zero.
+    /// \returns false if \c packet is shorter than \c size
+    bool read_header(std::span<std::byte const> packet, std::size_t size, bool swapped,
+            packet_header& h) noexcept;
+
+    /// The data captured after the header (of \c size bytes) and ISO
+    /// descriptors.
+    std::span<std::byte const> payload(std::span<std::byte const> packet, std::size_t size,
+            packet_header const& h) noexcept;
+
+
+    /// Which events to keep; checked on the header alone, before any
+    /// data is copied.
+    struct capture_filter
+    {
+        int bus = -1; ///< any if negative
+        int devnum = -1; ///< device address; any if negative
+        int endpoint = -1; ///< number, both directions; any if negative
+
+        bool
+        accepts(packet_header const& h) const noexcept
+        {
+            return h.type != '@' && (bus < 0 || h.busnum == bus)
+                    && (devnum < 0 || h.devnum == devnum)
+                    && (endpoint < 0 || (h.epnum & 0x7f) == endpoint);
+        }
+    };
+
+
+    struct ring_stats
+    {
+        std::uint32_t queued = 0; ///< events in the ring, not yet flushed
+        std::uint32_t dropped = 0; ///< events lost to a full ring, since open
+    };
+
+    /// A usbmon device with its ring mapped into memory. Events are
+    /// fetched as offsets into the mapping (MON_IOCX_MFETCH) and read in
+    /// place; nothing is copied until the caller writes them out. While
+    /// the ring is mapped the kernel keeps every event contiguous,
+    /// padding the end of the ring with '@' events where needed.
+    class ring
+    {
+    private:
+        int fd_ = -1;
+        std::byte* base_ = nullptr;
+        std::size_t size_ = 0;
+
+    public:
+        /// The largest ring the kernel allows (BUFF_MAX).
+        static constexpr std::size_t max_size = 1200 * 1024;
+
+        /// Opens /dev/usbmon<bus> (0 for all buses) with a ring of
+        /// \c size bytes, which the kernel may round.
+        /// \throws std::runtime_error if the device can't be opened or
+        /// mapped (usbmon not loaded, or no permission)
+        ring(unsigned bus, std::size_t size);
+        ~ring() noexcept;
+        ring(ring const&) = delete;
+        ring& operator=(ring const&) = delete;
+
+        std::size_t size() const noexcept { return size_; }
+
+        /// Releases the \c flush events fetched last, then waits for at
+        /// least one more and stores the offsets of up to
+        /// offsets.size() of them.
+        /// \returns the number of offsets stored, or -1 with errno set
+        /// (EINTR if a signal arrived while waiting)
+        int fetch(std::span<std::uint32_t> offsets, std::uint32_t flush) noexcept;
+
+        /// Releases the \c n events fetched last without waiting for
+        /// more.
+        /// \returns -1 with errno set on failure
+        int flush(std::uint32_t n) noexcept;
+
+        /// Waits up to \c timeout_ms for events that haven't been
+        /// released, fetched or not.
+        /// \returns poll(2)'s: positive if there are some, 0 on timeout,
+        /// -1 with errno set
+        int poll(int timeout_ms) noexcept;
+
+        /// The event at \c offset: its header, ISO descriptors and data.
+        std::span<std::byte const> event(std::uint32_t offset) const noexcept;
+
+        ring_stats stats() const noexcept;
+    };
+
+} // namespace usbmon